@@ -0,0 +1,242 @@
+#pragma once
+
+#include "CommonUtils.hpp"
+#include <array>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+// Declarations
+namespace LLTCCapabilities {
+    class CapabilityStore;
+    // Cached answer, if any, without probing.
+    inline std::optional<bool> Lookup(Capability capability) noexcept;
+    // Cached answer, or the result of probe(), which is remembered unless it is
+    // std::nullopt (the probe could not tell, e.g. WMI was unreachable).
+    template<typename Fn>
+    inline bool Probe(Capability capability, Fn&& probe) noexcept;
+    inline void Store(Capability capability, bool supported) noexcept;
+    // Forgets an answer after a call that relied on it failed. Returns true if the
+    // answer came from the cache file, i.e. probing again may tell otherwise.
+    inline bool Invalidate(Capability capability) noexcept;
+}
+
+// Definitions
+namespace LLTCCapabilities {
+    namespace {
+        constexpr std::string_view CacheSignature = "lltc-capabilities 1";
+    }
+
+    // Capability answers, persisted per machine in %LOCALAPPDATA%\lltc\capabilities.txt
+    // (on Linux $XDG_CACHE_HOME/lltc/capabilities.txt, falling back to ~/.cache)
+    // so later invocations skip the WMI and IOCTL probes. The file is keyed by
+    // IDeviceTransport::MachineIdentity(); on a mismatch it is ignored and rewritten.
+    // LLTC_CAPABILITY_CACHE names another file, or "off" to keep answers in memory.
+    class CapabilityStore {
+    public:
+        static CapabilityStore& Instance() noexcept {
+            static CapabilityStore store;
+            return store;
+        }
+
+        std::optional<bool> Get(Capability capability) noexcept {
+            std::lock_guard lock(m_mutex);
+            load();
+            return m_entries[index(capability)].supported;
+        }
+
+        void Put(Capability capability, bool supported) noexcept {
+            std::lock_guard lock(m_mutex);
+            load();
+            auto& entry = m_entries[index(capability)];
+            bool changed = entry.supported != supported;
+            entry = {supported, false};
+            if (changed) {
+                save();
+            }
+        }
+
+        bool Invalidate(Capability capability) noexcept {
+            std::lock_guard lock(m_mutex);
+            load();
+            auto& entry = m_entries[index(capability)];
+            bool fromFile = entry.supported.has_value() && entry.fromFile;
+            if (entry.supported) {
+                entry = {};
+                save();
+            }
+            return fromFile;
+        }
+
+    private:
+        struct Entry {
+            std::optional<bool> supported;
+            bool fromFile = false;
+        };
+
+        static size_t index(Capability capability) noexcept {
+            return static_cast<size_t>(capability);
+        }
+
+        static std::wstring defaultPath() {
+#ifdef _WIN32
+            wchar_t buffer[MAX_PATH];
+            DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, MAX_PATH);
+            if (length == 0 || length >= MAX_PATH) {
+                return {};
+            }
+            std::filesystem::path directory = std::filesystem::path(std::wstring(buffer, length)) / L"lltc";
+#else
+            std::filesystem::path directory;
+            if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache) {
+                directory = cache;
+            } else if (const char* home = std::getenv("HOME"); home && *home) {
+                directory = std::filesystem::path(home) / ".cache";
+            } else {
+                return {};
+            }
+            directory /= "lltc";
+#endif
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+            return (directory / L"capabilities.txt").wstring();
+        }
+
+        // Loads the file on first use. Without a machine identity (the simulator)
+        // answers are kept in memory only.
+        void load() noexcept {
+            if (m_loaded) {
+                return;
+            }
+            m_loaded = true;
+            const char* setting = std::getenv("LLTC_CAPABILITY_CACHE");
+            if (setting && std::string_view(setting) == "off") {
+                return;
+            }
+            try {
+                m_identity = LLTCCommonUtils::GetDeviceTransport().MachineIdentity();
+                if (m_identity.empty()) {
+                    return;
+                }
+                m_path = (setting && *setting) ? std::filesystem::path(setting).wstring() : defaultPath();
+            } catch (...) {
+                m_path.clear();
+                return;
+            }
+            if (m_path.empty()) {
+                return;
+            }
+
+            LLTCPlatform::File file;
+            if (!file.Open(m_path, LLTCPlatform::FileAccess::Read)) {
+                return;
+            }
+            char buffer[4096];
+            size_t read = 0;
+            if (!file.Read(buffer, sizeof(buffer), read)) {
+                return;
+            }
+
+            std::string_view text(buffer, read);
+            std::array<Entry, static_cast<size_t>(Capability::Count)> entries = {};
+            bool headerSeen = false;
+            bool sameMachine = false;
+            while (!text.empty()) {
+                size_t end = text.find('\n');
+                std::string_view line = text.substr(0, end);
+                text = (end == std::string_view::npos) ? std::string_view() : text.substr(end + 1);
+                if (line.ends_with('\r')) {
+                    line.remove_suffix(1);
+                }
+                if (!headerSeen) {
+                    headerSeen = (line == CacheSignature);
+                    if (!headerSeen) {
+                        return;
+                    }
+                    continue;
+                }
+                size_t equals = line.find('=');
+                if (equals == std::string_view::npos) {
+                    continue;
+                }
+                std::string_view key = line.substr(0, equals);
+                std::string_view value = line.substr(equals + 1);
+                if (key == "identity") {
+                    sameMachine = (value == m_identity);
+                    continue;
+                }
+                for (size_t i = 0; i < entries.size(); ++i) {
+                    if (key == to_string(static_cast<Capability>(i)) && (value == "0" || value == "1")) {
+                        entries[i] = {value == "1", true};
+                    }
+                }
+            }
+            if (sameMachine) {
+                m_entries = entries;
+            }
+        }
+
+        // Rewrites the whole file through a temporary so readers never see half of it.
+        void save() noexcept {
+            if (m_path.empty()) {
+                return;
+            }
+            std::string text;
+            try {
+                text.append(CacheSignature).append("\nidentity=").append(m_identity).append("\n");
+                for (size_t i = 0; i < m_entries.size(); ++i) {
+                    if (m_entries[i].supported) {
+                        text.append(to_string(static_cast<Capability>(i))).append(*m_entries[i].supported ? "=1\n" : "=0\n");
+                    }
+                }
+            } catch (...) {
+                return;
+            }
+            std::filesystem::path temporary = m_path + L".tmp";
+            LLTCPlatform::File file;
+            if (!file.Open(temporary, LLTCPlatform::FileAccess::Replace)) {
+                return;
+            }
+            bool ok = file.Write(text.data(), text.size());
+            file.Close();
+            std::error_code error;
+            if (ok) {
+                std::filesystem::rename(temporary, m_path, error);
+            }
+            if (!ok || error) {
+                std::filesystem::remove(temporary, error);
+            }
+        }
+
+        std::mutex m_mutex;
+        bool m_loaded = false;
+        std::string m_identity;
+        std::wstring m_path;
+        std::array<Entry, static_cast<size_t>(Capability::Count)> m_entries = {};
+    };
+
+    inline std::optional<bool> Lookup(Capability capability) noexcept {
+        return CapabilityStore::Instance().Get(capability);
+    }
+
+    template<typename Fn>
+    inline bool Probe(Capability capability, Fn&& probe) noexcept {
+        if (auto cached = Lookup(capability)) {
+            return *cached;
+        }
+        std::optional<bool> supported = probe();
+        if (!supported) {
+            return false;
+        }
+        Store(capability, *supported);
+        return *supported;
+    }
+
+    inline void Store(Capability capability, bool supported) noexcept {
+        CapabilityStore::Instance().Put(capability, supported);
+    }
+
+    inline bool Invalidate(Capability capability) noexcept {
+        return CapabilityStore::Instance().Invalidate(capability);
+    }
+}
\ No newline at end of file
@@ -1,18 +1,28 @@
 #pragma once
 
-#define NOMINMAX
-#include <windows.h>
-#include <setupapi.h>
-
-#include <wbemidl.h>
-#include <comdef.h>
+#include "Platform.hpp"
 
 #include <cstdint>
 #include <vector>
 #include <string>
 #include <expected>
-
-#include <wrl/client.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <tuple>
+#include <span>
+#include <chrono>
+#include <new>
+#include <functional>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <deque>
+#include <type_traits>
+#include <algorithm>
+#include <cmath>
+#include <bit>
 
 // Enums
 #include "Enums.hpp"
@@ -25,9 +35,11 @@ namespace LLTCCommonUtils {
     inline bool GetNthBit(uint32_t value, int n) noexcept;
     
     // Drivers
-    inline HANDLE GetEnergyDriverHandle() noexcept;
-    inline HANDLE GetBatteryHandle() noexcept;
-    inline bool GetBatteryTag(HANDLE hBattery, ULONG& outTag) noexcept;
+#ifdef _WIN32
+    inline HANDLE OpenEnergyDriverHandle() noexcept;
+    inline HANDLE OpenBatteryHandle() noexcept;
+#endif
+    inline bool GetBatteryTag(ULONG& outTag) noexcept;
     template<typename InputType, typename OutputType>
     inline bool EnergyDrvIoControl(
         DWORD ioctlCode,
@@ -36,7 +48,7 @@ namespace LLTCCommonUtils {
         DWORD* bytesReturned = nullptr
     ) noexcept;
     
-    // COM
+    // COM (nothing to do where there is none)
     inline HRESULT InitializeCOM() noexcept;
     inline void UninitializeCOM() noexcept;
     
@@ -45,13 +57,20 @@ namespace LLTCCommonUtils {
         Full,
         Relative
     };
+#ifdef _WIN32
     inline HRESULT ConnectToWMI(IWbemLocator** ppLocator, IWbemServices** ppServices) noexcept;
     inline std::wstring GetFirstWmiInstancePath(
         IWbemServices* pServices,
         const std::vector<std::wstring>& classNames,
         WmiPathType pathType = WmiPathType::Full
     ) noexcept;
-    inline int CallWmiMethodNoParams(IWbemServices* pServices, const std::wstring& instancePath, const wchar_t* methodName) noexcept;
+    inline bool IsWmiConnectionLost(HRESULT hr) noexcept;
+    inline int CallWmiMethodNoParams(
+        IWbemServices* pServices,
+        const std::wstring& instancePath,
+        const wchar_t* methodName,
+        HRESULT* outHr = nullptr
+    ) noexcept;
     inline HRESULT CallWmiMethodWithIntParamFromClassDef(
         IWbemServices* pServices, 
         const std::wstring& instancePath, 
@@ -71,7 +90,118 @@ namespace LLTCCommonUtils {
         const wchar_t* methodName,
         const wchar_t* paramName,
         int paramValue,
-        const wchar_t* resultPropertyName = L"Value"
+        const wchar_t* resultPropertyName = L"Value",
+        HRESULT* outHr = nullptr
+    ) noexcept;
+#endif
+
+    // WMI session
+    inline const std::vector<std::wstring> GameZoneClassNames = {
+        L"LENOVO_GAMEZONE_DATA",
+        L"Lenovo_GameZone_Data"
+    };
+    enum class WmiInParamsSource {
+        MethodDefinition,   // GetObject(class) -> GetMethod -> SpawnInstance
+        ParametersClass,    // GetObject(__PARAMETERS)
+        ParametersInstance  // GetObject(__PARAMETERS) -> SpawnInstance
+    };
+    struct WmiAsyncCall {
+        const wchar_t* methodName;
+        int result = -1;            // "Data" out-parameter
+        HRESULT hr = E_PENDING;
+    };
+    class WmiPreparedMethod;
+    class WmiCallSink;
+    class WmiEventSink;
+    class WmiEventSubscription;
+    class WmiWorker;
+    class WmiSession;
+
+    // Device transport
+    enum class DeviceKind {
+        EnergyDriver,   // \\.\EnergyDrv
+        Battery         // first GUID_DEVICE_BATTERY interface
+    };
+    struct DeviceHandleStats {
+        uint64_t opens = 0;
+        uint64_t reopens = 0;           // opens that replaced a handle reported lost
+        uint64_t failedOpens = 0;
+        long activeReferences = 0;      // references held outside the registry
+    };
+#ifdef _WIN32
+    class DeviceHandle;
+    class DeviceHandleRegistry;
+    inline bool IsDeviceLost(DWORD error) noexcept;
+#endif
+    struct WmiMethodCall {
+        const wchar_t* methodName;
+        const wchar_t* paramName = nullptr;     // nullptr: method takes no in-parameters
+        int paramValue = 0;
+        WmiInParamsSource source = WmiInParamsSource::MethodDefinition;
+        WmiPathType pathType = WmiPathType::Full;
+        const wchar_t* resultPropertyName = L"Data";
+    };
+    constexpr DWORD DefaultIoctlTimeoutMs = 2000;
+    struct IoctlRequest {
+        DWORD ioctlCode;
+        const void* input;
+        DWORD inputSize;
+        void* output;
+        DWORD outputSize;
+        DWORD timeoutMs = DefaultIoctlTimeoutMs;
+        DWORD bytesReturned = 0;
+        DWORD error = ERROR_IO_PENDING;     // ERROR_SUCCESS, ERROR_TIMEOUT, ERROR_CANCELLED or the driver's error
+        std::chrono::microseconds latency{};
+    };
+    enum class IoctlOrder {
+        Sequential,     // each request waits for the previous one; stops at the first failure
+        Concurrent      // all requests are in flight at once
+    };
+    using IoctlObserver = std::function<void(DeviceKind, const IoctlRequest&)>;
+    struct IoctlCounters {
+        uint64_t energyDriver = 0;
+        uint64_t battery = 0;
+    };
+    class IDeviceTransport;
+#ifdef _WIN32
+    class WindowsDeviceTransport;
+#else
+    class UnavailableDeviceTransport;
+#endif
+    inline IDeviceTransport& GetDeviceTransport() noexcept;
+    inline void SetDeviceTransport(std::unique_ptr<IDeviceTransport> transport) noexcept;
+    inline void SetIoctlObserver(IoctlObserver observer) noexcept;
+    // Requests issued through the transport since startup.
+    inline IoctlCounters GetIoctlCounters() noexcept;
+    inline bool TransportIoControlBatch(
+        DeviceKind device,
+        std::span<IoctlRequest> requests,
+        IoctlOrder order
+    ) noexcept;
+
+    // Periodic scheduler
+    struct SchedulerStats {
+        uint64_t ticks = 0;
+        uint64_t missed = 0;            // deadlines skipped because the previous tick overran
+        std::chrono::microseconds minJitter{};
+        std::chrono::microseconds maxJitter{};
+        std::chrono::microseconds totalJitter{};    // wake-up time minus deadline, summed over ticks
+    };
+    class PeriodicScheduler;
+
+    // Streaming statistics
+    class StreamingStats;
+
+    // Single-producer/single-consumer ring
+    template<typename T, size_t Capacity> class SpscRing;
+    inline bool TransportIoControl(
+        DeviceKind device,
+        DWORD ioctlCode,
+        const void* input,
+        DWORD inputSize,
+        void* output,
+        DWORD outputSize,
+        DWORD* bytesReturned = nullptr
     ) noexcept;
 }
 
@@ -93,109 +223,97 @@ namespace LLTCCommonUtils {
         return (value & (1U << n)) != 0;
     }
     
-    inline HANDLE GetEnergyDriverHandle() noexcept {
-        static HANDLE hDriver = INVALID_HANDLE_VALUE;
-        static bool initialized = false;
-        
-        if (!initialized) {
-            hDriver = CreateFileW(
-                L"\\\\.\\EnergyDrv",
-                GENERIC_READ | GENERIC_WRITE,
-                FILE_SHARE_READ | FILE_SHARE_WRITE,
-                nullptr,
-                OPEN_EXISTING,
-                FILE_ATTRIBUTE_NORMAL,
-                nullptr
-            );
-            initialized = true;
-        }
-        
-        return hDriver;
+#ifdef _WIN32
+    inline HANDLE OpenEnergyDriverHandle() noexcept {
+        return CreateFileW(
+            L"\\\\.\\EnergyDrv",
+            GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+            nullptr
+        );
     }
     
-    inline HANDLE GetBatteryHandle() noexcept {
-        static HANDLE hBattery = INVALID_HANDLE_VALUE;
-        static bool initialized = false;
+    inline HANDLE OpenBatteryHandle() noexcept {
+        HANDLE hBattery = INVALID_HANDLE_VALUE;
+        GUID guidBattery = {0x72631e54, 0x78A4, 0x11d0, {0xbc, 0xf7, 0x00, 0xaa, 0x00, 0xb7, 0xb3, 0x2a}};
+        HDEVINFO hDevInfo = SetupDiGetClassDevsW(
+            &guidBattery,
+            nullptr,
+            nullptr,
+            DIGCF_PRESENT | DIGCF_DEVICEINTERFACE
+        );
         
-        if (!initialized) {
-            GUID guidBattery = {0x72631e54, 0x78A4, 0x11d0, {0xbc, 0xf7, 0x00, 0xaa, 0x00, 0xb7, 0xb3, 0x2a}};
-            HDEVINFO hDevInfo = SetupDiGetClassDevsW(
-                &guidBattery,
-                nullptr,
-                nullptr,
-                DIGCF_PRESENT | DIGCF_DEVICEINTERFACE
-            );
+        if (hDevInfo != INVALID_HANDLE_VALUE) {
+            SP_DEVICE_INTERFACE_DATA devInterfaceData = {0};
+            devInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
             
-            if (hDevInfo != INVALID_HANDLE_VALUE) {
-                SP_DEVICE_INTERFACE_DATA devInterfaceData = {0};
-                devInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
-                
-                if (SetupDiEnumDeviceInterfaces(
+            if (SetupDiEnumDeviceInterfaces(
+                hDevInfo,
+                nullptr,
+                &guidBattery,
+                0,
+                &devInterfaceData
+            )) {
+                DWORD requiredSize = 0;
+                SetupDiGetDeviceInterfaceDetailW(
                     hDevInfo,
+                    &devInterfaceData,
                     nullptr,
-                    &guidBattery,
                     0,
-                    &devInterfaceData
-                )) {
-                    DWORD requiredSize = 0;
-                    SetupDiGetDeviceInterfaceDetailW(
-                        hDevInfo,
-                        &devInterfaceData,
-                        nullptr,
-                        0,
-                        &requiredSize,
-                        nullptr
-                    );
+                    &requiredSize,
+                    nullptr
+                );
+                
+                if (requiredSize > 0) {
+                    PSP_DEVICE_INTERFACE_DETAIL_DATA_W detailData =
+                        (PSP_DEVICE_INTERFACE_DETAIL_DATA_W)malloc(requiredSize);
                     
-                    if (requiredSize > 0) {
-                        PSP_DEVICE_INTERFACE_DETAIL_DATA_W detailData =
-                            (PSP_DEVICE_INTERFACE_DETAIL_DATA_W)malloc(requiredSize);
+                    if (detailData) {
+                        detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W);
                         
-                        if (detailData) {
-                            detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W);
-                            
-                            if (SetupDiGetDeviceInterfaceDetailW(
-                                hDevInfo,
-                                &devInterfaceData,
-                                detailData,
-                                requiredSize,
+                        if (SetupDiGetDeviceInterfaceDetailW(
+                            hDevInfo,
+                            &devInterfaceData,
+                            detailData,
+                            requiredSize,
+                            nullptr,
+                            nullptr
+                        )) {
+                            hBattery = CreateFileW(
+                                detailData->DevicePath,
+                                GENERIC_READ | GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE,
                                 nullptr,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
                                 nullptr
-                            )) {
-                                hBattery = CreateFileW(
-                                    detailData->DevicePath,
-                                    GENERIC_READ | GENERIC_WRITE,
-                                    FILE_SHARE_READ | FILE_SHARE_WRITE,
-                                    nullptr,
-                                    OPEN_EXISTING,
-                                    FILE_ATTRIBUTE_NORMAL,
-                                    nullptr
-                                );
-                            }
-                            free(detailData);
+                            );
                         }
+                        free(detailData);
                     }
                 }
-                SetupDiDestroyDeviceInfoList(hDevInfo);
             }
-            initialized = true;
+            SetupDiDestroyDeviceInfoList(hDevInfo);
         }
         
         return hBattery;
     }
+#endif
     
-    inline bool GetBatteryTag(HANDLE hBattery, ULONG& outTag) noexcept {
+    inline bool GetBatteryTag(ULONG& outTag) noexcept {
         DWORD dwWait = 0;
         DWORD dwBytesReturned = 0;
-        BOOL success = DeviceIoControl(
-            hBattery,
+        bool success = TransportIoControl(
+            DeviceKind::Battery,
             2703424U, // IOCTL_BATTERY_QUERY_TAG
             &dwWait,
             sizeof(dwWait),
             &outTag,
             sizeof(outTag),
-            &dwBytesReturned,
-            nullptr
+            &dwBytesReturned
         );
         return success && (dwBytesReturned == sizeof(outTag)) && (outTag != 0);
     }
@@ -207,34 +325,32 @@ namespace LLTCCommonUtils {
         OutputType& output,
         DWORD* bytesReturned
     ) noexcept {
-        HANDLE hDriver = GetEnergyDriverHandle();
-        if (hDriver == INVALID_HANDLE_VALUE) {
-            return false;
-        }
-        
-        DWORD localBytesReturned = 0;
-        BOOL success = DeviceIoControl(
-            hDriver,
+        return TransportIoControl(
+            DeviceKind::EnergyDriver,
             ioctlCode,
-            const_cast<InputType*>(&input),
+            &input,
             sizeof(InputType),
             &output,
             sizeof(OutputType),
-            bytesReturned ? bytesReturned : &localBytesReturned,
-            nullptr
+            bytesReturned
         );
-        
-        return success != FALSE;
     }
 
     inline HRESULT InitializeCOM() noexcept {
+#ifdef _WIN32
         return CoInitializeEx(0, COINIT_MULTITHREADED);
+#else
+        return S_FALSE;
+#endif
     }
 
     inline void UninitializeCOM() noexcept {
+#ifdef _WIN32
         CoUninitialize();
+#endif
     }
 
+#ifdef _WIN32
     inline HRESULT ConnectToWMI(IWbemLocator** ppLocator, IWbemServices** ppServices) noexcept {
         try{
             HRESULT hr = CoCreateInstance(
@@ -338,9 +454,22 @@ namespace LLTCCommonUtils {
         }
     }
 
-    inline int CallWmiMethodNoParams(IWbemServices* pServices, const std::wstring& instancePath, const wchar_t* methodName) noexcept {
+    inline bool IsWmiConnectionLost(HRESULT hr) noexcept {
+        return hr == RPC_E_DISCONNECTED ||
+               hr == static_cast<HRESULT>(WBEM_E_TRANSPORT_FAILURE) ||
+               hr == HRESULT_FROM_WIN32(RPC_S_SERVER_UNAVAILABLE) ||
+               hr == HRESULT_FROM_WIN32(RPC_S_CALL_FAILED);
+    }
+
+    inline int CallWmiMethodNoParams(
+        IWbemServices* pServices,
+        const std::wstring& instancePath,
+        const wchar_t* methodName,
+        HRESULT* outHr
+    ) noexcept {
         try{
-            if (instancePath.empty()) {
+            if (outHr) *outHr = E_FAIL;
+            if (!pServices || instancePath.empty()) {
                 return -1;
             }
             
@@ -354,6 +483,7 @@ namespace LLTCCommonUtils {
                 &pOutParams,
                 nullptr
             );
+            if (outHr) *outHr = hr;
             
             if (FAILED(hr) || !pOutParams) {
                 return -1;
@@ -492,9 +622,11 @@ namespace LLTCCommonUtils {
         const wchar_t* methodName,
         const wchar_t* paramName,
         int paramValue,
-        const wchar_t* resultPropertyName
+        const wchar_t* resultPropertyName,
+        HRESULT* outHr
     ) noexcept {
         try{
+            if (outHr) *outHr = E_FAIL;
             if (!pServices || instancePath.empty()) return -1;
             
             IWbemClassObject* pClass = nullptr;
@@ -505,6 +637,7 @@ namespace LLTCCommonUtils {
                 &pClass, 
                 nullptr
             );
+            if (outHr) *outHr = hr;
             if (FAILED(hr) || !pClass) return -1;
             
             IWbemClassObject* pInParams = nullptr;
@@ -534,6 +667,7 @@ namespace LLTCCommonUtils {
                 nullptr
             );
             pInParams->Release();
+            if (outHr) *outHr = hr;
             
             if (FAILED(hr) || !pOutParams) return -1;
             
@@ -552,4 +686,1898 @@ namespace LLTCCommonUtils {
             return -1;
         }
     }
+#endif
+}
+
+// WMI session
+namespace LLTCCommonUtils {
+    // Receiver of one event subscription. onEvent gets the subscribed integer
+    // property of every event; onClosed runs once if the subscription ends by
+    // itself (cancelled, invalid class, lost connection). Both run on a transport
+    // thread, and neither runs after Close.
+    class WmiEventSink {
+    public:
+        using EventHandler = std::function<void(int)>;
+        using ClosedHandler = std::function<void(HRESULT)>;
+
+        WmiEventSink(EventHandler onEvent, ClosedHandler onClosed)
+            : m_onEvent(std::move(onEvent)), m_onClosed(std::move(onClosed)) {}
+
+        WmiEventSink(const WmiEventSink&) = delete;
+        WmiEventSink& operator=(const WmiEventSink&) = delete;
+
+        void Indicate(int value) noexcept {
+            if (m_closed) {
+                return;
+            }
+            try {
+                m_onEvent(value);
+            } catch (...) {
+                // never let a handler exception unwind into the transport
+            }
+        }
+
+        void SetStatus(HRESULT hr) noexcept {
+            if (!m_closed.exchange(true)) {
+                try {
+                    if (m_onClosed) m_onClosed(hr);
+                } catch (...) {
+                }
+            }
+        }
+
+        void Close() noexcept {
+            m_closed = true;
+        }
+
+        bool IsClosed() const noexcept {
+            return m_closed;
+        }
+
+    private:
+        std::atomic<bool> m_closed = false;
+        EventHandler m_onEvent;
+        ClosedHandler m_onClosed;
+    };
+
+    // A running subscription from IDeviceTransport::SubscribeEventQuery. Cancel
+    // closes the sink and stops the query; destroying it does the same.
+    class WmiEventSubscription {
+    public:
+        virtual ~WmiEventSubscription() = default;
+        virtual void Cancel() noexcept = 0;
+    };
+
+#ifdef _WIN32
+    // Completion object for one ExecMethodAsync call. WMI delivers the out-parameters
+    // through Indicate and signals the final status through SetStatus.
+    class WmiCallSink final : public IWbemObjectSink {
+    public:
+        WmiCallSink() : m_hDone(CreateEventW(nullptr, TRUE, FALSE, nullptr)) {}
+
+        WmiCallSink(const WmiCallSink&) = delete;
+        WmiCallSink& operator=(const WmiCallSink&) = delete;
+
+        ULONG STDMETHODCALLTYPE AddRef() override {
+            return ++m_refCount;
+        }
+
+        ULONG STDMETHODCALLTYPE Release() override {
+            ULONG count = --m_refCount;
+            if (count == 0) {
+                delete this;
+            }
+            return count;
+        }
+
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+            if (!ppv) {
+                return E_POINTER;
+            }
+            if (riid == IID_IUnknown || riid == IID_IWbemObjectSink) {
+                *ppv = static_cast<IWbemObjectSink*>(this);
+                AddRef();
+                return S_OK;
+            }
+            *ppv = nullptr;
+            return E_NOINTERFACE;
+        }
+
+        HRESULT STDMETHODCALLTYPE Indicate(long lObjectCount, IWbemClassObject** apObjArray) override {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (lObjectCount > 0 && apObjArray && apObjArray[0] && !m_pOutParams) {
+                m_pOutParams = apObjArray[0];
+            }
+            return WBEM_S_NO_ERROR;
+        }
+
+        HRESULT STDMETHODCALLTYPE SetStatus(long lFlags, HRESULT hResult, BSTR, IWbemClassObject*) override {
+            if (lFlags == WBEM_STATUS_COMPLETE) {
+                m_status = hResult;
+                SetEvent(m_hDone);
+            }
+            return WBEM_S_NO_ERROR;
+        }
+
+        HRESULT Wait(DWORD timeoutMs) const noexcept {
+            if (!m_hDone) {
+                return E_OUTOFMEMORY;
+            }
+            DWORD waitResult = WaitForSingleObject(m_hDone, timeoutMs);
+            if (waitResult == WAIT_TIMEOUT) {
+                return WBEM_E_TIMED_OUT;
+            }
+            if (waitResult != WAIT_OBJECT_0) {
+                return E_FAIL;
+            }
+            return m_status.load();
+        }
+
+        int GetInt(const wchar_t* propertyName) noexcept {
+            try {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_pOutParams) {
+                    return -1;
+                }
+                _variant_t vtResult;
+                HRESULT hr = m_pOutParams->Get(propertyName, 0, &vtResult, nullptr, nullptr);
+                return (SUCCEEDED(hr) && vtResult.vt == VT_I4) ? vtResult.lVal : -1;
+            } catch (...) {
+                return -1;
+            }
+        }
+
+    private:
+        ~WmiCallSink() {
+            if (m_hDone) {
+                CloseHandle(m_hDone);
+            }
+        }
+
+        std::atomic<ULONG> m_refCount = 1;
+        std::atomic<HRESULT> m_status = E_PENDING;
+        HANDLE m_hDone = nullptr;
+        std::mutex m_mutex;
+        Microsoft::WRL::ComPtr<IWbemClassObject> m_pOutParams;
+    };
+
+    // Long-lived COM sink for ExecNotificationQueryAsync. Hands the integer property
+    // of every delivered event object to a WmiEventSink on the WMI callback thread,
+    // then the status the subscription ends with.
+    class WmiEventObjectSink final : public IWbemObjectSink {
+    public:
+        WmiEventObjectSink(std::shared_ptr<WmiEventSink> sink, std::wstring propertyName)
+            : m_sink(std::move(sink)), m_propertyName(std::move(propertyName)) {}
+
+        WmiEventObjectSink(const WmiEventObjectSink&) = delete;
+        WmiEventObjectSink& operator=(const WmiEventObjectSink&) = delete;
+
+        ULONG STDMETHODCALLTYPE AddRef() override {
+            return ++m_refCount;
+        }
+
+        ULONG STDMETHODCALLTYPE Release() override {
+            ULONG count = --m_refCount;
+            if (count == 0) {
+                delete this;
+            }
+            return count;
+        }
+
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+            if (!ppv) {
+                return E_POINTER;
+            }
+            if (riid == IID_IUnknown || riid == IID_IWbemObjectSink) {
+                *ppv = static_cast<IWbemObjectSink*>(this);
+                AddRef();
+                return S_OK;
+            }
+            *ppv = nullptr;
+            return E_NOINTERFACE;
+        }
+
+        HRESULT STDMETHODCALLTYPE Indicate(long lObjectCount, IWbemClassObject** apObjArray) override {
+            if (m_sink->IsClosed() || !apObjArray) {
+                return WBEM_S_NO_ERROR;
+            }
+            for (long i = 0; i < lObjectCount; ++i) {
+                if (!apObjArray[i]) continue;
+                try {
+                    _variant_t vtValue;
+                    HRESULT hr = apObjArray[i]->Get(m_propertyName.c_str(), 0, &vtValue, nullptr, nullptr);
+                    if (SUCCEEDED(hr) && vtValue.vt == VT_I4) {
+                        m_sink->Indicate(vtValue.lVal);
+                    }
+                } catch (...) {
+                    // never let an exception unwind into WMI
+                }
+            }
+            return WBEM_S_NO_ERROR;
+        }
+
+        HRESULT STDMETHODCALLTYPE SetStatus(long lFlags, HRESULT hResult, BSTR, IWbemClassObject*) override {
+            if (lFlags == WBEM_STATUS_COMPLETE) {
+                m_sink->SetStatus(hResult);
+            }
+            return WBEM_S_NO_ERROR;
+        }
+
+    private:
+        ~WmiEventObjectSink() = default;
+
+        std::atomic<ULONG> m_refCount = 1;
+        std::shared_ptr<WmiEventSink> m_sink;
+        std::wstring m_propertyName;
+    };
+
+    // In-parameter object for one (class, method, parameter) triple, resolved once.
+    // Each call only clones the local template, puts the value and runs ExecMethod.
+    class WmiPreparedMethod {
+    public:
+        WmiPreparedMethod(
+            WmiInParamsSource source,
+            std::wstring className,
+            std::wstring methodName,
+            std::wstring paramName
+        ) : m_source(source),
+            m_className(std::move(className)),
+            m_methodName(std::move(methodName)),
+            m_paramName(std::move(paramName)) {}
+
+        HRESULT Prepare(IWbemServices* pServices) noexcept {
+            try {
+                if (!pServices) {
+                    return E_POINTER;
+                }
+                Microsoft::WRL::ComPtr<IWbemClassObject> pClass;
+                HRESULT hr = pServices->GetObject(
+                    _bstr_t(m_className.c_str()),
+                    (m_source == WmiInParamsSource::MethodDefinition) ? WBEM_FLAG_DIRECT_READ : 0,
+                    nullptr,
+                    pClass.GetAddressOf(),
+                    nullptr
+                );
+                if (FAILED(hr) || !pClass) {
+                    return FAILED(hr) ? hr : E_FAIL;
+                }
+
+                switch (m_source) {
+                    case WmiInParamsSource::MethodDefinition: {
+                        Microsoft::WRL::ComPtr<IWbemClassObject> pInParamsDef;
+                        hr = pClass->GetMethod(m_methodName.c_str(), 0, pInParamsDef.GetAddressOf(), nullptr);
+                        if (FAILED(hr) || !pInParamsDef) {
+                            return FAILED(hr) ? hr : E_FAIL;
+                        }
+                        hr = pInParamsDef->SpawnInstance(0, m_pInParams.ReleaseAndGetAddressOf());
+                        break;
+                    }
+                    case WmiInParamsSource::ParametersClass:
+                        m_pInParams = pClass;
+                        break;
+                    case WmiInParamsSource::ParametersInstance:
+                        hr = pClass->SpawnInstance(0, m_pInParams.ReleaseAndGetAddressOf());
+                        break;
+                }
+                if (FAILED(hr) || !m_pInParams) {
+                    m_pInParams.Reset();
+                    return FAILED(hr) ? hr : E_FAIL;
+                }
+                return S_OK;
+            } catch (...) {
+                return E_UNEXPECTED;
+            }
+        }
+
+        HRESULT Invoke(
+            IWbemServices* pServices,
+            const std::wstring& instancePath,
+            int paramValue,
+            IWbemClassObject** ppOutParams
+        ) const noexcept {
+            try {
+                if (!pServices || !m_pInParams || instancePath.empty()) {
+                    return E_FAIL;
+                }
+                Microsoft::WRL::ComPtr<IWbemClassObject> pInParams;
+                HRESULT hr = m_pInParams->Clone(pInParams.GetAddressOf());
+                if (FAILED(hr)) {
+                    return hr;
+                }
+
+                VARIANT var;
+                VariantInit(&var);
+                var.vt = VT_I4;
+                var.lVal = paramValue;
+                hr = pInParams->Put(m_paramName.c_str(), 0, &var, 0);
+                VariantClear(&var);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+
+                return pServices->ExecMethod(
+                    _bstr_t(instancePath.c_str()),
+                    _bstr_t(m_methodName.c_str()),
+                    0,
+                    nullptr,
+                    pInParams.Get(),
+                    ppOutParams,
+                    nullptr
+                );
+            } catch (...) {
+                return E_UNEXPECTED;
+            }
+        }
+
+    private:
+        WmiInParamsSource m_source;
+        std::wstring m_className;
+        std::wstring m_methodName;
+        std::wstring m_paramName;
+        Microsoft::WRL::ComPtr<IWbemClassObject> m_pInParams;
+    };
+
+#endif
+
+    // One long-lived thread that owns the process's COM apartment (MTA) and runs
+    // every job that touches a WMI proxy, in submission order. Callers on any
+    // thread, in any apartment, never initialise COM or marshal a proxy. A job
+    // submitted from the worker itself runs inline, so jobs may nest.
+    class WmiWorker {
+    public:
+        static WmiWorker& Instance() noexcept {
+            static WmiWorker worker;
+            return worker;
+        }
+
+        WmiWorker(const WmiWorker&) = delete;
+        WmiWorker& operator=(const WmiWorker&) = delete;
+
+        template<typename Fn>
+        auto Submit(Fn&& fn) -> std::future<std::invoke_result_t<std::decay_t<Fn>&>> {
+            using Result = std::invoke_result_t<std::decay_t<Fn>&>;
+            std::packaged_task<Result()> task(std::forward<Fn>(fn));
+            auto future = task.get_future();
+            enqueue(std::move(task));
+            return future;
+        }
+
+        // Runs fn on the worker and hands its result to done, also on the worker.
+        template<typename Fn, typename Callback>
+        void Post(Fn&& fn, Callback&& done) {
+            enqueue([fn = std::forward<Fn>(fn), done = std::forward<Callback>(done)]() mutable {
+                if constexpr (std::is_void_v<std::invoke_result_t<std::decay_t<Fn>&>>) {
+                    fn();
+                    done();
+                } else {
+                    done(fn());
+                }
+            });
+        }
+
+        // Runs fn on the worker once delay has passed, behind any job queued by
+        // then. Jobs still waiting when the worker stops are dropped.
+        template<typename Fn>
+        void PostAfter(std::chrono::milliseconds delay, Fn&& fn) {
+            std::lock_guard lock(m_mutex);
+            if (m_stopping) {
+                return;
+            }
+            m_delayed.emplace(std::chrono::steady_clock::now() + delay, std::forward<Fn>(fn));
+            m_wake.notify_one();
+        }
+
+        // Runs fn on the worker and waits for it.
+        template<typename Fn>
+        auto Run(Fn&& fn) -> std::invoke_result_t<std::decay_t<Fn>&> {
+            if (IsWorkerThread()) {
+                return fn();
+            }
+            return Submit(std::forward<Fn>(fn)).get();
+        }
+
+        bool IsWorkerThread() const noexcept {
+            return std::this_thread::get_id() == m_threadId.load(std::memory_order_acquire);
+        }
+
+        // Result of CoInitializeEx on the worker, once it has started.
+        HRESULT ApartmentResult() noexcept {
+            std::unique_lock lock(m_mutex);
+            m_started.wait(lock, [this]() { return m_running || m_stopping; });
+            return m_apartment;
+        }
+
+        // Finishes queued jobs and leaves the apartment. Jobs submitted afterwards
+        // run inline on the caller. Releases the WMI session first, so hosts that
+        // unload the code (a DLL) can call this before static destruction.
+        void Shutdown() noexcept;
+
+    private:
+        WmiWorker() {
+            try {
+                m_thread = std::thread([this]() { loop(); });
+            } catch (...) {
+                m_stopping = true;      // no thread: every job runs inline
+            }
+        }
+
+        ~WmiWorker() {
+            stop();
+        }
+
+        template<typename Job>
+        void enqueue(Job&& job) {
+            {
+                std::lock_guard lock(m_mutex);
+                if (!m_stopping) {
+                    m_jobs.emplace_back(std::forward<Job>(job));
+                    m_wake.notify_one();
+                    return;
+                }
+            }
+            job();
+        }
+
+        void stop() noexcept {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stopping = true;
+            }
+            m_wake.notify_one();
+            if (m_thread.joinable() && !IsWorkerThread()) {
+                m_thread.join();
+            }
+        }
+
+        void loop() noexcept {
+            m_threadId.store(std::this_thread::get_id(), std::memory_order_release);
+            HRESULT apartment = InitializeCOM();
+            std::unique_lock lock(m_mutex);
+            m_apartment = apartment;
+            m_running = true;
+            m_started.notify_all();
+            while (true) {
+                if (m_jobs.empty() && !m_stopping) {
+                    if (m_delayed.empty()) {
+                        m_wake.wait(lock);
+                    } else {
+                        m_wake.wait_until(lock, m_delayed.begin()->first);
+                    }
+                }
+                std::move_only_function<void()> job;
+                if (!m_jobs.empty()) {
+                    job = std::move(m_jobs.front());
+                    m_jobs.pop_front();
+                } else if (m_stopping) {
+                    break;
+                } else if (!m_delayed.empty() && m_delayed.begin()->first <= std::chrono::steady_clock::now()) {
+                    job = std::move(m_delayed.begin()->second);
+                    m_delayed.erase(m_delayed.begin());
+                } else {
+                    continue;
+                }
+                lock.unlock();
+                job();
+                lock.lock();
+            }
+            m_running = false;
+            auto dropped = std::move(m_delayed);
+            lock.unlock();
+            dropped.clear();
+            if (SUCCEEDED(apartment)) {
+                UninitializeCOM();
+            }
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_started;
+        std::deque<std::move_only_function<void()>> m_jobs;
+        std::multimap<std::chrono::steady_clock::time_point, std::move_only_function<void()>> m_delayed;
+        bool m_stopping = false;
+        bool m_running = false;
+        HRESULT m_apartment = E_PENDING;
+        std::atomic<std::thread::id> m_threadId;
+        std::thread m_thread;
+    };
+
+#ifdef _WIN32
+    // Process-wide ROOT\WMI connection shared by every control namespace.
+    // The locator, the services proxy and the resolved GameZone instance paths
+    // are created on first use, rebuilt after a lost connection and released at exit.
+    // All of it lives on the WmiWorker thread; the public calls hop there.
+    class WmiSession {
+    public:
+        static WmiSession& Instance() noexcept {
+            static WmiSession instance;
+            return instance;
+        }
+
+        WmiSession(const WmiSession&) = delete;
+        WmiSession& operator=(const WmiSession&) = delete;
+
+        HRESULT Connect() noexcept {
+            return runOnWorker([this]() {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return connectLocked();
+            }, E_UNEXPECTED);
+        }
+
+        void Release() noexcept {
+            runOnWorker([this]() {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                releaseLocked();
+                return S_OK;
+            }, E_UNEXPECTED);
+        }
+
+        std::wstring GetGameZonePath(WmiPathType pathType = WmiPathType::Full) noexcept {
+            std::wstring instancePath;
+            runOnWorker([&]() {
+                Microsoft::WRL::ComPtr<IWbemServices> pServices;
+                return acquire(pathType, pServices, instancePath);
+            }, E_UNEXPECTED);
+            return instancePath;
+        }
+
+        // fn: HRESULT(IWbemServices* pServices, const std::wstring& gameZonePath)
+        // Runs on the WMI worker; retried once on a fresh connection if the proxy
+        // was disconnected.
+        template<typename Fn>
+        HRESULT Execute(WmiPathType pathType, Fn&& fn) noexcept {
+            return runOnWorker([&]() { return executeOnWorker(pathType, fn); }, E_UNEXPECTED);
+        }
+
+        int CallMethodNoParams(const wchar_t* methodName, WmiPathType pathType = WmiPathType::Full) noexcept {
+            int result = -1;
+            Execute(pathType, [&](IWbemServices* pServices, const std::wstring& instancePath) {
+                HRESULT hr = E_FAIL;
+                result = CallWmiMethodNoParams(pServices, instancePath, methodName, &hr);
+                return hr;
+            });
+            return result;
+        }
+
+        // Runs methodName with a single int in-parameter through the prepared-method cache.
+        // The in-parameter object is fetched from WMI once per (source, class, method, parameter).
+        HRESULT CallPreparedMethod(
+            WmiInParamsSource source,
+            const wchar_t* className,
+            const wchar_t* methodName,
+            const wchar_t* paramName,
+            int paramValue,
+            WmiPathType pathType = WmiPathType::Full,
+            int* outValue = nullptr,
+            const wchar_t* resultPropertyName = L"Data"
+        ) noexcept {
+            return Execute(pathType, [&](IWbemServices* pServices, const std::wstring& instancePath) -> HRESULT {
+                std::shared_ptr<const WmiPreparedMethod> method;
+                HRESULT hr = getPreparedMethod(pServices, source, className, methodName, paramName, method);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+
+                Microsoft::WRL::ComPtr<IWbemClassObject> pOutParams;
+                hr = method->Invoke(pServices, instancePath, paramValue, pOutParams.GetAddressOf());
+                if (FAILED(hr) || !outValue) {
+                    return hr;
+                }
+                if (!pOutParams) {
+                    return E_FAIL;
+                }
+
+                _variant_t vtResult;
+                hr = pOutParams->Get(resultPropertyName, 0, &vtResult, nullptr, nullptr);
+                if (FAILED(hr) || vtResult.vt != VT_I4) {
+                    return FAILED(hr) ? hr : E_FAIL;
+                }
+                *outValue = vtResult.lVal;
+                return S_OK;
+            });
+        }
+
+        HRESULT CallMethodWithIntParamFromClassDef(const wchar_t* methodName, int paramValue) noexcept {
+            return CallPreparedMethod(
+                WmiInParamsSource::MethodDefinition, L"LENOVO_GAMEZONE_DATA", methodName, L"Data", paramValue);
+        }
+
+        HRESULT CallMethodWithIntParamFromParameters(
+            const wchar_t* methodName,
+            int paramValue,
+            WmiPathType pathType = WmiPathType::Full
+        ) noexcept {
+            return CallPreparedMethod(
+                WmiInParamsSource::ParametersClass, L"__PARAMETERS", methodName, L"Data", paramValue, pathType);
+        }
+
+        int CallMethodWithNamedParam(
+            const wchar_t* methodName,
+            const wchar_t* paramName,
+            int paramValue,
+            const wchar_t* resultPropertyName = L"Value",
+            WmiPathType pathType = WmiPathType::Full
+        ) noexcept {
+            int result = -1;
+            HRESULT hr = CallPreparedMethod(
+                WmiInParamsSource::ParametersInstance, L"__PARAMETERS", methodName, paramName, paramValue,
+                pathType, &result, resultPropertyName);
+            return SUCCEEDED(hr) ? result : -1;
+        }
+
+        // Starts every call with ExecMethodAsync before waiting on any of them, so
+        // independent reads overlap and the batch costs about one round trip.
+        HRESULT CallMethodsNoParamsAsync(
+            std::span<WmiAsyncCall> calls,
+            WmiPathType pathType = WmiPathType::Full,
+            DWORD timeoutMs = WBEM_INFINITE
+        ) noexcept {
+            return Execute(pathType, [&](IWbemServices* pServices, const std::wstring& instancePath) -> HRESULT {
+                std::vector<Microsoft::WRL::ComPtr<WmiCallSink>> sinks(calls.size());
+                _bstr_t path(instancePath.c_str());
+
+                for (size_t i = 0; i < calls.size(); ++i) {
+                    calls[i].result = -1;
+                    sinks[i].Attach(new (std::nothrow) WmiCallSink());
+                    if (!sinks[i]) {
+                        calls[i].hr = E_OUTOFMEMORY;
+                        continue;
+                    }
+                    calls[i].hr = pServices->ExecMethodAsync(
+                        path,
+                        _bstr_t(calls[i].methodName),
+                        0,
+                        nullptr,
+                        nullptr,
+                        sinks[i].Get()
+                    );
+                    if (FAILED(calls[i].hr)) {
+                        sinks[i].Reset();
+                    }
+                }
+
+                const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+                HRESULT batchResult = S_OK;
+                for (size_t i = 0; i < calls.size(); ++i) {
+                    if (sinks[i]) {
+                        DWORD waitMs = timeoutMs;
+                        if (timeoutMs != WBEM_INFINITE) {
+                            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                deadline - std::chrono::steady_clock::now()).count();
+                            waitMs = static_cast<DWORD>(remaining > 0 ? remaining : 0);
+                        }
+                        calls[i].hr = sinks[i]->Wait(waitMs);
+                        if (calls[i].hr == WBEM_E_TIMED_OUT) {
+                            pServices->CancelAsyncCall(sinks[i].Get());
+                        } else if (SUCCEEDED(calls[i].hr)) {
+                            calls[i].result = sinks[i]->GetInt(L"Data");
+                        }
+                    }
+                    if (IsWmiConnectionLost(calls[i].hr)) {
+                        batchResult = calls[i].hr;
+                    }
+                }
+                return batchResult;
+            });
+        }
+
+        // Registers a WQL event query on ROOT\WMI. On success outServices holds the proxy
+        // the subscription lives on; pass both back to CancelEventQuery to stop it.
+        HRESULT SubscribeEventQuery(
+            const wchar_t* query,
+            IWbemObjectSink* pSink,
+            Microsoft::WRL::ComPtr<IWbemServices>& outServices
+        ) noexcept {
+            if (!pSink) {
+                return E_POINTER;
+            }
+            return Execute(WmiPathType::Full, [&](IWbemServices* pServices, const std::wstring&) -> HRESULT {
+                HRESULT hr = pServices->ExecNotificationQueryAsync(
+                    _bstr_t(L"WQL"),
+                    _bstr_t(query),
+                    0,
+                    nullptr,
+                    pSink
+                );
+                if (SUCCEEDED(hr)) {
+                    outServices = pServices;
+                }
+                return hr;
+            });
+        }
+
+        static void CancelEventQuery(IWbemServices* pServices, IWbemObjectSink* pSink) noexcept {
+            if (pServices && pSink) {
+                try {
+                    WmiWorker::Instance().Run([&]() { pServices->CancelAsyncCall(pSink); });
+                } catch (...) {
+                }
+            }
+        }
+
+        uint32_t GetConnectCount() const noexcept {
+            return m_connectCount.load();
+        }
+
+    private:
+        // Creating the worker first makes it outlive the session, so the proxies
+        // are released on it at exit.
+        WmiSession() {
+            WmiWorker::Instance();
+        }
+        ~WmiSession() {
+            Release();
+        }
+
+        template<typename Fn>
+        HRESULT runOnWorker(Fn&& fn, HRESULT failure) noexcept {
+            try {
+                return WmiWorker::Instance().Run(std::forward<Fn>(fn));
+            } catch (...) {
+                return failure;
+            }
+        }
+
+        template<typename Fn>
+        HRESULT executeOnWorker(WmiPathType pathType, Fn& fn) noexcept {
+            HRESULT hr = E_FAIL;
+            for (int attempt = 0; attempt < 2; ++attempt) {
+                Microsoft::WRL::ComPtr<IWbemServices> pServices;
+                std::wstring instancePath;
+                hr = acquire(pathType, pServices, instancePath);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+                try {
+                    hr = fn(pServices.Get(), instancePath);
+                } catch (...) {
+                    return E_UNEXPECTED;
+                }
+                if (!IsWmiConnectionLost(hr)) {
+                    return hr;
+                }
+                invalidate(pServices.Get());
+            }
+            return hr;
+        }
+
+        HRESULT connectLocked() noexcept {
+            if (m_pServices) {
+                return S_OK;
+            }
+            HRESULT hr = ConnectToWMI(m_pLocator.ReleaseAndGetAddressOf(), m_pServices.ReleaseAndGetAddressOf());
+            if (FAILED(hr)) {
+                m_pServices.Reset();
+                m_pLocator.Reset();
+                return hr;
+            }
+            m_fullPath.clear();
+            m_relativePath.clear();
+            m_preparedMethods.clear();
+            m_connectCount++;
+            return S_OK;
+        }
+
+        void releaseLocked() noexcept {
+            m_pServices.Reset();
+            m_pLocator.Reset();
+            m_fullPath.clear();
+            m_relativePath.clear();
+            m_preparedMethods.clear();
+        }
+
+        HRESULT acquire(
+            WmiPathType pathType,
+            Microsoft::WRL::ComPtr<IWbemServices>& outServices,
+            std::wstring& outPath
+        ) noexcept {
+            try {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                HRESULT hr = connectLocked();
+                if (FAILED(hr)) {
+                    return hr;
+                }
+                std::wstring& path = (pathType == WmiPathType::Full) ? m_fullPath : m_relativePath;
+                if (path.empty()) {
+                    path = GetFirstWmiInstancePath(m_pServices.Get(), GameZoneClassNames, pathType);
+                    if (path.empty()) {
+                        return WBEM_E_NOT_FOUND;
+                    }
+                }
+                outServices = m_pServices;
+                outPath = path;
+                return S_OK;
+            } catch (...) {
+                return E_UNEXPECTED;
+            }
+        }
+
+        HRESULT getPreparedMethod(
+            IWbemServices* pServices,
+            WmiInParamsSource source,
+            const wchar_t* className,
+            const wchar_t* methodName,
+            const wchar_t* paramName,
+            std::shared_ptr<const WmiPreparedMethod>& outMethod
+        ) noexcept {
+            try {
+                PreparedMethodKey key{static_cast<int>(source), className, methodName, paramName};
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    auto it = m_preparedMethods.find(key);
+                    if (it != m_preparedMethods.end()) {
+                        outMethod = it->second;
+                        return S_OK;
+                    }
+                }
+
+                // Resolve outside the lock: this is the round trip the cache exists to avoid.
+                auto method = std::make_shared<WmiPreparedMethod>(source, className, methodName, paramName);
+                HRESULT hr = method->Prepare(pServices);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_pServices.Get() == pServices) {
+                    auto [it, inserted] = m_preparedMethods.emplace(std::move(key), std::move(method));
+                    outMethod = it->second;
+                } else {
+                    outMethod = std::move(method);
+                }
+                return S_OK;
+            } catch (...) {
+                return E_UNEXPECTED;
+            }
+        }
+
+        void invalidate(IWbemServices* pStale) noexcept {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_pServices.Get() != pStale) {
+                return; // another caller already reconnected
+            }
+            m_pServices.Reset();
+            m_pLocator.Reset();
+            m_fullPath.clear();
+            m_relativePath.clear();
+            m_preparedMethods.clear();
+        }
+
+        std::mutex m_mutex;
+        Microsoft::WRL::ComPtr<IWbemLocator> m_pLocator;
+        Microsoft::WRL::ComPtr<IWbemServices> m_pServices;
+        std::wstring m_fullPath;
+        std::wstring m_relativePath;
+        using PreparedMethodKey = std::tuple<int, std::wstring, std::wstring, std::wstring>;
+        std::map<PreparedMethodKey, std::shared_ptr<const WmiPreparedMethod>> m_preparedMethods;
+        std::atomic<uint32_t> m_connectCount = 0;
+    };
+
+#endif
+
+    inline void WmiWorker::Shutdown() noexcept {
+#ifdef _WIN32
+        WmiSession::Instance().Release();
+#endif
+        stop();
+    }
+}
+
+
+// Device handle registry
+#ifdef _WIN32
+namespace LLTCCommonUtils {
+    inline bool IsDeviceLost(DWORD error) noexcept {
+        return error == ERROR_INVALID_HANDLE ||
+               error == ERROR_DEVICE_REMOVED ||
+               error == ERROR_DEVICE_NOT_CONNECTED ||
+               error == ERROR_NO_SUCH_DEVICE;
+    }
+
+    // An open device handle; closed when the last reference to it is dropped.
+    class DeviceHandle {
+    public:
+        DeviceHandle(HANDLE handle, uint64_t generation) noexcept
+            : m_handle(handle), m_generation(generation) {}
+        ~DeviceHandle() {
+            if (m_handle != INVALID_HANDLE_VALUE) {
+                CloseHandle(m_handle);
+            }
+        }
+        DeviceHandle(const DeviceHandle&) = delete;
+        DeviceHandle& operator=(const DeviceHandle&) = delete;
+
+        HANDLE Get() const noexcept { return m_handle; }
+        uint64_t GetGeneration() const noexcept { return m_generation; }
+
+    private:
+        HANDLE m_handle;
+        uint64_t m_generation;
+    };
+
+    // Opens each device once, hands out shared references and replaces a handle that
+    // a caller reported lost (e.g. after resume). A retired handle stays open until
+    // every in-flight user has released it.
+    class DeviceHandleRegistry {
+    public:
+        static DeviceHandleRegistry& Instance() noexcept {
+            static DeviceHandleRegistry instance;
+            return instance;
+        }
+
+        // nullptr if the device cannot be opened right now.
+        std::shared_ptr<const DeviceHandle> Acquire(DeviceKind device) noexcept {
+            auto& entry = m_entries[static_cast<size_t>(device)];
+            std::lock_guard lock(entry.mutex);
+            if (entry.handle) {
+                return entry.handle;
+            }
+
+            HANDLE handle = (device == DeviceKind::Battery) ? OpenBatteryHandle() : OpenEnergyDriverHandle();
+            if (handle == INVALID_HANDLE_VALUE) {
+                ++entry.stats.failedOpens;
+                return nullptr;
+            }
+            ++entry.stats.opens;
+            if (entry.invalidated) {
+                ++entry.stats.reopens;
+                entry.invalidated = false;
+            }
+            entry.handle = std::make_shared<const DeviceHandle>(handle, ++entry.generation);
+            return entry.handle;
+        }
+
+        // Drops the registry's reference if `handle` is still the current one, so the
+        // next Acquire reopens the device. Stale reports from other threads are ignored.
+        void Invalidate(DeviceKind device, const DeviceHandle& handle) noexcept {
+            auto& entry = m_entries[static_cast<size_t>(device)];
+            std::lock_guard lock(entry.mutex);
+            if (entry.handle && entry.handle->GetGeneration() == handle.GetGeneration()) {
+                entry.handle.reset();
+                entry.invalidated = true;
+            }
+        }
+
+        DeviceHandleStats GetStats(DeviceKind device) const noexcept {
+            auto& entry = m_entries[static_cast<size_t>(device)];
+            std::lock_guard lock(entry.mutex);
+            DeviceHandleStats stats = entry.stats;
+            stats.activeReferences = entry.handle ? entry.handle.use_count() - 1 : 0;
+            return stats;
+        }
+
+    private:
+        DeviceHandleRegistry() = default;
+
+        struct Entry {
+            mutable std::mutex mutex;
+            std::shared_ptr<const DeviceHandle> handle;
+            uint64_t generation = 0;
+            bool invalidated = false;
+            DeviceHandleStats stats;
+        };
+        Entry m_entries[2];
+    };
+}
+#endif
+
+
+// Device transport
+namespace LLTCCommonUtils {
+    // Everything the controls need from the machine: EnergyDrv and battery IOCTLs,
+    // the system power status and LENOVO_GAMEZONE_DATA methods. The Windows backend
+    // is the default; SetDeviceTransport swaps in another one (e.g. a simulator),
+    // which other systems have to do before the first device access.
+    class IDeviceTransport {
+    public:
+        virtual ~IDeviceTransport() = default;
+
+        virtual bool IsAvailable(DeviceKind device) noexcept = 0;
+        // Fills bytesReturned, error and latency of every request. Returns true if all succeeded.
+        virtual bool IoControlBatch(DeviceKind device, std::span<IoctlRequest> requests, IoctlOrder order) noexcept = 0;
+        virtual bool QueryPowerStatus(SYSTEM_POWER_STATUS& outStatus) noexcept = 0;
+
+        // S_OK when the GameZone instance is reachable, WBEM_E_NOT_FOUND when it is missing.
+        // Connects and resolves the instance path of the given type, so it also
+        // serves to warm the session up ahead of the first method call.
+        virtual HRESULT ConnectWmi(WmiPathType pathType = WmiPathType::Full) noexcept = 0;
+        virtual HRESULT CallWmiMethod(const WmiMethodCall& call, int* outValue) noexcept = 0;
+        virtual HRESULT CallWmiMethodsAsync(std::span<WmiAsyncCall> calls, WmiPathType pathType) noexcept = 0;
+        // Delivers propertyName of every event matching the WQL query to sink until
+        // outSubscription is cancelled.
+        virtual HRESULT SubscribeEventQuery(
+            const wchar_t* query,
+            const wchar_t* propertyName,
+            std::shared_ptr<WmiEventSink> sink,
+            std::unique_ptr<WmiEventSubscription>& outSubscription
+        ) noexcept = 0;
+
+        // Model, BIOS version and EnergyDrv version: what the probed capabilities
+        // depend on. Empty if unknown, which keeps them from being persisted.
+        virtual std::string MachineIdentity() noexcept = 0;
+
+        // Stops background threads, for hosts that unload the code (a DLL) and
+        // must not join threads under the loader lock. No call may be in flight,
+        // and device calls made afterwards fail.
+        virtual void Shutdown() noexcept {}
+    };
+
+#ifdef _WIN32
+    // An ExecNotificationQueryAsync subscription on the shared WMI session.
+    class WmiQuerySubscription final : public WmiEventSubscription {
+    public:
+        WmiQuerySubscription(std::shared_ptr<WmiEventSink> sink, const wchar_t* propertyName)
+            : m_sink(std::move(sink)) {
+            m_pObjectSink.Attach(new WmiEventObjectSink(m_sink, propertyName));
+        }
+        ~WmiQuerySubscription() override {
+            Cancel();
+        }
+
+        HRESULT Start(const wchar_t* query) noexcept {
+            return WmiSession::Instance().SubscribeEventQuery(query, m_pObjectSink.Get(), m_pServices);
+        }
+
+        void Cancel() noexcept override {
+            m_sink->Close();
+            WmiSession::CancelEventQuery(m_pServices.Get(), m_pObjectSink.Get());
+            m_pServices.Reset();
+        }
+
+    private:
+        std::shared_ptr<WmiEventSink> m_sink;
+        Microsoft::WRL::ComPtr<IWbemObjectSink> m_pObjectSink;
+        Microsoft::WRL::ComPtr<IWbemServices> m_pServices;
+    };
+
+    class WindowsDeviceTransport final : public IDeviceTransport {
+    public:
+        ~WindowsDeviceTransport() override {
+            Shutdown();
+        }
+
+        // Joins the completion thread and closes the port; a no-op the second time.
+        void Shutdown() noexcept override {
+            std::lock_guard lock(m_mutex);
+            m_shutDown = true;
+            if (m_completionThread.joinable()) {
+                PostQueuedCompletionStatus(m_port, 0, ShutdownKey, nullptr);
+                m_completionThread.join();
+            }
+            if (m_port) {
+                CloseHandle(m_port);
+                m_port = nullptr;
+            }
+        }
+
+        bool IsAvailable(DeviceKind device) noexcept override {
+            return DeviceHandleRegistry::Instance().Acquire(device) != nullptr;
+        }
+
+        // Device handles are opened with FILE_FLAG_OVERLAPPED and bound to one completion
+        // port, drained by a single completion thread, so batches from several threads
+        // (including long battery waits) run side by side. The driver only ever sees
+        // buffers owned by the batch, so each request has a hard deadline: a request
+        // still pending then is cancelled with CancelIoEx and reported as ERROR_TIMEOUT
+        // at once, even if the driver ignores the cancel. The batch state lives on
+        // until the completion thread has seen the last packet. A batch that fails
+        // because the handle went stale is retried once, from the first unfinished
+        // request, on a freshly opened handle.
+        bool IoControlBatch(DeviceKind device, std::span<IoctlRequest> requests, IoctlOrder order) noexcept override {
+            auto& registry = DeviceHandleRegistry::Instance();
+
+            auto handle = registry.Acquire(device);
+            if (runBatch(device, handle.get(), requests, order)) {
+                return true;
+            }
+            bool lost = std::ranges::any_of(requests, [](const IoctlRequest& request) { return IsDeviceLost(request.error); });
+            if (!lost || !handle) {
+                return false;
+            }
+
+            registry.Invalidate(device, *handle);
+            handle = registry.Acquire(device);
+            std::vector<IoctlRequest> retry;
+            std::vector<size_t> indices;
+            for (size_t i = 0; i < requests.size(); ++i) {
+                if (requests[i].error != ERROR_SUCCESS) {
+                    retry.push_back(requests[i]);
+                    indices.push_back(i);
+                }
+            }
+            bool success = runBatch(device, handle.get(), retry, order);
+            for (size_t i = 0; i < indices.size(); ++i) {
+                requests[indices[i]] = retry[i];
+            }
+            return success;
+        }
+
+        bool QueryPowerStatus(SYSTEM_POWER_STATUS& outStatus) noexcept override {
+            return GetSystemPowerStatus(&outStatus) != FALSE;
+        }
+
+        HRESULT ConnectWmi(WmiPathType pathType) noexcept override {
+            auto& session = WmiSession::Instance();
+            HRESULT hr = session.Connect();
+            if (FAILED(hr)) {
+                return hr;
+            }
+            return session.GetGameZonePath(pathType).empty() ? WBEM_E_NOT_FOUND : S_OK;
+        }
+
+        HRESULT CallWmiMethod(const WmiMethodCall& call, int* outValue) noexcept override {
+            auto& session = WmiSession::Instance();
+            if (!call.paramName) {
+                return session.Execute(call.pathType, [&](IWbemServices* pServices, const std::wstring& instancePath) {
+                    HRESULT hr = E_FAIL;
+                    int result = CallWmiMethodNoParams(pServices, instancePath, call.methodName, &hr);
+                    if (SUCCEEDED(hr) && outValue) {
+                        *outValue = result;
+                    }
+                    return hr;
+                });
+            }
+            const wchar_t* className = (call.source == WmiInParamsSource::MethodDefinition)
+                ? L"LENOVO_GAMEZONE_DATA"
+                : L"__PARAMETERS";
+            return session.CallPreparedMethod(
+                call.source,
+                className,
+                call.methodName,
+                call.paramName,
+                call.paramValue,
+                call.pathType,
+                outValue,
+                call.resultPropertyName
+            );
+        }
+
+        HRESULT CallWmiMethodsAsync(std::span<WmiAsyncCall> calls, WmiPathType pathType) noexcept override {
+            return WmiSession::Instance().CallMethodsNoParamsAsync(calls, pathType);
+        }
+
+        HRESULT SubscribeEventQuery(
+            const wchar_t* query,
+            const wchar_t* propertyName,
+            std::shared_ptr<WmiEventSink> sink,
+            std::unique_ptr<WmiEventSubscription>& outSubscription
+        ) noexcept override {
+            if (!sink || !propertyName) {
+                return E_POINTER;
+            }
+            try {
+                auto subscription = std::make_unique<WmiQuerySubscription>(std::move(sink), propertyName);
+                HRESULT hr = subscription->Start(query);
+                if (SUCCEEDED(hr)) {
+                    outSubscription = std::move(subscription);
+                }
+                return hr;
+            } catch (...) {
+                return E_OUTOFMEMORY;
+            }
+        }
+
+        std::string MachineIdentity() noexcept override {
+            constexpr const wchar_t* BiosKey = L"HARDWARE\\DESCRIPTION\\System\\BIOS";
+            std::wstring manufacturer = registryString(BiosKey, L"SystemManufacturer");
+            std::wstring product = registryString(BiosKey, L"SystemProductName");
+            std::wstring family = registryString(BiosKey, L"SystemVersion");
+            std::wstring bios = registryString(BiosKey, L"BIOSVersion");
+            if (product.empty() || bios.empty()) {
+                return {};
+            }
+            std::wstring identity = manufacturer + L" " + product + L" " + family + L"; BIOS " + bios +
+                                    L"; EnergyDrv " + energyDriverVersion();
+            int size = WideCharToMultiByte(CP_UTF8, 0, identity.c_str(), static_cast<int>(identity.size()), nullptr, 0, nullptr, nullptr);
+            std::string utf8(size > 0 ? size : 0, '\0');
+            if (size > 0) {
+                WideCharToMultiByte(CP_UTF8, 0, identity.c_str(), static_cast<int>(identity.size()), utf8.data(), size, nullptr, nullptr);
+            }
+            return utf8;
+        }
+
+    private:
+        static std::wstring registryString(const wchar_t* key, const wchar_t* value) noexcept {
+            wchar_t buffer[512];
+            DWORD size = sizeof(buffer);
+            if (RegGetValueW(HKEY_LOCAL_MACHINE, key, value, RRF_RT_REG_SZ, nullptr, buffer, &size) != ERROR_SUCCESS) {
+                return {};
+            }
+            return buffer;
+        }
+
+        // File version of the driver image named by the EnergyDrv service, or
+        // "none" when the driver is not installed.
+        static std::wstring energyDriverVersion() noexcept {
+            std::wstring image = registryString(L"SYSTEM\\CurrentControlSet\\Services\\EnergyDrv", L"ImagePath");
+            if (image.empty()) {
+                return L"none";
+            }
+            wchar_t windowsDir[MAX_PATH] = {};
+            GetWindowsDirectoryW(windowsDir, MAX_PATH);
+            if (image.starts_with(L"\\??\\")) {
+                image.erase(0, 4);
+            } else if (image.starts_with(L"\\SystemRoot\\")) {
+                image = windowsDir + image.substr(11);
+            } else if (image.find(L':') == std::wstring::npos) {
+                image = std::wstring(windowsDir) + L"\\" + image;
+            }
+            DWORD size = GetFileVersionInfoSizeW(image.c_str(), nullptr);
+            std::vector<uint8_t> info(size);
+            VS_FIXEDFILEINFO* fixed = nullptr;
+            UINT fixedSize = 0;
+            if (size == 0 || !GetFileVersionInfoW(image.c_str(), 0, size, info.data()) ||
+                !VerQueryValueW(info.data(), L"\\", reinterpret_cast<void**>(&fixed), &fixedSize) || !fixed) {
+                return L"unknown";
+            }
+            return std::to_wstring(HIWORD(fixed->dwFileVersionMS)) + L"." + std::to_wstring(LOWORD(fixed->dwFileVersionMS)) + L"." +
+                   std::to_wstring(HIWORD(fixed->dwFileVersionLS)) + L"." + std::to_wstring(LOWORD(fixed->dwFileVersionLS));
+        }
+
+        static constexpr ULONG_PTR ShutdownKey = ~ULONG_PTR{0};
+
+        struct BatchState;
+
+        // The OVERLAPPED base and the two buffers are what the driver and the
+        // completion packet refer to.
+        struct PendingIoctl : OVERLAPPED {
+            // Holds the batch alive until the completion thread is done with this
+            // OVERLAPPED; the completion thread drops it.
+            std::shared_ptr<BatchState> keepAlive;
+            std::vector<uint8_t> input;
+            std::vector<uint8_t> output;
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point deadline;
+            bool inFlight = false;
+            bool completed = false;
+            DWORD bytes = 0;
+            DWORD error = ERROR_SUCCESS;
+        };
+
+        struct BatchState {
+            std::mutex mutex;
+            std::condition_variable completed;
+            std::unique_ptr<PendingIoctl[]> slots;
+        };
+
+        bool runBatch(DeviceKind device, const DeviceHandle* handle, std::span<IoctlRequest> requests, IoctlOrder order) noexcept {
+            for (auto& request : requests) {
+                request.bytesReturned = 0;
+                request.error = ERROR_CANCELLED;
+                request.latency = {};
+            }
+
+            if (!handle) {
+                for (auto& request : requests) {
+                    request.error = ERROR_INVALID_HANDLE;
+                }
+                return false;
+            }
+            HANDLE hDevice = handle->Get();
+            if (!associate(device, *handle)) {
+                DWORD error = GetLastError();
+                for (auto& request : requests) {
+                    request.error = error;
+                }
+                return false;
+            }
+
+            std::shared_ptr<BatchState> batch;
+            try {
+                batch = std::make_shared<BatchState>();
+                batch->slots = std::make_unique<PendingIoctl[]>(requests.size());
+            } catch (...) {
+                return false;
+            }
+
+            // Held while issuing so the completion thread cannot report a slot before
+            // it is marked in flight; released while waiting.
+            std::unique_lock lock(batch->mutex);
+            size_t outstanding = 0;
+            size_t next = 0;
+            bool allSucceeded = true;
+
+            auto elapsedSince = [](std::chrono::steady_clock::time_point start) {
+                return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            };
+
+            auto issue = [&](size_t index) {
+                auto& request = requests[index];
+                auto& slot = batch->slots[index];
+                static_cast<OVERLAPPED&>(slot) = {};
+                slot.start = std::chrono::steady_clock::now();
+                try {
+                    auto input = static_cast<const uint8_t*>(request.input);
+                    slot.input.assign(input, input + (input ? request.inputSize : 0));
+                    slot.output.assign(request.output ? request.outputSize : 0, 0);
+                } catch (...) {
+                    request.error = ERROR_NOT_ENOUGH_MEMORY;
+                    allSucceeded = false;
+                    return;
+                }
+                slot.keepAlive = batch;
+                slot.inFlight = true;
+                slot.deadline = (request.timeoutMs == INFINITE)
+                    ? std::chrono::steady_clock::time_point::max()
+                    : slot.start + std::chrono::milliseconds(request.timeoutMs);
+                BOOL success = DeviceIoControl(
+                    hDevice,
+                    request.ioctlCode,
+                    slot.input.empty() ? nullptr : slot.input.data(),
+                    static_cast<DWORD>(slot.input.size()),
+                    slot.output.empty() ? nullptr : slot.output.data(),
+                    static_cast<DWORD>(slot.output.size()),
+                    nullptr,
+                    &slot
+                );
+                // Synchronous success still queues a completion packet.
+                if (success || GetLastError() == ERROR_IO_PENDING) {
+                    ++outstanding;
+                    return;
+                }
+                request.error = GetLastError();
+                request.latency = elapsedSince(slot.start);
+                slot.inFlight = false;
+                slot.keepAlive.reset();
+                allSucceeded = false;
+            };
+
+            auto issueNext = [&] {
+                if (order == IoctlOrder::Concurrent) {
+                    for (; next < requests.size(); ++next) {
+                        issue(next);
+                    }
+                } else {
+                    while (next < requests.size() && outstanding == 0 && allSucceeded) {
+                        issue(next++);
+                    }
+                }
+            };
+
+            issueNext();
+            while (outstanding > 0) {
+                auto now = std::chrono::steady_clock::now();
+                auto wakeAt = std::chrono::steady_clock::time_point::max();
+                for (size_t i = 0; i < requests.size(); ++i) {
+                    auto& request = requests[i];
+                    auto& slot = batch->slots[i];
+                    if (!slot.inFlight) {
+                        continue;
+                    }
+                    if (slot.completed) {
+                        slot.inFlight = false;
+                        --outstanding;
+                        request.bytesReturned = std::min<DWORD>(slot.bytes, static_cast<DWORD>(slot.output.size()));
+                        std::copy_n(slot.output.data(), request.bytesReturned, static_cast<uint8_t*>(request.output));
+                        request.latency = elapsedSince(slot.start);
+                        request.error = slot.error;
+                        if (slot.error != ERROR_SUCCESS) {
+                            allSucceeded = false;
+                        }
+                        continue;
+                    }
+                    if (slot.deadline <= now) {
+                        // The packet may never come if the driver ignores the cancel;
+                        // the completion thread frees the batch if it does.
+                        CancelIoEx(hDevice, &slot);
+                        slot.inFlight = false;
+                        --outstanding;
+                        request.error = ERROR_TIMEOUT;
+                        request.latency = elapsedSince(slot.start);
+                        allSucceeded = false;
+                        continue;
+                    }
+                    wakeAt = std::min(wakeAt, slot.deadline);
+                }
+
+                if (order == IoctlOrder::Sequential && outstanding == 0) {
+                    issueNext();
+                    continue;
+                }
+                if (outstanding > 0 && wakeAt == std::chrono::steady_clock::time_point::max()) {
+                    batch->completed.wait(lock);
+                } else if (outstanding > 0) {
+                    batch->completed.wait_until(lock, wakeAt);
+                }
+            }
+            return allSucceeded;
+        }
+
+        void completionLoop() noexcept {
+            while (true) {
+                DWORD bytes = 0;
+                ULONG_PTR key = 0;
+                LPOVERLAPPED pOverlapped = nullptr;
+                BOOL success = GetQueuedCompletionStatus(m_port, &bytes, &key, &pOverlapped, INFINITE);
+                if (!pOverlapped) {
+                    if (!success || key == ShutdownKey) {
+                        return;
+                    }
+                    continue;
+                }
+
+                auto* slot = static_cast<PendingIoctl*>(pOverlapped);
+                DWORD error = success ? ERROR_SUCCESS : GetLastError();
+                // Released after the batch lock, so the last reference never destroys a held mutex.
+                auto batch = std::move(slot->keepAlive);
+                {
+                    std::lock_guard lock(batch->mutex);
+                    slot->completed = true;
+                    slot->bytes = bytes;
+                    slot->error = error;
+                }
+                batch->completed.notify_all();
+            }
+        }
+
+        // Each handle generation has to be bound to the port once.
+        bool associate(DeviceKind device, const DeviceHandle& handle) noexcept {
+            std::lock_guard lock(m_mutex);
+            if (m_shutDown) {
+                SetLastError(ERROR_SHUTDOWN_IN_PROGRESS);
+                return false;
+            }
+            uint64_t& associated = m_associatedGeneration[static_cast<size_t>(device)];
+            if (associated == handle.GetGeneration()) {
+                return true;
+            }
+            HANDLE port = CreateIoCompletionPort(handle.Get(), m_port, static_cast<ULONG_PTR>(device), 0);
+            if (!port) {
+                return false;
+            }
+            m_port = port;
+            associated = handle.GetGeneration();
+            if (!m_completionThread.joinable()) {
+                try {
+                    m_completionThread = std::thread([this] { completionLoop(); });
+                } catch (...) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::mutex m_mutex;
+        HANDLE m_port = nullptr;
+        uint64_t m_associatedGeneration[2] = {};
+        std::thread m_completionThread;
+        bool m_shutDown = false;
+    };
+#else
+    // Stands in for the Windows backend where there is none: no device can be
+    // opened and every call fails.
+    class UnavailableDeviceTransport final : public IDeviceTransport {
+    public:
+        bool IsAvailable(DeviceKind) noexcept override {
+            return false;
+        }
+
+        bool IoControlBatch(DeviceKind, std::span<IoctlRequest> requests, IoctlOrder) noexcept override {
+            for (auto& request : requests) {
+                request.bytesReturned = 0;
+                request.error = ERROR_NOT_SUPPORTED;
+                request.latency = {};
+            }
+            return requests.empty();
+        }
+
+        bool QueryPowerStatus(SYSTEM_POWER_STATUS&) noexcept override {
+            return false;
+        }
+
+        HRESULT ConnectWmi(WmiPathType) noexcept override {
+            return WBEM_E_NOT_FOUND;
+        }
+
+        HRESULT CallWmiMethod(const WmiMethodCall&, int*) noexcept override {
+            return WBEM_E_NOT_FOUND;
+        }
+
+        HRESULT CallWmiMethodsAsync(std::span<WmiAsyncCall> calls, WmiPathType) noexcept override {
+            for (auto& call : calls) {
+                call.result = -1;
+                call.hr = WBEM_E_NOT_FOUND;
+            }
+            return WBEM_E_NOT_FOUND;
+        }
+
+        HRESULT SubscribeEventQuery(
+            const wchar_t*,
+            const wchar_t*,
+            std::shared_ptr<WmiEventSink>,
+            std::unique_ptr<WmiEventSubscription>&
+        ) noexcept override {
+            return WBEM_E_NOT_FOUND;
+        }
+
+        std::string MachineIdentity() noexcept override {
+            return {};
+        }
+    };
+#endif
+
+    namespace {
+        inline std::unique_ptr<IDeviceTransport>& TransportOverride() noexcept {
+            static std::unique_ptr<IDeviceTransport> transport;
+            return transport;
+        }
+
+        inline IoctlObserver& IoctlObserverSlot() noexcept {
+            static IoctlObserver observer;
+            return observer;
+        }
+
+        inline std::atomic<uint64_t>& IoctlCounter(DeviceKind device) noexcept {
+            static std::atomic<uint64_t> counters[2];
+            return counters[static_cast<size_t>(device)];
+        }
+    }
+
+    inline IDeviceTransport& GetDeviceTransport() noexcept {
+        if (auto& transport = TransportOverride()) {
+            return *transport;
+        }
+#ifdef _WIN32
+        static WindowsDeviceTransport windowsTransport;
+        return windowsTransport;
+#else
+        static UnavailableDeviceTransport unavailableTransport;
+        return unavailableTransport;
+#endif
+    }
+
+    // Call before the first device access; the transport is not swapped under running calls.
+    inline void SetDeviceTransport(std::unique_ptr<IDeviceTransport> transport) noexcept {
+        TransportOverride() = std::move(transport);
+    }
+
+    inline void SetIoctlObserver(IoctlObserver observer) noexcept {
+        IoctlObserverSlot() = std::move(observer);
+    }
+
+    inline IoctlCounters GetIoctlCounters() noexcept {
+        return {
+            IoctlCounter(DeviceKind::EnergyDriver).load(std::memory_order_relaxed),
+            IoctlCounter(DeviceKind::Battery).load(std::memory_order_relaxed)
+        };
+    }
+
+    inline bool TransportIoControlBatch(
+        DeviceKind device,
+        std::span<IoctlRequest> requests,
+        IoctlOrder order
+    ) noexcept {
+        IoctlCounter(device).fetch_add(requests.size(), std::memory_order_relaxed);
+        bool success = GetDeviceTransport().IoControlBatch(device, requests, order);
+        if (auto& observer = IoctlObserverSlot()) {
+            for (const auto& request : requests) {
+                observer(device, request);
+            }
+        }
+        return success;
+    }
+
+    inline bool TransportIoControl(
+        DeviceKind device,
+        DWORD ioctlCode,
+        const void* input,
+        DWORD inputSize,
+        void* output,
+        DWORD outputSize,
+        DWORD* bytesReturned
+    ) noexcept {
+        IoctlRequest request{ioctlCode, input, inputSize, output, outputSize};
+        bool success = TransportIoControlBatch(device, {&request, 1}, IoctlOrder::Sequential);
+        if (bytesReturned) {
+            *bytesReturned = request.bytesReturned;
+        }
+        if (!success) {
+            SetLastError(request.error);
+        }
+        return success;
+    }
+}
+
+// Periodic scheduler
+namespace LLTCCommonUtils {
+    // Ticks at start + k * period on the steady clock, so the phase never drifts no
+    // matter how long each tick's work takes. Waits use a high-resolution waitable
+    // timer on Windows and an absolute CLOCK_MONOTONIC timerfd (or clock_nanosleep
+    // without a stop event) on Linux, so they are not rounded to milliseconds. Ticks that are already over when the previous one
+    // finishes are skipped and counted as missed instead of being run back to back.
+    class PeriodicScheduler {
+    public:
+        explicit PeriodicScheduler(std::chrono::microseconds period) noexcept
+            : m_period(std::max(period, std::chrono::microseconds(1000))),
+              m_deadline(std::chrono::steady_clock::now()) {
+#ifdef _WIN32
+            m_timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+            if (!m_timer) {
+                m_timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+            }
+#else
+            m_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+#endif
+        }
+        ~PeriodicScheduler() {
+#ifdef _WIN32
+            if (m_timer) {
+                CloseHandle(m_timer);
+            }
+#else
+            if (m_timer >= 0) {
+                close(m_timer);
+            }
+#endif
+        }
+        PeriodicScheduler(const PeriodicScheduler&) = delete;
+        PeriodicScheduler& operator=(const PeriodicScheduler&) = delete;
+
+        // Blocks until the next deadline. Returns false if stopEvent was signalled first.
+        bool WaitNext(const LLTCPlatform::Event* stopEvent = nullptr) noexcept {
+            auto next = m_deadline + m_period;
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next + m_period) {
+                auto skipped = (now - next) / m_period;
+                next += skipped * m_period;
+                m_stats.missed += static_cast<uint64_t>(skipped);
+            }
+            m_deadline = next;
+
+            if (!waitUntil(next, stopEvent)) {
+                return false;
+            }
+
+            auto jitter = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - next);
+            if (m_stats.ticks == 0) {
+                m_stats.minJitter = m_stats.maxJitter = jitter;
+            } else {
+                m_stats.minJitter = std::min(m_stats.minJitter, jitter);
+                m_stats.maxJitter = std::max(m_stats.maxJitter, jitter);
+            }
+            ++m_stats.ticks;
+            m_stats.totalJitter += jitter;
+            return true;
+        }
+
+        // Deadline of the tick WaitNext last returned for.
+        std::chrono::steady_clock::time_point GetDeadline() const noexcept { return m_deadline; }
+        std::chrono::microseconds GetPeriod() const noexcept { return m_period; }
+        const SchedulerStats& GetStats() const noexcept { return m_stats; }
+
+    private:
+        bool waitUntil(std::chrono::steady_clock::time_point deadline, const LLTCPlatform::Event* stopEvent) noexcept {
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if (remaining <= std::chrono::steady_clock::duration::zero()) {
+                return !stopEvent || !stopEvent->IsSet();
+            }
+
+#ifdef _WIN32
+            if (m_timer) {
+                // Negative due time: relative, in 100 ns units.
+                LARGE_INTEGER dueTime;
+                dueTime.QuadPart = -std::max<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count() / 100, 1);
+                if (SetWaitableTimer(m_timer, &dueTime, 0, nullptr, nullptr, FALSE)) {
+                    HANDLE handles[2] = {m_timer, stopEvent ? stopEvent->Native() : nullptr};
+                    DWORD result = WaitForMultipleObjects(stopEvent ? 2 : 1, handles, FALSE, INFINITE);
+                    return result == WAIT_OBJECT_0;
+                }
+            }
+#else
+            // steady_clock is CLOCK_MONOTONIC, so the deadline is already an absolute time on it.
+            auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch());
+            timespec due = {
+                static_cast<time_t>(sinceEpoch.count() / 1000000000),
+                static_cast<long>(sinceEpoch.count() % 1000000000)
+            };
+            if (!stopEvent) {
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr) == EINTR) {}
+                return true;
+            }
+            itimerspec spec = {{0, 0}, due};
+            if (m_timer >= 0 && timerfd_settime(m_timer, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+                pollfd entries[2] = {{m_timer, POLLIN, 0}, {stopEvent->Native(), POLLIN, 0}};
+                if (LLTCPlatform::PollFor(entries, 2, INFINITE) > 0 && (entries[0].revents & POLLIN)) {
+                    uint64_t expirations = 0;
+                    ssize_t bytesRead = read(m_timer, &expirations, sizeof(expirations));
+                    (void)bytesRead;
+                    return true;
+                }
+                return false;
+            }
+#endif
+
+            DWORD waitMs = static_cast<DWORD>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+            if (stopEvent) {
+                return !stopEvent->Wait(waitMs);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+            return true;
+        }
+
+        std::chrono::microseconds m_period;
+        std::chrono::steady_clock::time_point m_deadline;
+#ifdef _WIN32
+        HANDLE m_timer = nullptr;
+#else
+        int m_timer = -1;
+#endif
+        SchedulerStats m_stats;
+    };
+}
+
+// Streaming statistics
+namespace LLTCCommonUtils {
+    // Mean/variance (Welford), min/max and an exponentially weighted mean over a
+    // stream of samples, in constant memory and constant time per sample.
+    class StreamingStats {
+    public:
+        explicit StreamingStats(double ewmaAlpha = 0.1) noexcept : m_alpha(ewmaAlpha) {}
+
+        void Add(double value) noexcept {
+            ++m_count;
+            double delta = value - m_mean;
+            m_mean += delta / static_cast<double>(m_count);
+            m_m2 += delta * (value - m_mean);
+            if (m_count == 1) {
+                m_min = m_max = value;
+            } else {
+                m_min = std::min(m_min, value);
+                m_max = std::max(m_max, value);
+            }
+            m_ewma = m_hasEwma ? m_ewma + m_alpha * (value - m_ewma) : value;
+            m_hasEwma = true;
+        }
+
+        // Starts a new window; the EWMA carries over.
+        void Reset() noexcept {
+            m_count = 0;
+            m_mean = m_m2 = m_min = m_max = 0.0;
+        }
+
+        uint64_t Count() const noexcept { return m_count; }
+        double Mean() const noexcept { return m_mean; }
+        double Variance() const noexcept { return (m_count > 1) ? m_m2 / static_cast<double>(m_count - 1) : 0.0; }
+        double StdDev() const noexcept { return std::sqrt(Variance()); }
+        double Min() const noexcept { return m_min; }
+        double Max() const noexcept { return m_max; }
+        double Ewma() const noexcept { return m_ewma; }
+
+    private:
+        double m_alpha;
+        uint64_t m_count = 0;
+        double m_mean = 0.0;
+        double m_m2 = 0.0;
+        double m_min = 0.0;
+        double m_max = 0.0;
+        double m_ewma = 0.0;
+        bool m_hasEwma = false;
+    };
+}
+
+
+// Single-producer/single-consumer ring
+namespace LLTCCommonUtils {
+    enum class PopResult {
+        Item,
+        Timeout,
+        Closed      // closed and drained
+    };
+
+    // Bounded lock-free queue between exactly one producer thread and one consumer
+    // thread. Indices grow monotonically and are masked into the slot array; each
+    // side only writes its own index. An idle side sleeps instead of spinning (the
+    // consumer on a condition variable so it can time out, the producer in
+    // std::atomic::wait); the other side only pays for a notify when a waiter has
+    // announced itself.
+    template<typename T, size_t Capacity>
+    class SpscRing {
+        static_assert(std::has_single_bit(Capacity), "Capacity must be a power of two");
+
+    public:
+        // Producer: false if the ring is full.
+        bool TryPush(const T& item) noexcept {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) == Capacity) {
+                return false;
+            }
+            m_items[head & (Capacity - 1)] = item;
+            m_head.store(head + 1, std::memory_order_release);
+            m_signal.fetch_add(1);
+            if (m_consumerWaiting.load()) {
+                wakeConsumer();
+            }
+            return true;
+        }
+
+        // Producer: blocks while the ring is full (back-pressure).
+        void WaitForSpace() noexcept {
+            size_t tail = m_tail.load(std::memory_order_acquire);
+            while (m_head.load(std::memory_order_relaxed) - tail == Capacity) {
+                m_producerWaiting.store(true);
+                if (m_tail.load() == tail) {
+                    m_tail.wait(tail);
+                }
+                m_producerWaiting.store(false, std::memory_order_relaxed);
+                tail = m_tail.load(std::memory_order_acquire);
+            }
+        }
+
+        // Producer: no more items; wakes a waiting consumer.
+        void Close() noexcept {
+            m_closed.store(true, std::memory_order_release);
+            m_signal.fetch_add(1);
+            wakeConsumer();
+        }
+
+        // Consumer: false if the ring is empty.
+        bool TryPop(T& item) noexcept {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail == m_head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            item = m_items[tail & (Capacity - 1)];
+            m_tail.store(tail + 1);
+            if (m_producerWaiting.load()) {
+                m_tail.notify_one();
+            }
+            return true;
+        }
+
+        // Consumer: waits for an item; false once the ring is closed and drained.
+        bool Pop(T& item) noexcept {
+            return PopUntil(item, std::chrono::steady_clock::time_point::max()) == PopResult::Item;
+        }
+
+        // Consumer: waits for an item until `deadline` (time_point::max() waits forever).
+        PopResult PopUntil(T& item, std::chrono::steady_clock::time_point deadline) noexcept {
+            while (true) {
+                uint64_t seen = m_signal.load(std::memory_order_acquire);
+                if (TryPop(item)) {
+                    return PopResult::Item;
+                }
+                if (m_closed.load(std::memory_order_acquire)) {
+                    return TryPop(item) ? PopResult::Item : PopResult::Closed;
+                }
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    return PopResult::Timeout;
+                }
+                std::unique_lock lock(m_wakeMutex);
+                m_consumerWaiting.store(true);
+                auto signalled = [&] { return m_signal.load() != seen; };
+                if (deadline == std::chrono::steady_clock::time_point::max()) {
+                    m_consumerWake.wait(lock, signalled);
+                } else {
+                    m_consumerWake.wait_until(lock, deadline, signalled);
+                }
+                m_consumerWaiting.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        // Items currently queued; exact only from the producer or consumer thread.
+        size_t Size() const noexcept {
+            return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+        }
+
+        static constexpr size_t GetCapacity() noexcept { return Capacity; }
+
+    private:
+        // Taking the mutex orders the notify after a consumer that announced
+        // itself has started waiting, so the wake-up cannot fall in between.
+        void wakeConsumer() noexcept {
+            {
+                std::lock_guard lock(m_wakeMutex);
+            }
+            m_consumerWake.notify_one();
+        }
+
+        alignas(64) std::atomic<size_t> m_head{0};
+        alignas(64) std::atomic<size_t> m_tail{0};
+        alignas(64) std::atomic<uint64_t> m_signal{0};
+        std::atomic<bool> m_closed{false};
+        std::atomic<bool> m_consumerWaiting{false};
+        std::atomic<bool> m_producerWaiting{false};
+        std::mutex m_wakeMutex;
+        std::condition_variable m_consumerWake;
+        T m_items[Capacity];
+    };
 }
\ No newline at end of file
@@ -0,0 +1,821 @@
+#pragma once
+
+#include "LenovoBatteryControl.hpp"
+#include "LenovoOverdriveControl.hpp"
+#include "LenovoWhitekeyboardbacklightControl.hpp"
+#include "LenovoPowerModeControl.hpp"
+#include "LenovoHybridmodeControl.hpp"
+#include "LenovoAlwaysonusbControl.hpp"
+#include "StatusPage.hpp"
+#include "MetricsExporter.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Wire format of the `lltc serve` pipe (a Unix seqpacket socket on Linux): one fixed-size request message answered
+// by one fixed-size response message. Both ends are the same lltc.exe, so the
+// structs travel as they are; a layout change bumps ServiceProtocolVersion.
+constexpr uint32_t ServiceMagic = 0x43544C4C;   // "LLTC"
+constexpr uint8_t ServiceProtocolVersion = 1;
+constexpr uint8_t ServiceFlagCached = 0x01;     // answered from the server's cache
+
+enum class ServiceOp : uint8_t {
+    Ping,
+    Get,
+    Set
+};
+
+enum class ServiceProperty : uint8_t {
+    BatteryMode,
+    OverDrive,
+    KeyboardBacklight,
+    PowerMode,
+    GpuMode,
+    AlwaysOnUSB,
+    BatteryInformation,
+    Count
+};
+
+// The long property names of the command line.
+constexpr std::string_view to_string(ServiceProperty property) noexcept {
+    switch (property) {
+        case ServiceProperty::BatteryMode:        return "batterymode";
+        case ServiceProperty::OverDrive:          return "overdrive";
+        case ServiceProperty::KeyboardBacklight:  return "keyboardbacklight";
+        case ServiceProperty::PowerMode:          return "powermode";
+        case ServiceProperty::GpuMode:            return "gpumode";
+        case ServiceProperty::AlwaysOnUSB:        return "alwaysonusb";
+        case ServiceProperty::BatteryInformation: return "batteryinformation";
+        default:                                  return "unknown";
+    }
+}
+
+struct ServiceRequest {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t op;             // ServiceOp
+    uint8_t property;       // ServiceProperty
+    uint8_t reserved;
+    int32_t value;          // Set: the integer value of the property's enum
+    uint32_t tag;           // echoed in the response
+};
+
+struct ServiceResponse {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t status;         // ResultState
+    uint8_t property;
+    uint8_t flags;          // ServiceFlag*
+    int32_t value;
+    uint32_t tag;
+    uint32_t ageMs;         // age of a cached value
+    uint32_t serverUs;      // time spent in the server
+    BatteryInfoResult battery;  // BatteryInformation only
+};
+
+static_assert(sizeof(ServiceRequest) == 16);
+static_assert(std::is_trivially_copyable_v<ServiceRequest> && std::is_trivially_copyable_v<ServiceResponse>);
+
+// Declarations
+namespace LLTCService {
+#ifdef _WIN32
+    constexpr const wchar_t* DefaultPipeName = L"\\\\.\\pipe\\lltc";
+#else
+    constexpr const wchar_t* DefaultPipeName = L"/tmp/lltc.sock";
+#endif
+    constexpr std::chrono::milliseconds DefaultMaxAge{1000};
+    constexpr uint32_t DefaultInstances = 4;
+    // How often the server re-reads expired properties for the status page.
+    constexpr std::chrono::milliseconds StatusRefreshInterval{1000};
+    // LLTC_PIPE, or DefaultPipeName (on Linux $XDG_RUNTIME_DIR/lltc.sock first).
+    inline std::wstring PipeName();
+    class ServiceClient;
+    class ControlServer;
+}
+
+// Definitions
+namespace LLTCService {
+    inline std::wstring PipeName() {
+        const char* setting = std::getenv("LLTC_PIPE");
+        if (setting && *setting) {
+            return std::filesystem::path(setting).wstring();
+        }
+#ifndef _WIN32
+        if (const char* runtime = std::getenv("XDG_RUNTIME_DIR"); runtime && *runtime) {
+            return (std::filesystem::path(runtime) / "lltc.sock").wstring();
+        }
+#endif
+        return DefaultPipeName;
+    }
+
+#ifndef _WIN32
+    namespace {
+        inline bool SocketAddress(const std::wstring& name, sockaddr_un& address) noexcept {
+            std::string path;
+            try {
+                path = std::filesystem::path(name).string();
+            } catch (...) {
+                return false;
+            }
+            address = {};
+            address.sun_family = AF_UNIX;
+            if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+                return false;
+            }
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+            return true;
+        }
+    }
+#endif
+
+    // One connection to a running server. Each Call is a single TransactNamedPipe
+    // (write request, read response) on a message-mode pipe, or a send and a recv
+    // on the seqpacket socket. Any transport error closes the connection, so
+    // callers can fall back to the local controls.
+    class ServiceClient {
+    public:
+        ServiceClient() = default;
+        ServiceClient(const ServiceClient&) = delete;
+        ServiceClient& operator=(const ServiceClient&) = delete;
+        ~ServiceClient() { Close(); }
+
+        // False if no server is listening. A server with every instance busy
+        // is waited for up to busyTimeoutMs.
+        bool Connect(const std::wstring& pipeName, DWORD busyTimeoutMs = 50) noexcept {
+            Close();
+#ifdef _WIN32
+            for (int attempt = 0; attempt < 2; ++attempt) {
+                // Identification level only: a squatting pipe server cannot impersonate us.
+                m_pipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+                                     SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, nullptr);
+                if (m_pipe != INVALID_HANDLE_VALUE) {
+                    break;
+                }
+                if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(pipeName.c_str(), busyTimeoutMs)) {
+                    return false;
+                }
+            }
+            if (m_pipe == INVALID_HANDLE_VALUE) {
+                return false;
+            }
+            DWORD mode = PIPE_READMODE_MESSAGE;
+            if (!SetNamedPipeHandleState(m_pipe, &mode, nullptr, nullptr)) {
+                Close();
+                return false;
+            }
+            return true;
+#else
+            sockaddr_un address;
+            if (!SocketAddress(pipeName, address)) {
+                return false;
+            }
+            m_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+            if (m_socket < 0) {
+                return false;
+            }
+            // connect() blocks while the listen backlog is full; bound that wait.
+            timeval timeout = {static_cast<time_t>(busyTimeoutMs / 1000), static_cast<suseconds_t>((busyTimeoutMs % 1000) * 1000)};
+            setsockopt(m_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (connect(m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+                Close();
+                return false;
+            }
+            timeout = {};
+            setsockopt(m_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            return true;
+#endif
+        }
+
+        bool IsConnected() const noexcept {
+#ifdef _WIN32
+            return m_pipe != INVALID_HANDLE_VALUE;
+#else
+            return m_socket >= 0;
+#endif
+        }
+
+        void Close() noexcept {
+#ifdef _WIN32
+            if (m_pipe != INVALID_HANDLE_VALUE) {
+                CloseHandle(m_pipe);
+                m_pipe = INVALID_HANDLE_VALUE;
+            }
+#else
+            if (m_socket >= 0) {
+                close(m_socket);
+                m_socket = -1;
+            }
+#endif
+        }
+
+        // The server's response (whose status may still be a failure), or
+        // ResultState::Failed if the server could not be reached.
+        std::expected<ServiceResponse, ResultState> Call(ServiceOp op, ServiceProperty property, int32_t value = 0) noexcept {
+            if (!IsConnected()) {
+                return std::unexpected(ResultState::Failed);
+            }
+            ServiceRequest request = {ServiceMagic, ServiceProtocolVersion, static_cast<uint8_t>(op),
+                                      static_cast<uint8_t>(property), 0, value, ++m_tag};
+            ServiceResponse response;
+#ifdef _WIN32
+            DWORD read = 0;
+            bool transacted = TransactNamedPipe(m_pipe, &request, sizeof(request), &response, sizeof(response), &read, nullptr);
+#else
+            ssize_t read = -1;
+            bool transacted = send(m_socket, &request, sizeof(request), MSG_NOSIGNAL) == sizeof(request);
+            if (transacted) {
+                do {
+                    read = recv(m_socket, &response, sizeof(response), 0);
+                } while (read < 0 && errno == EINTR);
+            }
+#endif
+            if (!transacted || read != sizeof(response) || response.magic != ServiceMagic ||
+                response.version != ServiceProtocolVersion || response.tag != request.tag) {
+                Close();
+                return std::unexpected(ResultState::Failed);
+            }
+            return response;
+        }
+
+    private:
+#ifdef _WIN32
+        HANDLE m_pipe = INVALID_HANDLE_VALUE;
+#else
+        int m_socket = -1;
+#endif
+        uint32_t m_tag = 0;
+    };
+
+    // Keeps the devices, the WMI session, capability answers and the last value of
+    // every property warm for other lltc processes. Reads younger than maxAge are
+    // answered from memory; the power mode is kept current by a subscription when
+    // the GameZone event is available, and never expires then. A set goes to the
+    // device and refreshes the cached value.
+    //
+    // Every value the server learns is also published to the shared status page
+    // (see StatusPage.hpp), which the server keeps fresh by re-reading expired
+    // properties every StatusRefreshInterval even without clients.
+    //
+    // WriteMetrics renders the same values, the request counters and latency
+    // histograms for `lltc serve --metrics` (see MetricsExporter.hpp).
+    //
+    // Each pipe instance has its own thread and serves one client at a time;
+    // connections stay open until the client closes them. The pipe gets the
+    // default security descriptor (only the owner, administrators and SYSTEM may
+    // write to it) and rejects remote clients. On Linux the instances share one
+    // listening socket, created with mode 0600, and each accepts in turn.
+    class ControlServer {
+    public:
+        struct Options {
+            std::wstring pipeName = DefaultPipeName;
+            std::chrono::milliseconds maxAge = DefaultMaxAge;
+            uint32_t instances = DefaultInstances;
+        };
+
+        struct Statistics {
+            uint64_t requests;
+            uint64_t cacheHits;
+            uint64_t deviceReads;
+            uint64_t deviceWrites;
+            uint64_t failures;
+        };
+
+        explicit ControlServer(Options options) : m_options(std::move(options)) {}
+        ControlServer(const ControlServer&) = delete;
+        ControlServer& operator=(const ControlServer&) = delete;
+        ~ControlServer() {
+#ifdef _WIN32
+            if (m_firstInstance != INVALID_HANDLE_VALUE) {
+                CloseHandle(m_firstInstance);
+            }
+#else
+            if (m_listener >= 0) {
+                close(m_listener);
+                sockaddr_un address;
+                if (SocketAddress(m_options.pipeName, address)) {
+                    unlink(address.sun_path);
+                }
+            }
+#endif
+        }
+
+        // Claims the pipe name and primes the cache. Fails with ERROR_ACCESS_DENIED
+        // if another server already owns the name.
+        std::expected<void, DWORD> Start() noexcept {
+#ifdef _WIN32
+            m_firstInstance = createInstance(true);
+            if (m_firstInstance == INVALID_HANDLE_VALUE) {
+                return std::unexpected(GetLastError());
+            }
+#else
+            if (auto listening = listen(); !listening) {
+                return listening;
+            }
+#endif
+            // Optional: clients still work without it.
+            if (auto page = LLTCStatus::StatusPage::Create()) {
+                m_statusPage = std::move(*page);
+            }
+            LLTCCommonUtils::GetDeviceTransport().ConnectWmi(LLTCCommonUtils::WmiPathType::Full);
+            for (uint8_t i = 0; i < static_cast<uint8_t>(ServiceProperty::Count); ++i) {
+                Handle({ServiceMagic, ServiceProtocolVersion, static_cast<uint8_t>(ServiceOp::Get), i, 0, 0, 0});
+            }
+            auto subscription = LLTCPowerMode::Subscribe([this](PowerMode mode) {
+                publish(ServiceProperty::PowerMode, static_cast<int32_t>(mode));
+            });
+            if (subscription) {
+                m_powerModeEvents = subscription->IsEventDriven();
+                m_subscription = std::move(*subscription);
+            }
+            // Count client traffic only.
+            m_statistics.Reset();
+            m_requestLatency.Reset();
+            return {};
+        }
+
+        // Serves clients until stopEvent is signalled.
+        void Serve(const LLTCPlatform::Event& stopEvent) {
+            std::vector<std::thread> threads;
+            threads.reserve(m_options.instances);
+            for (uint32_t i = 0; i < m_options.instances; ++i) {
+#ifdef _WIN32
+                HANDLE pipe = (i == 0) ? std::exchange(m_firstInstance, INVALID_HANDLE_VALUE) : createInstance(false);
+                if (pipe == INVALID_HANDLE_VALUE) {
+                    break;
+                }
+                threads.emplace_back([this, pipe, &stopEvent] { serveInstance(pipe, stopEvent.Native()); });
+#else
+                threads.emplace_back([this, &stopEvent] { serveInstance(stopEvent); });
+#endif
+            }
+            while (!stopEvent.Wait(static_cast<DWORD>(StatusRefreshInterval.count()))) {
+                if (m_statusPage.IsOpen()) {
+                    for (uint8_t i = 0; i < static_cast<uint8_t>(ServiceProperty::Count); ++i) {
+                        ServiceResponse response = {};
+                        get(static_cast<ServiceProperty>(i), response);
+                    }
+                }
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+
+        ServiceResponse Handle(const ServiceRequest& request) noexcept {
+            auto start = std::chrono::steady_clock::now();
+            ServiceResponse response = {};
+            response.magic = ServiceMagic;
+            response.version = ServiceProtocolVersion;
+            response.property = request.property;
+            response.tag = request.tag;
+            response.status = static_cast<uint8_t>(ResultState::InvalidParameter);
+
+            bool valid = request.magic == ServiceMagic && request.version == ServiceProtocolVersion;
+            auto op = static_cast<ServiceOp>(request.op);
+            if (valid && op == ServiceOp::Ping) {
+                response.status = static_cast<uint8_t>(ResultState::Success);
+            } else if (valid && request.property < static_cast<uint8_t>(ServiceProperty::Count)) {
+                auto property = static_cast<ServiceProperty>(request.property);
+                if (op == ServiceOp::Get) {
+                    get(property, response);
+                } else if (op == ServiceOp::Set) {
+                    set(property, request.value, response);
+                }
+            }
+
+            m_statistics.requests.fetch_add(1, std::memory_order_relaxed);
+            if (response.status != static_cast<uint8_t>(ResultState::Success)) {
+                m_statistics.failures.fetch_add(1, std::memory_order_relaxed);
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            m_requestLatency.Record(elapsed);
+            response.serverUs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+            return response;
+        }
+
+        // Reads every property through the cache (refreshing expired ones, as the
+        // status page refresh does) and writes them with the server's counters and
+        // latency histograms. Properties that cannot be read are left out.
+        void WriteMetrics(LLTCMetrics::MetricsWriter& out) {
+            std::array<ServiceResponse, static_cast<size_t>(ServiceProperty::Count)> responses = {};
+            for (size_t i = 0; i < responses.size(); ++i) {
+                responses[i].status = static_cast<uint8_t>(ResultState::Failed);
+                get(static_cast<ServiceProperty>(i), responses[i]);
+            }
+            auto valid = [&](ServiceProperty property) -> const ServiceResponse* {
+                auto& response = responses[static_cast<size_t>(property)];
+                return response.status == static_cast<uint8_t>(ResultState::Success) ? &response : nullptr;
+            };
+
+            if (auto* response = valid(ServiceProperty::BatteryInformation)) {
+                const auto& battery = response->battery;
+                auto gauge = [&](std::string_view name, std::string_view help, double value) {
+                    out.Family(name, "gauge", help);
+                    out.Sample(name, "", value);
+                };
+                gauge("lltc_battery_percent", "Battery charge in percent.", battery.batteryLifePercent);
+                gauge("lltc_battery_rate_watts", "Charge (positive) or discharge (negative) rate.", battery.dischargeRate / 1000.0);
+                gauge("lltc_battery_capacity_wh", "Remaining capacity.", battery.currentCapacity / 1000.0);
+                gauge("lltc_battery_full_charge_capacity_wh", "Capacity when fully charged.", battery.fullChargedCapacity / 1000.0);
+                gauge("lltc_battery_design_capacity_wh", "Design capacity.", battery.designedCapacity / 1000.0);
+                gauge("lltc_battery_cycles", "Charge cycle count.", battery.cycleCount);
+                gauge("lltc_battery_ac_connected", "1 while the AC adapter is connected.", battery.isAcConnected ? 1 : 0);
+                if (battery.temperatureC >= 0) {
+                    gauge("lltc_battery_temperature_celsius", "Battery temperature.", battery.temperatureC);
+                }
+            }
+            // Enum-valued properties as state sets: one series per state, 1 for the current one.
+            auto states = [&]<typename E>(ServiceProperty property, std::string_view name, std::string_view help,
+                                          std::initializer_list<E> values) {
+                auto* response = valid(property);
+                if (!response) {
+                    return;
+                }
+                out.Family(name, "gauge", help);
+                for (E value : values) {
+                    out.Sample(name, std::format("state=\"{}\"", to_string(value)),
+                               static_cast<uint64_t>(response->value == static_cast<int32_t>(value)));
+                }
+            };
+            states(ServiceProperty::PowerMode, "lltc_power_mode", "Current power mode.",
+                   {PowerMode::Quiet, PowerMode::Balance, PowerMode::Performance, PowerMode::GodMode});
+            states(ServiceProperty::GpuMode, "lltc_gpu_mode", "Current GPU working mode.",
+                   {HybridModeState::On, HybridModeState::OnIGPUOnly, HybridModeState::OnAuto, HybridModeState::Off});
+            states(ServiceProperty::BatteryMode, "lltc_battery_mode", "Current battery charging mode.",
+                   {BatteryMode::Conservation, BatteryMode::Normal, BatteryMode::RapidCharge});
+            states(ServiceProperty::OverDrive, "lltc_overdrive", "Screen OverDrive.", {OverDriveState::Off, OverDriveState::On});
+            states(ServiceProperty::AlwaysOnUSB, "lltc_always_on_usb", "Always-on USB.",
+                   {AlwaysOnUSBState::Off, AlwaysOnUSBState::OnWhenSleeping, AlwaysOnUSBState::OnAlways});
+            states(ServiceProperty::KeyboardBacklight, "lltc_keyboard_backlight", "White keyboard backlight.",
+                   {WhiteKeyboardBacklightState::Off, WhiteKeyboardBacklightState::Low, WhiteKeyboardBacklightState::High});
+
+            auto stats = GetStatistics();
+            auto counter = [&](std::string_view name, std::string_view help, uint64_t value) {
+                out.Family(name, "counter", help);
+                out.Sample(name, "", value);
+            };
+            counter("lltc_server_requests_total", "Pipe requests answered.", stats.requests);
+            counter("lltc_server_cache_hits_total", "Reads answered from the cache.", stats.cacheHits);
+            counter("lltc_server_device_reads_total", "Reads that went to the device.", stats.deviceReads);
+            counter("lltc_server_device_writes_total", "Writes to the device.", stats.deviceWrites);
+            counter("lltc_server_failures_total", "Pipe requests that failed.", stats.failures);
+
+            out.Family("lltc_request_duration_seconds", "histogram", "Time to answer a pipe request, inside the server.");
+            out.Histogram("lltc_request_duration_seconds", "", m_requestLatency);
+            out.Family("lltc_device_call_duration_seconds", "histogram", "Time of driver and WMI calls, by property.");
+            for (size_t i = 0; i < responses.size(); ++i) {
+                auto name = to_string(static_cast<ServiceProperty>(i));
+                out.Histogram("lltc_device_call_duration_seconds", std::format("property=\"{}\",op=\"read\"", name), m_readLatency[i]);
+                if (m_writeLatency[i].Read().count > 0) {
+                    out.Histogram("lltc_device_call_duration_seconds", std::format("property=\"{}\",op=\"write\"", name), m_writeLatency[i]);
+                }
+            }
+        }
+
+        Statistics GetStatistics() const noexcept {
+            return {m_statistics.requests.load(), m_statistics.cacheHits.load(), m_statistics.deviceReads.load(),
+                    m_statistics.deviceWrites.load(), m_statistics.failures.load()};
+        }
+
+        bool IsPowerModeEventDriven() const noexcept { return m_powerModeEvents; }
+        bool IsPublishingStatus() const noexcept { return m_statusPage.IsOpen(); }
+
+    private:
+        struct Entry {
+            std::mutex mutex;
+            bool valid = false;
+            int32_t value = 0;
+            std::chrono::steady_clock::time_point time;
+
+            void Store(int32_t newValue, std::chrono::steady_clock::time_point at) noexcept {
+                valid = true;
+                value = newValue;
+                time = at;
+            }
+        };
+
+        struct Counters {
+            std::atomic<uint64_t> requests = 0;
+            std::atomic<uint64_t> cacheHits = 0;
+            std::atomic<uint64_t> deviceReads = 0;
+            std::atomic<uint64_t> deviceWrites = 0;
+            std::atomic<uint64_t> failures = 0;
+
+            void Reset() noexcept {
+                requests = cacheHits = deviceReads = deviceWrites = failures = 0;
+            }
+        };
+
+        template<typename T>
+        static std::expected<int32_t, ResultState> asValue(const std::expected<T, ResultState>& result) noexcept {
+            if (!result) {
+                return std::unexpected(result.error());
+            }
+            return static_cast<int32_t>(*result);
+        }
+
+#ifdef _WIN32
+        HANDLE createInstance(bool first) const noexcept {
+            return CreateNamedPipeW(m_options.pipeName.c_str(),
+                                    PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                                    PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                    PIPE_UNLIMITED_INSTANCES, sizeof(ServiceResponse), sizeof(ServiceRequest), 0, nullptr);
+        }
+
+        // Finishes an overlapped call, or cancels it once stopEvent is signalled.
+        static bool complete(HANDLE pipe, OVERLAPPED& overlapped, BOOL started, DWORD& bytes, HANDLE stopEvent) noexcept {
+            if (!started && GetLastError() != ERROR_IO_PENDING) {
+                return false;
+            }
+            HANDLE handles[2] = {overlapped.hEvent, stopEvent};
+            if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                CancelIoEx(pipe, &overlapped);
+                GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+                return false;
+            }
+            return GetOverlappedResult(pipe, &overlapped, &bytes, FALSE);
+        }
+
+        void serveInstance(HANDLE pipe, HANDLE stopEvent) noexcept {
+            HANDLE ioEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+            while (ioEvent && WaitForSingleObject(stopEvent, 0) != WAIT_OBJECT_0) {
+                OVERLAPPED overlapped = {};
+                overlapped.hEvent = ioEvent;
+                DWORD bytes = 0;
+                BOOL started = ConnectNamedPipe(pipe, &overlapped);
+                bool connected = (!started && GetLastError() == ERROR_PIPE_CONNECTED) ||
+                                 complete(pipe, overlapped, started, bytes, stopEvent);
+                if (connected) {
+                    serveClient(pipe, ioEvent, stopEvent);
+                }
+                DisconnectNamedPipe(pipe);
+            }
+            if (ioEvent) {
+                CloseHandle(ioEvent);
+            }
+            CloseHandle(pipe);
+        }
+
+        // Answers requests until the client disconnects, sends something that is
+        // not a request, or the server stops.
+        void serveClient(HANDLE pipe, HANDLE ioEvent, HANDLE stopEvent) noexcept {
+            while (true) {
+                ServiceRequest request;
+                OVERLAPPED overlapped = {};
+                overlapped.hEvent = ioEvent;
+                DWORD bytes = 0;
+                if (!complete(pipe, overlapped, ReadFile(pipe, &request, sizeof(request), nullptr, &overlapped), bytes, stopEvent) ||
+                    bytes != sizeof(request)) {
+                    return;
+                }
+                ServiceResponse response = Handle(request);
+                overlapped = {};
+                overlapped.hEvent = ioEvent;
+                if (!complete(pipe, overlapped, WriteFile(pipe, &response, sizeof(response), nullptr, &overlapped), bytes, stopEvent)) {
+                    return;
+                }
+            }
+        }
+#else
+        // Binds the socket. A leftover socket file nobody answers on is replaced;
+        // a live one means another server owns the name.
+        std::expected<void, DWORD> listen() noexcept {
+            sockaddr_un address;
+            if (!SocketAddress(m_options.pipeName, address)) {
+                return std::unexpected(static_cast<DWORD>(ENAMETOOLONG));
+            }
+            m_listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            if (m_listener < 0) {
+                return std::unexpected(static_cast<DWORD>(errno));
+            }
+            auto fail = [this](DWORD error) -> std::expected<void, DWORD> {
+                close(m_listener);
+                m_listener = -1;
+                return std::unexpected(error);
+            };
+            mode_t mask = umask(0077);
+            int bound = bind(m_listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+            if (bound != 0 && errno == EADDRINUSE) {
+                ServiceClient probe;
+                if (probe.Connect(m_options.pipeName)) {
+                    umask(mask);
+                    return fail(ERROR_ACCESS_DENIED);
+                }
+                unlink(address.sun_path);
+                bound = bind(m_listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+            }
+            int error = errno;
+            umask(mask);
+            if (bound != 0) {
+                return fail(static_cast<DWORD>(error));
+            }
+            if (::listen(m_listener, static_cast<int>(m_options.instances)) != 0) {
+                error = errno;
+                unlink(address.sun_path);
+                return fail(static_cast<DWORD>(error));
+            }
+            return {};
+        }
+
+        void serveInstance(const LLTCPlatform::Event& stopEvent) noexcept {
+            while (!stopEvent.IsSet()) {
+                pollfd entries[2] = {{m_listener, POLLIN, 0}, {stopEvent.Native(), POLLIN, 0}};
+                if (poll(entries, 2, -1) < 0 && errno != EINTR) {
+                    return;
+                }
+                // Another instance may have taken the connection first.
+                int client = accept4(m_listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client >= 0) {
+                    serveClient(client, stopEvent);
+                    close(client);
+                }
+            }
+        }
+
+        // Answers requests until the client disconnects, sends something that is
+        // not a request, or the server stops.
+        void serveClient(int client, const LLTCPlatform::Event& stopEvent) noexcept {
+            while (true) {
+                pollfd entries[2] = {{client, POLLIN, 0}, {stopEvent.Native(), POLLIN, 0}};
+                if (poll(entries, 2, -1) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return;
+                }
+                if (entries[1].revents) {
+                    return;
+                }
+                ServiceRequest request;
+                ssize_t bytes = recv(client, &request, sizeof(request), 0);
+                if (bytes != sizeof(request)) {
+                    return;
+                }
+                ServiceResponse response = Handle(request);
+                if (send(client, &response, sizeof(response), MSG_NOSIGNAL) != sizeof(response)) {
+                    return;
+                }
+            }
+        }
+#endif
+
+        void get(ServiceProperty property, ServiceResponse& response) noexcept {
+            auto& entry = m_entries[static_cast<size_t>(property)];
+            // Held across the device call, so concurrent misses make one call.
+            std::lock_guard lock(entry.mutex);
+            auto now = std::chrono::steady_clock::now();
+            bool live = property == ServiceProperty::PowerMode && m_powerModeEvents;
+            if (entry.valid && (live || now - entry.time <= m_options.maxAge)) {
+                m_statistics.cacheHits.fetch_add(1, std::memory_order_relaxed);
+                response.status = static_cast<uint8_t>(ResultState::Success);
+                response.flags = ServiceFlagCached;
+                response.value = entry.value;
+                response.ageMs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.time).count());
+                if (property == ServiceProperty::BatteryInformation) {
+                    response.battery = m_battery;
+                }
+                return;
+            }
+
+            m_statistics.deviceReads.fetch_add(1, std::memory_order_relaxed);
+            auto value = readDevice(property);
+            m_readLatency[static_cast<size_t>(property)].Record(std::chrono::steady_clock::now() - now);
+            if (!value) {
+                response.status = static_cast<uint8_t>(value.error());
+                return;
+            }
+            entry.Store(*value, now);
+            publishStatus(property, *value);
+            response.status = static_cast<uint8_t>(ResultState::Success);
+            response.value = *value;
+            if (property == ServiceProperty::BatteryInformation) {
+                response.battery = m_battery;
+            }
+        }
+
+        void set(ServiceProperty property, int32_t value, ServiceResponse& response) noexcept {
+            auto& entry = m_entries[static_cast<size_t>(property)];
+            std::lock_guard lock(entry.mutex);
+            m_statistics.deviceWrites.fetch_add(1, std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            auto result = writeDevice(property, value);
+            m_writeLatency[static_cast<size_t>(property)].Record(std::chrono::steady_clock::now() - start);
+            if (!result) {
+                entry.valid = false;
+                response.status = static_cast<uint8_t>(result.error());
+                return;
+            }
+            entry.Store(*result, std::chrono::steady_clock::now());
+            publishStatus(property, *result);
+            response.status = static_cast<uint8_t>(ResultState::Success);
+            response.value = *result;
+        }
+
+        void publish(ServiceProperty property, int32_t value) noexcept {
+            auto& entry = m_entries[static_cast<size_t>(property)];
+            std::lock_guard lock(entry.mutex);
+            entry.Store(value, std::chrono::steady_clock::now());
+            publishStatus(property, value);
+        }
+
+        // Called with the property's entry locked.
+        void publishStatus(ServiceProperty property, int32_t value) noexcept {
+            if (!m_statusPage.IsOpen()) {
+                return;
+            }
+            switch (property) {
+                case ServiceProperty::BatteryInformation: m_statusPage.PublishBattery(m_battery); break;
+                case ServiceProperty::BatteryMode:        m_statusPage.Publish(StatusField::BatteryMode, value); break;
+                case ServiceProperty::OverDrive:          m_statusPage.Publish(StatusField::OverDrive, value); break;
+                case ServiceProperty::KeyboardBacklight:  m_statusPage.Publish(StatusField::KeyboardBacklight, value); break;
+                case ServiceProperty::PowerMode:          m_statusPage.Publish(StatusField::PowerMode, value); break;
+                case ServiceProperty::GpuMode:            m_statusPage.Publish(StatusField::GpuMode, value); break;
+                case ServiceProperty::AlwaysOnUSB:        m_statusPage.Publish(StatusField::AlwaysOnUSB, value); break;
+                default:                                  break;
+            }
+        }
+
+        // Called with the property's entry locked.
+        std::expected<int32_t, ResultState> readDevice(ServiceProperty property) noexcept {
+            switch (property) {
+                case ServiceProperty::BatteryMode:       return asValue(LLTCBatteryControl::GetBatteryMode());
+                case ServiceProperty::OverDrive:         return asValue(LLTCOverDrive::GetState());
+                case ServiceProperty::KeyboardBacklight: return asValue(LLTCWhiteKeyboardBacklight::GetState());
+                case ServiceProperty::PowerMode:         return asValue(LLTCPowerMode::GetState());
+                case ServiceProperty::AlwaysOnUSB:       return asValue(LLTCAlwaysOnUSB::GetState());
+                case ServiceProperty::GpuMode: {
+                    if (!m_hybridMode) {
+                        m_hybridMode = std::make_unique<HybridModeController>();
+                    }
+                    HybridModeState mode;
+                    if (m_hybridMode->GetHybridModeSync(mode) != OperationResult::Success) {
+                        return std::unexpected(ResultState::Failed);
+                    }
+                    return static_cast<int32_t>(mode);
+                }
+                case ServiceProperty::BatteryInformation: {
+                    auto info = LLTCBatteryControl::GetBatteryInformation();
+                    if (!info) {
+                        return std::unexpected(info.error());
+                    }
+                    m_battery = *info;
+                    return info->batteryLifePercent;
+                }
+                default:
+                    return std::unexpected(ResultState::InvalidParameter);
+            }
+        }
+
+        // Returns the value to cache: the enum's own value, which for BatteryMode
+        // differs from the 1-based value on the wire. Switching the GPU mode stays
+        // in the client, which owns the restart prompt.
+        std::expected<int32_t, ResultState> writeDevice(ServiceProperty property, int32_t value) noexcept {
+            auto apply = [](auto state, auto&& setter) -> std::expected<int32_t, ResultState> {
+                if (!state) {
+                    return std::unexpected(state.error());
+                }
+                if (auto result = setter(*state); !result) {
+                    return std::unexpected(result.error());
+                }
+                return static_cast<int32_t>(*state);
+            };
+            switch (property) {
+                case ServiceProperty::BatteryMode:
+                    return apply(intToBatteryMode(value), LLTCBatteryControl::SetBatteryMode);
+                case ServiceProperty::OverDrive:
+                    return apply(intToOverDriveState(value), [](OverDriveState state) { return LLTCOverDrive::SetState(state); });
+                case ServiceProperty::KeyboardBacklight:
+                    return apply(intToWhiteKeyboardBacklightState(value), LLTCWhiteKeyboardBacklight::SetState);
+                case ServiceProperty::PowerMode:
+                    return apply(intToPowerMode(value), LLTCPowerMode::SetState);
+                case ServiceProperty::AlwaysOnUSB:
+                    return apply(intToAlwaysOnUSBState(value), LLTCAlwaysOnUSB::SetState);
+                default:
+                    return std::unexpected(ResultState::NotSupported);
+            }
+        }
+
+        Options m_options;
+#ifdef _WIN32
+        HANDLE m_firstInstance = INVALID_HANDLE_VALUE;
+#else
+        int m_listener = -1;
+#endif
+        std::array<Entry, static_cast<size_t>(ServiceProperty::Count)> m_entries;
+        BatteryInfoResult m_battery = {};   // guarded by the BatteryInformation entry
+        std::unique_ptr<HybridModeController> m_hybridMode;   // guarded by the GpuMode entry
+        Counters m_statistics;
+        LLTCMetrics::LatencyHistogram m_requestLatency;
+        std::array<LLTCMetrics::LatencyHistogram, static_cast<size_t>(ServiceProperty::Count)> m_readLatency;
+        std::array<LLTCMetrics::LatencyHistogram, static_cast<size_t>(ServiceProperty::Count)> m_writeLatency;
+        LLTCStatus::StatusPage m_statusPage;
+        bool m_powerModeEvents = false;
+        // Last member: the callback writes to the entries and the status page above.
+        LLTCPowerMode::Subscription m_subscription;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "TelemetryLog.hpp"
+#include <chrono>
+
+// Energy drawn from the battery under one power mode / GPU mode pair.
+struct EnergyBucket {
+    double wattHours = 0;
+    double seconds = 0;
+    uint64_t intervals = 0;
+};
+
+// Declarations
+namespace LLTCTelemetry {
+    constexpr std::chrono::seconds DefaultMaxSampleGap{60};
+    class EnergyAccountant;
+}
+
+// Definitions
+namespace LLTCTelemetry {
+    // Integrates discharge power over time with the trapezoidal rule, one interval
+    // per pair of consecutive samples, in constant memory. Each interval is charged
+    // to the mode tagged on its first sample, and counted only when both ends are
+    // on battery. Intervals longer than maxGap (sleep, a stopped -dmon, a gap in a
+    // stored log) are skipped rather than interpolated.
+    class EnergyAccountant {
+    public:
+        static constexpr uint8_t ModeCodes = TelemetryModeMask + 1;
+
+        explicit EnergyAccountant(std::chrono::seconds maxGap = DefaultMaxSampleGap) noexcept
+            : m_maxGapUs(std::chrono::duration_cast<std::chrono::microseconds>(maxGap).count()) {}
+
+        void Add(const TelemetrySample& sample) noexcept {
+            if (m_hasPrevious) {
+                int64_t elapsedUs = sample.timestampUs - m_previous.timestampUs;
+                bool onBattery = !(m_previous.flags & TelemetryFlagAc) && !(sample.flags & TelemetryFlagAc);
+                if (elapsedUs <= 0 || elapsedUs > m_maxGapUs) {
+                    ++m_skippedGaps;
+                } else if (!onBattery) {
+                    m_acSeconds += elapsedUs / 1e6;
+                } else {
+                    // rateMw is negative while discharging; a momentary charge reading counts as zero draw.
+                    double startW = std::max(-m_previous.rateMw, 0) / 1000.0;
+                    double endW = std::max(-sample.rateMw, 0) / 1000.0;
+                    double seconds = elapsedUs / 1e6;
+                    auto& bucket = m_buckets[PowerModeOf(m_previous)][GpuModeOf(m_previous)];
+                    bucket.wattHours += (startW + endW) / 2.0 * seconds / 3600.0;
+                    bucket.seconds += seconds;
+                    ++bucket.intervals;
+                    m_batterySeconds += seconds;
+                }
+            }
+            m_previous = sample;
+            m_hasPrevious = true;
+            ++m_samples;
+        }
+
+        // Calls fn(powerModeCode, gpuModeCode, bucket) for every pair with battery time.
+        template<typename Fn>
+        void ForEachBucket(Fn&& fn) const {
+            for (uint8_t power = 0; power < ModeCodes; ++power) {
+                for (uint8_t gpu = 0; gpu < ModeCodes; ++gpu) {
+                    if (m_buckets[power][gpu].intervals > 0) {
+                        fn(power, gpu, m_buckets[power][gpu]);
+                    }
+                }
+            }
+        }
+
+        double TotalWattHours() const noexcept {
+            double total = 0;
+            ForEachBucket([&](uint8_t, uint8_t, const EnergyBucket& bucket) { total += bucket.wattHours; });
+            return total;
+        }
+
+        double BatterySeconds() const noexcept { return m_batterySeconds; }
+        double AcSeconds() const noexcept { return m_acSeconds; }
+        uint64_t Samples() const noexcept { return m_samples; }
+        uint64_t SkippedGaps() const noexcept { return m_skippedGaps; }
+
+    private:
+        static uint8_t PowerModeOf(const TelemetrySample& sample) noexcept {
+            return (sample.flags >> TelemetryPowerModeShift) & TelemetryModeMask;
+        }
+
+        static uint8_t GpuModeOf(const TelemetrySample& sample) noexcept {
+            return (sample.flags >> TelemetryGpuModeShift) & TelemetryModeMask;
+        }
+
+        int64_t m_maxGapUs;
+        EnergyBucket m_buckets[ModeCodes][ModeCodes] = {};
+        TelemetrySample m_previous = {};
+        bool m_hasPrevious = false;
+        double m_batterySeconds = 0;
+        double m_acSeconds = 0;
+        uint64_t m_samples = 0;
+        uint64_t m_skippedGaps = 0;
+    };
+}
\ No newline at end of file
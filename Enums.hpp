@@ -171,4 +171,45 @@ std::expected<HybridModeState, ResultState> intToHybridModeState(int value) noex
         case 4:     return HybridModeState::Off;
         default:    return std::unexpected(ResultState::InvalidParameter);
     }
+}
+
+enum class OutputFormat {
+    Text,
+    Json,
+    Ndjson,
+    Csv
+};
+constexpr std::string_view to_string(OutputFormat format) noexcept {
+    switch (format) {
+        case OutputFormat::Text:    return "text";
+        case OutputFormat::Json:    return "json";
+        case OutputFormat::Ndjson:  return "ndjson";
+        case OutputFormat::Csv:     return "csv";
+        default:                    return "Unknown";
+    }
+}
+std::expected<OutputFormat, ResultState> stringToOutputFormat(std::string_view value) noexcept {
+    if (value == "text")    return OutputFormat::Text;
+    if (value == "json")    return OutputFormat::Json;
+    if (value == "ndjson")  return OutputFormat::Ndjson;
+    if (value == "csv")     return OutputFormat::Csv;
+    return std::unexpected(ResultState::InvalidParameter);
+}
+
+// Features whose support is probed once per machine and remembered (see CapabilityCache.hpp).
+enum class Capability {
+    OverDrive,
+    AlwaysOnUSB,
+    GSync,
+    IGPUMode,
+    Count
+};
+constexpr std::string_view to_string(Capability capability) noexcept {
+    switch (capability) {
+        case Capability::OverDrive:     return "overdrive";
+        case Capability::AlwaysOnUSB:   return "alwaysonusb";
+        case Capability::GSync:         return "gsync";
+        case Capability::IGPUMode:      return "igpumode";
+        default:                        return "unknown";
+    }
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "CommonUtils.hpp"
+#include "CapabilityCache.hpp"
+#include <array>
 
 // Declarations
 namespace LLTCAlwaysOnUSB {
@@ -19,8 +21,10 @@ namespace LLTCAlwaysOnUSB {
         uint32_t input = 0x2;
         uint32_t output = 0;
         
-        if (!LLTCCommonUtils::EnergyDrvIoControl(IOCTL_ENERGY_SETTINGS, input, output))
+        if (!LLTCCommonUtils::EnergyDrvIoControl(IOCTL_ENERGY_SETTINGS, input, output)) {
+            LLTCCapabilities::Invalidate(Capability::AlwaysOnUSB);
             return std::unexpected(ResultState::Failed);
+        }
         
         uint32_t state = LLTCCommonUtils::ReverseEndianness(output);
 
@@ -32,7 +36,7 @@ namespace LLTCAlwaysOnUSB {
     }
     
     inline std::expected<void, ResultState> SetState(AlwaysOnUSBState state) noexcept {
-        std::vector<uint32_t> commands;
+        std::array<uint32_t, 2> commands;
         switch (state) {
             case AlwaysOnUSBState::Off:             commands = {0xB, 0x12}; break;
             case AlwaysOnUSBState::OnWhenSleeping:  commands = {0xA, 0x12}; break;
@@ -40,11 +44,14 @@ namespace LLTCAlwaysOnUSB {
             default: return std::unexpected(ResultState::InvalidParameter);
         }
         
-        for (uint32_t cmd : commands) {
-            uint32_t dummyOutput = 0;
-            if (!LLTCCommonUtils::EnergyDrvIoControl(IOCTL_ENERGY_SETTINGS, cmd, dummyOutput))
-                return std::unexpected(ResultState::Failed);
-        }
+        // The two commands switch independent settings, so both are in flight at once.
+        std::array<uint32_t, 2> outputs = {};
+        LLTCCommonUtils::IoctlRequest requests[2] = {
+            {IOCTL_ENERGY_SETTINGS, &commands[0], sizeof(uint32_t), &outputs[0], sizeof(uint32_t)},
+            {IOCTL_ENERGY_SETTINGS, &commands[1], sizeof(uint32_t), &outputs[1], sizeof(uint32_t)}
+        };
+        if (!LLTCCommonUtils::TransportIoControlBatch(LLTCCommonUtils::DeviceKind::EnergyDriver, requests, LLTCCommonUtils::IoctlOrder::Concurrent))
+            return std::unexpected(ResultState::Failed);
         
         for (int retry = 0; retry < 10; ++retry) {
             auto currentState = GetState();
@@ -52,13 +59,21 @@ namespace LLTCAlwaysOnUSB {
                 return std::unexpected(currentState.error());
             if (currentState.value() == state)
                 return {};
-            Sleep(50);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
         }
         
         return std::unexpected(ResultState::RetryTimeout);
     }
     
+    // A failed query is only remembered when EnergyDrv itself is missing; anything
+    // else may be transient and is probed again next time.
     inline bool IsSupported() noexcept {
-        return GetState().has_value();
+        return LLTCCapabilities::Probe(Capability::AlwaysOnUSB, []() -> std::optional<bool> {
+            if (!LLTCCommonUtils::GetDeviceTransport().IsAvailable(LLTCCommonUtils::DeviceKind::EnergyDriver))
+                return false;
+            if (!GetState())
+                return std::nullopt;
+            return true;
+        });
     }
 }
\ No newline at end of file
@@ -2,7 +2,7 @@
 
 #include "CommonUtils.hpp"
 #include <stdexcept>
-#include <batclass.h>
+#include <optional>
 
 // Lenovo-specific battery structure
 #pragma pack(push, 2)
@@ -33,12 +33,23 @@ struct BatteryInfoResult {
     SYSTEMTIME firstUseDate;
 };
 
+struct BatteryWaitResult {
+    BATTERY_STATUS status;
+    bool timedOut;      // no change within the timeout; status is the last known one
+};
+
 // Declarations
 namespace LLTCBatteryControl {
     inline std::expected<BatteryMode, ResultState> GetBatteryMode() noexcept;
     inline std::expected<void, ResultState> SetBatteryMode(BatteryMode newState) noexcept;
     inline std::expected<double, ResultState> GetBatteryTemperatureC() noexcept;
     inline std::expected<BatteryInfoResult, ResultState> GetBatteryInformation() noexcept;
+    inline std::expected<BATTERY_STATUS, ResultState> GetBatteryStatus() noexcept;
+    inline std::expected<BatteryWaitResult, ResultState> WaitForBatteryChange(
+        const BATTERY_STATUS& last,
+        ULONG capacityBand,
+        DWORD timeoutMs
+    ) noexcept;
 }
 
 // Definitions
@@ -46,9 +57,13 @@ namespace LLTCBatteryControl {
     using LLTCCommonUtils::ReverseEndianness;
     using LLTCCommonUtils::ReverseEndianness16;
     using LLTCCommonUtils::GetNthBit;
-    using LLTCCommonUtils::GetEnergyDriverHandle;
-    using LLTCCommonUtils::GetBatteryHandle;
     using LLTCCommonUtils::GetBatteryTag;
+    using LLTCCommonUtils::GetDeviceTransport;
+    using LLTCCommonUtils::TransportIoControl;
+    using LLTCCommonUtils::TransportIoControlBatch;
+    using LLTCCommonUtils::IoctlRequest;
+    using LLTCCommonUtils::IoctlOrder;
+    using LLTCCommonUtils::DeviceKind;
 
     namespace{
         constexpr DWORD IOCTL_ENERGY_BATTERY_INFORMATION = 0x83102138;
@@ -79,24 +94,18 @@ namespace LLTCBatteryControl {
         }
 
         inline bool GetLenovoBatteryInformation(uint32_t index, LENOVO_BATTERY_INFORMATION& outInfo) {
-            HANDLE hDriver = GetEnergyDriverHandle();
-            if (hDriver == INVALID_HANDLE_VALUE) {
-                return false;
-            }
-
             DWORD bytesReturned = 0;
             constexpr DWORD bufferSize = 256;
             BYTE buffer[bufferSize] = {0};
 
-            BOOL success = DeviceIoControl(
-                hDriver,
+            bool success = TransportIoControl(
+                DeviceKind::EnergyDriver,
                 IOCTL_ENERGY_BATTERY_INFORMATION,
                 &index,
                 sizeof(index),
                 buffer,
                 bufferSize,
-                &bytesReturned,
-                nullptr
+                &bytesReturned
             );
             if(!success) return false;
 
@@ -105,11 +114,6 @@ namespace LLTCBatteryControl {
             return true;
         }
         inline bool GetStandardBatteryInformation(ULONG batteryTag, BATTERY_INFORMATION& outInfo) {
-            HANDLE hBattery = GetBatteryHandle();
-            if (hBattery == INVALID_HANDLE_VALUE) {
-                return false;
-            }
-
             BATTERY_QUERY_INFORMATION query = { 
                 batteryTag, 
                 BatteryInformation, 
@@ -117,46 +121,118 @@ namespace LLTCBatteryControl {
             };
 
             DWORD bytesReturned = 0;
-            BOOL success = DeviceIoControl(
-                hBattery,
+            bool success = TransportIoControl(
+                DeviceKind::Battery,
                 IOCTL_BATTERY_QUERY_INFORMATION,
                 &query,
                 sizeof(query),
                 &outInfo,
                 sizeof(outInfo),
-                &bytesReturned,
-                nullptr
+                &bytesReturned
             );
 
             return success && (bytesReturned == sizeof(BATTERY_INFORMATION));
         }
 
         inline bool GetBatteryStatus(ULONG batteryTag, BATTERY_STATUS& outStatus) {
-            HANDLE hBattery = GetBatteryHandle();
-            if (hBattery == INVALID_HANDLE_VALUE) {
-                return false;
-            }
-
             BATTERY_WAIT_STATUS waitStatus = {0};
             waitStatus.BatteryTag = batteryTag;
 
             DWORD bytesReturned = 0;
-            BOOL success = DeviceIoControl(
-                hBattery,
+            bool success = TransportIoControl(
+                DeviceKind::Battery,
                 IOCTL_BATTERY_QUERY_STATUS,
                 &waitStatus,
                 sizeof(waitStatus),
                 &outStatus,
                 sizeof(outStatus),
-                &bytesReturned,
-                nullptr
+                &bytesReturned
             );
             return success && (bytesReturned == sizeof(BATTERY_STATUS));
         }
 
+        // Facts that only change with the battery itself, cached per battery tag.
+        struct StaticBatteryInfo {
+            ULONG tag = 0;
+            DWORD designedCapacity = 0;
+            int lenovoIndex = -1;           // Lenovo slot with a valid temperature, -1 if none
+            SYSTEMTIME manufactureDate = {};
+            SYSTEMTIME firstUseDate = {};
+        };
+
+        // Full-charge capacity, cycle count and alert levels drift with wear and
+        // charging, so this copy is re-read on an AC change or once it is stale.
+        struct CachedBatteryInformation {
+            ULONG tag = 0;
+            BYTE acLineStatus = 0;
+            std::chrono::steady_clock::time_point readAt;
+            BATTERY_INFORMATION info = {};
+        };
+
+        constexpr std::chrono::minutes BatteryInformationMaxAge{5};
+
+        std::mutex m_staticInfoMutex;
+        std::optional<StaticBatteryInfo> m_staticInfo;
+        std::optional<CachedBatteryInformation> m_batteryInformation;   // guarded by m_staticInfoMutex
+
+        inline bool LoadStaticBatteryInfo(StaticBatteryInfo& outInfo) {
+            BATTERY_INFORMATION info = {0};
+            if (!GetBatteryTag(outInfo.tag) || !GetStandardBatteryInformation(outInfo.tag, info)) {
+                return false;
+            }
+            outInfo.designedCapacity = info.DesignedCapacity;
+
+            LENOVO_BATTERY_INFORMATION lenovoInfo = {0};
+            for (uint32_t i = 0; i < 3; i++) {
+                if (GetLenovoBatteryInformation(i, lenovoInfo) &&
+                    lenovoInfo.Temperature != 0x0000 && lenovoInfo.Temperature != 0xFFFF) {
+                    outInfo.lenovoIndex = static_cast<int>(i);
+                    if (!DecodeFATDate(lenovoInfo.ManufactureDate, outInfo.manufactureDate)) {
+                        memset(&outInfo.manufactureDate, 0, sizeof(SYSTEMTIME));
+                    }
+                    if (!DecodeFATDate(lenovoInfo.FirstUseDate, outInfo.firstUseDate)) {
+                        memset(&outInfo.firstUseDate, 0, sizeof(SYSTEMTIME));
+                    }
+                    break;
+                }
+            }
+            return true;
+        }
+
+        inline std::optional<StaticBatteryInfo> GetStaticBatteryInfo(bool reload = false) {
+            std::lock_guard lock(m_staticInfoMutex);
+            if (reload) {
+                m_staticInfo.reset();
+            }
+            if (!m_staticInfo) {
+                StaticBatteryInfo info;
+                if (!LoadStaticBatteryInfo(info)) {
+                    return std::nullopt;
+                }
+                m_staticInfo = info;
+            }
+            return m_staticInfo;
+        }
+
+        inline std::optional<BATTERY_INFORMATION> GetCurrentBatteryInformation(ULONG tag, BYTE acLineStatus) {
+            std::lock_guard lock(m_staticInfoMutex);
+            auto now = std::chrono::steady_clock::now();
+            if (!m_batteryInformation || m_batteryInformation->tag != tag ||
+                m_batteryInformation->acLineStatus != acLineStatus ||
+                now - m_batteryInformation->readAt >= BatteryInformationMaxAge) {
+                CachedBatteryInformation cached{tag, acLineStatus, now, {}};
+                if (!GetStandardBatteryInformation(tag, cached.info)) {
+                    m_batteryInformation.reset();
+                    return std::nullopt;
+                }
+                m_batteryInformation = cached;
+            }
+            return m_batteryInformation->info;
+        }
+
         inline bool GetChargingState(ChargingState& outState) { // may some bugs
             SYSTEM_POWER_STATUS sps = {0};
-            if (!GetSystemPowerStatus(&sps)) {
+            if (!GetDeviceTransport().QueryPowerStatus(sps)) {
                 return false;
             }
             if (sps.ACLineStatus == 1) outState = ChargingState::Connected;
@@ -166,58 +242,54 @@ namespace LLTCBatteryControl {
     }   // namespace
     
     inline std::expected<double, ResultState> GetBatteryTemperatureC() noexcept {
+        auto staticInfo = GetStaticBatteryInfo();
+        if (!staticInfo || staticInfo->lenovoIndex < 0) {
+            return std::unexpected(ResultState::Failed);
+        }
+
         LENOVO_BATTERY_INFORMATION info = {0};
-        double outTempC;
-        for (uint32_t i = 0; i < 3; i++) {
-            if (GetLenovoBatteryInformation(i, info)) {
-                if (info.Temperature != 0x0000 && info.Temperature != 0xFFFF) {
-                    outTempC = DecodeTemperature(info.Temperature);
-                    if (outTempC >= 0){
-                        return outTempC;
-                    } else{
-                        return std::unexpected(ResultState::Failed);
-                    }
-                }
-            }
+        if (!GetLenovoBatteryInformation(static_cast<uint32_t>(staticInfo->lenovoIndex), info) ||
+            info.Temperature == 0x0000 || info.Temperature == 0xFFFF) {
+            return std::unexpected(ResultState::Failed);
         }
-        return std::unexpected(ResultState::Failed);
+        double outTempC = DecodeTemperature(info.Temperature);
+        if (outTempC < 0) {
+            return std::unexpected(ResultState::Failed);
+        }
+        return outTempC;
     }
 
     inline std::expected<BatteryInfoResult, ResultState> GetBatteryInformation() noexcept {
         try {
             BatteryInfoResult outResult;
             SYSTEM_POWER_STATUS sps = {0};
-            if (!GetSystemPowerStatus(&sps)) {
+            if (!GetDeviceTransport().QueryPowerStatus(sps)) {
                 return std::unexpected(ResultState::Failed);
             }
 
-            HANDLE hBattery = GetBatteryHandle();
-            if (hBattery == INVALID_HANDLE_VALUE) {
-                return std::unexpected(ResultState::Failed);
-            }
-            ULONG batteryTag = 0;
-            if (!GetBatteryTag(hBattery, batteryTag)) {
+            auto staticInfo = GetStaticBatteryInfo();
+            if (!staticInfo) {
                 return std::unexpected(ResultState::Failed);
             }
 
-            BATTERY_INFORMATION batInfo = {0};
+            // A status query against a stale tag fails once the battery was replaced
+            // or re-enumerated; only then are the static facts read again.
             BATTERY_STATUS batStatus = {0};
-            if (!GetStandardBatteryInformation(batteryTag, batInfo) ||
-                !GetBatteryStatus(batteryTag, batStatus)) {
+            if (!GetBatteryStatus(staticInfo->tag, batStatus)) {
+                staticInfo = GetStaticBatteryInfo(true);
+                if (!staticInfo || !GetBatteryStatus(staticInfo->tag, batStatus)) {
+                    return std::unexpected(ResultState::Failed);
+                }
+            }
+            auto batInfo = GetCurrentBatteryInformation(staticInfo->tag, sps.ACLineStatus);
+            if (!batInfo) {
                 return std::unexpected(ResultState::Failed);
             }
 
             LENOVO_BATTERY_INFORMATION lenovoInfo = {0};
-            bool hasLenovoInfo = false;
-            
-            for (uint32_t i = 0; i < 3; i++) {
-                if (GetLenovoBatteryInformation(i, lenovoInfo)) {
-                    if (lenovoInfo.Temperature != 0x0000 && lenovoInfo.Temperature != 0xFFFF) {
-                        hasLenovoInfo = true;
-                        break;
-                    }
-                }
-            }
+            bool hasLenovoInfo = staticInfo->lenovoIndex >= 0 &&
+                GetLenovoBatteryInformation(static_cast<uint32_t>(staticInfo->lenovoIndex), lenovoInfo) &&
+                lenovoInfo.Temperature != 0x0000 && lenovoInfo.Temperature != 0xFFFF;
 
             outResult.isAcConnected = (sps.ACLineStatus == 1);
             outResult.batteryLifePercent = sps.BatteryLifePercent;
@@ -225,34 +297,21 @@ namespace LLTCBatteryControl {
             outResult.batteryFullLifeTime = static_cast<DWORD>(sps.BatteryFullLifeTime);
             outResult.dischargeRate = batStatus.Rate;
             outResult.currentCapacity = batStatus.Capacity;
-            outResult.designedCapacity = batInfo.DesignedCapacity;
-            outResult.fullChargedCapacity = batInfo.FullChargedCapacity;
-            outResult.cycleCount = batInfo.CycleCount;
+            outResult.designedCapacity = staticInfo->designedCapacity;
+            outResult.fullChargedCapacity = batInfo->FullChargedCapacity;
+            outResult.cycleCount = batInfo->CycleCount;
             
             outResult.isLowBattery = (sps.ACLineStatus == 0) && 
-                                    (batInfo.DefaultAlert2 >= batStatus.Capacity);
+                                    (batInfo->DefaultAlert2 >= batStatus.Capacity);
 
             if (hasLenovoInfo) {
                 double tempC = DecodeTemperature(lenovoInfo.Temperature);
                 outResult.temperatureC = (tempC >= 0) ? tempC : -1.0;
-                
-                SYSTEMTIME tempDate = {0};
-                if (DecodeFATDate(lenovoInfo.ManufactureDate, tempDate)) {
-                    outResult.manufactureDate = tempDate;
-                } else {
-                    memset(&outResult.manufactureDate, 0, sizeof(SYSTEMTIME));
-                }
-                
-                if (DecodeFATDate(lenovoInfo.FirstUseDate, tempDate)) {
-                    outResult.firstUseDate = tempDate;
-                } else {
-                    memset(&outResult.firstUseDate, 0, sizeof(SYSTEMTIME));
-                }
             } else {
                 outResult.temperatureC = -1.0;
-                memset(&outResult.manufactureDate, 0, sizeof(SYSTEMTIME));
-                memset(&outResult.firstUseDate, 0, sizeof(SYSTEMTIME));
             }
+            outResult.manufactureDate = staticInfo->manufactureDate;
+            outResult.firstUseDate = staticInfo->firstUseDate;
             
             return outResult;
         } catch (...) {
@@ -260,9 +319,51 @@ namespace LLTCBatteryControl {
         }
     }
 
+    inline std::expected<BATTERY_STATUS, ResultState> GetBatteryStatus() noexcept {
+        auto staticInfo = GetStaticBatteryInfo();
+        BATTERY_STATUS status = {0};
+        if (!staticInfo || !GetBatteryStatus(staticInfo->tag, status)) {
+            return std::unexpected(ResultState::Failed);
+        }
+        return status;
+    }
+
+    // Lets the battery driver hold the request until the power state differs from
+    // `last`, the capacity leaves last.Capacity +/- capacityBand, or timeoutMs passes.
+    // The wait conditions have no rate field; rate changes surface with the next wake.
+    inline std::expected<BatteryWaitResult, ResultState> WaitForBatteryChange(
+        const BATTERY_STATUS& last,
+        ULONG capacityBand,
+        DWORD timeoutMs
+    ) noexcept {
+        auto staticInfo = GetStaticBatteryInfo();
+        if (!staticInfo) {
+            return std::unexpected(ResultState::Failed);
+        }
+
+        BATTERY_WAIT_STATUS waitStatus = {0};
+        waitStatus.BatteryTag = staticInfo->tag;
+        waitStatus.Timeout = timeoutMs;
+        waitStatus.PowerState = last.PowerState;
+        waitStatus.LowCapacity = (last.Capacity > capacityBand) ? last.Capacity - capacityBand : 0;
+        waitStatus.HighCapacity = last.Capacity + capacityBand;
+
+        BATTERY_STATUS status = {0};
+        IoctlRequest request{IOCTL_BATTERY_QUERY_STATUS, &waitStatus, sizeof(waitStatus), &status, sizeof(status)};
+        request.timeoutMs = (timeoutMs == INFINITE) ? INFINITE : timeoutMs + LLTCCommonUtils::DefaultIoctlTimeoutMs;
+        if (TransportIoControlBatch(DeviceKind::Battery, {&request, 1}, IoctlOrder::Sequential) &&
+            request.bytesReturned == sizeof(BATTERY_STATUS)) {
+            return BatteryWaitResult{status, false};
+        }
+        if (request.error == ERROR_SEM_TIMEOUT || request.error == ERROR_TIMEOUT) {
+            return BatteryWaitResult{last, true};
+        }
+        GetStaticBatteryInfo(true);
+        return std::unexpected(ResultState::Failed);
+    }
+
     inline std::expected<BatteryMode, ResultState> GetBatteryMode() noexcept {
-        HANDLE hDriver = GetEnergyDriverHandle();
-        if (hDriver == INVALID_HANDLE_VALUE) {
+        if (!GetDeviceTransport().IsAvailable(DeviceKind::EnergyDriver)) {
             return std::unexpected(ResultState::Failed);
         }
 
@@ -270,13 +371,12 @@ namespace LLTCBatteryControl {
         uint32_t inBuffer = 0xFFFFFFFF;
         uint32_t outBuffer = 0;
 
-        BOOL success = DeviceIoControl(
-            hDriver,
+        bool success = TransportIoControl(
+            DeviceKind::EnergyDriver,
             IOCTL_ENERGY_BATTERY_CHARGE_MODE,
             &inBuffer, sizeof(inBuffer),
             &outBuffer, sizeof(outBuffer),
-            &bytesReturned,
-            nullptr
+            &bytesReturned
         );
 
         if (!success || bytesReturned != sizeof(uint32_t)) {
@@ -295,8 +395,7 @@ namespace LLTCBatteryControl {
     }
 
     inline std::expected<void, ResultState> SetBatteryMode(BatteryMode newState) noexcept {
-        HANDLE hDriver = GetEnergyDriverHandle();
-        if (hDriver == INVALID_HANDLE_VALUE) {
+        if (!GetDeviceTransport().IsAvailable(DeviceKind::EnergyDriver)) {
             return std::unexpected(ResultState::Failed);
         }
 
@@ -336,20 +435,14 @@ namespace LLTCBatteryControl {
             return std::unexpected(ResultState::Failed);
         }
 
-        DWORD bytesReturned;
-        uint32_t dummyOutput = 0;
-        for (uint32_t cmd : commands) {
-            BOOL success = DeviceIoControl(
-                hDriver,
-                IOCTL_ENERGY_BATTERY_CHARGE_MODE,
-                &cmd, sizeof(cmd),
-                &dummyOutput, sizeof(dummyOutput),
-                &bytesReturned,
-                nullptr
-            );
-            if (!success) {
-                return std::unexpected(ResultState::Failed);
-            }
+        // Rapid charge is refused while conservation is still on, so keep the order.
+        std::vector<uint32_t> outputs(commands.size());
+        std::vector<IoctlRequest> requests;
+        for (size_t i = 0; i < commands.size(); ++i) {
+            requests.push_back({IOCTL_ENERGY_BATTERY_CHARGE_MODE, &commands[i], sizeof(uint32_t), &outputs[i], sizeof(uint32_t)});
+        }
+        if (!TransportIoControlBatch(DeviceKind::EnergyDriver, requests, IoctlOrder::Sequential)) {
+            return std::unexpected(ResultState::Failed);
         }
 
         return {};
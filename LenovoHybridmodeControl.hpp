@@ -1,12 +1,13 @@
 #pragma once
 
 #include "CommonUtils.hpp"
+#include "CapabilityCache.hpp"
 #include <future>
-#include <thread>
 #include <chrono>
 #include <atomic>
-#include <mutex>
+#include <memory>
 #include <stdexcept>
+#include <array>
 
 enum class IGPUModeState {
     Default = 0,
@@ -28,151 +29,66 @@ enum class OperationResult {
 
 class HybridModeController {
 private:
-    IWbemLocator* m_pLocator = nullptr;
-    IWbemServices* m_pServices = nullptr;
-    std::wstring m_instancePath;
-    std::atomic<bool> m_stopDgpuCheck = false;
-    std::mutex m_checkMutex;
+    // Bumped by every set and by the destructor; a queued dGPU check step
+    // started under an older value gives up. Shared so steps never touch
+    // the controller itself.
+    std::shared_ptr<std::atomic<uint64_t>> m_checkGeneration = std::make_shared<std::atomic<uint64_t>>(0);
     bool m_gsyncSupported = false;
     bool m_igpuModeSupported = false;
+    bool m_supportFromCache = false;
     
-    HRESULT initializeWMI() {
-        HRESULT hr = LLTCCommonUtils::InitializeCOM();
-        if (FAILED(hr)) {
-            return hr;
-        }
-        hr = LLTCCommonUtils::ConnectToWMI(&m_pLocator, &m_pServices);
-        if (FAILED(hr)) {
-            LLTCCommonUtils::UninitializeCOM();
-            return hr;
-        }
-        m_instancePath = LLTCCommonUtils::GetFirstWmiInstancePath(m_pServices, {L"LENOVO_GAMEZONE_DATA"}, LLTCCommonUtils::WmiPathType::Full);
-        return S_OK;
+    static LLTCCommonUtils::IDeviceTransport& transport() {
+        return LLTCCommonUtils::GetDeviceTransport();
     }
     
-    void cleanupWMI() {
-        if (m_pServices) {
-            m_pServices->Release();
-            m_pServices = nullptr;
-        }
-        if (m_pLocator) {
-            m_pLocator->Release();
-            m_pLocator = nullptr;
-        }
-        LLTCCommonUtils::UninitializeCOM();
+    static int callMethodNoParams(const wchar_t* methodName) {
+        int result = -1;
+        transport().CallWmiMethod({.methodName = methodName}, &result);
+        return result;
     }
     
-    bool isGSyncSupported() {
-        if (m_instancePath.empty()) return false;
-        int result = LLTCCommonUtils::CallWmiMethodNoParams(
-            m_pServices, m_instancePath.c_str(), L"IsSupportGSync");
-        return result > 0;
+    static HRESULT callMethodWithParam(const wchar_t* methodName, const wchar_t* paramName, int paramValue) {
+        return transport().CallWmiMethod({
+            .methodName = methodName,
+            .paramName = paramName,
+            .paramValue = paramValue
+        }, nullptr);
     }
     
-    int getGSyncStatus() {
-        if (m_instancePath.empty()) return -1;
-        return LLTCCommonUtils::CallWmiMethodNoParams(
-            m_pServices, m_instancePath.c_str(), L"GetGSyncStatus");
+    static OperationResult checkSession() {
+        HRESULT hr = transport().ConnectWmi();
+        if (hr == WBEM_E_NOT_FOUND) {
+            return OperationResult::InstanceNotFound;
+        }
+        if (FAILED(hr)) {
+            return OperationResult::WmiConnectionFailed;
+        }
+        return OperationResult::Success;
     }
     
-    bool setGSyncStatus(bool enable) {
-        if (m_instancePath.empty()) return false;
-        return LLTCCommonUtils::CallWmiMethodWithIntParamFromClassDef(
-            m_pServices,
-            m_instancePath,
-            L"LENOVO_GAMEZONE_DATA",
-            L"SetGSyncStatus",
-            enable ? 1 : 0
-        ) == S_OK;
+    int getGSyncStatus() {
+        return callMethodNoParams(L"GetGSyncStatus");
     }
     
-    bool isIGPUModeSupported() {
-        if (m_instancePath.empty()) return false;
-        int result = LLTCCommonUtils::CallWmiMethodNoParams(
-            m_pServices, m_instancePath.c_str(), L"IsSupportIGPUMode");
-        return result > 0;
+    bool setGSyncStatus(bool enable) {
+        return callMethodWithParam(L"SetGSyncStatus", L"Data", enable ? 1 : 0) == S_OK;
     }
     
-    int getIGPUModeStatus() {
-        if (m_instancePath.empty()) return -1;
-        return LLTCCommonUtils::CallWmiMethodNoParams(
-            m_pServices, m_instancePath.c_str(), L"GetIGPUModeStatus");
+    static int getIGPUModeStatus() {
+        return callMethodNoParams(L"GetIGPUModeStatus");
     }
     
     bool setIGPUModeStatus(IGPUModeState mode) {
-        if (m_instancePath.empty()) return false;
-        
-        IWbemClassObject* pClass = nullptr;
-        HRESULT hr = m_pServices->GetObject(
-            _bstr_t(L"LENOVO_GAMEZONE_DATA"),
-            WBEM_FLAG_DIRECT_READ,
-            nullptr,
-            &pClass,
-            nullptr
-        );
-        if (FAILED(hr) || !pClass) {
-            return false;
-        }
-        
-        IWbemClassObject* pInParamsDef = nullptr;
-        hr = pClass->GetMethod(L"SetIGPUModeStatus", 0, &pInParamsDef, nullptr);
-        pClass->Release();
-        if (FAILED(hr) || !pInParamsDef) {
-            return false;
-        }
-        
-        IWbemClassObject* pInParams = nullptr;
-        hr = pInParamsDef->SpawnInstance(0, &pInParams);
-        pInParamsDef->Release();
-        if (FAILED(hr) || !pInParams) {
-            return false;
-        }
-        
-        VARIANT var;
-        VariantInit(&var);
-        var.vt = VT_I4;
-        var.lVal = static_cast<LONG>(mode);
-        hr = pInParams->Put(L"mode", 0, &var, 0);
-        VariantClear(&var);
-        if (FAILED(hr)) {
-            pInParams->Release();
-            return false;
-        }
-        
-        IWbemClassObject* pOutParams = nullptr;
-        hr = m_pServices->ExecMethod(
-            _bstr_t(m_instancePath.c_str()),
-            _bstr_t(L"SetIGPUModeStatus"),
-            0,
-            nullptr,
-            pInParams,
-            &pOutParams,
-            nullptr
-        );
-        pInParams->Release();
-        if (pOutParams) {
-            pOutParams->Release();
-        }
-        
-        return SUCCEEDED(hr);
+        return SUCCEEDED(callMethodWithParam(L"SetIGPUModeStatus", L"mode", static_cast<int>(mode)));
     }
     
-    bool isDGPUAvailable() {
-        if (m_instancePath.empty()) return false;
-        int result = LLTCCommonUtils::CallWmiMethodNoParams(
-            m_pServices, m_instancePath.c_str(), L"IsDGPUAvailable");
+    static bool isDGPUAvailable() {
+        int result = callMethodNoParams(L"IsDGPUAvailable");
         return result > 0;
     }
     
-    bool notifyDGPUStatus(bool activate) {
-        if (m_instancePath.empty()) return false;
-        return LLTCCommonUtils::CallWmiMethodWithIntParamFromClassDef(
-            m_pServices,
-            m_instancePath,
-            L"LENOVO_GAMEZONE_DATA",
-            L"NotifyDGPUStatus",
-            activate ? 1 : 0
-        ) == S_OK;
+    static bool notifyDGPUStatus(bool activate) {
+        return callMethodWithParam(L"NotifyDGPUStatus", L"Data", activate ? 1 : 0) == S_OK;
     }
     
     std::pair<bool, IGPUModeState> unpackState(HybridModeState state) {
@@ -207,151 +123,98 @@ private:
         }
     }
     
-    void ensureDGPUEjectedIfNeeded() {
-        std::lock_guard<std::mutex> lock(m_checkMutex);
-        m_stopDgpuCheck = false;
-        
-        std::thread([this]() {
-            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-            if (m_stopDgpuCheck) return;
+    struct DgpuCheck {
+        std::shared_ptr<std::atomic<uint64_t>> generation;
+        uint64_t started;
+        bool activate;                      // false: make sure the dGPU is ejected
+        std::chrono::milliseconds retryDelay;
+        int attempt = 1;
+    };
+    
+    static constexpr int DgpuCheckAttempts = 5;
+    
+    // One attempt of a dGPU check. Runs as a delayed job on the WMI worker,
+    // so its WMI calls run inline there and nothing ever waits for it.
+    static void runDgpuCheck(DgpuCheck check) {
+        if (check.generation->load() != check.started) return;
+        
+        std::chrono::milliseconds delay = check.retryDelay;
+        if (checkSession() == OperationResult::Success) {
+            bool isIGPUOnlyMode = (getIGPUModeStatus() == static_cast<int>(IGPUModeState::IGPUOnly));
+            bool isAvailable = isDGPUAvailable();
             
-            constexpr int maxRetries = 5;
-            constexpr int delayMs = 5000;
+            if (check.activate ? (isIGPUOnlyMode || isAvailable) : (!isIGPUOnlyMode || !isAvailable)) {
+                return;
+            }
             
-            for (int retry = 1; retry <= maxRetries; ++retry) {
-                if (m_stopDgpuCheck) return;
-                
-                if (FAILED(initializeWMI())) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
-                    continue;
-                }
-                
-                int currentMode = getIGPUModeStatus();
-                bool isIGPUOnlyMode = (currentMode == static_cast<int>(IGPUModeState::IGPUOnly));
-                
-                bool isAvailable = isDGPUAvailable();
-                
-                cleanupWMI();
-                
-                if (!isIGPUOnlyMode) {
-                    return;
-                }
-                
-                if (!isAvailable) {
-                    return;
-                }
-                
-                if (SUCCEEDED(initializeWMI())) {
-                    bool success = notifyDGPUStatus(false);
-                    cleanupWMI();
-                    if (success) {
-                        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                    }
-                }
-                
-                std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+            if (notifyDGPUStatus(check.activate)) {
+                delay += std::chrono::milliseconds(1000);
             }
-        }).detach();
+        }
+        
+        if (++check.attempt > DgpuCheckAttempts) return;
+        LLTCCommonUtils::WmiWorker::Instance().PostAfter(delay, [check]() { runDgpuCheck(check); });
+    }
+    
+    // Replaces any pending check with a new one starting in two seconds.
+    void startDgpuCheck(bool activate, std::chrono::milliseconds retryDelay) {
+        DgpuCheck check{m_checkGeneration, m_checkGeneration->fetch_add(1) + 1, activate, retryDelay};
+        LLTCCommonUtils::WmiWorker::Instance().PostAfter(std::chrono::milliseconds(2000), [check]() { runDgpuCheck(check); });
+    }
+    
+    void ensureDGPUEjectedIfNeeded() {
+        startDgpuCheck(false, std::chrono::milliseconds(5000));
     }
     
     void ensureDGPUActivatedIfNeeded() {
-        std::lock_guard<std::mutex> lock(m_checkMutex);
-        m_stopDgpuCheck = false;
-        
-        std::thread([this]() {
-            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-            if (m_stopDgpuCheck) return;
-            
-            constexpr int maxRetries = 5;
-            constexpr int delayMs = 3000;
-            
-            for (int retry = 1; retry <= maxRetries; ++retry) {
-                if (m_stopDgpuCheck) return;
-                
-                if (FAILED(initializeWMI())) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
-                    continue;
-                }
-                
-                int currentMode = getIGPUModeStatus();
-                bool isIGPUOnlyMode = (currentMode == static_cast<int>(IGPUModeState::IGPUOnly));
-                
-                bool isAvailable = isDGPUAvailable();
-                
-                cleanupWMI();
-                
-                if (isIGPUOnlyMode) {
-                    return;
-                }
-                
-                if (isAvailable) {
-                    return;
-                }
-                
-                if (SUCCEEDED(initializeWMI())) {
-                    bool success = notifyDGPUStatus(true);
-                    cleanupWMI();
-                    if (success) {
-                        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                    }
-                }
-                
-                std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
-            }
-        }).detach();
+        startDgpuCheck(true, std::chrono::milliseconds(3000));
     }
     
     OperationResult getHybridModeInternal(HybridModeState& outMode) {
-        HRESULT hr = initializeWMI();
-        if (FAILED(hr)) {
-            return OperationResult::ComInitializationFailed;
-        }
-        
-        if (m_instancePath.empty()) {
-            cleanupWMI();
-            return OperationResult::InstanceNotFound;
+        OperationResult sessionResult = checkSession();
+        if (sessionResult != OperationResult::Success) {
+            return sessionResult;
         }
         
         bool gsyncEnabled = false;
         IGPUModeState igpuMode = IGPUModeState::Default;
         
+        // Both reads are independent: issue them together and wait once.
+        std::array<LLTCCommonUtils::WmiAsyncCall, 2> reads = {{
+            {L"GetGSyncStatus"},
+            {L"GetIGPUModeStatus"}
+        }};
+        size_t first = m_gsyncSupported ? 0 : 1;
+        size_t count = (m_gsyncSupported ? 1 : 0) + (m_igpuModeSupported ? 1 : 0);
+        transport().CallWmiMethodsAsync(std::span(reads).subspan(first, count), LLTCCommonUtils::WmiPathType::Full);
+        
         if (m_gsyncSupported) {
-            int gsyncStatus = getGSyncStatus();
+            int gsyncStatus = reads[0].result;
             gsyncEnabled = (gsyncStatus == 1);
         }
         
         if (m_igpuModeSupported) {
-            int modeStatus = getIGPUModeStatus();
+            int modeStatus = reads[1].result;
             if (modeStatus >= 0 && modeStatus <= 3) {
                 igpuMode = static_cast<IGPUModeState>(modeStatus);
             } else {
-                cleanupWMI();
                 return OperationResult::MethodCallFailed;
             }
         }
         
-        cleanupWMI();
         outMode = packState(gsyncEnabled, igpuMode);
         return OperationResult::Success;
     }
     
     OperationResult setHybridModeInternal(HybridModeState mode) {
-        HRESULT hr = initializeWMI();
-        if (FAILED(hr)) {
-            return OperationResult::ComInitializationFailed;
-        }
-        
-        if (m_instancePath.empty()) {
-            cleanupWMI();
-            return OperationResult::InstanceNotFound;
+        OperationResult sessionResult = checkSession();
+        if (sessionResult != OperationResult::Success) {
+            return sessionResult;
         }
         
         auto [targetGSync, targetIGPUMode] = unpackState(mode);
         
-        {
-            std::lock_guard<std::mutex> lock(m_checkMutex);
-            m_stopDgpuCheck = true;
-        }
+        m_checkGeneration->fetch_add(1);
         
         bool gsyncChanged = false;
         
@@ -361,7 +224,6 @@ private:
             
             if (currentGSyncEnabled != targetGSync) {
                 if (!setGSyncStatus(targetGSync)) {
-                    cleanupWMI();
                     return OperationResult::MethodCallFailed;
                 }
                 gsyncChanged = true;
@@ -376,7 +238,6 @@ private:
                 bool success = setIGPUModeStatus(targetIGPUMode);
                 
                 if (!success && !gsyncChanged) {
-                    cleanupWMI();
                     return OperationResult::MethodCallFailed;
                 }
                 
@@ -389,27 +250,55 @@ private:
             }
         }
         
-        cleanupWMI();
         return OperationResult::Success;
     }
 
+    void probeSupport() {
+        m_supportFromCache = false;
+        if (checkSession() == OperationResult::Success) {
+            std::array<LLTCCommonUtils::WmiAsyncCall, 2> probes = {{
+                {L"IsSupportGSync"},
+                {L"IsSupportIGPUMode"}
+            }};
+            transport().CallWmiMethodsAsync(probes, LLTCCommonUtils::WmiPathType::Full);
+            m_gsyncSupported = probes[0].result > 0;
+            m_igpuModeSupported = probes[1].result > 0;
+            LLTCCapabilities::Store(Capability::GSync, m_gsyncSupported);
+            LLTCCapabilities::Store(Capability::IGPUMode, m_igpuModeSupported);
+        }
+    }
+
+    // A call that failed on cached support answers is retried once after probing
+    // again, in case the firmware changed under the same identity.
+    template<typename Call>
+    OperationResult withSupportRetry(Call&& call) {
+        OperationResult result = call();
+        if (result == OperationResult::MethodCallFailed && m_supportFromCache) {
+            bool stale = LLTCCapabilities::Invalidate(Capability::GSync);
+            stale = LLTCCapabilities::Invalidate(Capability::IGPUMode) || stale;
+            if (stale) {
+                probeSupport();
+                result = call();
+            }
+        }
+        return result;
+    }
+
 public:
     HybridModeController() {
-        HRESULT hr = initializeWMI();
-        if (SUCCEEDED(hr) && !m_instancePath.empty()) {
-            m_gsyncSupported = isGSyncSupported();
-            m_igpuModeSupported = isIGPUModeSupported();
-            cleanupWMI();
+        auto gsync = LLTCCapabilities::Lookup(Capability::GSync);
+        auto igpuMode = LLTCCapabilities::Lookup(Capability::IGPUMode);
+        if (gsync && igpuMode) {
+            m_gsyncSupported = *gsync;
+            m_igpuModeSupported = *igpuMode;
+            m_supportFromCache = true;
+        } else {
+            probeSupport();
         }
-        m_stopDgpuCheck = false;
     }
     
     ~HybridModeController() {
-        {
-            std::lock_guard<std::mutex> lock(m_checkMutex);
-            m_stopDgpuCheck = true;
-        }
-        cleanupWMI();
+        m_checkGeneration->fetch_add(1);
     }
     
     bool IsHybridModeSupported() {
@@ -446,7 +335,7 @@ public:
         if (!IsHybridModeSupported()) {
             return OperationResult::NotSupported;
         }
-        return getHybridModeInternal(outMode);
+        return withSupportRetry([&]() { return getHybridModeInternal(outMode); });
     }
     
     OperationResult SetHybridModeSync(HybridModeState mode) {
@@ -459,11 +348,12 @@ public:
             return OperationResult::InvalidMode;
         }
         
-        return setHybridModeInternal(mode);
+        return withSupportRetry([&]() { return setHybridModeInternal(mode); });
     }
     
+    // Queued on the WMI worker rather than a thread of their own.
     std::future<std::pair<OperationResult, HybridModeState>> GetHybridModeAsync() {
-        return std::async(std::launch::async, [this]() {
+        return LLTCCommonUtils::WmiWorker::Instance().Submit([this]() {
             HybridModeState mode;
             auto result = this->GetHybridModeSync(mode);
             return std::make_pair(result, mode);
@@ -471,7 +361,7 @@ public:
     }
     
     std::future<OperationResult> SetHybridModeAsync(HybridModeState mode) {
-        return std::async(std::launch::async, [this, mode]() {
+        return LLTCCommonUtils::WmiWorker::Instance().Submit([this, mode]() {
             return this->SetHybridModeSync(mode);
         });
     }
@@ -481,14 +371,11 @@ public:
             return false;
         }
         
-        HRESULT hr = initializeWMI();
-        if (FAILED(hr) || m_instancePath.empty()) {
-            if (SUCCEEDED(hr)) cleanupWMI();
+        if (checkSession() != OperationResult::Success) {
             return false;
         }
         
         int status = getGSyncStatus();
-        cleanupWMI();
         
         outEnabled = (status == 1);
         return true;
@@ -499,14 +386,11 @@ public:
             return false;
         }
         
-        HRESULT hr = initializeWMI();
-        if (FAILED(hr) || m_instancePath.empty()) {
-            if (SUCCEEDED(hr)) cleanupWMI();
+        if (checkSession() != OperationResult::Success) {
             return false;
         }
         
         int mode = getIGPUModeStatus();
-        cleanupWMI();
         
         if (mode < 0 || mode > 3) {
             return false;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "CommonUtils.hpp"
+#include "CapabilityCache.hpp"
 
 // Declarations
 namespace LLTCOverDrive {
@@ -13,68 +14,41 @@ namespace LLTCOverDrive {
 // Definitions
 namespace LLTCOverDrive {
     namespace{
-        IWbemLocator* m_pLocator = nullptr;
-        IWbemServices* m_pServices = nullptr;
-        std::wstring m_instancePath;
-
-        void Cleanup() noexcept{
-            if (m_pServices) {
-                m_pServices->Release();
-                m_pServices = nullptr;
-            }
-            if (m_pLocator) {
-                m_pLocator->Release();
-                m_pLocator = nullptr;
-            }
-            LLTCCommonUtils::UninitializeCOM();
-        }
-
-        void InitializeCOMAndWMI() {
-            HRESULT hr = LLTCCommonUtils::InitializeCOM();
-            if (FAILED(hr)) {
-                throw std::runtime_error("COM initialization failed");
-            }
-
-            hr = LLTCCommonUtils::ConnectToWMI(&m_pLocator, &m_pServices);
-            if (FAILED(hr)) {
-                LLTCCommonUtils::UninitializeCOM();
-                throw std::runtime_error("WMI connection failed");
-            }
-
-            m_instancePath = LLTCCommonUtils::GetFirstWmiInstancePath(m_pServices, {L"LENOVO_GAMEZONE_DATA"}, LLTCCommonUtils::WmiPathType::Full);
-            if (m_instancePath.empty()) {
-                Cleanup();
-                throw std::runtime_error("Failed to get LENOVO_GAMEZONE_DATA instance path");
-            }
-        }
-
         int CallMethodInt(const wchar_t* methodName) noexcept{
-            return LLTCCommonUtils::CallWmiMethodNoParams(m_pServices, m_instancePath, methodName);
+            int result = -1;
+            LLTCCommonUtils::GetDeviceTransport().CallWmiMethod({.methodName = methodName}, &result);
+            return result;
         }
 
         HRESULT CallMethod(const wchar_t* methodName, int paramValue) noexcept{
-            return LLTCCommonUtils::CallWmiMethodWithIntParamFromClassDef(
-                m_pServices,
-                m_instancePath,
-                L"LENOVO_GAMEZONE_DATA",
-                methodName,
-                paramValue
-            );
+            return LLTCCommonUtils::GetDeviceTransport().CallWmiMethod({
+                .methodName = methodName,
+                .paramName = L"Data",
+                .paramValue = paramValue
+            }, nullptr);
         }
     }
     inline bool IsSupported() noexcept {
-        try{
-            InitializeCOMAndWMI();
-        } catch (...) {
-            return false;
-        }
-        return CallMethodInt(L"IsSupportOD") == 1;
+        return LLTCCapabilities::Probe(Capability::OverDrive, []() -> std::optional<bool> {
+            HRESULT hr = LLTCCommonUtils::GetDeviceTransport().ConnectWmi();
+            if (hr == WBEM_E_NOT_FOUND)
+                return false;
+            if (FAILED(hr))
+                return std::nullopt;
+            return CallMethodInt(L"IsSupportOD") == 1;
+        });
     }
 
     inline std::expected<OverDriveState, ResultState> GetState() noexcept {
         if(!IsSupported())
             return std::unexpected(ResultState::NotSupported);
         auto result = intToOverDriveState(CallMethodInt(L"GetODStatus"));
+        if(!result && LLTCCapabilities::Invalidate(Capability::OverDrive)) {
+            // The cached answer may be stale (e.g. a BIOS setting changed): probe again.
+            if(!IsSupported())
+                return std::unexpected(ResultState::NotSupported);
+            result = intToOverDriveState(CallMethodInt(L"GetODStatus"));
+        }
         if(!result)
             return std::unexpected(ResultState::Failed);
         return result.value();
@@ -83,8 +57,10 @@ namespace LLTCOverDrive {
     inline std::expected<void, ResultState> SetState(OverDriveState state) noexcept {
         if(!IsSupported())
             return std::unexpected(ResultState::NotSupported);
-        if(!SUCCEEDED(CallMethod(L"SetODStatus", (state == OverDriveState::On) ? 1 : 0)))
+        if(!SUCCEEDED(CallMethod(L"SetODStatus", (state == OverDriveState::On) ? 1 : 0))) {
+            LLTCCapabilities::Invalidate(Capability::OverDrive);
             return std::unexpected(ResultState::Failed);
+        }
         return {};
     }
 
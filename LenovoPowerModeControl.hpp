@@ -3,78 +3,188 @@
 #include "CommonUtils.hpp"
 #include <optional>
 #include <iostream>
+#include <functional>
+#include <thread>
+#include <condition_variable>
 
 // Declarations
 namespace LLTCPowerMode {
+    using PowerModeCallback = std::function<void(PowerMode)>;
+    class Subscription;
     inline std::expected<PowerMode, ResultState> GetState() noexcept;
     inline std::expected<void, ResultState> SetState(PowerMode mode) noexcept;
+    inline std::expected<Subscription, ResultState> Subscribe(PowerModeCallback callback) noexcept;
 }
 
 // Definitions
 namespace LLTCPowerMode {
     namespace {
-        const std::vector<std::wstring> WmiClassNames = {
-            L"LENOVO_GAMEZONE_DATA",
-            L"Lenovo_GameZone_Data"
-        };
-        std::optional<PowerMode> InternalGetPowerMode(IWbemServices* pSvc) {
+        std::optional<PowerMode> InternalGetPowerMode() {
             using namespace LLTCCommonUtils;
             
-            auto instancePath = GetFirstWmiInstancePath(pSvc, WmiClassNames, WmiPathType::Relative);
-            if (instancePath.empty()) {
-                return std::nullopt;
-            }
-            
-            IWbemClassObject* pOutParams = nullptr;
-            HRESULT hr = pSvc->ExecMethod(
-                _bstr_t(instancePath.c_str()),
-                _bstr_t(L"GetSmartFanMode"),
-                0,
-                nullptr,
-                nullptr,
-                &pOutParams,
-                nullptr
+            int mode = -1;
+            GetDeviceTransport().CallWmiMethod(
+                {.methodName = L"GetSmartFanMode", .pathType = WmiPathType::Relative},
+                &mode
             );
-            
-            if (FAILED(hr) || !pOutParams) {
-                return std::nullopt;
+            if ((mode >= 1 && mode <= 3) || mode == 254) {
+                return static_cast<PowerMode>(mode);
             }
             
-            VARIANT vtProp;
-            VariantInit(&vtProp);
-            hr = pOutParams->Get(L"Data", 0, &vtProp, 0, 0);
-            pOutParams->Release();
+            return std::nullopt;
+        }
+
+        HRESULT SetSmartFanMode(PowerMode mode) {
+            using namespace LLTCCommonUtils;
             
-            if (SUCCEEDED(hr) && vtProp.vt == VT_I4) {
-                int mode = vtProp.lVal;
-                VariantClear(&vtProp);
-                if ((mode >= 1 && mode <= 3) || mode == 254) {
-                    return static_cast<PowerMode>(mode);
+            return GetDeviceTransport().CallWmiMethod({
+                .methodName = L"SetSmartFanMode",
+                .paramName = L"Data",
+                .paramValue = static_cast<int>(mode),
+                .source = WmiInParamsSource::ParametersClass,
+                .pathType = WmiPathType::Relative
+            }, nullptr);
+        }
+
+        constexpr const wchar_t* SmartFanModeEventQuery = L"SELECT * FROM LENOVO_GAMEZONE_SMART_FAN_MODE_EVENT";
+        constexpr auto MinPollInterval = std::chrono::milliseconds(250);
+        constexpr auto MaxPollInterval = std::chrono::milliseconds(4000);
+    }   // namespace
+
+    // Owns a power-mode subscription; the callback stops when this is destroyed.
+    class Subscription {
+    public:
+        Subscription() = default;
+        Subscription(Subscription&&) noexcept = default;
+        Subscription& operator=(Subscription&& other) noexcept;
+        ~Subscription();
+
+        bool IsActive() const noexcept;
+        // False when the GameZone event class is unavailable and polling is used instead.
+        bool IsEventDriven() const noexcept;
+        void Stop() noexcept;
+
+    private:
+        struct State;
+        explicit Subscription(std::shared_ptr<State> state) : m_state(std::move(state)) {}
+        friend std::expected<Subscription, ResultState> Subscribe(PowerModeCallback callback) noexcept;
+
+        std::shared_ptr<State> m_state;
+    };
+
+    struct Subscription::State {
+        PowerModeCallback callback;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopping = false;
+        std::optional<PowerMode> lastMode;
+        std::thread poller;
+        std::atomic<bool> eventDriven = false;
+        std::unique_ptr<LLTCCommonUtils::WmiEventSubscription> events;
+
+        ~State() {
+            Stop();
+        }
+
+        // Returns true if mode differs from the last delivered one.
+        bool Deliver(PowerMode mode) noexcept {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping || lastMode == mode) {
+                    return false;
                 }
+                lastMode = mode;
             }
-            VariantClear(&vtProp);
-            
-            return std::nullopt;
+            try {
+                callback(mode);
+            } catch (...) {
+            }
+            return true;
         }
-    }   // namespace
 
-    inline std::expected<PowerMode, ResultState> GetState() noexcept {
-        HRESULT hr = LLTCCommonUtils::InitializeCOM();
-        if (FAILED(hr)) {
-            return std::unexpected(ResultState::Failed);
+        // Adaptive fallback: poll quickly right after a change, back off while idle.
+        void StartPolling() noexcept {
+            try {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping || poller.joinable()) {
+                    return;
+                }
+                poller = std::thread([this]() {
+                    auto interval = MinPollInterval;
+                    std::unique_lock<std::mutex> lock(mutex);
+                    while (!stopping) {
+                        lock.unlock();
+                        auto mode = InternalGetPowerMode();
+                        bool changed = mode.has_value() && Deliver(mode.value());
+                        lock.lock();
+                        interval = changed ? MinPollInterval : std::min(interval * 2, MaxPollInterval);
+                        cv.wait_for(lock, interval, [this]() { return stopping; });
+                    }
+                });
+            } catch (...) {
+            }
         }
-        
-        IWbemLocator* pLoc = nullptr;
-        IWbemServices* pSvc = nullptr;
-        
-        hr = LLTCCommonUtils::ConnectToWMI(&pLoc, &pSvc);
-        if (SUCCEEDED(hr) && pSvc) {
-            auto currentMode = InternalGetPowerMode(pSvc);
-            if (currentMode.has_value()) {
-                return currentMode.value();
+
+        void Stop() noexcept {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping) {
+                    return;
+                }
+                stopping = true;
+            }
+            cv.notify_all();
+            if (events) {
+                events->Cancel();
+            }
+
+            std::thread pollThread;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pollThread = std::move(poller);
+            }
+            if (pollThread.joinable()) {
+                if (pollThread.get_id() == std::this_thread::get_id()) {
+                    pollThread.detach(); // Stop() called from inside the callback
+                } else {
+                    pollThread.join();
+                }
             }
         }
-        LLTCCommonUtils::UninitializeCOM();
+    };
+
+    inline Subscription& Subscription::operator=(Subscription&& other) noexcept {
+        if (this != &other) {
+            Stop();
+            m_state = std::move(other.m_state);
+        }
+        return *this;
+    }
+
+    inline Subscription::~Subscription() {
+        Stop();
+    }
+
+    inline bool Subscription::IsActive() const noexcept {
+        return m_state != nullptr;
+    }
+
+    inline bool Subscription::IsEventDriven() const noexcept {
+        return m_state && m_state->eventDriven.load();
+    }
+
+    inline void Subscription::Stop() noexcept {
+        if (m_state) {
+            m_state->Stop();
+            m_state.reset();
+        }
+    }
+
+    inline std::expected<PowerMode, ResultState> GetState() noexcept {
+        auto currentMode = InternalGetPowerMode();
+        if (currentMode.has_value()) {
+            return currentMode.value();
+        }
         return std::unexpected(ResultState::Failed);
     }
 
@@ -82,41 +192,70 @@ namespace LLTCPowerMode {
         if(mode == PowerMode::GodMode)
             return std::unexpected(ResultState::NotSupported);
         
-        HRESULT hr = LLTCCommonUtils::InitializeCOM();
-        if (FAILED(hr)) {
-            return std::unexpected(ResultState::Failed);
-        }
-        
-        IWbemLocator* pLoc = nullptr;
-        IWbemServices* pSvc = nullptr;
-        
-        bool result = false;
-        hr = LLTCCommonUtils::ConnectToWMI(&pLoc, &pSvc);
-        if (SUCCEEDED(hr) && pSvc) {
-            auto instancePath = LLTCCommonUtils::GetFirstWmiInstancePath(pSvc, WmiClassNames, LLTCCommonUtils::WmiPathType::Relative);
-            if (!instancePath.empty()) {
-                /* 
-                std::optional<PowerMode> currentMode = InternalGetPowerMode(pSvc);
-                if (currentMode == PowerMode::Quiet && mode == PowerMode::Performance) {
-                    if (!CallWmiMethodWithIntParamFromParameters(pSvc, instancePath, L"SetSmartFanMode", static_cast<int>(PowerMode::Balance))) {
-                        goto cleanup;
-                    }
-                    Sleep(300);
-                }
-                */
-                result = SUCCEEDED(LLTCCommonUtils::CallWmiMethodWithIntParamFromParameters(
-                    pSvc, 
-                    instancePath, 
-                    L"SetSmartFanMode", 
-                    static_cast<int>(mode)
-                ));
+        using namespace LLTCCommonUtils;
+        /* 
+        std::optional<PowerMode> currentMode = InternalGetPowerMode();
+        if (currentMode == PowerMode::Quiet && mode == PowerMode::Performance) {
+            if (FAILED(SetSmartFanMode(PowerMode::Balance))) {
+                return std::unexpected(ResultState::Failed);
             }
+            Sleep(300);
         }
+        */
+        bool result = SUCCEEDED(SetSmartFanMode(mode));
         
-        LLTCCommonUtils::UninitializeCOM();
         if(!result) 
             return std::unexpected(ResultState::Failed);
         return {};
     }
 
+    // Calls callback with the current mode, then on every change (e.g. Fn+Q).
+    // Changes are pushed by LENOVO_GAMEZONE_SMART_FAN_MODE_EVENT when the firmware
+    // provides it, otherwise GetSmartFanMode is polled adaptively. The callback runs
+    // on a WMI or polling thread.
+    inline std::expected<Subscription, ResultState> Subscribe(PowerModeCallback callback) noexcept {
+        using namespace LLTCCommonUtils;
+        
+        if (!callback)
+            return std::unexpected(ResultState::InvalidParameter);
+        
+        try {
+            auto state = std::make_shared<Subscription::State>();
+            state->callback = std::move(callback);
+            
+            auto currentMode = InternalGetPowerMode();
+            if (currentMode.has_value()) {
+                state->Deliver(currentMode.value());
+            }
+            
+            std::weak_ptr<Subscription::State> weakState = state;
+            auto sink = std::make_shared<WmiEventSink>(
+                [weakState](int value) {
+                    auto locked = weakState.lock();
+                    if (!locked) return;
+                    auto mode = intToPowerMode(value);
+                    if (mode) locked->Deliver(mode.value());
+                },
+                [weakState](HRESULT) {
+                    auto locked = weakState.lock();
+                    if (!locked) return;
+                    locked->eventDriven = false;
+                    locked->StartPolling();
+                }
+            );
+            
+            HRESULT hr = GetDeviceTransport().SubscribeEventQuery(
+                SmartFanModeEventQuery, L"mode", std::move(sink), state->events);
+            if (SUCCEEDED(hr)) {
+                state->eventDriven = true;
+            } else {
+                state->StartPolling();
+            }
+            
+            return Subscription(std::move(state));
+        } catch (...) {
+            return std::unexpected(ResultState::Failed);
+        }
+    }
+
 } // namespace LegionPowerMode
\ No newline at end of file
@@ -13,35 +13,14 @@ namespace LLTCWhiteKeyboardBacklight {
     namespace{
         constexpr DWORD IOCTL_ENERGY_KEYBOARD = 0x83102144;
 
-        class DriverHandleSingleton {
-            public:
-                static HANDLE Get() {
-                    static DriverHandleSingleton instance;
-                    return instance.handle_;
-                }
-                ~DriverHandleSingleton() {
-                    if (handle_ != INVALID_HANDLE_VALUE) {
-                        CloseHandle(handle_);
-                    }
-                }
-            private:
-                DriverHandleSingleton() : handle_(LLTCCommonUtils::GetEnergyDriverHandle()) {}
-                HANDLE handle_ = INVALID_HANDLE_VALUE;
-        };
         inline bool ExecuteKeyboardIoctl(uint32_t inBuffer, uint32_t& outBuffer) {
-            HANDLE hDriver = DriverHandleSingleton::Get();
-            if (hDriver == INVALID_HANDLE_VALUE) {
-                return false;
-            }
-
             DWORD bytesReturned = 0;
-            return DeviceIoControl(
-                hDriver,
+            return LLTCCommonUtils::TransportIoControl(
+                LLTCCommonUtils::DeviceKind::EnergyDriver,
                 IOCTL_ENERGY_KEYBOARD,
                 &inBuffer, sizeof(inBuffer),
                 &outBuffer, sizeof(outBuffer),
-                &bytesReturned,
-                nullptr
+                &bytesReturned
             ) && (bytesReturned == sizeof(uint32_t));
         }
         
@@ -57,8 +36,7 @@ namespace LLTCWhiteKeyboardBacklight {
         uint32_t outBuffer = 0;
         if(!ExecuteKeyboardIoctl(0x22, outBuffer))
             return std::unexpected(ResultState::Failed);
-        HANDLE hDriver = LLTCCommonUtils::GetEnergyDriverHandle();
-        if (hDriver == INVALID_HANDLE_VALUE) {
+        if (!LLTCCommonUtils::GetDeviceTransport().IsAvailable(LLTCCommonUtils::DeviceKind::EnergyDriver)) {
             return std::unexpected(ResultState::Failed);
         }
         switch (outBuffer) {
@@ -89,7 +67,7 @@ namespace LLTCWhiteKeyboardBacklight {
             if (currentState.has_value() && currentState.value() == newState) {
                 return {};
             }
-            Sleep(DELAY_MS);
+            std::this_thread::sleep_for(std::chrono::milliseconds(DELAY_MS));
         }
         
         return std::unexpected(ResultState::RetryTimeout);
@@ -0,0 +1,515 @@
+#pragma once
+
+#include "CommonUtils.hpp"
+#include "TelemetryLog.hpp"
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <expected>
+#include <format>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Declarations
+namespace LLTCMetrics {
+    // How often the exporter re-renders its response.
+    constexpr std::chrono::milliseconds DefaultSampleInterval{1000};
+    // Open scrape connections; further clients wait in the listen backlog.
+    constexpr size_t MaxConnections = 32;
+    // Parses "[address:]port"; the address is an IPv4 literal and defaults to 127.0.0.1.
+    inline std::expected<sockaddr_in, ResultState> ParseEndpoint(std::string_view text) noexcept;
+    inline std::string FormatEndpoint(const sockaddr_in& endpoint);
+    // The value of the first unlabelled sample called name in an exposition body.
+    inline std::optional<double> FindSample(std::string_view body, std::string_view name) noexcept;
+    class LatencyHistogram;
+    class MetricsWriter;
+    class MetricsExporter;
+    class ScrapeClient;
+}
+
+// Definitions
+namespace LLTCMetrics {
+    inline std::expected<sockaddr_in, ResultState> ParseEndpoint(std::string_view text) noexcept {
+        sockaddr_in endpoint = {};
+        endpoint.sin_family = AF_INET;
+        endpoint.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::string_view portText = text;
+        if (auto colon = text.rfind(':'); colon != std::string_view::npos) {
+            std::string address(text.substr(0, colon));
+            if (inet_pton(AF_INET, address.c_str(), &endpoint.sin_addr) != 1) {
+                return std::unexpected(ResultState::InvalidParameter);
+            }
+            portText = text.substr(colon + 1);
+        }
+        uint16_t port = 0;
+        auto [ptr, ec] = std::from_chars(portText.data(), portText.data() + portText.size(), port);
+        if (ec != std::errc() || ptr != portText.data() + portText.size() || port == 0) {
+            return std::unexpected(ResultState::InvalidParameter);
+        }
+        endpoint.sin_port = htons(port);
+        return endpoint;
+    }
+
+    inline std::string FormatEndpoint(const sockaddr_in& endpoint) {
+        char address[INET_ADDRSTRLEN] = {};
+        inet_ntop(AF_INET, &endpoint.sin_addr, address, sizeof(address));
+        return std::format("{}:{}", address, ntohs(endpoint.sin_port));
+    }
+
+    inline std::optional<double> FindSample(std::string_view body, std::string_view name) noexcept {
+        for (size_t at = 0; at < body.size();) {
+            size_t end = body.find('\n', at);
+            std::string_view line = body.substr(at, end == std::string_view::npos ? std::string_view::npos : end - at);
+            if (line.size() > name.size() && line.starts_with(name) && line[name.size()] == ' ') {
+                std::string_view text = line.substr(name.size() + 1);
+                double value = 0;
+                auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+                if (ec == std::errc()) {
+                    return value;
+                }
+            }
+            if (end == std::string_view::npos) {
+                break;
+            }
+            at = end + 1;
+        }
+        return std::nullopt;
+    }
+
+    // Fixed-bucket latency histogram. Record is a few relaxed atomic increments,
+    // so it can sit on the request path; readers get per-bucket counts that may
+    // be a request or two apart, which the exposition format tolerates.
+    class LatencyHistogram {
+    public:
+        static constexpr std::array<uint32_t, 14> BoundsUs = {
+            25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000};
+
+        struct Snapshot {
+            std::array<uint64_t, BoundsUs.size() + 1> buckets;  // last: above every bound
+            uint64_t count;
+            uint64_t sumNs;
+        };
+
+        void Record(std::chrono::nanoseconds elapsed) noexcept {
+            int64_t ns = std::max<int64_t>(elapsed.count(), 0);
+            size_t bucket = 0;
+            while (bucket < BoundsUs.size() && ns > static_cast<int64_t>(BoundsUs[bucket]) * 1000) {
+                ++bucket;
+            }
+            m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            m_sumNs.fetch_add(static_cast<uint64_t>(ns), std::memory_order_relaxed);
+        }
+
+        Snapshot Read() const noexcept {
+            Snapshot snapshot = {};
+            for (size_t i = 0; i < m_buckets.size(); ++i) {
+                snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+                snapshot.count += snapshot.buckets[i];
+            }
+            snapshot.sumNs = m_sumNs.load(std::memory_order_relaxed);
+            return snapshot;
+        }
+
+        void Reset() noexcept {
+            for (auto& bucket : m_buckets) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            m_sumNs.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, BoundsUs.size() + 1> m_buckets = {};
+        std::atomic<uint64_t> m_sumNs = 0;
+    };
+
+    // Builds a response body in the Prometheus text exposition format (0.0.4).
+    // Labels are passed preformatted, e.g. `property="pm"`.
+    class MetricsWriter {
+    public:
+        void Family(std::string_view name, std::string_view type, std::string_view help) {
+            std::format_to(std::back_inserter(m_text), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+        }
+
+        void Sample(std::string_view name, std::string_view labels, double value) {
+            if (labels.empty()) {
+                std::format_to(std::back_inserter(m_text), "{} {}\n", name, value);
+            } else {
+                std::format_to(std::back_inserter(m_text), "{}{{{}}} {}\n", name, labels, value);
+            }
+        }
+
+        void Sample(std::string_view name, std::string_view labels, uint64_t value) {
+            if (labels.empty()) {
+                std::format_to(std::back_inserter(m_text), "{} {}\n", name, value);
+            } else {
+                std::format_to(std::back_inserter(m_text), "{}{{{}}} {}\n", name, labels, value);
+            }
+        }
+
+        // Writes name_bucket (cumulative, in seconds), name_sum and name_count.
+        void Histogram(std::string_view name, std::string_view labels, const LatencyHistogram& histogram) {
+            auto snapshot = histogram.Read();
+            std::string_view separator = labels.empty() ? "" : ",";
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < LatencyHistogram::BoundsUs.size(); ++i) {
+                cumulative += snapshot.buckets[i];
+                std::format_to(std::back_inserter(m_text), "{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels, separator,
+                               LatencyHistogram::BoundsUs[i] / 1e6, cumulative);
+            }
+            std::format_to(std::back_inserter(m_text), "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, separator, snapshot.count);
+            std::string sum = std::format("{}_sum", name);
+            std::string count = std::format("{}_count", name);
+            Sample(sum, labels, snapshot.sumNs / 1e9);
+            Sample(count, labels, snapshot.count);
+        }
+
+        std::string Take() noexcept { return std::move(m_text); }
+
+    private:
+        std::string m_text;
+    };
+
+    // Serves GET /metrics on a TCP endpoint. A sampler thread calls the collector
+    // every interval and stores the complete HTTP response (headers and body) as
+    // an immutable buffer; a scrape loads the current buffer's pointer and writes
+    // it. Scrapes never call the collector, so their cost does not depend on how
+    // often they come, and a slow collector never delays one.
+    //
+    // One thread serves every connection with non-blocking sockets and select,
+    // with HTTP/1.1 keep-alive. There is no authentication: bind to loopback
+    // unless the metrics may be read by anyone on the network.
+    class MetricsExporter {
+    public:
+        using Collector = std::function<void(MetricsWriter&)>;
+
+        MetricsExporter(sockaddr_in endpoint, Collector collector, std::chrono::milliseconds interval = DefaultSampleInterval)
+            : m_endpoint(endpoint), m_collector(std::move(collector)), m_interval(interval) {}
+        MetricsExporter(const MetricsExporter&) = delete;
+        MetricsExporter& operator=(const MetricsExporter&) = delete;
+        ~MetricsExporter() {
+            m_stop.Set();
+            for (auto* thread : {&m_sampler, &m_listener}) {
+                if (thread->joinable()) {
+                    thread->join();
+                }
+            }
+            if (m_socket != INVALID_SOCKET) {
+                closesocket(m_socket);
+            }
+            if (m_winsock) {
+                WSACleanup();
+            }
+        }
+
+        // Binds the endpoint, renders the first response and starts serving until
+        // stopEvent is signalled or the exporter is destroyed. Fails with the
+        // Winsock error (errno on Linux), e.g. WSAEADDRINUSE.
+        std::expected<void, int> Start(const LLTCPlatform::Event& stopEvent) noexcept {
+            WSADATA data;
+            if (int error = WSAStartup(MAKEWORD(2, 2), &data); error != 0) {
+                return std::unexpected(error);
+            }
+            m_winsock = true;
+            m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (!m_stop.IsValid() || m_socket == INVALID_SOCKET) {
+                return std::unexpected(WSAGetLastError());
+            }
+            // No SO_REUSEADDR on Windows: there it would let a second exporter steal
+            // the port. Elsewhere it only allows rebinding past TIME_WAIT.
+#ifndef _WIN32
+            int reuse = 1;
+            setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+            if (bind(m_socket, reinterpret_cast<const sockaddr*>(&m_endpoint), sizeof(m_endpoint)) != 0 ||
+                listen(m_socket, SOMAXCONN) != 0 || !setNonBlocking(m_socket)) {
+                return std::unexpected(WSAGetLastError());
+            }
+            render();
+            try {
+                m_sampler = std::thread([this, &stopEvent] { sample(stopEvent); });
+                m_listener = std::thread([this, &stopEvent] { serve(stopEvent); });
+            } catch (...) {
+                return std::unexpected(WSAENOBUFS);
+            }
+            return {};
+        }
+
+        uint64_t Scrapes() const noexcept { return m_scrapes.load(std::memory_order_relaxed); }
+
+    private:
+        struct Connection {
+            SOCKET socket;
+            std::string input;
+            std::shared_ptr<const std::string> output;
+            size_t sent = 0;
+            bool closeAfterSend = false;
+        };
+
+        static bool setNonBlocking(SOCKET socket) noexcept {
+            u_long enabled = 1;
+            return ioctlsocket(socket, FIONBIO, &enabled) == 0;
+        }
+
+        static std::shared_ptr<const std::string> makeResponse(std::string_view status, std::string_view body) {
+            return std::make_shared<const std::string>(std::format(
+                "HTTP/1.1 {}\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: {}\r\n\r\n{}",
+                status, body.size(), body));
+        }
+
+        bool stopping(const LLTCPlatform::Event& stopEvent, DWORD timeoutMs) const noexcept {
+            return LLTCPlatform::WaitAny(stopEvent, m_stop, timeoutMs);
+        }
+
+        void sample(const LLTCPlatform::Event& stopEvent) noexcept {
+            while (!stopping(stopEvent, static_cast<DWORD>(m_interval.count()))) {
+                render();
+            }
+        }
+
+        // Keeps the previous response if rendering fails.
+        void render() noexcept {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                MetricsWriter out;
+                m_collector(out);
+                out.Family("lltc_exporter_scrapes_total", "counter", "Scrapes answered by the metrics exporter.");
+                out.Sample("lltc_exporter_scrapes_total", "", Scrapes());
+                out.Family("lltc_exporter_render_seconds", "gauge", "Time the previous render of this response took.");
+                out.Sample("lltc_exporter_render_seconds", "", m_renderSeconds);
+                out.Family("lltc_exporter_render_timestamp_seconds", "gauge", "When this response was rendered.");
+                out.Sample("lltc_exporter_render_timestamp_seconds", "", LLTCTelemetry::CurrentTimestampUs() / 1e6);
+                out.Family("process_cpu_seconds_total", "counter", "User and kernel CPU time of the lltc process.");
+                out.Sample("process_cpu_seconds_total", "", LLTCPlatform::ProcessCpuSeconds());
+                m_response.store(makeResponse("200 OK", out.Take()), std::memory_order_release);
+            } catch (...) {
+            }
+            m_renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        void serve(const LLTCPlatform::Event& stopEvent) noexcept {
+            std::vector<Connection> connections;
+            std::shared_ptr<const std::string> notFound;
+            std::shared_ptr<const std::string> badMethod;
+            try {
+                connections.reserve(MaxConnections);
+                notFound = makeResponse("404 Not Found", "Metrics are at /metrics.\n");
+                badMethod = makeResponse("405 Method Not Allowed", "Only GET is supported.\n");
+            } catch (...) {
+                return;
+            }
+            while (!stopping(stopEvent, 0)) {
+                fd_set readable;
+                fd_set writable;
+                FD_ZERO(&readable);
+                FD_ZERO(&writable);
+                if (connections.size() < MaxConnections) {
+                    FD_SET(m_socket, &readable);
+                }
+                int highest = static_cast<int>(m_socket);
+                for (auto& connection : connections) {
+                    FD_SET(connection.socket, connection.output ? &writable : &readable);
+                    highest = std::max(highest, static_cast<int>(connection.socket));
+                }
+                // Wakes at least every 100 ms to notice the stop events.
+                timeval timeout = {0, 100000};
+                if (select(highest + 1, &readable, &writable, nullptr, &timeout) <= 0) {
+                    continue;
+                }
+                for (auto& connection : connections) {
+                    if (FD_ISSET(connection.socket, &readable) || FD_ISSET(connection.socket, &writable)) {
+                        if (!advance(connection, notFound, badMethod)) {
+                            closesocket(connection.socket);
+                            connection.socket = INVALID_SOCKET;
+                        }
+                    }
+                }
+                std::erase_if(connections, [](const Connection& connection) { return connection.socket == INVALID_SOCKET; });
+                if (FD_ISSET(m_socket, &readable)) {
+                    SOCKET client = accept(m_socket, nullptr, nullptr);
+                    if (client != INVALID_SOCKET) {
+                        int noDelay = 1;
+                        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+                        if (setNonBlocking(client)) {
+                            connections.emplace_back().socket = client;
+                        } else {
+                            closesocket(client);
+                        }
+                    }
+                }
+            }
+            for (auto& connection : connections) {
+                closesocket(connection.socket);
+            }
+        }
+
+        // Reads, answers and writes as far as the socket allows. False once the
+        // connection should be closed.
+        bool advance(Connection& connection, const std::shared_ptr<const std::string>& notFound,
+                     const std::shared_ptr<const std::string>& badMethod) noexcept {
+            try {
+                if (!connection.output) {
+                    char buffer[4096];
+                    int received = recv(connection.socket, buffer, sizeof(buffer), 0);
+                    if (received <= 0) {
+                        return received < 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+                    }
+                    connection.input.append(buffer, static_cast<size_t>(received));
+                }
+                // Pipelined requests are answered one after the other.
+                while (true) {
+                    if (!connection.output) {
+                        size_t end = connection.input.find("\r\n\r\n");
+                        if (end == std::string::npos) {
+                            return connection.input.size() <= 8192;
+                        }
+                        std::string_view head(connection.input.data(), end);
+                        connection.output = answer(head, connection.closeAfterSend, notFound, badMethod);
+                        connection.sent = 0;
+                        connection.input.erase(0, end + 4);
+                    }
+                    const std::string& output = *connection.output;
+                    while (connection.sent < output.size()) {
+                        int sent = send(connection.socket, output.data() + connection.sent,
+                                        static_cast<int>(output.size() - connection.sent), MSG_NOSIGNAL);
+                        if (sent < 0) {
+                            return WSAGetLastError() == WSAEWOULDBLOCK;
+                        }
+                        connection.sent += static_cast<size_t>(sent);
+                    }
+                    connection.output.reset();
+                    if (connection.closeAfterSend) {
+                        return false;
+                    }
+                }
+            } catch (...) {
+                return false;
+            }
+        }
+
+        std::shared_ptr<const std::string> answer(std::string_view head, bool& closeAfterSend,
+                                                  const std::shared_ptr<const std::string>& notFound,
+                                                  const std::shared_ptr<const std::string>& badMethod) noexcept {
+            std::string_view requestLine = head.substr(0, head.find("\r\n"));
+            closeAfterSend = requestLine.ends_with("HTTP/1.0") || containsCaseless(head, "\nconnection: close");
+            if (!requestLine.starts_with("GET ")) {
+                closeAfterSend = true;
+                return badMethod;
+            }
+            std::string_view target = requestLine.substr(4, requestLine.find(' ', 4) - 4);
+            if (target != "/metrics" && !target.starts_with("/metrics?")) {
+                return notFound;
+            }
+            m_scrapes.fetch_add(1, std::memory_order_relaxed);
+            return m_response.load(std::memory_order_acquire);
+        }
+
+        static bool containsCaseless(std::string_view text, std::string_view lowerNeedle) noexcept {
+            auto lower = [](char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; };
+            for (size_t i = 0; i + lowerNeedle.size() <= text.size(); ++i) {
+                size_t j = 0;
+                while (j < lowerNeedle.size() && lower(text[i + j]) == lowerNeedle[j]) {
+                    ++j;
+                }
+                if (j == lowerNeedle.size()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        sockaddr_in m_endpoint;
+        Collector m_collector;
+        std::chrono::milliseconds m_interval;
+        bool m_winsock = false;
+        LLTCPlatform::Event m_stop;
+        SOCKET m_socket = INVALID_SOCKET;
+        std::atomic<std::shared_ptr<const std::string>> m_response;
+        std::atomic<uint64_t> m_scrapes = 0;
+        double m_renderSeconds = 0;     // sampler thread only
+        std::thread m_sampler;
+        std::thread m_listener;
+    };
+
+    // A keep-alive HTTP client for GET /metrics, used by `lltc loadgen --metrics`.
+    class ScrapeClient {
+    public:
+        ScrapeClient() = default;
+        ScrapeClient(const ScrapeClient&) = delete;
+        ScrapeClient& operator=(const ScrapeClient&) = delete;
+        ~ScrapeClient() { Close(); }
+
+        bool Connect(const sockaddr_in& endpoint) noexcept {
+            Close();
+            m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (m_socket == INVALID_SOCKET) {
+                return false;
+            }
+            int noDelay = 1;
+            setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+            if (connect(m_socket, reinterpret_cast<const sockaddr*>(&endpoint), sizeof(endpoint)) != 0) {
+                Close();
+                return false;
+            }
+            return true;
+        }
+
+        bool IsConnected() const noexcept { return m_socket != INVALID_SOCKET; }
+
+        void Close() noexcept {
+            if (m_socket != INVALID_SOCKET) {
+                closesocket(m_socket);
+                m_socket = INVALID_SOCKET;
+            }
+            m_buffer.clear();
+        }
+
+        // The body of a 200 response, valid until the next call. Any other
+        // outcome closes the connection.
+        std::optional<std::string_view> Scrape() noexcept {
+            static constexpr std::string_view Request = "GET /metrics HTTP/1.1\r\nHost: lltc\r\n\r\n";
+            if (!IsConnected() || send(m_socket, Request.data(), static_cast<int>(Request.size()), MSG_NOSIGNAL) != static_cast<int>(Request.size())) {
+                Close();
+                return std::nullopt;
+            }
+            try {
+                m_buffer.clear();
+                size_t headerEnd = std::string::npos;
+                size_t length = 0;
+                while (headerEnd == std::string::npos || m_buffer.size() < headerEnd + 4 + length) {
+                    char chunk[16384];
+                    int received = recv(m_socket, chunk, sizeof(chunk), 0);
+                    if (received <= 0) {
+                        Close();
+                        return std::nullopt;
+                    }
+                    m_buffer.append(chunk, static_cast<size_t>(received));
+                    if (headerEnd == std::string::npos && (headerEnd = m_buffer.find("\r\n\r\n")) != std::string::npos) {
+                        auto field = std::string_view(m_buffer).substr(0, headerEnd);
+                        size_t at = field.find("Content-Length: ");
+                        if (!field.starts_with("HTTP/1.1 200 ") || at == std::string_view::npos) {
+                            Close();
+                            return std::nullopt;
+                        }
+                        auto value = field.substr(at + 16);
+                        std::from_chars(value.data(), value.data() + value.size(), length);
+                    }
+                }
+                return std::string_view(m_buffer).substr(headerEnd + 4, length);
+            } catch (...) {
+                Close();
+                return std::nullopt;
+            }
+        }
+
+    private:
+        SOCKET m_socket = INVALID_SOCKET;
+        std::string m_buffer;
+    };
+}
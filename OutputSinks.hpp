@@ -0,0 +1,260 @@
+#pragma once
+
+#include "CommonUtils.hpp"
+#include <cstdio>
+#include <memory>
+#include <span>
+
+enum class FsyncPolicy {
+    Never,          // leave persistence to the OS
+    EveryBatch,     // FlushFileBuffers after each batch write
+    Interval        // FlushFileBuffers at most once per SinkOptions::fsyncInterval
+};
+
+struct SinkOptions {
+    uint32_t batchRows = 1;                         // write once this many rows are buffered...
+    std::chrono::milliseconds batchInterval{0};     // ...or the oldest buffered row is this old (0 = off)
+    FsyncPolicy fsync = FsyncPolicy::Never;
+    std::chrono::milliseconds fsyncInterval{0};
+};
+
+struct SinkStats {
+    uint64_t rows = 0;
+    uint64_t writes = 0;
+    uint64_t syncs = 0;
+    uint64_t rotations = 0;
+    uint64_t failedWrites = 0;
+};
+
+// Declarations
+namespace LLTCOutput {
+    class RecordSink;
+    class StdoutSink;
+    class FileSink;
+    class SinkPipeline;
+}
+
+// Definitions
+namespace LLTCOutput {
+    // Buffers rendered rows and writes them in batches. The batch buffer is
+    // reserved up front and reused, so a steady stream of rows costs one write
+    // (and at most one sync) per batch and no allocation.
+    class RecordSink {
+    public:
+        explicit RecordSink(const SinkOptions& options) : m_options(options) {
+            m_options.batchRows = std::max<uint32_t>(m_options.batchRows, 1);
+            m_batch.reserve(std::min<size_t>(m_options.batchRows, 4096) * 256);
+        }
+        virtual ~RecordSink() = default;
+        RecordSink(const RecordSink&) = delete;
+        RecordSink& operator=(const RecordSink&) = delete;
+
+        virtual std::string_view Name() const noexcept = 0;
+
+        // Text that is not a row (headers, JSON brackets) rides along with the
+        // next batch; rows count towards batchRows.
+        void Append(std::string_view text, bool row) noexcept {
+            if (m_batch.empty()) {
+                m_batchStart = std::chrono::steady_clock::now();
+            }
+            m_batch.insert(m_batch.end(), text.begin(), text.end());
+            if (row) {
+                ++m_pendingRows;
+                ++m_stats.rows;
+            }
+            bool full = m_pendingRows >= m_options.batchRows;
+            bool old = m_options.batchInterval.count() > 0 &&
+                       std::chrono::steady_clock::now() - m_batchStart >= m_options.batchInterval;
+            if (full || old) {
+                Flush(false);
+            }
+        }
+
+        // Writes buffered text; `sync` forces a FlushFileBuffers regardless of policy.
+        void Flush(bool sync) noexcept {
+            if (!m_batch.empty()) {
+                if (WriteBatch({m_batch.data(), m_batch.size()})) {
+                    ++m_stats.writes;
+                } else {
+                    ++m_stats.failedWrites;
+                }
+                m_batch.clear();
+                m_pendingRows = 0;
+                auto now = std::chrono::steady_clock::now();
+                if (m_options.fsync == FsyncPolicy::EveryBatch ||
+                    (m_options.fsync == FsyncPolicy::Interval && now - m_lastSync >= m_options.fsyncInterval)) {
+                    sync = true;
+                }
+                m_syncPending = m_options.fsync == FsyncPolicy::Interval && !sync;
+            }
+            if (sync) {
+                m_syncPending = false;
+                if (Sync()) {
+                    ++m_stats.syncs;
+                    m_lastSync = std::chrono::steady_clock::now();
+                }
+            }
+        }
+
+        // When the buffered batch grows too old or a deferred Interval sync falls
+        // due; time_point::max() if neither is pending. Rows may stop arriving, so
+        // the caller waits until then and calls FlushDue.
+        std::chrono::steady_clock::time_point NextDeadline() const noexcept {
+            auto deadline = std::chrono::steady_clock::time_point::max();
+            if (!m_batch.empty() && m_options.batchInterval.count() > 0) {
+                deadline = m_batchStart + m_options.batchInterval;
+            }
+            if (m_syncPending) {
+                deadline = std::min(deadline, m_lastSync + m_options.fsyncInterval);
+            }
+            return deadline;
+        }
+
+        void FlushDue() noexcept {
+            auto now = std::chrono::steady_clock::now();
+            if (!m_batch.empty() && m_options.batchInterval.count() > 0 && now - m_batchStart >= m_options.batchInterval) {
+                Flush(false);
+            } else if (m_syncPending && now - m_lastSync >= m_options.fsyncInterval) {
+                Flush(true);
+            }
+        }
+
+        const SinkStats& GetStats() const noexcept { return m_stats; }
+
+    protected:
+        virtual bool WriteBatch(std::span<const char> data) noexcept = 0;
+        virtual bool Sync() noexcept { return false; }
+
+        SinkStats m_stats;
+
+    private:
+        SinkOptions m_options;
+        std::vector<char> m_batch;
+        uint32_t m_pendingRows = 0;
+        bool m_syncPending = false;     // written since the last sync under FsyncPolicy::Interval
+        std::chrono::steady_clock::time_point m_batchStart;
+        std::chrono::steady_clock::time_point m_lastSync = std::chrono::steady_clock::now();
+    };
+
+    // Writes through the C stdout stream so batches stay ordered with std::print.
+    class StdoutSink : public RecordSink {
+    public:
+        using RecordSink::RecordSink;
+        std::string_view Name() const noexcept override { return "stdout"; }
+
+    protected:
+        bool WriteBatch(std::span<const char> data) noexcept override {
+            bool ok = std::fwrite(data.data(), 1, data.size(), stdout) == data.size();
+            return std::fflush(stdout) == 0 && ok;
+        }
+    };
+
+    // Appends to a file. With maxBytes set, the file is rotated before a batch
+    // would push it past the limit: path -> path.1 -> ... -> path.<keep>.
+    class FileSink : public RecordSink {
+    public:
+        FileSink(const std::wstring& path, const SinkOptions& options, uint64_t maxBytes = 0, uint32_t keep = 0)
+            : RecordSink(options), m_path(path), m_maxBytes(maxBytes), m_keep(keep) {
+            Open();
+        }
+        ~FileSink() override {
+            Flush(false);
+            Close();
+        }
+
+        std::string_view Name() const noexcept override { return m_maxBytes ? "rotating file" : "file"; }
+        bool IsOpen() const noexcept { return m_file.IsOpen(); }
+
+    protected:
+        bool WriteBatch(std::span<const char> data) noexcept override {
+            if (m_maxBytes && m_size > 0 && m_size + data.size() > m_maxBytes) {
+                Rotate();
+            }
+            if (!IsOpen()) {
+                return false;
+            }
+            size_t written = 0;
+            bool ok = m_file.Write(data.data(), data.size(), &written);
+            m_size += written;
+            return ok;
+        }
+
+        bool Sync() noexcept override {
+            return IsOpen() && m_file.Sync();
+        }
+
+    private:
+        void Open() noexcept {
+            m_size = m_file.Open(m_path, LLTCPlatform::FileAccess::Append) ? m_file.Size().value_or(0) : 0;
+        }
+
+        void Close() noexcept {
+            m_file.Close();
+        }
+
+        void Rotate() noexcept {
+            Close();
+            auto numbered = [this](uint32_t index) { return std::filesystem::path(m_path + L"." + std::to_wstring(index)); };
+            std::error_code error;
+            if (m_keep == 0) {
+                std::filesystem::remove(m_path, error);
+            } else {
+                for (uint32_t index = m_keep; index > 1; --index) {
+                    std::filesystem::rename(numbered(index - 1), numbered(index), error);
+                }
+                std::filesystem::rename(m_path, numbered(1), error);
+            }
+            ++m_stats.rotations;
+            Open();
+        }
+
+        std::wstring m_path;
+        uint64_t m_maxBytes;
+        uint32_t m_keep;
+        uint64_t m_size = 0;
+        LLTCPlatform::File m_file;
+    };
+
+    // Fans each row out to every sink.
+    class SinkPipeline {
+    public:
+        void Add(std::unique_ptr<RecordSink> sink) { m_sinks.push_back(std::move(sink)); }
+        bool Empty() const noexcept { return m_sinks.empty(); }
+
+        void Append(std::string_view text, bool row) noexcept {
+            for (auto& sink : m_sinks) {
+                sink->Append(text, row);
+            }
+        }
+
+        void Flush(bool sync) noexcept {
+            for (auto& sink : m_sinks) {
+                sink->Flush(sync);
+            }
+        }
+
+        std::chrono::steady_clock::time_point NextDeadline() const noexcept {
+            auto deadline = std::chrono::steady_clock::time_point::max();
+            for (const auto& sink : m_sinks) {
+                deadline = std::min(deadline, sink->NextDeadline());
+            }
+            return deadline;
+        }
+
+        void FlushDue() noexcept {
+            for (auto& sink : m_sinks) {
+                sink->FlushDue();
+            }
+        }
+
+        template<typename Fn>
+        void ForEachSink(Fn&& fn) const {
+            for (const auto& sink : m_sinks) {
+                fn(*sink);
+            }
+        }
+
+    private:
+        std::vector<std::unique_ptr<RecordSink>> m_sinks;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,594 @@
+#pragma once
+
+// Operating system layer. On Windows this is the SDK. Elsewhere a shim supplies
+// the Win32 scalar types, status codes, battery class structures and Winsock
+// names that the shared code is written against; the device handles and WMI
+// over COM only exist in the Windows backend (CommonUtils.hpp), so other
+// systems run against a stand-in transport such as the simulator.
+//
+// LLTCPlatform wraps the few OS objects the shared code needs on both sides:
+// a manual-reset event, files, file mappings and the local clock.
+
+#ifdef _WIN32
+#define NOMINMAX
+// Before windows.h, which would otherwise pull in the old winsock.h.
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <setupapi.h>
+#include <batclass.h>
+
+#include <wbemidl.h>
+#include <comdef.h>
+#include <wrl/client.h>
+
+// Sockets never raise SIGPIPE on Windows.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+
+#ifndef _WIN32
+using BYTE = uint8_t;
+using WORD = uint16_t;
+using DWORD = uint32_t;
+using UINT = unsigned int;
+using ULONG = uint32_t;
+using LONG = int32_t;
+using BOOL = int;
+using HRESULT = int32_t;
+using ULONG_PTR = uintptr_t;
+using HANDLE = void*;
+
+constexpr DWORD INFINITE = 0xFFFFFFFF;
+
+constexpr DWORD ERROR_SUCCESS = 0;
+constexpr DWORD ERROR_ACCESS_DENIED = 5;
+constexpr DWORD ERROR_INVALID_HANDLE = 6;
+constexpr DWORD ERROR_NOT_ENOUGH_MEMORY = 8;
+constexpr DWORD ERROR_INVALID_DATA = 13;
+constexpr DWORD ERROR_GEN_FAILURE = 31;
+constexpr DWORD ERROR_NOT_SUPPORTED = 50;
+constexpr DWORD ERROR_SEM_TIMEOUT = 121;
+constexpr DWORD ERROR_IO_PENDING = 997;
+constexpr DWORD ERROR_SHUTDOWN_IN_PROGRESS = 1115;
+constexpr DWORD ERROR_CANCELLED = 1223;
+constexpr DWORD ERROR_TIMEOUT = 1460;
+
+constexpr HRESULT S_OK = 0;
+constexpr HRESULT S_FALSE = 1;
+constexpr HRESULT E_PENDING = static_cast<HRESULT>(0x8000000A);
+constexpr HRESULT E_POINTER = static_cast<HRESULT>(0x80004003);
+constexpr HRESULT E_FAIL = static_cast<HRESULT>(0x80004005);
+constexpr HRESULT E_UNEXPECTED = static_cast<HRESULT>(0x8000FFFF);
+constexpr HRESULT E_OUTOFMEMORY = static_cast<HRESULT>(0x8007000E);
+constexpr HRESULT WBEM_E_NOT_FOUND = static_cast<HRESULT>(0x80041002);
+constexpr HRESULT WBEM_E_INVALID_CLASS = static_cast<HRESULT>(0x80041010);
+constexpr HRESULT WBEM_E_METHOD_NOT_IMPLEMENTED = static_cast<HRESULT>(0x80041055);
+constexpr HRESULT WBEM_E_TIMED_OUT = static_cast<HRESULT>(0x80043001);
+constexpr DWORD WBEM_INFINITE = 0xFFFFFFFF;
+
+constexpr bool FAILED(HRESULT hr) noexcept { return hr < 0; }
+constexpr bool SUCCEEDED(HRESULT hr) noexcept { return hr >= 0; }
+
+inline DWORD& LastErrorSlot() noexcept {
+    thread_local DWORD error = ERROR_SUCCESS;
+    return error;
+}
+inline DWORD GetLastError() noexcept { return LastErrorSlot(); }
+inline void SetLastError(DWORD error) noexcept { LastErrorSlot() = error; }
+
+struct SYSTEMTIME {
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+};
+
+struct SYSTEM_POWER_STATUS {
+    BYTE ACLineStatus;
+    BYTE BatteryFlag;
+    BYTE BatteryLifePercent;
+    BYTE SystemStatusFlag;
+    DWORD BatteryLifeTime;
+    DWORD BatteryFullLifeTime;
+};
+
+// Battery class driver interface (batclass.h).
+enum BATTERY_QUERY_INFORMATION_LEVEL {
+    BatteryInformation = 0,
+    BatteryGranularityInformation,
+    BatteryTemperature,
+    BatteryEstimatedTime,
+    BatteryDeviceName,
+    BatteryManufactureDate,
+    BatteryManufactureName,
+    BatteryUniqueID,
+    BatterySerialNumber
+};
+
+struct BATTERY_QUERY_INFORMATION {
+    ULONG BatteryTag;
+    BATTERY_QUERY_INFORMATION_LEVEL InformationLevel;
+    LONG AtRate;
+};
+
+struct BATTERY_INFORMATION {
+    ULONG Capabilities;
+    BYTE Technology;
+    BYTE Reserved[3];
+    BYTE Chemistry[4];
+    ULONG DesignedCapacity;
+    ULONG FullChargedCapacity;
+    ULONG DefaultAlert1;
+    ULONG DefaultAlert2;
+    ULONG CriticalBias;
+    ULONG CycleCount;
+};
+
+struct BATTERY_WAIT_STATUS {
+    ULONG BatteryTag;
+    ULONG Timeout;
+    ULONG PowerState;
+    ULONG LowCapacity;
+    ULONG HighCapacity;
+};
+
+struct BATTERY_STATUS {
+    ULONG PowerState;
+    ULONG Capacity;
+    ULONG Voltage;
+    LONG Rate;
+};
+
+constexpr DWORD IOCTL_BATTERY_QUERY_TAG = 0x294040;
+constexpr DWORD IOCTL_BATTERY_QUERY_INFORMATION = 0x294044;
+constexpr DWORD IOCTL_BATTERY_QUERY_STATUS = 0x29404C;
+constexpr ULONG BATTERY_POWER_ON_LINE = 0x1;
+constexpr ULONG BATTERY_DISCHARGING = 0x2;
+constexpr ULONG BATTERY_CHARGING = 0x4;
+constexpr ULONG BATTERY_CRITICAL = 0x8;
+constexpr ULONG BATTERY_UNKNOWN_CAPACITY = 0xFFFFFFFF;
+constexpr LONG BATTERY_UNKNOWN_RATE = static_cast<LONG>(0x80000000);
+
+// Winsock names over BSD sockets.
+using SOCKET = int;
+using u_long = unsigned long;
+struct WSADATA {};
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int WSAEWOULDBLOCK = EWOULDBLOCK;
+constexpr int WSAENOBUFS = ENOBUFS;
+constexpr int WSAEADDRINUSE = EADDRINUSE;
+constexpr WORD MAKEWORD(BYTE low, BYTE high) noexcept { return static_cast<WORD>(low | (high << 8)); }
+inline int WSAStartup(WORD, WSADATA*) noexcept { return 0; }
+inline int WSACleanup() noexcept { return 0; }
+inline int WSAGetLastError() noexcept { return errno; }
+inline int closesocket(SOCKET socket) noexcept { return close(socket); }
+inline int ioctlsocket(SOCKET socket, unsigned long command, u_long* argument) noexcept {
+    int value = static_cast<int>(*argument);
+    return ioctl(socket, command, &value);
+}
+#endif
+
+// Declarations
+namespace LLTCPlatform {
+#ifdef _WIN32
+    using NativeEvent = HANDLE;
+    using NativeFile = HANDLE;
+#else
+    using NativeEvent = int;
+    using NativeFile = int;
+#endif
+    class Event;
+    // True if either event is signalled within timeoutMs.
+    inline bool WaitAny(const Event& first, const Event& second, DWORD timeoutMs) noexcept;
+    enum class FileAccess {
+        Read,           // existing file, read-only; others may read, write and delete it
+        ReadWrite,      // created if missing; others may read it
+        Append,         // created if missing; every write goes to the end
+        Replace         // created or truncated, write-only, not shared
+    };
+    class File;
+    class FileMapping;
+    inline SYSTEMTIME LocalTime() noexcept;
+    // User plus kernel CPU time of this process.
+    inline double ProcessCpuSeconds() noexcept;
+}
+
+// Definitions
+namespace LLTCPlatform {
+#ifndef _WIN32
+    namespace {
+        // poll() that restarts after signals until timeoutMs has passed.
+        inline int PollFor(pollfd* entries, nfds_t count, DWORD timeoutMs) noexcept {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+            while (true) {
+                int waitMs = -1;
+                if (timeoutMs != INFINITE) {
+                    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                    waitMs = static_cast<int>(std::max<long long>(remaining.count(), 0));
+                }
+                int ready = poll(entries, count, waitMs);
+                if (ready >= 0 || errno != EINTR) {
+                    return ready;
+                }
+            }
+        }
+    }
+#endif
+
+    // A manual-reset event: once Set, every wait returns at once. On POSIX it is
+    // an eventfd, readable once set, so it can join a poll() set; Set only
+    // writes to it and may be called from a signal handler.
+    class Event {
+    public:
+        Event() noexcept {
+#ifdef _WIN32
+            m_handle = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+#else
+            m_handle = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#endif
+        }
+        ~Event() {
+            if (IsValid()) {
+#ifdef _WIN32
+                CloseHandle(m_handle);
+#else
+                close(m_handle);
+#endif
+            }
+        }
+        Event(const Event&) = delete;
+        Event& operator=(const Event&) = delete;
+
+        bool IsValid() const noexcept {
+#ifdef _WIN32
+            return m_handle != nullptr;
+#else
+            return m_handle >= 0;
+#endif
+        }
+
+        void Set() noexcept {
+#ifdef _WIN32
+            SetEvent(m_handle);
+#else
+            uint64_t one = 1;
+            ssize_t written = write(m_handle, &one, sizeof(one));
+            (void)written;
+#endif
+        }
+
+        // True once the event is set, false if timeoutMs passed first.
+        bool Wait(DWORD timeoutMs = INFINITE) const noexcept {
+#ifdef _WIN32
+            return WaitForSingleObject(m_handle, timeoutMs) == WAIT_OBJECT_0;
+#else
+            pollfd entry = {m_handle, POLLIN, 0};
+            return PollFor(&entry, 1, timeoutMs) > 0;
+#endif
+        }
+
+        bool IsSet() const noexcept { return Wait(0); }
+
+        NativeEvent Native() const noexcept { return m_handle; }
+
+    private:
+#ifdef _WIN32
+        HANDLE m_handle = nullptr;
+#else
+        int m_handle = -1;
+#endif
+    };
+
+    inline bool WaitAny(const Event& first, const Event& second, DWORD timeoutMs) noexcept {
+#ifdef _WIN32
+        HANDLE handles[2] = {first.Native(), second.Native()};
+        return WaitForMultipleObjects(2, handles, FALSE, timeoutMs) != WAIT_TIMEOUT;
+#else
+        pollfd entries[2] = {{first.Native(), POLLIN, 0}, {second.Native(), POLLIN, 0}};
+        return PollFor(entries, 2, timeoutMs) != 0;
+#endif
+    }
+
+    // An open file, closed on destruction.
+    class File {
+    public:
+        File() = default;
+        ~File() { Close(); }
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        bool Open(const std::filesystem::path& path, FileAccess access) noexcept {
+            Close();
+#ifdef _WIN32
+            DWORD desired = GENERIC_READ;
+            DWORD share = FILE_SHARE_READ;
+            DWORD disposition = OPEN_ALWAYS;
+            switch (access) {
+                case FileAccess::Read:
+                    share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+                    disposition = OPEN_EXISTING;
+                    break;
+                case FileAccess::ReadWrite:
+                    desired = GENERIC_READ | GENERIC_WRITE;
+                    break;
+                case FileAccess::Append:
+                    desired = FILE_APPEND_DATA;
+                    share = FILE_SHARE_READ | FILE_SHARE_DELETE;
+                    break;
+                case FileAccess::Replace:
+                    desired = GENERIC_WRITE;
+                    share = 0;
+                    disposition = CREATE_ALWAYS;
+                    break;
+            }
+            m_handle = CreateFileW(path.c_str(), desired, share, nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+            int flags = O_CLOEXEC;
+            switch (access) {
+                case FileAccess::Read:      flags |= O_RDONLY; break;
+                case FileAccess::ReadWrite: flags |= O_RDWR | O_CREAT; break;
+                case FileAccess::Append:    flags |= O_WRONLY | O_APPEND | O_CREAT; break;
+                case FileAccess::Replace:   flags |= O_WRONLY | O_CREAT | O_TRUNC; break;
+            }
+            m_handle = open(path.c_str(), flags, 0644);
+#endif
+            return IsOpen();
+        }
+
+        bool IsOpen() const noexcept {
+#ifdef _WIN32
+            return m_handle != INVALID_HANDLE_VALUE;
+#else
+            return m_handle >= 0;
+#endif
+        }
+
+        void Close() noexcept {
+            if (IsOpen()) {
+#ifdef _WIN32
+                CloseHandle(m_handle);
+                m_handle = INVALID_HANDLE_VALUE;
+#else
+                close(m_handle);
+                m_handle = -1;
+#endif
+            }
+        }
+
+        std::optional<uint64_t> Size() const noexcept {
+#ifdef _WIN32
+            LARGE_INTEGER size = {};
+            if (!GetFileSizeEx(m_handle, &size)) {
+                return std::nullopt;
+            }
+            return static_cast<uint64_t>(size.QuadPart);
+#else
+            struct stat status = {};
+            if (fstat(m_handle, &status) != 0) {
+                return std::nullopt;
+            }
+            return static_cast<uint64_t>(status.st_size);
+#endif
+        }
+
+        // One read of up to size bytes at the current position.
+        bool Read(void* data, size_t size, size_t& read) noexcept {
+            read = 0;
+#ifdef _WIN32
+            DWORD count = 0;
+            if (!ReadFile(m_handle, data, static_cast<DWORD>(size), &count, nullptr)) {
+                return false;
+            }
+            read = count;
+            return true;
+#else
+            ssize_t count;
+            do {
+                count = ::read(m_handle, data, size);
+            } while (count < 0 && errno == EINTR);
+            if (count < 0) {
+                return false;
+            }
+            read = static_cast<size_t>(count);
+            return true;
+#endif
+        }
+
+        // Writes all of data; written is what reached the file, also on failure.
+        bool Write(const void* data, size_t size, size_t* written = nullptr) noexcept {
+            size_t done = 0;
+            bool ok = true;
+            while (ok && done < size) {
+#ifdef _WIN32
+                DWORD count = 0;
+                ok = WriteFile(m_handle, static_cast<const uint8_t*>(data) + done, static_cast<DWORD>(size - done), &count, nullptr) &&
+                     count > 0;
+                done += count;
+#else
+                ssize_t count = ::write(m_handle, static_cast<const uint8_t*>(data) + done, size - done);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                ok = count > 0;
+                done += ok ? static_cast<size_t>(count) : 0;
+#endif
+            }
+            if (written) {
+                *written = done;
+            }
+            return ok;
+        }
+
+        // Cuts or extends the file to size and moves the position there.
+        bool Truncate(uint64_t size) noexcept {
+#ifdef _WIN32
+            LARGE_INTEGER target;
+            target.QuadPart = static_cast<long long>(size);
+            return SetFilePointerEx(m_handle, target, nullptr, FILE_BEGIN) && SetEndOfFile(m_handle);
+#else
+            return ftruncate(m_handle, static_cast<off_t>(size)) == 0 &&
+                   lseek(m_handle, static_cast<off_t>(size), SEEK_SET) >= 0;
+#endif
+        }
+
+        // Waits until the written data is on the disk.
+        bool Sync() noexcept {
+#ifdef _WIN32
+            return FlushFileBuffers(m_handle);
+#else
+            return fsync(m_handle) == 0;
+#endif
+        }
+
+        NativeFile Native() const noexcept { return m_handle; }
+
+    private:
+#ifdef _WIN32
+        HANDLE m_handle = INVALID_HANDLE_VALUE;
+#else
+        int m_handle = -1;
+#endif
+    };
+
+    // A view of a whole file. It stays valid after the file is closed.
+    class FileMapping {
+    public:
+        FileMapping() = default;
+        ~FileMapping() { Unmap(); }
+        FileMapping(const FileMapping&) = delete;
+        FileMapping& operator=(const FileMapping&) = delete;
+
+        // size is the file's current size.
+        bool Map(const File& file, uint64_t size, bool writable) noexcept {
+            Unmap();
+#ifdef _WIN32
+            m_mapping = CreateFileMappingW(file.Native(), nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+            if (!m_mapping) {
+                return false;
+            }
+            m_data = static_cast<uint8_t*>(MapViewOfFile(m_mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+#else
+            void* view = mmap(nullptr, static_cast<size_t>(size), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                              MAP_SHARED, file.Native(), 0);
+            m_data = (view == MAP_FAILED) ? nullptr : static_cast<uint8_t*>(view);
+#endif
+            m_size = size;
+            if (!m_data) {
+                Unmap();
+                return false;
+            }
+            return true;
+        }
+
+        void Unmap() noexcept {
+#ifdef _WIN32
+            if (m_data) {
+                UnmapViewOfFile(m_data);
+            }
+            if (m_mapping) {
+                CloseHandle(m_mapping);
+                m_mapping = nullptr;
+            }
+#else
+            if (m_data) {
+                munmap(m_data, static_cast<size_t>(m_size));
+            }
+#endif
+            m_data = nullptr;
+            m_size = 0;
+        }
+
+        // Hands dirty pages to the OS without waiting for the disk.
+        void Flush() noexcept {
+            if (m_data) {
+#ifdef _WIN32
+                FlushViewOfFile(m_data, 0);
+#else
+                msync(m_data, static_cast<size_t>(m_size), MS_ASYNC);
+#endif
+            }
+        }
+
+        uint8_t* Data() const noexcept { return m_data; }
+        uint64_t Size() const noexcept { return m_size; }
+
+    private:
+#ifdef _WIN32
+        HANDLE m_mapping = nullptr;
+#endif
+        uint8_t* m_data = nullptr;
+        uint64_t m_size = 0;
+    };
+
+    inline SYSTEMTIME LocalTime() noexcept {
+        SYSTEMTIME time = {};
+#ifdef _WIN32
+        GetLocalTime(&time);
+#else
+        timespec now = {};
+        clock_gettime(CLOCK_REALTIME, &now);
+        tm local = {};
+        localtime_r(&now.tv_sec, &local);
+        time.wYear = static_cast<WORD>(local.tm_year + 1900);
+        time.wMonth = static_cast<WORD>(local.tm_mon + 1);
+        time.wDayOfWeek = static_cast<WORD>(local.tm_wday);
+        time.wDay = static_cast<WORD>(local.tm_mday);
+        time.wHour = static_cast<WORD>(local.tm_hour);
+        time.wMinute = static_cast<WORD>(local.tm_min);
+        time.wSecond = static_cast<WORD>(local.tm_sec);
+        time.wMilliseconds = static_cast<WORD>(now.tv_nsec / 1000000);
+#endif
+        return time;
+    }
+
+    inline double ProcessCpuSeconds() noexcept {
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+            return 0;
+        }
+        auto ticks = [](const FILETIME& time) {
+            return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+        };
+        return (ticks(kernel) + ticks(user)) / 1e7;
+#else
+        rusage usage = {};
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+        auto seconds = [](const timeval& time) { return time.tv_sec + time.tv_usec / 1e6; };
+        return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+#endif
+    }
+}
\ No newline at end of file
@@ -0,0 +1,342 @@
+#pragma once
+
+#include "CommonUtils.hpp"
+#include "OutputSinks.hpp"
+#include <charconv>
+#include <concepts>
+#include <cstdio>
+#include <format>
+
+// Declarations
+namespace LLTCOutput {
+    class RecordWriter;
+    inline RecordWriter& Output() noexcept;
+}
+
+// Definitions
+namespace LLTCOutput {
+    // Serialises flat records as JSON, NDJSON or CSV. Each record is built in a
+    // fixed buffer and written with one fwrite, so steady-state output (e.g. a
+    // -dmon row) does not allocate. Numbers go through std::to_chars directly;
+    // per-call std::format_to_n overhead dominated a row otherwise.
+    //
+    // JSON prints a bare object per record, or an array when the records are
+    // wrapped in BeginStream()/EndStream(). CSV prints a header line before the
+    // first record. Output goes to the stream given at construction, or to a
+    // SinkPipeline once one is attached.
+    class RecordWriter {
+    public:
+        explicit RecordWriter(std::FILE* stream) noexcept : m_stream(stream) {}
+        RecordWriter(const RecordWriter&) = delete;
+        RecordWriter& operator=(const RecordWriter&) = delete;
+
+        void SetFormat(OutputFormat format) noexcept { m_format = format; }
+        OutputFormat Format() const noexcept { return m_format; }
+        bool IsText() const noexcept { return m_format == OutputFormat::Text; }
+
+        void SetPipeline(SinkPipeline* pipeline) noexcept { m_pipeline = pipeline; }
+
+        // Sends already rendered text (a text-mode row or header) the same way as records.
+        bool Emit(std::string_view text, bool row) noexcept {
+            if (m_pipeline) {
+                m_pipeline->Append(text, row);
+                return true;
+            }
+            return std::fwrite(text.data(), 1, text.size(), m_stream) == text.size();
+        }
+
+        void BeginStream() noexcept {
+            m_streaming = true;
+            m_records = 0;
+        }
+
+        void EndStream() noexcept {
+            if (m_streaming && m_format == OutputFormat::Json) {
+                Emit(m_records ? "\n]\n" : "[]\n", false);
+                if (!m_pipeline) {
+                    std::fflush(m_stream);
+                }
+            }
+            m_streaming = false;
+        }
+
+        RecordWriter& Begin() noexcept {
+            m_length = 0;
+            m_headerLength = 0;
+            m_fields = 0;
+            m_overflow = false;
+            if (m_format == OutputFormat::Json || m_format == OutputFormat::Ndjson) {
+                if (m_streaming && m_format == OutputFormat::Json) {
+                    AppendRaw(m_records ? ",\n" : "[\n");
+                }
+                AppendRaw("{");
+            }
+            return *this;
+        }
+
+        RecordWriter& Field(std::string_view key, std::string_view value) noexcept {
+            Key(key);
+            if (m_format == OutputFormat::Csv) {
+                AppendCsvString(value);
+            } else {
+                AppendJsonString(value);
+            }
+            return *this;
+        }
+
+        RecordWriter& Field(std::string_view key, const char* value) noexcept {
+            return Field(key, std::string_view(value));
+        }
+
+        RecordWriter& Field(std::string_view key, bool value) noexcept {
+            Key(key);
+            AppendRaw(value ? "true" : "false");
+            return *this;
+        }
+
+        template<typename T>
+            requires std::integral<T> && (!std::same_as<T, bool>)
+        RecordWriter& Field(std::string_view key, T value) noexcept {
+            Key(key);
+            if (char* at = Reserve(24)) {
+                m_length = std::to_chars(at, m_buffer + BufferSize, value).ptr - m_buffer;
+            }
+            return *this;
+        }
+
+        // Fixed-point; NaN and infinities are written as null.
+        RecordWriter& Field(std::string_view key, double value, int precision) noexcept {
+            if (!std::isfinite(value)) {
+                return Null(key);
+            }
+            Key(key);
+            if (char* at = Reserve(1)) {
+                if (char* end = FixedFromScaled(at, value, precision)) {
+                    m_length = end - m_buffer;
+                    return *this;
+                }
+                auto result = std::to_chars(at, m_buffer + BufferSize, value, std::chars_format::fixed, precision);
+                if (result.ec == std::errc()) {
+                    m_length = result.ptr - m_buffer;
+                } else {
+                    m_overflow = true;
+                }
+            }
+            return *this;
+        }
+
+        // JSON null; an empty CSV cell.
+        RecordWriter& Null(std::string_view key) noexcept {
+            Key(key);
+            if (m_format != OutputFormat::Csv) {
+                AppendRaw("null");
+            }
+            return *this;
+        }
+
+        // ISO 8601 local time, with milliseconds if requested.
+        RecordWriter& Field(std::string_view key, const SYSTEMTIME& time, bool milliseconds) noexcept {
+            Key(key);
+            char* at = Reserve(25);
+            if (!at) {
+                return *this;
+            }
+            char* p = at;
+            if (m_format != OutputFormat::Csv) {
+                *p++ = '"';
+            }
+            p = Digits(p, time.wYear, 4);
+            *p++ = '-';
+            p = Digits(p, time.wMonth, 2);
+            *p++ = '-';
+            p = Digits(p, time.wDay, 2);
+            *p++ = 'T';
+            p = Digits(p, time.wHour, 2);
+            *p++ = ':';
+            p = Digits(p, time.wMinute, 2);
+            *p++ = ':';
+            p = Digits(p, time.wSecond, 2);
+            if (milliseconds) {
+                *p++ = '.';
+                p = Digits(p, time.wMilliseconds, 3);
+            }
+            if (m_format != OutputFormat::Csv) {
+                *p++ = '"';
+            }
+            m_length = p - m_buffer;
+            return *this;
+        }
+
+        // Writes the record. Returns false if it did not fit the buffer (nothing
+        // is written) or the write failed.
+        bool End() noexcept {
+            if (m_format == OutputFormat::Csv) {
+                AppendRaw("\n");
+                if (!m_csvHeaderWritten && !m_overflow) {
+                    m_header[m_headerLength++] = '\n';
+                    Emit({m_header, m_headerLength}, false);
+                    m_csvHeaderWritten = true;
+                }
+            } else {
+                AppendRaw("}");
+                if (!(m_streaming && m_format == OutputFormat::Json)) {
+                    AppendRaw("\n");
+                }
+            }
+            if (m_overflow) {
+                return false;
+            }
+            ++m_records;
+            return Emit({m_buffer, m_length}, true);
+        }
+
+    private:
+        static constexpr size_t BufferSize = 2048;
+
+        void Key(std::string_view key) noexcept {
+            bool first = (m_fields++ == 0);
+            if (m_format == OutputFormat::Csv) {
+                if (!first) {
+                    AppendRaw(",");
+                }
+                if (!m_csvHeaderWritten && m_headerLength + key.size() + 2 < sizeof(m_header)) {
+                    if (!first) {
+                        m_header[m_headerLength++] = ',';
+                    }
+                    std::memcpy(m_header + m_headerLength, key.data(), key.size());
+                    m_headerLength += key.size();
+                }
+                return;
+            }
+            AppendRaw(first ? "\"" : ",\"");
+            AppendRaw(key);
+            AppendRaw("\":");
+        }
+
+        // Space for `size` more bytes, or nullptr (and the record is dropped).
+        char* Reserve(size_t size) noexcept {
+            if (size > BufferSize - m_length) {
+                m_overflow = true;
+                m_length = BufferSize;
+                return nullptr;
+            }
+            return m_buffer + m_length;
+        }
+
+        // The same text as to_chars(fixed, precision), built from value * 10^precision
+        // rounded to an integer, which costs a fraction of it. Below 2^40 the
+        // product is within 2^-13 of the exact one, so it rounds the same way unless
+        // it is that close to a tie. Returns nullptr for those, for larger values and
+        // when fewer than 24 bytes are free; the caller then uses to_chars.
+        char* FixedFromScaled(char* out, double value, int precision) noexcept {
+            static constexpr uint32_t Scale[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+            if (precision < 0 || precision > 6 || m_buffer + BufferSize - out < 24) {
+                return nullptr;
+            }
+            double scaled = std::abs(value) * Scale[precision];
+            if (!(scaled < 0x1p40)) {
+                return nullptr;
+            }
+            double whole = std::floor(scaled);
+            double fraction = scaled - whole;
+            if (std::abs(fraction - 0.5) < 1e-3) {
+                return nullptr;
+            }
+            uint64_t units = static_cast<uint64_t>(whole) + (fraction > 0.5 ? 1 : 0);
+            if (std::signbit(value)) {
+                *out++ = '-';
+            }
+            out = std::to_chars(out, out + 20, units / Scale[precision]).ptr;
+            if (precision > 0) {
+                *out++ = '.';
+                out = Digits(out, static_cast<unsigned>(units % Scale[precision]), precision);
+            }
+            return out;
+        }
+
+        static char* Digits(char* out, unsigned value, int width) noexcept {
+            for (int i = width - 1; i >= 0; --i) {
+                out[i] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+            return out + width;
+        }
+
+        template<typename... Args>
+        void Append(std::format_string<Args...> fmt, Args&&... args) noexcept {
+            size_t room = BufferSize - m_length;
+            auto result = std::format_to_n(m_buffer + m_length, room, fmt, std::forward<Args>(args)...);
+            if (static_cast<size_t>(result.size) > room) {
+                m_overflow = true;
+                m_length = BufferSize;
+            } else {
+                m_length += static_cast<size_t>(result.size);
+            }
+        }
+
+        void AppendRaw(std::string_view text) noexcept {
+            if (text.size() > BufferSize - m_length) {
+                m_overflow = true;
+                m_length = BufferSize;
+                return;
+            }
+            std::memcpy(m_buffer + m_length, text.data(), text.size());
+            m_length += text.size();
+        }
+
+        void AppendJsonString(std::string_view value) noexcept {
+            AppendRaw("\"");
+            size_t run = 0;
+            for (size_t i = 0; i < value.size(); ++i) {
+                unsigned char c = static_cast<unsigned char>(value[i]);
+                if (c >= 0x20 && c != '"' && c != '\\') {
+                    continue;
+                }
+                AppendRaw(value.substr(run, i - run));
+                if (c == '"' || c == '\\') {
+                    char escaped[2] = {'\\', static_cast<char>(c)};
+                    AppendRaw({escaped, 2});
+                } else {
+                    Append("\\u{:04x}", static_cast<unsigned>(c));
+                }
+                run = i + 1;
+            }
+            AppendRaw(value.substr(run));
+            AppendRaw("\"");
+        }
+
+        void AppendCsvString(std::string_view value) noexcept {
+            if (value.find_first_of(",\"\r\n") == std::string_view::npos) {
+                AppendRaw(value);
+                return;
+            }
+            AppendRaw("\"");
+            size_t run = 0;
+            for (size_t quote = value.find('"'); quote != std::string_view::npos; quote = value.find('"', run)) {
+                AppendRaw(value.substr(run, quote + 1 - run));
+                AppendRaw("\"");
+                run = quote + 1;
+            }
+            AppendRaw(value.substr(run));
+            AppendRaw("\"");
+        }
+
+        std::FILE* m_stream;
+        SinkPipeline* m_pipeline = nullptr;
+        OutputFormat m_format = OutputFormat::Text;
+        bool m_streaming = false;
+        bool m_overflow = false;
+        bool m_csvHeaderWritten = false;
+        uint64_t m_records = 0;
+        uint32_t m_fields = 0;
+        size_t m_length = 0;
+        size_t m_headerLength = 0;
+        char m_buffer[BufferSize];
+        char m_header[512];
+    };
+
+    inline RecordWriter& Output() noexcept {
+        static RecordWriter writer(stdout);
+        return writer;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,595 @@
+#pragma once
+
+#include "CommonUtils.hpp"
+#include "LenovoBatteryControl.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Declarations
+namespace LLTCSimulatedTransport {
+    class SimulatedDeviceTransport;
+    // Installs the simulator when LLTC_TRANSPORT=sim, which is the default where
+    // there is no Windows backend. Returns true if it was installed.
+    inline bool InstallFromEnvironment() noexcept;
+}
+
+// Definitions
+namespace LLTCSimulatedTransport {
+    using LLTCCommonUtils::DeviceKind;
+    using LLTCCommonUtils::WmiMethodCall;
+    using LLTCCommonUtils::WmiAsyncCall;
+    using LLTCCommonUtils::WmiPathType;
+    using LLTCCommonUtils::WmiEventSink;
+    using LLTCCommonUtils::WmiEventSubscription;
+
+    namespace {
+        constexpr DWORD IOCTL_ENERGY_SETTINGS = 0x831020E8;
+        constexpr DWORD IOCTL_ENERGY_BATTERY_CHARGE_MODE = 0x831020F8;
+        constexpr DWORD IOCTL_ENERGY_BATTERY_INFORMATION = 0x83102138;
+        constexpr DWORD IOCTL_ENERGY_KEYBOARD = 0x83102144;
+
+        constexpr ULONG SimBatteryTag = 1;
+        constexpr ULONG SimDesignedCapacity = 80000;    // mWh
+        constexpr ULONG SimFullChargedCapacity = 76000; // mWh
+        constexpr LONG SimChargeRate = 20000;           // mW
+        constexpr LONG SimDischargeRate = 15000;        // mW
+
+        inline unsigned long ReadEnvMicroseconds(const char* name) noexcept {
+            const char* value = std::getenv(name);
+            return value ? std::strtoul(value, nullptr, 10) : 0;
+        }
+
+        inline uint16_t EncodeFatDate(int year, int month, int day) noexcept {
+            return static_cast<uint16_t>(((year - 1980) << 9) | (month << 5) | day);
+        }
+    }
+
+    // In-memory model of EnergyDrv, the battery device and LENOVO_GAMEZONE_DATA.
+    // Every call sleeps for the configured latency so callers can be measured
+    // without Legion hardware; an async WMI batch sleeps once, like real overlap.
+    // LENOVO_GAMEZONE_SMART_FAN_MODE_EVENT fires on every SetSmartFanMode and
+    // on RaiseSmartFanModeEvent; events reach the sinks in the order of the changes.
+    class SimulatedDeviceTransport final : public LLTCCommonUtils::IDeviceTransport {
+    public:
+        SimulatedDeviceTransport(
+            std::chrono::microseconds ioctlLatency = {},
+            std::chrono::microseconds wmiLatency = {}
+        ) noexcept
+            : m_ioctlLatency(ioctlLatency), m_wmiLatency(wmiLatency), m_lastUpdate(std::chrono::steady_clock::now()) {}
+
+        bool IsAvailable(DeviceKind) noexcept override {
+            return true;
+        }
+
+        // Completion model: a request finishes after the IOCTL latency, or never if its
+        // code is stalled, in which case it times out. Concurrent requests overlap, so a
+        // batch takes as long as its slowest request.
+        bool IoControlBatch(DeviceKind device, std::span<LLTCCommonUtils::IoctlRequest> requests, LLTCCommonUtils::IoctlOrder order) noexcept override {
+            using namespace std::chrono;
+            bool allSucceeded = true;
+            microseconds batchDuration{};
+
+            for (auto& request : requests) {
+                request.bytesReturned = 0;
+                request.error = ERROR_CANCELLED;
+                request.latency = {};
+            }
+
+            for (auto& request : requests) {
+                bool stalled = isStalled(request.ioctlCode);
+                microseconds duration = stalled ? duration_cast<microseconds>(milliseconds(request.timeoutMs)) : m_ioctlLatency;
+                if (order == LLTCCommonUtils::IoctlOrder::Sequential) {
+                    simulateLatency(duration);
+                } else {
+                    batchDuration = std::max(batchDuration, duration);
+                }
+
+                request.latency = duration;
+                if (stalled) {
+                    request.error = ERROR_TIMEOUT;
+                } else if (DWORD waitError = waitForBatteryCondition(device, request); waitError != ERROR_SUCCESS) {
+                    request.error = waitError;
+                } else {
+                    std::lock_guard lock(m_mutex);
+                    ++m_ioctlCount;
+                    request.bytesReturned = (device == DeviceKind::Battery)
+                        ? batteryIoControl(request.ioctlCode, request.input, request.inputSize, request.output, request.outputSize)
+                        : energyIoControl(request.ioctlCode, request.input, request.inputSize, request.output, request.outputSize);
+                    request.error = request.bytesReturned ? ERROR_SUCCESS : ERROR_GEN_FAILURE;
+                }
+
+                if (request.error != ERROR_SUCCESS) {
+                    allSucceeded = false;
+                    if (order == LLTCCommonUtils::IoctlOrder::Sequential) {
+                        break;
+                    }
+                }
+            }
+
+            simulateLatency(batchDuration);
+            return allSucceeded;
+        }
+
+        // Flips the AC adapter every `interval`, so battery waiters see scripted
+        // power-state changes. Zero keeps AC connected.
+        void SetAcToggleInterval(std::chrono::seconds interval) noexcept {
+            std::lock_guard lock(m_mutex);
+            advanceBattery();
+            m_acToggleInterval = interval;
+            m_nextAcToggle = m_lastUpdate + interval;
+        }
+
+        // Requests with this IOCTL code never complete and run into their timeout.
+        void SetStalledIoctl(DWORD ioctlCode) noexcept {
+            std::lock_guard lock(m_mutex);
+            m_stalledIoctl = ioctlCode;
+        }
+
+        bool QueryPowerStatus(SYSTEM_POWER_STATUS& outStatus) noexcept override {
+            std::lock_guard lock(m_mutex);
+            advanceBattery();
+            outStatus = {};
+            outStatus.ACLineStatus = m_acOnline ? 1 : 0;
+            outStatus.BatteryFlag = (currentRate() > 0) ? 8 : 1;
+            outStatus.BatteryLifePercent = static_cast<BYTE>(m_capacity * 100 / SimFullChargedCapacity);
+            outStatus.BatteryLifeTime = m_acOnline
+                ? static_cast<DWORD>(-1)
+                : static_cast<DWORD>(m_capacity * 3600 / SimDischargeRate);
+            outStatus.BatteryFullLifeTime = static_cast<DWORD>(-1);
+            return true;
+        }
+
+        HRESULT ConnectWmi(WmiPathType) noexcept override {
+            simulateConnect();
+            return S_OK;
+        }
+
+        HRESULT CallWmiMethod(const WmiMethodCall& call, int* outValue) noexcept override {
+            simulateConnect();
+            simulateLatency(m_wmiLatency);
+            std::lock_guard events(m_eventMutex);
+            std::vector<std::shared_ptr<WmiEventSink>> sinks;
+            HRESULT hr;
+            {
+                std::lock_guard lock(m_mutex);
+                ++m_wmiCount;
+                hr = gameZoneMethod(call.methodName, call.paramValue, outValue);
+                if (SUCCEEDED(hr) && std::wstring_view(call.methodName) == L"SetSmartFanMode") {
+                    sinks = liveSinks();
+                }
+            }
+            indicate(sinks, call.paramValue);
+            return hr;
+        }
+
+        HRESULT CallWmiMethodsAsync(std::span<WmiAsyncCall> calls, WmiPathType) noexcept override {
+            simulateConnect();
+            simulateLatency(m_wmiLatency);
+            std::lock_guard lock(m_mutex);
+            HRESULT batchHr = S_OK;
+            for (auto& call : calls) {
+                ++m_wmiCount;
+                call.hr = gameZoneMethod(call.methodName, 0, &call.result);
+                if (FAILED(call.hr)) {
+                    batchHr = call.hr;
+                }
+            }
+            return batchHr;
+        }
+
+        // Only the smart fan mode event exists; other queries fail like an unknown class.
+        HRESULT SubscribeEventQuery(
+            const wchar_t* query,
+            const wchar_t*,
+            std::shared_ptr<WmiEventSink> sink,
+            std::unique_ptr<WmiEventSubscription>& outSubscription
+        ) noexcept override {
+            if (!query || !sink || std::wstring_view(query).find(L"LENOVO_GAMEZONE_SMART_FAN_MODE_EVENT") == std::wstring_view::npos) {
+                return WBEM_E_INVALID_CLASS;
+            }
+            simulateConnect();
+            try {
+                outSubscription = std::make_unique<SimulatedEventSubscription>(sink);
+                std::lock_guard lock(m_mutex);
+                std::erase_if(m_eventSinks, [](const auto& weak) { return weak.expired(); });
+                m_eventSinks.push_back(std::move(sink));
+            } catch (...) {
+                outSubscription.reset();
+                return E_OUTOFMEMORY;
+            }
+            return S_OK;
+        }
+
+        // The firmware changes the mode by itself (e.g. Fn+Q) and reports it.
+        // Repeating the current mode raises a duplicate event.
+        void RaiseSmartFanModeEvent(int mode) noexcept {
+            std::lock_guard events(m_eventMutex);
+            std::vector<std::shared_ptr<WmiEventSink>> sinks;
+            {
+                std::lock_guard lock(m_mutex);
+                m_smartFanMode = mode;
+                sinks = liveSinks();
+            }
+            indicate(sinks, mode);
+        }
+
+        // Ends every subscription with hr, as a lost WMI connection would.
+        void FailEventSubscriptions(HRESULT hr) noexcept {
+            std::lock_guard events(m_eventMutex);
+            std::vector<std::shared_ptr<WmiEventSink>> sinks;
+            {
+                std::lock_guard lock(m_mutex);
+                sinks = liveSinks();
+                m_eventSinks.clear();
+            }
+            for (auto& sink : sinks) {
+                sink->SetStatus(hr);
+            }
+        }
+
+        // Subscriptions neither cancelled nor failed.
+        size_t GetEventSubscriptionCount() const noexcept {
+            std::lock_guard lock(m_mutex);
+            return liveSinks().size();
+        }
+
+        // Simulated capabilities follow the environment, so they are never persisted.
+        std::string MachineIdentity() noexcept override {
+            return {};
+        }
+
+        size_t GetIoControlCount() const noexcept {
+            std::lock_guard lock(m_mutex);
+            return m_ioctlCount;
+        }
+
+        size_t GetWmiCallCount() const noexcept {
+            std::lock_guard lock(m_mutex);
+            return m_wmiCount;
+        }
+
+        // The first WMI use of the process pays this once, like COM setup plus
+        // ConnectServer and the instance enumeration; concurrent callers wait for it.
+        void SetWmiConnectLatency(std::chrono::microseconds latency) noexcept {
+            std::lock_guard lock(m_connectMutex);
+            m_connectLatency = latency;
+        }
+
+    private:
+        class SimulatedEventSubscription final : public WmiEventSubscription {
+        public:
+            explicit SimulatedEventSubscription(std::shared_ptr<WmiEventSink> sink) : m_sink(std::move(sink)) {}
+            ~SimulatedEventSubscription() override { Cancel(); }
+            void Cancel() noexcept override { m_sink->Close(); }
+
+        private:
+            std::shared_ptr<WmiEventSink> m_sink;
+        };
+
+        // Called with m_mutex held.
+        std::vector<std::shared_ptr<WmiEventSink>> liveSinks() const noexcept {
+            std::vector<std::shared_ptr<WmiEventSink>> sinks;
+            try {
+                for (const auto& weak : m_eventSinks) {
+                    if (auto sink = weak.lock(); sink && !sink->IsClosed()) {
+                        sinks.push_back(std::move(sink));
+                    }
+                }
+            } catch (...) {
+            }
+            return sinks;
+        }
+
+        // Called with m_eventMutex held, so events arrive in the order of the changes.
+        static void indicate(const std::vector<std::shared_ptr<WmiEventSink>>& sinks, int mode) noexcept {
+            for (const auto& sink : sinks) {
+                sink->Indicate(mode);
+            }
+        }
+
+        void simulateConnect() noexcept {
+            std::lock_guard lock(m_connectMutex);
+            if (!m_wmiConnected) {
+                simulateLatency(m_connectLatency);
+                m_wmiConnected = true;
+            }
+        }
+
+        bool isStalled(DWORD ioctlCode) const noexcept {
+            std::lock_guard lock(m_mutex);
+            return m_stalledIoctl != 0 && m_stalledIoctl == ioctlCode;
+        }
+
+        static void simulateLatency(std::chrono::microseconds latency) noexcept {
+            if (latency.count() > 0) {
+                std::this_thread::sleep_for(latency);
+            }
+        }
+
+        double chargeLimit() const noexcept {
+            return m_conservation ? SimFullChargedCapacity * 0.8 : SimFullChargedCapacity;
+        }
+
+        LONG currentRate() const noexcept {
+            if (!m_acOnline) {
+                return -SimDischargeRate;
+            }
+            return (m_capacity < chargeLimit()) ? SimChargeRate : 0;
+        }
+
+        // Integrates capacity up to now: charging on AC until the charge limit,
+        // discharging otherwise, with AC flips at the scripted interval.
+        void advanceBattery() noexcept {
+            auto now = std::chrono::steady_clock::now();
+            while (m_lastUpdate < now) {
+                bool toggle = m_acToggleInterval.count() > 0 && m_nextAcToggle <= now;
+                auto stepEnd = toggle ? m_nextAcToggle : now;
+                double hours = std::chrono::duration<double>(stepEnd - m_lastUpdate).count() / 3600.0;
+                m_capacity = std::clamp(m_capacity + currentRate() * hours, 0.0, std::max(m_capacity, chargeLimit()));
+                m_lastUpdate = stepEnd;
+                if (toggle) {
+                    m_acOnline = !m_acOnline;
+                    m_nextAcToggle += m_acToggleInterval;
+                }
+            }
+        }
+
+        BATTERY_STATUS currentStatus() const noexcept {
+            LONG rate = currentRate();
+            BATTERY_STATUS status = {};
+            status.PowerState = (m_acOnline ? BATTERY_POWER_ON_LINE : BATTERY_DISCHARGING) | (rate > 0 ? BATTERY_CHARGING : 0);
+            status.Capacity = static_cast<ULONG>(m_capacity);
+            status.Voltage = 16800;
+            status.Rate = rate;
+            return status;
+        }
+
+        // Blocks a QUERY_STATUS with a non-zero Timeout until its wait conditions hold,
+        // like the battery class driver. Returns ERROR_SEM_TIMEOUT when Timeout passes
+        // first and ERROR_TIMEOUT when the caller's own deadline is shorter.
+        DWORD waitForBatteryCondition(DeviceKind device, LLTCCommonUtils::IoctlRequest& request) noexcept {
+            BATTERY_WAIT_STATUS wait = {};
+            if (device != DeviceKind::Battery || request.ioctlCode != IOCTL_BATTERY_QUERY_STATUS ||
+                !readInput(request.input, request.inputSize, wait) || wait.Timeout == 0) {
+                return ERROR_SUCCESS;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            bool callerDeadlineFirst = request.timeoutMs < wait.Timeout;
+            auto deadline = start + std::chrono::milliseconds(callerDeadlineFirst ? request.timeoutMs : wait.Timeout);
+            DWORD result = ERROR_SUCCESS;
+            while (true) {
+                {
+                    std::lock_guard lock(m_mutex);
+                    advanceBattery();
+                    BATTERY_STATUS status = currentStatus();
+                    if (status.PowerState != wait.PowerState ||
+                        status.Capacity < wait.LowCapacity ||
+                        status.Capacity > wait.HighCapacity) {
+                        break;
+                    }
+                }
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    result = callerDeadlineFirst ? ERROR_TIMEOUT : ERROR_SEM_TIMEOUT;
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+            request.latency += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            return result;
+        }
+
+        template<typename T>
+        static bool readInput(const void* input, DWORD inputSize, T& out) noexcept {
+            if (!input || inputSize < sizeof(T)) {
+                return false;
+            }
+            std::memcpy(&out, input, sizeof(T));
+            return true;
+        }
+
+        template<typename T>
+        static DWORD writeOutput(void* output, DWORD outputSize, const T& value) noexcept {
+            if (!output || outputSize < sizeof(T)) {
+                return 0;
+            }
+            std::memcpy(output, &value, sizeof(T));
+            return sizeof(T);
+        }
+
+        DWORD energyIoControl(DWORD ioctlCode, const void* input, DWORD inputSize, void* output, DWORD outputSize) noexcept {
+            uint32_t command = 0;
+            if (!readInput(input, inputSize, command)) {
+                return 0;
+            }
+
+            switch (ioctlCode) {
+            case IOCTL_ENERGY_BATTERY_CHARGE_MODE: {
+                switch (command) {
+                case 0xFFFFFFFF: {
+                    uint32_t state = 0;
+                    if (m_conservation) {
+                        state |= 1U << 29;
+                    } else {
+                        state |= 1U << 17;
+                        if (m_rapidCharge) state |= 1U << 26;
+                    }
+                    return writeOutput(output, outputSize, LLTCCommonUtils::ReverseEndianness(state));
+                }
+                case 0x3: m_conservation = true; m_rapidCharge = false; break;
+                case 0x5: m_conservation = false; break;
+                case 0x7:
+                    if (m_conservation) return 0;
+                    m_rapidCharge = true;
+                    break;
+                case 0x8: m_rapidCharge = false; break;
+                default: return 0;
+                }
+                return writeOutput(output, outputSize, uint32_t{0});
+            }
+            case IOCTL_ENERGY_SETTINGS: {
+                switch (command) {
+                case 0x2: {
+                    uint32_t state = 0;
+                    if (m_alwaysOnUsb) state |= 1U << 31;
+                    if (m_alwaysOnUsbAlways) state |= 1U << 23;
+                    return writeOutput(output, outputSize, LLTCCommonUtils::ReverseEndianness(state));
+                }
+                case 0xA: m_alwaysOnUsb = true; break;
+                case 0xB: m_alwaysOnUsb = false; break;
+                case 0x12: m_alwaysOnUsbAlways = false; break;
+                case 0x13: m_alwaysOnUsbAlways = true; break;
+                default: return 0;
+                }
+                return writeOutput(output, outputSize, uint32_t{0});
+            }
+            case IOCTL_ENERGY_KEYBOARD: {
+                switch (command) {
+                case 0x1: return writeOutput(output, outputSize, uint32_t{0x2 << 1});
+                case 0x22: return writeOutput(output, outputSize, uint32_t{1} + 2 * m_keyboardLevel);
+                case 0x00023: m_keyboardLevel = 0; break;
+                case 0x10023: m_keyboardLevel = 1; break;
+                case 0x20023: m_keyboardLevel = 2; break;
+                default: return 0;
+                }
+                return writeOutput(output, outputSize, uint32_t{0});
+            }
+            case IOCTL_ENERGY_BATTERY_INFORMATION: {
+                if (command != 0 || !output || outputSize < sizeof(LENOVO_BATTERY_INFORMATION)) {
+                    return 0;
+                }
+                LENOVO_BATTERY_INFORMATION info = {};
+                info.Temperature = 3031;    // 0.1 K, i.e. 30.0 C
+                info.ManufactureDate = EncodeFatDate(2024, 3, 14);
+                info.FirstUseDate = EncodeFatDate(2024, 6, 1);
+                std::memset(output, 0, outputSize);
+                std::memcpy(output, &info, sizeof(info));
+                return outputSize;
+            }
+            default:
+                return 0;
+            }
+        }
+
+        DWORD batteryIoControl(DWORD ioctlCode, const void* input, DWORD inputSize, void* output, DWORD outputSize) noexcept {
+            switch (ioctlCode) {
+            case IOCTL_BATTERY_QUERY_TAG:
+                return writeOutput(output, outputSize, SimBatteryTag);
+            case IOCTL_BATTERY_QUERY_INFORMATION: {
+                BATTERY_QUERY_INFORMATION query = {};
+                if (!readInput(input, inputSize, query) || query.BatteryTag != SimBatteryTag ||
+                    query.InformationLevel != BatteryInformation) {
+                    return 0;
+                }
+                BATTERY_INFORMATION info = {};
+                info.Capabilities = 0x80000000;     // BATTERY_SYSTEM_BATTERY
+                info.DesignedCapacity = SimDesignedCapacity;
+                info.FullChargedCapacity = SimFullChargedCapacity;
+                info.DefaultAlert1 = SimFullChargedCapacity / 10;
+                info.DefaultAlert2 = SimFullChargedCapacity / 20;
+                info.CycleCount = 42;
+                return writeOutput(output, outputSize, info);
+            }
+            case IOCTL_BATTERY_QUERY_STATUS: {
+                BATTERY_WAIT_STATUS wait = {};
+                if (!readInput(input, inputSize, wait) || wait.BatteryTag != SimBatteryTag) {
+                    return 0;
+                }
+                advanceBattery();
+                return writeOutput(output, outputSize, currentStatus());
+            }
+            default:
+                return 0;
+            }
+        }
+
+        HRESULT gameZoneMethod(const wchar_t* methodName, int value, int* outValue) noexcept {
+            std::wstring_view method = methodName ? methodName : L"";
+            int result = 0;
+
+            if (method == L"GetSmartFanMode")           result = m_smartFanMode;
+            else if (method == L"SetSmartFanMode")      m_smartFanMode = value;
+            else if (method == L"IsSupportOD")          result = 1;
+            else if (method == L"GetODStatus")          result = m_overdrive;
+            else if (method == L"SetODStatus")          m_overdrive = value;
+            else if (method == L"IsSupportGSync")       result = 1;
+            else if (method == L"GetGSyncStatus")       result = m_gsync;
+            else if (method == L"SetGSyncStatus")       m_gsync = value;
+            else if (method == L"IsSupportIGPUMode")    result = 1;
+            else if (method == L"GetIGPUModeStatus")    result = m_igpuMode;
+            else if (method == L"SetIGPUModeStatus")    m_igpuMode = value;
+            else if (method == L"IsDGPUAvailable")      result = m_dgpuActive;
+            else if (method == L"NotifyDGPUStatus")     m_dgpuActive = value;
+            else return WBEM_E_METHOD_NOT_IMPLEMENTED;
+
+            if (outValue) {
+                *outValue = result;
+            }
+            return S_OK;
+        }
+
+        mutable std::mutex m_mutex;
+        // Held from a mode change until its event is delivered. Recursive: a handler
+        // may set the mode again.
+        std::recursive_mutex m_eventMutex;
+        std::vector<std::weak_ptr<WmiEventSink>> m_eventSinks;
+        std::mutex m_connectMutex;
+        std::chrono::microseconds m_connectLatency{};
+        bool m_wmiConnected = false;
+        std::chrono::microseconds m_ioctlLatency;
+        std::chrono::microseconds m_wmiLatency;
+        std::chrono::steady_clock::time_point m_lastUpdate;
+        std::chrono::steady_clock::time_point m_nextAcToggle;
+        std::chrono::seconds m_acToggleInterval{0};
+        double m_capacity = SimFullChargedCapacity * 0.6;   // mWh
+        bool m_acOnline = true;
+        size_t m_ioctlCount = 0;
+        size_t m_wmiCount = 0;
+        DWORD m_stalledIoctl = 0;
+
+        bool m_conservation = false;
+        bool m_rapidCharge = false;
+        bool m_alwaysOnUsb = false;
+        bool m_alwaysOnUsbAlways = false;
+        uint32_t m_keyboardLevel = 0;
+
+        int m_smartFanMode = 2;     // Balance
+        int m_overdrive = 0;
+        int m_gsync = 0;
+        int m_igpuMode = 0;
+        int m_dgpuActive = 1;
+    };
+
+    inline bool InstallFromEnvironment() noexcept {
+        const char* transport = std::getenv("LLTC_TRANSPORT");
+#ifdef _WIN32
+        if (!transport || std::string_view(transport) != "sim") {
+            return false;
+        }
+#else
+        if (transport && *transport && std::string_view(transport) != "sim") {
+            return false;
+        }
+#endif
+        auto simulator = std::make_unique<SimulatedDeviceTransport>(
+            std::chrono::microseconds(ReadEnvMicroseconds("LLTC_SIM_IOCTL_LATENCY_US")),
+            std::chrono::microseconds(ReadEnvMicroseconds("LLTC_SIM_WMI_LATENCY_US"))
+        );
+        simulator->SetWmiConnectLatency(std::chrono::microseconds(ReadEnvMicroseconds("LLTC_SIM_WMI_CONNECT_US")));
+        if (const char* toggle = std::getenv("LLTC_SIM_AC_TOGGLE_S")) {
+            simulator->SetAcToggleInterval(std::chrono::seconds(std::strtoul(toggle, nullptr, 10)));
+        }
+        if (const char* stalled = std::getenv("LLTC_SIM_STALL_IOCTL")) {
+            simulator->SetStalledIoctl(static_cast<DWORD>(std::strtoul(stalled, nullptr, 0)));
+        }
+        LLTCCommonUtils::SetDeviceTransport(std::move(simulator));
+        return true;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,354 @@
+#pragma once
+
+#include "TelemetryLog.hpp"
+#include <atomic>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+enum class StatusField : uint8_t {
+    Battery,
+    PowerMode,
+    GpuMode,
+    BatteryMode,
+    OverDrive,
+    AlwaysOnUSB,
+    KeyboardBacklight,
+    Count
+};
+
+// The published state. Enum-valued fields hold the integer value of PowerMode,
+// HybridModeState, BatteryMode, OverDriveState, AlwaysOnUSBState and
+// WhiteKeyboardBacklightState. updatedUs is when each field was last published
+// (microseconds since the Unix epoch), or 0 if it never was.
+struct StatusSnapshot {
+    uint64_t generation;        // publishes so far
+    BatteryInfoResult battery;
+    int32_t powerMode;
+    int32_t gpuMode;
+    int32_t batteryMode;
+    int32_t overDrive;
+    int32_t alwaysOnUsb;
+    int32_t keyboardBacklight;
+    int64_t updatedUs[static_cast<size_t>(StatusField::Count)];
+
+    bool Has(StatusField field) const noexcept { return updatedUs[static_cast<size_t>(field)] != 0; }
+};
+
+static_assert(std::is_trivially_copyable_v<StatusSnapshot>);
+
+// Declarations
+namespace LLTCStatus {
+    constexpr const wchar_t* DefaultPageName = L"Local\\lltc-status";
+    constexpr uint32_t StatusPageMagic = 0x5354534C;  // "LSTS"
+    constexpr uint16_t StatusPageVersion = 1;
+    class StatusPage;
+}
+
+// Definitions
+namespace LLTCStatus {
+    constexpr size_t SnapshotWords = (sizeof(StatusSnapshot) + 7) / 8;
+
+    // Layout of the shared page. The snapshot is stored as relaxed atomic words
+    // so concurrent reads and writes are well defined; sequence is odd while a
+    // writer is inside. Cache-line aligned so readers polling the sequence do
+    // not share a line with the header.
+    struct StatusPageLayout {
+        std::atomic<uint32_t> magic;
+        uint16_t version;
+        uint16_t snapshotSize;
+        alignas(64) std::atomic<uint64_t> sequence;
+        alignas(64) std::atomic<uint64_t> words[SnapshotWords];
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+    // A seqlock-guarded status snapshot in a named shared-memory page, so other
+    // processes (status-bar widgets, scripts) can read the current state with a
+    // handful of loads and no system calls.
+    //
+    // Readers retry while a write is in progress or if the sequence moved under
+    // them, so they never see a torn snapshot. Writers in different processes
+    // (`lltc serve`, -dmon) take a named mutex around each publish; a writer that
+    // dies mid-publish leaves the mutex abandoned, and the next writer completes
+    // the sequence. The page lives as long as any process has it open.
+    //
+    // On Linux the page is a POSIX shared-memory object (the name without its
+    // "Local\" prefix) and the writer lock is a flock on it, which the kernel
+    // drops when a writer dies; it persists until reboot or shm_unlink.
+    class StatusPage {
+    public:
+        StatusPage() = default;
+        StatusPage(StatusPage&& other) noexcept { *this = std::move(other); }
+        StatusPage& operator=(StatusPage&& other) noexcept {
+            if (this != &other) {
+                close();
+#ifdef _WIN32
+                m_mapping = std::exchange(other.m_mapping, nullptr);
+                m_writerLock = std::exchange(other.m_writerLock, nullptr);
+#else
+                m_fd = std::exchange(other.m_fd, -1);
+                m_writerLock = std::move(other.m_writerLock);
+#endif
+                m_page = std::exchange(other.m_page, nullptr);
+            }
+            return *this;
+        }
+        ~StatusPage() { close(); }
+
+        // Creates the page, or opens it read/write if another publisher already
+        // did. An empty name creates a private page (used by the stress test).
+        static std::expected<StatusPage, DWORD> Create(const std::wstring& name = DefaultPageName) noexcept {
+            StatusPage page;
+#ifdef _WIN32
+            const wchar_t* mappingName = name.empty() ? nullptr : name.c_str();
+            page.m_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                                sizeof(StatusPageLayout), mappingName);
+            if (!page.m_mapping) {
+                return std::unexpected(GetLastError());
+            }
+            std::wstring lockName = name.empty() ? std::wstring() : name + L"-writer";
+            page.m_writerLock = CreateMutexW(nullptr, FALSE, lockName.empty() ? nullptr : lockName.c_str());
+            auto* view = MapViewOfFile(page.m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(StatusPageLayout));
+            if (!page.m_writerLock || !view) {
+                return std::unexpected(GetLastError());
+            }
+            page.m_page = static_cast<StatusPageLayout*>(view);
+#else
+            page.m_fd = name.empty() ? memfd_create("lltc-status", MFD_CLOEXEC)
+                                     : shm_open(sharedName(name).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            struct stat status = {};
+            if (page.m_fd < 0 || fstat(page.m_fd, &status) != 0) {
+                return std::unexpected(static_cast<DWORD>(errno));
+            }
+            if (status.st_size < static_cast<off_t>(sizeof(StatusPageLayout)) &&
+                ftruncate(page.m_fd, sizeof(StatusPageLayout)) != 0) {
+                return std::unexpected(static_cast<DWORD>(errno));
+            }
+            void* view = mmap(nullptr, sizeof(StatusPageLayout), PROT_READ | PROT_WRITE, MAP_SHARED, page.m_fd, 0);
+            if (view == MAP_FAILED) {
+                return std::unexpected(static_cast<DWORD>(errno));
+            }
+            page.m_page = static_cast<StatusPageLayout*>(view);
+            try {
+                page.m_writerLock = std::make_unique<std::timed_mutex>();
+            } catch (...) {
+                return std::unexpected(static_cast<DWORD>(ERROR_NOT_ENOUGH_MEMORY));
+            }
+#endif
+            // A new mapping is zero-filled; publishing the magic last marks it ready.
+            if (page.m_page->magic.load(std::memory_order_acquire) != StatusPageMagic) {
+                page.m_page->version = StatusPageVersion;
+                page.m_page->snapshotSize = sizeof(StatusSnapshot);
+                page.m_page->magic.store(StatusPageMagic, std::memory_order_release);
+            } else if (page.m_page->version != StatusPageVersion || page.m_page->snapshotSize != sizeof(StatusSnapshot)) {
+                return std::unexpected(static_cast<DWORD>(ERROR_INVALID_DATA));
+            }
+            return page;
+        }
+
+        // Opens a page for reading. Fails if no publisher is running.
+        static std::expected<StatusPage, DWORD> Open(const std::wstring& name = DefaultPageName) noexcept {
+            StatusPage page;
+#ifdef _WIN32
+            page.m_mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, name.c_str());
+            if (!page.m_mapping) {
+                return std::unexpected(GetLastError());
+            }
+            auto* view = MapViewOfFile(page.m_mapping, FILE_MAP_READ, 0, 0, sizeof(StatusPageLayout));
+            if (!view) {
+                return std::unexpected(GetLastError());
+            }
+#else
+            page.m_fd = shm_open(sharedName(name).c_str(), O_RDONLY | O_CLOEXEC, 0);
+            struct stat status = {};
+            if (page.m_fd < 0 || fstat(page.m_fd, &status) != 0) {
+                return std::unexpected(static_cast<DWORD>(errno));
+            }
+            if (status.st_size < static_cast<off_t>(sizeof(StatusPageLayout))) {
+                return std::unexpected(static_cast<DWORD>(ERROR_INVALID_DATA));
+            }
+            void* view = mmap(nullptr, sizeof(StatusPageLayout), PROT_READ, MAP_SHARED, page.m_fd, 0);
+            if (view == MAP_FAILED) {
+                return std::unexpected(static_cast<DWORD>(errno));
+            }
+#endif
+            page.m_page = static_cast<StatusPageLayout*>(view);
+            if (page.m_page->magic.load(std::memory_order_acquire) != StatusPageMagic ||
+                page.m_page->version != StatusPageVersion || page.m_page->snapshotSize != sizeof(StatusSnapshot)) {
+                return std::unexpected(static_cast<DWORD>(ERROR_INVALID_DATA));
+            }
+            return page;
+        }
+
+        bool IsOpen() const noexcept { return m_page != nullptr; }
+
+        // Copies a consistent snapshot. Returns false only if writers kept the
+        // page busy for maxAttempts tries in a row.
+        bool Read(StatusSnapshot& out, uint32_t maxAttempts = 1u << 20) const noexcept {
+            uint64_t words[SnapshotWords];
+            for (uint32_t attempt = 0; attempt < maxAttempts; ++attempt) {
+                uint64_t before = m_page->sequence.load(std::memory_order_acquire);
+                if (before & 1) {
+                    backOff(attempt);
+                    continue;
+                }
+                for (size_t i = 0; i < SnapshotWords; ++i) {
+                    words[i] = m_page->words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (m_page->sequence.load(std::memory_order_relaxed) == before) {
+                    std::memcpy(&out, words, sizeof(StatusSnapshot));
+                    return true;
+                }
+                backOff(attempt);
+            }
+            return false;
+        }
+
+        // Changes on every publish; lets pollers skip Read when nothing changed.
+        uint64_t Sequence() const noexcept { return m_page->sequence.load(std::memory_order_acquire); }
+
+        // Runs fn(snapshot) on the current snapshot and publishes the result with
+        // the generation advanced. Only valid on a page from Create().
+        template<typename Fn>
+        bool Update(Fn&& fn) noexcept {
+#ifdef _WIN32
+            DWORD wait = WaitForSingleObject(m_writerLock, 1000);
+            if (wait != WAIT_OBJECT_0 && wait != WAIT_ABANDONED) {
+                return false;
+            }
+#else
+            // flock excludes other open descriptions only, so threads sharing
+            // this page also take the in-process mutex.
+            std::unique_lock threadLock(*m_writerLock, std::defer_lock);
+            if (!threadLock.try_lock_for(std::chrono::seconds(1)) || !lockFile()) {
+                return false;
+            }
+#endif
+            // Odd already if the previous writer died inside; keep it odd.
+            uint64_t sequence = m_page->sequence.load(std::memory_order_relaxed) | 1;
+            m_page->sequence.store(sequence, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            uint64_t words[SnapshotWords] = {};
+            for (size_t i = 0; i < SnapshotWords; ++i) {
+                words[i] = m_page->words[i].load(std::memory_order_relaxed);
+            }
+            StatusSnapshot snapshot;
+            std::memcpy(&snapshot, words, sizeof(StatusSnapshot));
+            fn(snapshot);
+            ++snapshot.generation;
+            std::memcpy(words, &snapshot, sizeof(StatusSnapshot));
+            for (size_t i = 0; i < SnapshotWords; ++i) {
+                m_page->words[i].store(words[i], std::memory_order_relaxed);
+            }
+
+            m_page->sequence.store(sequence + 1, std::memory_order_release);
+#ifdef _WIN32
+            ReleaseMutex(m_writerLock);
+#else
+            flock(m_fd, LOCK_UN);
+#endif
+            return true;
+        }
+
+        bool Publish(StatusField field, int32_t value) noexcept {
+            int64_t now = LLTCTelemetry::CurrentTimestampUs();
+            return Update([&](StatusSnapshot& snapshot) {
+                switch (field) {
+                    case StatusField::PowerMode:         snapshot.powerMode = value; break;
+                    case StatusField::GpuMode:           snapshot.gpuMode = value; break;
+                    case StatusField::BatteryMode:       snapshot.batteryMode = value; break;
+                    case StatusField::OverDrive:         snapshot.overDrive = value; break;
+                    case StatusField::AlwaysOnUSB:       snapshot.alwaysOnUsb = value; break;
+                    case StatusField::KeyboardBacklight: snapshot.keyboardBacklight = value; break;
+                    default:                             return;
+                }
+                snapshot.updatedUs[static_cast<size_t>(field)] = now;
+            });
+        }
+
+        bool PublishBattery(const BatteryInfoResult& battery) noexcept {
+            int64_t now = LLTCTelemetry::CurrentTimestampUs();
+            return Update([&](StatusSnapshot& snapshot) {
+                snapshot.battery = battery;
+                snapshot.updatedUs[static_cast<size_t>(StatusField::Battery)] = now;
+            });
+        }
+
+    private:
+        static void backOff(uint32_t attempt) noexcept {
+            // A publish takes well under a microsecond; yield only if the writer
+            // seems to have been preempted inside.
+            if (attempt >= 64) {
+                std::this_thread::yield();
+            }
+        }
+
+#ifdef _WIN32
+        void close() noexcept {
+            if (m_page) {
+                UnmapViewOfFile(m_page);
+                m_page = nullptr;
+            }
+            if (m_writerLock) {
+                CloseHandle(m_writerLock);
+                m_writerLock = nullptr;
+            }
+            if (m_mapping) {
+                CloseHandle(m_mapping);
+                m_mapping = nullptr;
+            }
+        }
+
+        HANDLE m_mapping = nullptr;
+        HANDLE m_writerLock = nullptr;
+#else
+        // "Local\\lltc-status" -> "/lltc-status".
+        static std::string sharedName(const std::wstring& name) {
+            std::wstring_view local = name;
+            if (local.starts_with(L"Local\\")) {
+                local.remove_prefix(6);
+            }
+            std::string shared = "/";
+            for (wchar_t c : local) {
+                shared.push_back(c < 0x80 && c != L'/' ? static_cast<char>(c) : '_');
+            }
+            return shared;
+        }
+
+        bool lockFile() noexcept {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            while (flock(m_fd, LOCK_EX | LOCK_NB) != 0) {
+                if ((errno != EWOULDBLOCK && errno != EINTR) || std::chrono::steady_clock::now() >= deadline) {
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            return true;
+        }
+
+        void close() noexcept {
+            if (m_page) {
+                munmap(m_page, sizeof(StatusPageLayout));
+                m_page = nullptr;
+            }
+            if (m_fd >= 0) {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+            m_writerLock.reset();
+        }
+
+        int m_fd = -1;
+        std::unique_ptr<std::timed_mutex> m_writerLock;
+#endif
+        StatusPageLayout* m_page = nullptr;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,616 @@
+#pragma once
+
+#include "TelemetryLog.hpp"
+#include <bit>
+#include <span>
+#include <vector>
+
+// Per-block summary, stored after the block's columns so a reader can skip
+// blocks outside a time or value range without decoding them.
+struct TelemetryBlockSummary {
+    int64_t firstTimestampUs;
+    int64_t lastTimestampUs;
+    int32_t minRateMw;
+    int32_t maxRateMw;
+    uint32_t minCapacityMwh;
+    uint32_t maxCapacityMwh;
+    int16_t minTemperatureDeciC;    // TelemetryNoTemperature if no sample had one
+    int16_t maxTemperatureDeciC;
+    uint8_t minPercent;
+    uint8_t maxPercent;
+    uint8_t flagsAny;               // OR of all sample flags
+    uint8_t flagsAll;               // AND of all sample flags
+};
+static_assert(sizeof(TelemetryBlockSummary) == 40);
+
+// Declarations
+namespace LLTCTelemetry {
+    constexpr uint32_t DefaultBlockSamples = 4096;
+    class BitWriter;
+    class BitReader;
+    class TelemetryBlockEncoder;
+    class TelemetryBlockView;
+    class TelemetryBlockReader;
+    class TelemetryBlockFileWriter;
+    class TelemetryBlockFileReader;
+}
+
+// Definitions
+namespace LLTCTelemetry {
+    namespace {
+        constexpr char BlockFileMagic[4] = {'L', 'L', 'T', 'Z'};
+        constexpr char BlockMagic[4] = {'B', 'L', 'K', '1'};
+        constexpr uint32_t BlockFileVersion = 1;
+
+        // One bit stream per field. Timestamps are kept to the millisecond.
+        enum Column : uint32_t {
+            ColumnTimestamp,
+            ColumnRate,
+            ColumnCapacity,
+            ColumnCycle,
+            ColumnTemperature,
+            ColumnPercent,
+            ColumnFlags,
+            ColumnCount
+        };
+
+        inline uint64_t ZigZag(int64_t value) noexcept {
+            return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        }
+
+        inline int64_t UnZigZag(uint64_t value) noexcept {
+            return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        }
+
+        inline double TemperatureToDouble(int16_t deciC) noexcept {
+            return (deciC == TelemetryNoTemperature) ? std::numeric_limits<double>::quiet_NaN() : deciC / 10.0;
+        }
+
+        inline int16_t TemperatureFromDouble(double value) noexcept {
+            return std::isnan(value) ? TelemetryNoTemperature : static_cast<int16_t>(std::lround(value * 10.0));
+        }
+    }
+
+    struct BlockFileHeader {
+        char magic[4];
+        uint32_t version;
+    };
+    static_assert(sizeof(BlockFileHeader) == 8);
+
+    struct BlockHeader {
+        char magic[4];
+        uint32_t sampleCount;
+        uint32_t columnBytes[ColumnCount];
+    };
+    static_assert(sizeof(BlockHeader) == 36);
+
+    // MSB-first bit stream into a reusable byte buffer.
+    class BitWriter {
+    public:
+        void Write(uint64_t value, int count) noexcept {
+            if (count == 0) {
+                return;
+            }
+            if (count < 64) {
+                value &= (uint64_t{1} << count) - 1;
+            }
+            int free = 64 - m_used;
+            if (count <= free) {
+                m_acc |= (count == 64) ? value : value << (free - count);
+                m_used += count;
+            } else {
+                int rest = count - free;
+                m_acc |= value >> rest;
+                Emit(8);
+                m_acc = value << (64 - rest);
+                m_used = rest;
+            }
+            if (m_used == 64) {
+                Emit(8);
+                m_acc = 0;
+                m_used = 0;
+            }
+        }
+
+        // Zigzag value in a prefix-coded bucket: '0', '10'+6, '110'+13, '1110'+20 or '1111'+64 bits.
+        void WriteSigned(int64_t value) noexcept {
+            uint64_t zz = ZigZag(value);
+            if (zz == 0) {
+                Write(0b0, 1);
+            } else if (zz < (uint64_t{1} << 6)) {
+                Write((0b10ULL << 6) | zz, 8);
+            } else if (zz < (uint64_t{1} << 13)) {
+                Write((0b110ULL << 13) | zz, 16);
+            } else if (zz < (uint64_t{1} << 20)) {
+                Write((0b1110ULL << 20) | zz, 24);
+            } else {
+                Write(0b1111, 4);
+                Write(zz, 64);
+            }
+        }
+
+        // Pads the last byte and appends the stream to `out`; the writer is reset.
+        void FinishInto(std::vector<uint8_t>& out) {
+            if (m_used > 0) {
+                Emit((m_used + 7) / 8);
+            }
+            out.insert(out.end(), m_bytes.begin(), m_bytes.end());
+            m_bytes.clear();
+            m_acc = 0;
+            m_used = 0;
+        }
+
+        size_t PendingBytes() const noexcept { return m_bytes.size() + (m_used + 7) / 8; }
+
+    private:
+        void Emit(int bytes) {
+            for (int i = 0; i < bytes; ++i) {
+                m_bytes.push_back(static_cast<uint8_t>(m_acc >> (56 - 8 * i)));
+            }
+        }
+
+        std::vector<uint8_t> m_bytes;
+        uint64_t m_acc = 0;
+        int m_used = 0;
+    };
+
+    // Reads a stream produced by BitWriter. Reading past the end yields zero bits
+    // and sets Overrun().
+    class BitReader {
+    public:
+        BitReader() = default;
+        explicit BitReader(std::span<const uint8_t> data) noexcept : m_data(data) {}
+
+        uint64_t Read(int count) noexcept {
+            uint64_t value = 0;
+            while (count > 0) {
+                if (m_avail == 0) {
+                    Refill();
+                }
+                int take = std::min(count, m_avail);
+                uint64_t bits = m_cache >> (64 - take);
+                value = (take == 64) ? bits : (value << take) | bits;
+                m_cache = (take == 64) ? 0 : m_cache << take;
+                m_avail -= take;
+                count -= take;
+            }
+            return value;
+        }
+
+        int64_t ReadSigned() noexcept {
+            if (Read(1) == 0) {
+                return 0;
+            }
+            if (Read(1) == 0) {
+                return UnZigZag(Read(6));
+            }
+            if (Read(1) == 0) {
+                return UnZigZag(Read(13));
+            }
+            if (Read(1) == 0) {
+                return UnZigZag(Read(20));
+            }
+            return UnZigZag(Read(64));
+        }
+
+        bool Overrun() const noexcept { return m_overrun; }
+
+    private:
+        void Refill() noexcept {
+            m_cache = 0;
+            m_avail = 0;
+            while (m_avail < 64 && m_pos < m_data.size()) {
+                m_cache |= uint64_t{m_data[m_pos++]} << (56 - m_avail);
+                m_avail += 8;
+            }
+            if (m_avail == 0) {
+                m_overrun = true;
+                m_avail = 64;
+            }
+        }
+
+        std::span<const uint8_t> m_data;
+        size_t m_pos = 0;
+        uint64_t m_cache = 0;
+        int m_avail = 0;
+        bool m_overrun = false;
+    };
+
+    // Gorilla XOR coding of a double stream.
+    struct XorState {
+        uint64_t previous = 0;
+        int leading = -1;       // window of the last non-zero XOR; -1 before the first one
+        int trailing = 0;
+
+        void Encode(BitWriter& out, double value) noexcept {
+            uint64_t bits = std::bit_cast<uint64_t>(value);
+            uint64_t x = bits ^ previous;
+            previous = bits;
+            if (x == 0) {
+                out.Write(0b0, 1);
+                return;
+            }
+            int lz = std::min(std::countl_zero(x), 31);
+            int tz = std::countr_zero(x);
+            if (leading >= 0 && lz >= leading && tz >= trailing) {
+                out.Write(0b10, 2);
+                out.Write(x >> trailing, 64 - leading - trailing);
+                return;
+            }
+            int length = 64 - lz - tz;
+            out.Write(0b11, 2);
+            out.Write(lz, 5);
+            out.Write(length & 63, 6);   // 64 is stored as 0
+            out.Write(x >> tz, length);
+            leading = lz;
+            trailing = tz;
+        }
+
+        double Decode(BitReader& in) noexcept {
+            if (in.Read(1) != 0) {
+                if (in.Read(1) != 0) {
+                    leading = static_cast<int>(in.Read(5));
+                    int length = static_cast<int>(in.Read(6));
+                    if (length == 0) {
+                        length = 64;
+                    }
+                    trailing = 64 - leading - length;
+                }
+                int length = 64 - leading - trailing;
+                previous ^= (length > 0 && trailing >= 0) ? in.Read(length) << trailing : 0;
+            }
+            return std::bit_cast<double>(previous);
+        }
+    };
+
+    // Running per-column state shared by the encoder and the decoder.
+    struct ColumnState {
+        int64_t timestampMs = 0;
+        int64_t timestampDelta = 0;
+        int64_t rateMw = 0;
+        int64_t capacityMwh = 0;
+        int64_t cycleCount = 0;
+        int64_t percent = 0;
+        int64_t flags = 0;
+        XorState temperature;
+    };
+
+    // Encodes samples into one block as they arrive; Finish() appends the block.
+    class TelemetryBlockEncoder {
+    public:
+        void Add(const TelemetrySample& sample) noexcept {
+            int64_t timestampMs = sample.timestampUs / 1000;
+            int64_t delta = timestampMs - m_state.timestampMs;
+            m_columns[ColumnTimestamp].WriteSigned(delta - m_state.timestampDelta);
+            m_state.timestampDelta = delta;
+            m_state.timestampMs = timestampMs;
+
+            m_columns[ColumnRate].WriteSigned(sample.rateMw - m_state.rateMw);
+            m_columns[ColumnCapacity].WriteSigned(int64_t{sample.capacityMwh} - m_state.capacityMwh);
+            m_columns[ColumnCycle].WriteSigned(int64_t{sample.cycleCount} - m_state.cycleCount);
+            m_columns[ColumnPercent].WriteSigned(int64_t{sample.percent} - m_state.percent);
+            m_columns[ColumnFlags].WriteSigned(int64_t{sample.flags} - m_state.flags);
+            m_state.temperature.Encode(m_columns[ColumnTemperature], TemperatureToDouble(sample.temperatureDeciC));
+            m_state.rateMw = sample.rateMw;
+            m_state.capacityMwh = sample.capacityMwh;
+            m_state.cycleCount = sample.cycleCount;
+            m_state.percent = sample.percent;
+            m_state.flags = sample.flags;
+
+            UpdateSummary(sample, timestampMs * 1000);
+            ++m_count;
+        }
+
+        uint32_t Count() const noexcept { return m_count; }
+
+        // Appends header, columns and summary to `out`, then starts a new block.
+        void Finish(std::vector<uint8_t>& out) {
+            if (m_count == 0) {
+                return;
+            }
+            BlockHeader header = {};
+            std::memcpy(header.magic, BlockMagic, sizeof(BlockMagic));
+            header.sampleCount = m_count;
+            for (uint32_t c = 0; c < ColumnCount; ++c) {
+                header.columnBytes[c] = static_cast<uint32_t>(m_columns[c].PendingBytes());
+            }
+            auto* raw = reinterpret_cast<const uint8_t*>(&header);
+            out.insert(out.end(), raw, raw + sizeof(header));
+            for (auto& column : m_columns) {
+                column.FinishInto(out);
+            }
+            raw = reinterpret_cast<const uint8_t*>(&m_summary);
+            out.insert(out.end(), raw, raw + sizeof(m_summary));
+
+            m_state = {};
+            m_count = 0;
+        }
+
+    private:
+        void UpdateSummary(const TelemetrySample& sample, int64_t timestampUs) noexcept {
+            if (m_count == 0) {
+                m_summary = {timestampUs, timestampUs, sample.rateMw, sample.rateMw,
+                             sample.capacityMwh, sample.capacityMwh,
+                             sample.temperatureDeciC, sample.temperatureDeciC,
+                             sample.percent, sample.percent, sample.flags, sample.flags};
+                return;
+            }
+            m_summary.lastTimestampUs = timestampUs;
+            m_summary.minRateMw = std::min(m_summary.minRateMw, sample.rateMw);
+            m_summary.maxRateMw = std::max(m_summary.maxRateMw, sample.rateMw);
+            m_summary.minCapacityMwh = std::min(m_summary.minCapacityMwh, sample.capacityMwh);
+            m_summary.maxCapacityMwh = std::max(m_summary.maxCapacityMwh, sample.capacityMwh);
+            if (sample.temperatureDeciC != TelemetryNoTemperature) {
+                if (m_summary.minTemperatureDeciC == TelemetryNoTemperature) {
+                    m_summary.minTemperatureDeciC = m_summary.maxTemperatureDeciC = sample.temperatureDeciC;
+                }
+                m_summary.minTemperatureDeciC = std::min(m_summary.minTemperatureDeciC, sample.temperatureDeciC);
+                m_summary.maxTemperatureDeciC = std::max(m_summary.maxTemperatureDeciC, sample.temperatureDeciC);
+            }
+            m_summary.minPercent = std::min(m_summary.minPercent, sample.percent);
+            m_summary.maxPercent = std::max(m_summary.maxPercent, sample.percent);
+            m_summary.flagsAny |= sample.flags;
+            m_summary.flagsAll &= sample.flags;
+        }
+
+        BitWriter m_columns[ColumnCount];
+        ColumnState m_state;
+        TelemetryBlockSummary m_summary = {};
+        uint32_t m_count = 0;
+    };
+
+    // One encoded block. ForEach decodes the columns in lock step, one sample at
+    // a time, so nothing is materialised beyond the current row.
+    class TelemetryBlockView {
+    public:
+        TelemetryBlockView(const BlockHeader& header, std::span<const uint8_t> columns,
+                           const TelemetryBlockSummary& summary) noexcept
+            : m_header(header), m_columns(columns), m_summary(summary) {}
+
+        uint32_t Count() const noexcept { return m_header.sampleCount; }
+        const TelemetryBlockSummary& Summary() const noexcept { return m_summary; }
+        size_t EncodedBytes() const noexcept { return sizeof(BlockHeader) + m_columns.size() + sizeof(TelemetryBlockSummary); }
+
+        // Returns false if a column ran out of data (corrupt block).
+        template<typename Fn>
+        bool ForEach(Fn&& fn) const {
+            BitReader readers[ColumnCount];
+            size_t offset = 0;
+            for (uint32_t c = 0; c < ColumnCount; ++c) {
+                readers[c] = BitReader(m_columns.subspan(offset, m_header.columnBytes[c]));
+                offset += m_header.columnBytes[c];
+            }
+
+            ColumnState state;
+            TelemetrySample sample = {};
+            for (uint32_t i = 0; i < m_header.sampleCount; ++i) {
+                state.timestampDelta += readers[ColumnTimestamp].ReadSigned();
+                state.timestampMs += state.timestampDelta;
+                state.rateMw += readers[ColumnRate].ReadSigned();
+                state.capacityMwh += readers[ColumnCapacity].ReadSigned();
+                state.cycleCount += readers[ColumnCycle].ReadSigned();
+                state.percent += readers[ColumnPercent].ReadSigned();
+                state.flags += readers[ColumnFlags].ReadSigned();
+                double temperature = state.temperature.Decode(readers[ColumnTemperature]);
+
+                sample.sequence = i;
+                sample.timestampUs = state.timestampMs * 1000;
+                sample.rateMw = static_cast<int32_t>(state.rateMw);
+                sample.capacityMwh = static_cast<uint32_t>(state.capacityMwh);
+                sample.cycleCount = static_cast<uint32_t>(state.cycleCount);
+                sample.temperatureDeciC = TemperatureFromDouble(temperature);
+                sample.percent = static_cast<uint8_t>(state.percent);
+                sample.flags = static_cast<uint8_t>(state.flags);
+                fn(sample);
+            }
+            return std::none_of(std::begin(readers), std::end(readers),
+                                [](const BitReader& r) { return r.Overrun(); });
+        }
+
+    private:
+        BlockHeader m_header;
+        std::span<const uint8_t> m_columns;
+        TelemetryBlockSummary m_summary;
+    };
+
+    // Walks the blocks of an in-memory .lltz image. A truncated last block (from
+    // an interrupted write) ends the walk; ValidLength() reports where.
+    class TelemetryBlockReader {
+    public:
+        explicit TelemetryBlockReader(std::span<const uint8_t> data) noexcept : m_data(data) {
+            BlockFileHeader header;
+            if (data.size() >= sizeof(header)) {
+                std::memcpy(&header, data.data(), sizeof(header));
+                m_valid = std::memcmp(header.magic, BlockFileMagic, sizeof(BlockFileMagic)) == 0 &&
+                          header.version == BlockFileVersion;
+            }
+        }
+
+        bool IsValid() const noexcept { return m_valid; }
+
+        // Calls fn(const TelemetryBlockView&); stops early if fn returns false.
+        template<typename Fn>
+        void ForEachBlock(Fn&& fn) const {
+            if (!m_valid) {
+                return;
+            }
+            size_t offset = sizeof(BlockFileHeader);
+            while (auto block = BlockAt(offset)) {
+                offset += block->EncodedBytes();
+                if (!fn(*block)) {
+                    return;
+                }
+            }
+        }
+
+        // Calls fn(const TelemetrySample&) for every sample, oldest first.
+        template<typename Fn>
+        void ForEach(Fn&& fn) const {
+            ForEachBlock([&](const TelemetryBlockView& block) {
+                return block.ForEach(fn);
+            });
+        }
+
+        size_t ValidLength() const noexcept {
+            if (!m_valid) {
+                return 0;
+            }
+            size_t offset = sizeof(BlockFileHeader);
+            while (auto block = BlockAt(offset)) {
+                offset += block->EncodedBytes();
+            }
+            return offset;
+        }
+
+    private:
+        std::optional<TelemetryBlockView> BlockAt(size_t offset) const noexcept {
+            BlockHeader header;
+            if (m_data.size() - offset < sizeof(header)) {
+                return std::nullopt;
+            }
+            std::memcpy(&header, m_data.data() + offset, sizeof(header));
+            if (std::memcmp(header.magic, BlockMagic, sizeof(BlockMagic)) != 0) {
+                return std::nullopt;
+            }
+            uint64_t columnBytes = 0;
+            for (uint32_t bytes : header.columnBytes) {
+                columnBytes += bytes;
+            }
+            size_t columnsAt = offset + sizeof(header);
+            if (m_data.size() - columnsAt < columnBytes + sizeof(TelemetryBlockSummary)) {
+                return std::nullopt;
+            }
+            TelemetryBlockSummary summary;
+            std::memcpy(&summary, m_data.data() + columnsAt + columnBytes, sizeof(summary));
+            return TelemetryBlockView(header, m_data.subspan(columnsAt, columnBytes), summary);
+        }
+
+        std::span<const uint8_t> m_data;
+        bool m_valid = false;
+    };
+
+    // Appends compressed blocks to a .lltz file. Samples are encoded as they
+    // arrive and a block is written each time it fills, or on Flush()/Close().
+    class TelemetryBlockFileWriter {
+    public:
+        TelemetryBlockFileWriter() = default;
+        ~TelemetryBlockFileWriter() { Close(); }
+        TelemetryBlockFileWriter(const TelemetryBlockFileWriter&) = delete;
+        TelemetryBlockFileWriter& operator=(const TelemetryBlockFileWriter&) = delete;
+
+        // Creates the file or appends to an existing one, dropping a torn last block.
+        std::expected<void, ResultState> Open(const std::wstring& path, uint32_t blockSamples = DefaultBlockSamples) noexcept {
+            Close();
+            if (!m_file.Open(path, LLTCPlatform::FileAccess::ReadWrite)) {
+                return std::unexpected(ResultState::Failed);
+            }
+            m_blockSamples = std::max<uint32_t>(blockSamples, 1);
+
+            uint64_t size = m_file.Size().value_or(0);
+            if (size == 0) {
+                BlockFileHeader header = {};
+                std::memcpy(header.magic, BlockFileMagic, sizeof(BlockFileMagic));
+                header.version = BlockFileVersion;
+                m_buffer.assign(reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header) + sizeof(header));
+                if (!WriteBuffer()) {
+                    Close();
+                    return std::unexpected(ResultState::Failed);
+                }
+                return {};
+            }
+
+            LLTCPlatform::FileMapping mapped;
+            if (!mapped.Map(m_file, size, false)) {
+                Close();
+                return std::unexpected(ResultState::Failed);
+            }
+            uint64_t end = TelemetryBlockReader({mapped.Data(), static_cast<size_t>(size)}).ValidLength();
+            mapped.Unmap();
+            if (end == 0) {
+                Close();
+                return std::unexpected(ResultState::InvalidParameter);
+            }
+            if (!m_file.Truncate(end)) {
+                Close();
+                return std::unexpected(ResultState::Failed);
+            }
+            return {};
+        }
+
+        bool IsOpen() const noexcept { return m_file.IsOpen(); }
+
+        bool Append(const TelemetrySample& sample) noexcept {
+            if (!IsOpen()) {
+                return false;
+            }
+            m_encoder.Add(sample);
+            return m_encoder.Count() < m_blockSamples || Flush();
+        }
+
+        // Writes the current partial block, if any.
+        bool Flush() noexcept {
+            if (!IsOpen() || m_encoder.Count() == 0) {
+                return true;
+            }
+            m_encoder.Finish(m_buffer);
+            return WriteBuffer();
+        }
+
+        void Close() noexcept {
+            if (IsOpen()) {
+                Flush();
+                m_file.Close();
+            }
+        }
+
+    private:
+        bool WriteBuffer() noexcept {
+            bool ok = m_file.Write(m_buffer.data(), m_buffer.size());
+            m_buffer.clear();
+            return ok;
+        }
+
+        LLTCPlatform::File m_file;
+        uint32_t m_blockSamples = DefaultBlockSamples;
+        TelemetryBlockEncoder m_encoder;
+        std::vector<uint8_t> m_buffer;
+    };
+
+    // Maps a .lltz file read-only and exposes it through TelemetryBlockReader.
+    class TelemetryBlockFileReader {
+    public:
+        TelemetryBlockFileReader() = default;
+        ~TelemetryBlockFileReader() { m_file.Close(); }
+        TelemetryBlockFileReader(const TelemetryBlockFileReader&) = delete;
+        TelemetryBlockFileReader& operator=(const TelemetryBlockFileReader&) = delete;
+
+        std::expected<void, ResultState> Open(const std::wstring& path) noexcept {
+            m_file.Close();
+            if (!m_file.file.Open(path, LLTCPlatform::FileAccess::Read)) {
+                return std::unexpected(ResultState::Failed);
+            }
+            auto size = m_file.file.Size();
+            if (!size || *size < sizeof(BlockFileHeader)) {
+                m_file.Close();
+                return std::unexpected(ResultState::InvalidParameter);
+            }
+            m_file.size = *size;
+            if (!m_file.Map(false)) {
+                m_file.Close();
+                return std::unexpected(ResultState::Failed);
+            }
+            if (!Reader().IsValid()) {
+                m_file.Close();
+                return std::unexpected(ResultState::InvalidParameter);
+            }
+            return {};
+        }
+
+        TelemetryBlockReader Reader() const noexcept {
+            return TelemetryBlockReader({m_file.view, static_cast<size_t>(m_file.size)});
+        }
+
+    private:
+        MappedFile m_file;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,296 @@
+#pragma once
+
+#include "CommonUtils.hpp"
+#include "LenovoBatteryControl.hpp"
+#include <cstring>
+#include <string>
+#include <limits>
+
+// Fixed-size battery sample, as stored in a .lltl ring file.
+struct TelemetrySample {
+    uint64_t sequence;          // written last; a record is valid only if it matches its slot
+    int64_t timestampUs;        // microseconds since the Unix epoch (UTC)
+    int32_t rateMw;             // + charging, - discharging
+    uint32_t capacityMwh;
+    uint32_t cycleCount;
+    int16_t temperatureDeciC;   // TelemetryNoTemperature if not available
+    uint8_t percent;
+    uint8_t flags;              // TelemetryFlag*
+};
+static_assert(sizeof(TelemetrySample) == 32);
+
+constexpr uint8_t TelemetryFlagAc = 0x01;
+constexpr uint8_t TelemetryFlagLowBattery = 0x02;
+// Bits 2-4 and 5-7 carry the power mode and GPU mode active when the sample was
+// taken, as TelemetryModeCode values; 0 means unknown (e.g. logs from older builds).
+constexpr uint8_t TelemetryPowerModeShift = 2;
+constexpr uint8_t TelemetryGpuModeShift = 5;
+constexpr uint8_t TelemetryModeMask = 0x07;
+constexpr int16_t TelemetryNoTemperature = std::numeric_limits<int16_t>::min();
+
+// Declarations
+namespace LLTCTelemetry {
+    constexpr uint32_t DefaultLogCapacity = 1U << 20;  // ~12 days at 1 Hz, 32 MiB
+    class TelemetryLogWriter;
+    class TelemetryLogReader;
+    inline int64_t CurrentTimestampUs() noexcept;
+    inline TelemetrySample MakeSample(const BatteryInfoResult& info, int64_t timestampUs) noexcept;
+    inline uint8_t TelemetryModeCode(PowerMode mode) noexcept;
+    inline uint8_t TelemetryModeCode(HybridModeState mode) noexcept;
+    inline void TagSample(TelemetrySample& sample, uint8_t powerModeCode, uint8_t gpuModeCode) noexcept;
+    inline std::string_view PowerModeCodeName(uint8_t code) noexcept;
+    inline std::string_view GpuModeCodeName(uint8_t code) noexcept;
+}
+
+// Definitions
+namespace LLTCTelemetry {
+    namespace {
+        constexpr char LogMagic[4] = {'L', 'L', 'T', 'L'};
+        constexpr uint32_t LogVersion = 1;
+    }
+
+    // Slot `s % capacity` holds record s. The header sequence counts committed
+    // records and is bumped only after the record body and its own sequence are
+    // written, so a crash mid-append leaves at most the slot being written torn;
+    // readers skip it because its sequence does not match.
+    struct LogHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t capacity;
+        std::atomic<uint64_t> sequence;
+        uint8_t reserved[40];
+    };
+    static_assert(sizeof(LogHeader) == 64);
+
+    inline bool IsValidHeader(const LogHeader& header, uint64_t fileSize) noexcept {
+        return std::memcmp(header.magic, LogMagic, sizeof(LogMagic)) == 0 &&
+               header.version == LogVersion &&
+               header.recordSize == sizeof(TelemetrySample) &&
+               header.capacity > 1 &&
+               fileSize >= sizeof(LogHeader) + uint64_t(header.capacity) * sizeof(TelemetrySample);
+    }
+
+    // Maps the whole file. Leaves view null on failure.
+    struct MappedFile {
+        LLTCPlatform::File file;
+        LLTCPlatform::FileMapping mapping;
+        uint8_t* view = nullptr;
+        uint64_t size = 0;
+
+        bool Map(bool writable) noexcept {
+            view = mapping.Map(file, size, writable) ? mapping.Data() : nullptr;
+            return view != nullptr;
+        }
+
+        void Close() noexcept {
+            mapping.Unmap();
+            view = nullptr;
+            file.Close();
+            size = 0;
+        }
+    };
+
+    inline int64_t CurrentTimestampUs() noexcept {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    inline TelemetrySample MakeSample(const BatteryInfoResult& info, int64_t timestampUs) noexcept {
+        TelemetrySample sample = {};
+        sample.timestampUs = timestampUs;
+        sample.rateMw = info.dischargeRate;
+        sample.capacityMwh = info.currentCapacity;
+        sample.cycleCount = info.cycleCount;
+        sample.temperatureDeciC = (info.temperatureC >= 0)
+            ? static_cast<int16_t>(std::lround(info.temperatureC * 10.0))
+            : TelemetryNoTemperature;
+        sample.percent = info.batteryLifePercent;
+        sample.flags = (info.isAcConnected ? TelemetryFlagAc : 0) | (info.isLowBattery ? TelemetryFlagLowBattery : 0);
+        return sample;
+    }
+
+    inline uint8_t TelemetryModeCode(PowerMode mode) noexcept {
+        switch (mode) {
+            case PowerMode::Quiet:          return 1;
+            case PowerMode::Balance:        return 2;
+            case PowerMode::Performance:    return 3;
+            case PowerMode::GodMode:        return 4;
+        }
+        return 0;
+    }
+
+    inline uint8_t TelemetryModeCode(HybridModeState mode) noexcept {
+        return static_cast<uint8_t>(static_cast<int>(mode) + 1);
+    }
+
+    inline void TagSample(TelemetrySample& sample, uint8_t powerModeCode, uint8_t gpuModeCode) noexcept {
+        sample.flags = static_cast<uint8_t>((sample.flags & ~((TelemetryModeMask << TelemetryPowerModeShift) | (TelemetryModeMask << TelemetryGpuModeShift))) |
+                                            ((powerModeCode & TelemetryModeMask) << TelemetryPowerModeShift) |
+                                            ((gpuModeCode & TelemetryModeMask) << TelemetryGpuModeShift));
+    }
+
+    inline std::string_view PowerModeCodeName(uint8_t code) noexcept {
+        constexpr PowerMode modes[] = {PowerMode::Quiet, PowerMode::Balance, PowerMode::Performance, PowerMode::GodMode};
+        return (code >= 1 && code <= 4) ? to_string(modes[code - 1]) : "Unknown";
+    }
+
+    inline std::string_view GpuModeCodeName(uint8_t code) noexcept {
+        return (code >= 1 && code <= 4) ? to_string(static_cast<HybridModeState>(code - 1)) : "Unknown";
+    }
+
+    // Appends samples to a memory-mapped ring file. The file is sized once at open;
+    // Append only stores into the mapping, with no allocation and no write call.
+    class TelemetryLogWriter {
+    public:
+        TelemetryLogWriter() = default;
+        ~TelemetryLogWriter() { Close(); }
+        TelemetryLogWriter(const TelemetryLogWriter&) = delete;
+        TelemetryLogWriter& operator=(const TelemetryLogWriter&) = delete;
+
+        // Creates the file or continues an existing log (keeping its capacity).
+        // Refuses to touch a non-empty file that is not a telemetry log.
+        std::expected<void, ResultState> Open(const std::wstring& path, uint32_t capacity = DefaultLogCapacity) noexcept {
+            Close();
+            if (!m_file.file.Open(path, LLTCPlatform::FileAccess::ReadWrite)) {
+                return std::unexpected(ResultState::Failed);
+            }
+
+            uint64_t size = m_file.file.Size().value_or(0);
+            bool fresh = (size == 0);
+            if (fresh) {
+                uint64_t target = sizeof(LogHeader) + uint64_t(capacity) * sizeof(TelemetrySample);
+                if (capacity < 2 || !m_file.file.Truncate(target)) {
+                    Close();
+                    return std::unexpected(ResultState::Failed);
+                }
+                size = target;
+            }
+            m_file.size = size;
+
+            if (m_file.size < sizeof(LogHeader) || !m_file.Map(true)) {
+                Close();
+                return std::unexpected(ResultState::Failed);
+            }
+
+            m_header = reinterpret_cast<LogHeader*>(m_file.view);
+            if (fresh) {
+                std::memcpy(m_header->magic, LogMagic, sizeof(LogMagic));
+                m_header->version = LogVersion;
+                m_header->recordSize = sizeof(TelemetrySample);
+                m_header->capacity = capacity;
+                m_header->sequence.store(0, std::memory_order_release);
+            } else if (!IsValidHeader(*m_header, m_file.size)) {
+                Close();
+                return std::unexpected(ResultState::InvalidParameter);
+            }
+            m_records = reinterpret_cast<TelemetrySample*>(m_file.view + sizeof(LogHeader));
+            return {};
+        }
+
+        void Append(const TelemetrySample& sample) noexcept {
+            if (!m_header) {
+                return;
+            }
+            uint64_t sequence = m_header->sequence.load(std::memory_order_relaxed);
+            TelemetrySample& slot = m_records[sequence % m_header->capacity];
+            // Invalidate first so a torn body is never paired with a matching sequence.
+            std::atomic_ref(slot.sequence).store(~uint64_t{0}, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(reinterpret_cast<uint8_t*>(&slot) + sizeof(slot.sequence),
+                        reinterpret_cast<const uint8_t*>(&sample) + sizeof(sample.sequence),
+                        sizeof(TelemetrySample) - sizeof(sample.sequence));
+            std::atomic_ref(slot.sequence).store(sequence, std::memory_order_release);
+            m_header->sequence.store(sequence + 1, std::memory_order_release);
+        }
+
+        // Hands dirty pages to the OS; the log survives a process crash without this.
+        void Flush() noexcept {
+            m_file.mapping.Flush();
+        }
+
+        void Close() noexcept {
+            Flush();
+            m_header = nullptr;
+            m_records = nullptr;
+            m_file.Close();
+        }
+
+        bool IsOpen() const noexcept { return m_header != nullptr; }
+
+    private:
+        MappedFile m_file;
+        LogHeader* m_header = nullptr;
+        TelemetrySample* m_records = nullptr;
+    };
+
+    // Read-only view of a ring file; samples are visited oldest first.
+    class TelemetryLogReader {
+    public:
+        TelemetryLogReader() = default;
+        ~TelemetryLogReader() { m_file.Close(); }
+        TelemetryLogReader(const TelemetryLogReader&) = delete;
+        TelemetryLogReader& operator=(const TelemetryLogReader&) = delete;
+
+        std::expected<void, ResultState> Open(const std::wstring& path) noexcept {
+            m_file.Close();
+            m_header = nullptr;
+            if (!m_file.file.Open(path, LLTCPlatform::FileAccess::Read)) {
+                return std::unexpected(ResultState::Failed);
+            }
+            auto size = m_file.file.Size();
+            if (!size || *size < sizeof(LogHeader)) {
+                m_file.Close();
+                return std::unexpected(ResultState::InvalidParameter);
+            }
+            m_file.size = *size;
+            if (!m_file.Map(false)) {
+                m_file.Close();
+                return std::unexpected(ResultState::Failed);
+            }
+            auto* header = reinterpret_cast<const LogHeader*>(m_file.view);
+            if (!IsValidHeader(*header, m_file.size)) {
+                m_file.Close();
+                return std::unexpected(ResultState::InvalidParameter);
+            }
+            m_header = header;
+            return {};
+        }
+
+        uint32_t Capacity() const noexcept { return m_header ? m_header->capacity : 0; }
+        uint64_t TotalWritten() const noexcept { return m_header ? m_header->sequence.load(std::memory_order_acquire) : 0; }
+
+        // Calls fn(const TelemetrySample&) for every intact sample still in the ring.
+        // A live writer can overwrite any slot while it is read, so each sample is
+        // copied out and handed over only if its sequence matched before and after
+        // the copy; a slot overwritten meanwhile is skipped.
+        template<typename Fn>
+        void ForEach(Fn&& fn) const {
+            if (!m_header) {
+                return;
+            }
+            auto* records = reinterpret_cast<const TelemetrySample*>(m_file.view + sizeof(LogHeader));
+            uint64_t end = TotalWritten();
+            uint64_t capacity = m_header->capacity;
+            uint64_t begin = (end > capacity) ? end - capacity : 0;
+            for (uint64_t sequence = begin; sequence < end; ++sequence) {
+                const TelemetrySample& slot = records[sequence % capacity];
+                std::atomic_ref slotSequence(const_cast<uint64_t&>(slot.sequence));
+                if (slotSequence.load(std::memory_order_acquire) != sequence) {
+                    continue;
+                }
+                TelemetrySample sample;
+                std::memcpy(&sample, &slot, sizeof(sample));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slotSequence.load(std::memory_order_relaxed) == sequence) {
+                    sample.sequence = sequence;
+                    fn(sample);
+                }
+            }
+        }
+
+    private:
+        MappedFile m_file;
+        const LogHeader* m_header = nullptr;
+    };
+}
\ No newline at end of file
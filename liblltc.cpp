@@ -0,0 +1,260 @@
+#define LLTC_BUILDING_DLL
+#include "liblltc.h"
+#include "LenovoBatteryControl.hpp"
+#include "LenovoOverdriveControl.hpp"
+#include "LenovoWhitekeyboardbacklightControl.hpp"
+#include "LenovoPowerModeControl.hpp"
+#include "LenovoHybridmodeControl.hpp"
+#include "LenovoAlwaysonusbControl.hpp"
+#include "SimulatedDeviceTransport.hpp"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+static_assert(LLTC_OK == static_cast<int>(ResultState::Success));
+static_assert(LLTC_FAILED == static_cast<int>(ResultState::Failed));
+static_assert(LLTC_INVALID_PARAMETER == static_cast<int>(ResultState::InvalidParameter));
+static_assert(LLTC_RETRY_TIMEOUT == static_cast<int>(ResultState::RetryTimeout));
+static_assert(LLTC_NOT_SUPPORTED == static_cast<int>(ResultState::NotSupported));
+
+// Device handles and the WMI session are process-wide already; the context adds
+// the hybrid-mode controller, whose G-Sync and iGPU probes would otherwise run
+// on every GPU call, and serialises calls made through it.
+struct lltc_context {
+    std::mutex mutex;
+    std::unique_ptr<HybridModeController> hybridMode;
+
+    HybridModeController& HybridMode() {
+        if (!hybridMode) {
+            hybridMode = std::make_unique<HybridModeController>();
+        }
+        return *hybridMode;
+    }
+};
+
+namespace {
+    std::once_flag g_transportInstalled;
+
+    lltc_result ToResult(ResultState state) noexcept {
+        return static_cast<lltc_result>(state);
+    }
+
+    // Runs fn with the context locked; nothing thrown inside leaves the library.
+    template<typename Fn>
+    lltc_result Guarded(lltc_context* context, Fn&& fn) noexcept {
+        if (!context) {
+            return LLTC_INVALID_PARAMETER;
+        }
+        try {
+            std::lock_guard lock(context->mutex);
+            return fn();
+        } catch (...) {
+            return LLTC_FAILED;
+        }
+    }
+
+    // Enum values as on the command line: BatteryMode and HybridModeState are 1-based there.
+    template<typename T>
+    lltc_result Output(const std::expected<T, ResultState>& result, int* out, int offset = 0) noexcept {
+        if (!result) {
+            return ToResult(result.error());
+        }
+        *out = static_cast<int>(*result) + offset;
+        return LLTC_OK;
+    }
+
+    template<typename T, typename Setter>
+    lltc_result Apply(const std::expected<T, ResultState>& state, Setter&& setter) {
+        if (!state) {
+            return ToResult(state.error());
+        }
+        auto result = setter(*state);
+        return result ? LLTC_OK : ToResult(result.error());
+    }
+
+    std::expected<HybridModeState, ResultState> IntToGpuMode(int mode) noexcept {
+        if (mode < LLTC_GPU_MODE_HYBRID || mode > LLTC_GPU_MODE_DGPU) {
+            return std::unexpected(ResultState::InvalidParameter);
+        }
+        return static_cast<HybridModeState>(mode - 1);
+    }
+}
+
+extern "C" {
+
+LLTC_API uint32_t lltc_api_version(void) {
+    return LLTC_API_VERSION;
+}
+
+LLTC_API const char* lltc_result_string(lltc_result result) {
+    // to_string() views literals, so data() is NUL-terminated.
+    return to_string(static_cast<ResultState>(result)).data();
+}
+
+LLTC_API lltc_result lltc_open(lltc_context** context) {
+    if (!context) {
+        return LLTC_INVALID_PARAMETER;
+    }
+    *context = nullptr;
+    try {
+        std::call_once(g_transportInstalled, [] { LLTCSimulatedTransport::InstallFromEnvironment(); });
+        auto created = std::make_unique<lltc_context>();
+        // Best effort: IOCTL-only calls work without WMI, and WMI calls reconnect on demand.
+        LLTCCommonUtils::GetDeviceTransport().ConnectWmi(LLTCCommonUtils::WmiPathType::Full);
+        *context = created.release();
+        return LLTC_OK;
+    } catch (...) {
+        return LLTC_FAILED;
+    }
+}
+
+LLTC_API void lltc_close(lltc_context* context) {
+    delete context;
+}
+
+LLTC_API void lltc_shutdown(void) {
+    LLTCCommonUtils::WmiWorker::Instance().Shutdown();
+    LLTCCommonUtils::GetDeviceTransport().Shutdown();
+}
+
+LLTC_API lltc_result lltc_get_power_mode(lltc_context* context, int* mode) {
+    if (!mode) {
+        return LLTC_INVALID_PARAMETER;
+    }
+    return Guarded(context, [&] { return Output(LLTCPowerMode::GetState(), mode); });
+}
+
+LLTC_API lltc_result lltc_set_power_mode(lltc_context* context, int mode) {
+    return Guarded(context, [&] { return Apply(intToPowerMode(mode), LLTCPowerMode::SetState); });
+}
+
+LLTC_API lltc_result lltc_get_battery_mode(lltc_context* context, int* mode) {
+    if (!mode) {
+        return LLTC_INVALID_PARAMETER;
+    }
+    return Guarded(context, [&] { return Output(LLTCBatteryControl::GetBatteryMode(), mode, 1); });
+}
+
+LLTC_API lltc_result lltc_set_battery_mode(lltc_context* context, int mode) {
+    return Guarded(context, [&] { return Apply(intToBatteryMode(mode), LLTCBatteryControl::SetBatteryMode); });
+}
+
+LLTC_API lltc_result lltc_get_overdrive(lltc_context* context, int* state) {
+    if (!state) {
+        return LLTC_INVALID_PARAMETER;
+    }
+    return Guarded(context, [&] { return Output(LLTCOverDrive::GetState(), state); });
+}
+
+LLTC_API lltc_result lltc_set_overdrive(lltc_context* context, int state) {
+    return Guarded(context, [&] {
+        return Apply(intToOverDriveState(state), [](OverDriveState value) { return LLTCOverDrive::SetState(value); });
+    });
+}
+
+LLTC_API lltc_result lltc_get_keyboard_backlight(lltc_context* context, int* level) {
+    if (!level) {
+        return LLTC_INVALID_PARAMETER;
+    }
+    return Guarded(context, [&] { return Output(LLTCWhiteKeyboardBacklight::GetState(), level); });
+}
+
+LLTC_API lltc_result lltc_set_keyboard_backlight(lltc_context* context, int level) {
+    return Guarded(context, [&] {
+        return Apply(intToWhiteKeyboardBacklightState(level), LLTCWhiteKeyboardBacklight::SetState);
+    });
+}
+
+LLTC_API lltc_result lltc_get_always_on_usb(lltc_context* context, int* state) {
+    if (!state) {
+        return LLTC_INVALID_PARAMETER;
+    }
+    return Guarded(context, [&] { return Output(LLTCAlwaysOnUSB::GetState(), state); });
+}
+
+LLTC_API lltc_result lltc_set_always_on_usb(lltc_context* context, int state) {
+    return Guarded(context, [&] { return Apply(intToAlwaysOnUSBState(state), LLTCAlwaysOnUSB::SetState); });
+}
+
+LLTC_API lltc_result lltc_get_gpu_mode(lltc_context* context, int* mode) {
+    if (!mode) {
+        return LLTC_INVALID_PARAMETER;
+    }
+    return Guarded(context, [&] {
+        auto& controller = context->HybridMode();
+        if (!controller.IsHybridModeSupported()) {
+            return LLTC_NOT_SUPPORTED;
+        }
+        HybridModeState current;
+        if (controller.GetHybridModeSync(current) != OperationResult::Success) {
+            return LLTC_FAILED;
+        }
+        *mode = static_cast<int>(current) + 1;
+        return LLTC_OK;
+    });
+}
+
+LLTC_API lltc_result lltc_set_gpu_mode(lltc_context* context, int mode, int* restart_required) {
+    if (restart_required) {
+        *restart_required = 0;
+    }
+    auto target = IntToGpuMode(mode);
+    if (!target) {
+        return ToResult(target.error());
+    }
+    return Guarded(context, [&] {
+        auto& controller = context->HybridMode();
+        if (!controller.IsHybridModeSupported()) {
+            return LLTC_NOT_SUPPORTED;
+        }
+        HybridModeState current;
+        if (controller.GetHybridModeSync(current) != OperationResult::Success) {
+            return LLTC_FAILED;
+        }
+        if (current == *target) {
+            return LLTC_OK;
+        }
+        if (controller.SetHybridModeSync(*target) != OperationResult::Success) {
+            return LLTC_FAILED;
+        }
+        if (restart_required) {
+            *restart_required = (current == HybridModeState::Off || *target == HybridModeState::Off) ? 1 : 0;
+        }
+        return LLTC_OK;
+    });
+}
+
+LLTC_API lltc_result lltc_get_battery_info(lltc_context* context, lltc_battery_info* info) {
+    if (!info || info->size < sizeof(info->size)) {
+        return LLTC_INVALID_PARAMETER;
+    }
+    return Guarded(context, [&] {
+        auto result = LLTCBatteryControl::GetBatteryInformation();
+        if (!result) {
+            return ToResult(result.error());
+        }
+        lltc_battery_info out = {};
+        out.size = info->size;
+        out.ac_connected = result->isAcConnected ? 1 : 0;
+        out.percent = result->batteryLifePercent;
+        out.remaining_seconds = result->batteryLifeTime;
+        out.rate_mw = result->dischargeRate;
+        out.capacity_mwh = result->currentCapacity;
+        out.design_capacity_mwh = result->designedCapacity;
+        out.full_charge_capacity_mwh = result->fullChargedCapacity;
+        out.cycle_count = result->cycleCount;
+        out.low_battery = result->isLowBattery ? 1 : 0;
+        out.temperature_c = result->temperatureC;
+        out.manufacture_year = result->manufactureDate.wYear;
+        out.manufacture_month = result->manufactureDate.wMonth;
+        out.manufacture_day = result->manufactureDate.wDay;
+        out.first_use_year = result->firstUseDate.wYear;
+        out.first_use_month = result->firstUseDate.wMonth;
+        out.first_use_day = result->firstUseDate.wDay;
+        std::memcpy(info, &out, std::min<size_t>(info->size, sizeof(out)));
+        return LLTC_OK;
+    });
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+/*
+ * liblltc: the lltc controls as a C library, for tools that would otherwise
+ * spawn lltc.exe and parse its output.
+ *
+ * Every function returns an lltc_result (mirroring ResultState) and never
+ * lets a C++ exception escape. Integer values are the ones the lltc command
+ * line accepts. A context caches the WMI session and the feature probes; it
+ * may be shared between threads, and calls on one context are serialised.
+ */
+#ifndef LIBLLTC_H
+#define LIBLLTC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(LLTC_API)
+#  if defined(LLTC_STATIC)
+#    define LLTC_API
+#  elif !defined(_WIN32)
+#    define LLTC_API __attribute__((visibility("default")))
+#  elif defined(LLTC_BUILDING_DLL)
+#    define LLTC_API __declspec(dllexport)
+#  else
+#    define LLTC_API __declspec(dllimport)
+#  endif
+#endif
+
+/* Bumped on any incompatible change; compare with lltc_api_version(). */
+#define LLTC_API_VERSION 1
+
+typedef struct lltc_context lltc_context;
+
+typedef enum lltc_result {
+    LLTC_OK = 0,
+    LLTC_FAILED = 1,
+    LLTC_INVALID_PARAMETER = 2,
+    LLTC_RETRY_TIMEOUT = 3,
+    LLTC_NOT_SUPPORTED = 4
+} lltc_result;
+
+enum {
+    LLTC_POWER_MODE_QUIET = 1,
+    LLTC_POWER_MODE_BALANCE = 2,
+    LLTC_POWER_MODE_PERFORMANCE = 3,
+    LLTC_POWER_MODE_GODMODE = 254
+};
+
+enum {
+    LLTC_BATTERY_MODE_CONSERVATION = 1,
+    LLTC_BATTERY_MODE_NORMAL = 2,
+    LLTC_BATTERY_MODE_RAPID_CHARGE = 3
+};
+
+enum {
+    LLTC_GPU_MODE_HYBRID = 1,
+    LLTC_GPU_MODE_HYBRID_IGPU = 2,
+    LLTC_GPU_MODE_HYBRID_AUTO = 3,
+    LLTC_GPU_MODE_DGPU = 4
+};
+
+enum {
+    LLTC_OVERDRIVE_OFF = 0,
+    LLTC_OVERDRIVE_ON = 1
+};
+
+enum {
+    LLTC_KEYBOARD_BACKLIGHT_OFF = 0,
+    LLTC_KEYBOARD_BACKLIGHT_LOW = 1,
+    LLTC_KEYBOARD_BACKLIGHT_HIGH = 2
+};
+
+enum {
+    LLTC_ALWAYS_ON_USB_OFF = 0,
+    LLTC_ALWAYS_ON_USB_ON_WHEN_SLEEPING = 1,
+    LLTC_ALWAYS_ON_USB_ON_ALWAYS = 2
+};
+
+/* Set size to sizeof(lltc_battery_info) before the call; fields beyond it are
+ * not written, so callers built against an older header keep working. */
+typedef struct lltc_battery_info {
+    uint32_t size;
+    int32_t ac_connected;
+    int32_t percent;
+    uint32_t remaining_seconds;         /* 0xFFFFFFFF if unknown */
+    int32_t rate_mw;                    /* negative while discharging */
+    uint32_t capacity_mwh;
+    uint32_t design_capacity_mwh;
+    uint32_t full_charge_capacity_mwh;
+    uint32_t cycle_count;
+    int32_t low_battery;
+    double temperature_c;               /* negative if not available */
+    uint16_t manufacture_year;          /* 0 if not available */
+    uint16_t manufacture_month;
+    uint16_t manufacture_day;
+    uint16_t first_use_year;            /* 0 if not available */
+    uint16_t first_use_month;
+    uint16_t first_use_day;
+} lltc_battery_info;
+
+LLTC_API uint32_t lltc_api_version(void);
+/* Static text; never NULL. */
+LLTC_API const char* lltc_result_string(lltc_result result);
+
+LLTC_API lltc_result lltc_open(lltc_context** context);
+LLTC_API void lltc_close(lltc_context* context);
+/* Stops the library's COM worker and IOCTL completion threads. Call once, after closing every
+ * context and before FreeLibrary; no other call is allowed afterwards. */
+LLTC_API void lltc_shutdown(void);
+
+LLTC_API lltc_result lltc_get_power_mode(lltc_context* context, int* mode);
+LLTC_API lltc_result lltc_set_power_mode(lltc_context* context, int mode);
+LLTC_API lltc_result lltc_get_battery_mode(lltc_context* context, int* mode);
+LLTC_API lltc_result lltc_set_battery_mode(lltc_context* context, int mode);
+LLTC_API lltc_result lltc_get_overdrive(lltc_context* context, int* state);
+LLTC_API lltc_result lltc_set_overdrive(lltc_context* context, int state);
+LLTC_API lltc_result lltc_get_keyboard_backlight(lltc_context* context, int* level);
+LLTC_API lltc_result lltc_set_keyboard_backlight(lltc_context* context, int level);
+LLTC_API lltc_result lltc_get_always_on_usb(lltc_context* context, int* state);
+LLTC_API lltc_result lltc_set_always_on_usb(lltc_context* context, int state);
+LLTC_API lltc_result lltc_get_gpu_mode(lltc_context* context, int* mode);
+/* restart_required (may be NULL) is set to 1 when the switch takes effect
+ * only after a restart, i.e. to or from LLTC_GPU_MODE_DGPU. */
+LLTC_API lltc_result lltc_set_gpu_mode(lltc_context* context, int mode, int* restart_required);
+LLTC_API lltc_result lltc_get_battery_info(lltc_context* context, lltc_battery_info* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBLLTC_H */
\ No newline at end of file
@@ -0,0 +1,153 @@
+/*
+ * Compares reading the power mode and battery information through liblltc
+ * with spawning lltc.exe for the same query, which is what tools did before.
+ *
+ *   liblltc_bench [calls] [spawns] [path to lltc.exe]
+ *
+ * The spawned CLI runs with LLTC_SERVER=off so a running `lltc serve` does not
+ * answer for it. Set LLTC_TRANSPORT=sim to compare without Legion hardware.
+ */
+#include "liblltc.h"
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double g_ticksPerUs;
+
+static double NowUs(void) {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / g_ticksPerUs;
+}
+
+static int CompareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void Report(const char* name, double* samples, int count) {
+    double total = 0;
+    int i;
+    if (count == 0) {
+        printf("%-28s no successful calls\n", name);
+        return;
+    }
+    qsort(samples, count, sizeof(double), CompareDoubles);
+    for (i = 0; i < count; ++i) {
+        total += samples[i];
+    }
+    printf("%-28s %6d calls  mean %10.1f us  p50 %10.1f us  p99 %10.1f us\n", name, count,
+           total / count, samples[count / 2], samples[(count * 99) / 100]);
+}
+
+/* Runs `lltc.exe <arguments>` with output discarded; returns 0 on exit code 0. */
+static int Spawn(const char* cli, const char* arguments) {
+    char commandLine[MAX_PATH + 64];
+    STARTUPINFOA startup;
+    PROCESS_INFORMATION process;
+    DWORD exitCode = 1;
+    HANDLE nul = CreateFileA("NUL", GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+
+    snprintf(commandLine, sizeof(commandLine), "\"%s\" %s", cli, arguments);
+    memset(&startup, 0, sizeof(startup));
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdOutput = nul;
+    startup.hStdError = nul;
+    SetHandleInformation(nul, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    if (!CreateProcessA(NULL, commandLine, NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &startup, &process)) {
+        CloseHandle(nul);
+        return -1;
+    }
+    WaitForSingleObject(process.hProcess, INFINITE);
+    GetExitCodeProcess(process.hProcess, &exitCode);
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+    CloseHandle(nul);
+    return exitCode == 0 ? 0 : -1;
+}
+
+int main(int argc, char* argv[]) {
+    int calls = argc > 1 ? atoi(argv[1]) : 1000;
+    int spawns = argc > 2 ? atoi(argv[2]) : 20;
+    const char* cli = argc > 3 ? argv[3] : "lltc.exe";
+    int maxCount = calls > spawns ? calls : spawns;
+    double* samples = (double*)malloc(sizeof(double) * (maxCount > 0 ? maxCount : 1));
+    LARGE_INTEGER frequency;
+    lltc_context* context = NULL;
+    lltc_battery_info info;
+    lltc_result result;
+    double start;
+    int mode;
+    int count;
+    int i;
+
+    if (!samples || calls < 1 || spawns < 0) {
+        fprintf(stderr, "usage: liblltc_bench [calls >= 1] [spawns >= 0] [path to lltc.exe]\n");
+        return 1;
+    }
+    if (lltc_api_version() != LLTC_API_VERSION) {
+        fprintf(stderr, "liblltc API version %u, expected %d\n", lltc_api_version(), LLTC_API_VERSION);
+        return 1;
+    }
+    QueryPerformanceFrequency(&frequency);
+    g_ticksPerUs = (double)frequency.QuadPart / 1e6;
+
+    start = NowUs();
+    result = lltc_open(&context);
+    printf("%-28s %6d call   %10.1f us\n", "lltc_open", 1, NowUs() - start);
+    if (result != LLTC_OK) {
+        fprintf(stderr, "lltc_open: %s\n", lltc_result_string(result));
+        return 1;
+    }
+
+    for (i = 0, count = 0; i < calls; ++i) {
+        start = NowUs();
+        result = lltc_get_power_mode(context, &mode);
+        if (result == LLTC_OK) {
+            samples[count++] = NowUs() - start;
+        }
+    }
+    if (count < calls) {
+        fprintf(stderr, "lltc_get_power_mode: %s\n", lltc_result_string(result));
+    }
+    Report("lltc_get_power_mode", samples, count);
+
+    for (i = 0, count = 0; i < calls; ++i) {
+        info.size = sizeof(info);
+        start = NowUs();
+        result = lltc_get_battery_info(context, &info);
+        if (result == LLTC_OK) {
+            samples[count++] = NowUs() - start;
+        }
+    }
+    if (count < calls) {
+        fprintf(stderr, "lltc_get_battery_info: %s\n", lltc_result_string(result));
+    }
+    Report("lltc_get_battery_info", samples, count);
+
+    lltc_close(context);
+    lltc_shutdown();
+
+    SetEnvironmentVariableA("LLTC_SERVER", "off");
+    for (i = 0, count = 0; i < spawns; ++i) {
+        start = NowUs();
+        if (Spawn(cli, "get pm") == 0) {
+            samples[count++] = NowUs() - start;
+        }
+    }
+    Report("spawn lltc get pm", samples, count);
+
+    for (i = 0, count = 0; i < spawns; ++i) {
+        start = NowUs();
+        if (Spawn(cli, "get bi") == 0) {
+            samples[count++] = NowUs() - start;
+        }
+    }
+    Report("spawn lltc get bi", samples, count);
+
+    free(samples);
+    return 0;
+}
\ No newline at end of file
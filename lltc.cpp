@@ -4,14 +4,35 @@
 #include "LenovoPowerModeControl.hpp"
 #include "LenovoHybridmodeControl.hpp"
 #include "LenovoAlwaysonusbControl.hpp"
+#include "ControlService.hpp"
+#include "SimulatedDeviceTransport.hpp"
+#include "TelemetryCodec.hpp"
+#include "EnergyAccountant.hpp"
+#include "StatusPage.hpp"
+#include "RecordWriter.hpp"
 
 #include <iomanip>
 #include <print>
 #include <algorithm>
-#include <numeric>
+#include <cstring>
+#include <charconv>
+#include <optional>
+#include <limits>
+#include <filesystem>
+#include <atomic>
+#ifdef _WIN32
 #include <conio.h>
+#else
+#include <csignal>
+#endif
 
 inline std::string toLower(std::string_view sv);
+std::optional<int> ParseIntervalMs(std::string_view text);
+#ifdef _WIN32
+BOOL WINAPI ConsoleCtrlHandler(DWORD ctrlType);
+#else
+void StopSignalHandler(int signal);
+#endif
 bool TurnOffMonitor();
 bool GetBatteryMode();
 bool SetBatteryMode(int tar);
@@ -20,38 +41,241 @@ bool SetOverdrive(int enable);
 bool GetWhiteKeyboardBacklight();
 bool SetWhiteKeyboardBacklight(int tar);
 bool GetFullBatteryInfo();
-void GetFullBatteryInfoDmon(int ms);
+struct SinkSpec;
+enum class OverflowPolicy { Drop, Block };
+void GetFullBatteryInfoDmon(int ms, const std::wstring& logPath, const std::vector<SinkSpec>& sinks, OverflowPolicy overflow, bool energyReport);
+bool BuildSinks(const std::vector<SinkSpec>& specs, LLTCOutput::SinkPipeline& pipeline);
+bool DumpTelemetryLog(const std::wstring& logPath);
+bool PackTelemetryLog(const std::wstring& ringPath, const std::wstring& packedPath);
+bool ReportLogEnergy(const std::wstring& logPath);
+void PrintEnergyReport(const LLTCTelemetry::EnergyAccountant& accountant, std::FILE* stream);
+bool IsPackedLogPath(const std::wstring& path);
 bool GetPowerMode();
 bool SetPowerMode(int tar);
+void WatchPowerMode();
+void WatchBatteryInformation(int heartbeatSeconds);
 bool GetGPUMode();
 bool SetGPUMode(int tar);
 bool GetAlwaysOnUSB();
 bool SetAlwaysOnUSB(int tar);
+void PrintIoctlTiming(LLTCCommonUtils::DeviceKind device, const LLTCCommonUtils::IoctlRequest& request);
+bool ReportValue(std::string_view property, std::string_view value);
+bool ReportFailure(std::string_view property, std::string_view error);
+std::optional<LLTCCommonUtils::WmiPathType> WmiPathForCommand(int argc, char* argv[]);
+bool IsServedCommand(int argc, char* argv[]);
+LLTCService::ServiceClient* ServerConnection();
+std::optional<ServiceProperty> ServicePropertyFromName(std::string_view name);
+bool RunServer(std::chrono::milliseconds maxAge, uint32_t instances, std::optional<sockaddr_in> metrics);
+bool RunLoadGenerator(ServiceProperty property, uint32_t requests, uint32_t clients, bool reconnect);
+bool RunScrapeLoad(const sockaddr_in& endpoint, uint32_t requests, uint32_t clients, bool reconnect);
+bool ShowStatus();
+bool RunStatusStress(int seconds, uint32_t readers);
+int RunCommand(int argc, char* argv[], bool checkOnly = false);
+bool RunBatch(const std::wstring& source, bool stopOnError);
+
+// One -dmon output destination; batching options apply to the last one named.
+struct SinkSpec {
+    enum class Kind { Stdout, File, RotatingFile } kind;
+    std::wstring path;
+    SinkOptions options;
+    uint64_t maxBytes = 0;
+    uint32_t keep = 3;
+};
+
+// What the -dmon sampler thread hands to the writer for each tick.
+struct DmonSample {
+    SYSTEMTIME localTime;
+    TelemetrySample sample;
+    double temperatureC;        // full precision for the averages; < 0 if not available
+    bool lowBattery;
+    uint32_t batteryIoctls;
+    uint32_t energyIoctls;
+};
+
+// Signalled on Ctrl+C so long-running modes can stop cleanly. Modes that wait
+// on it set g_gracefulStop; otherwise Ctrl+C terminates the process as usual.
+LLTCPlatform::Event g_stopEvent;
+std::atomic<bool> g_gracefulStop = false;
+
+// Named points in the life of the process, printed to stderr on exit when
+// LLTC_STARTUP_TIMING is set. Marks may come from any thread.
+class PhaseTimer {
+public:
+    PhaseTimer() noexcept : m_start(std::chrono::steady_clock::now()) {}
+
+    void Mark(const char* phase) noexcept {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard lock(m_mutex);
+        if (m_count < MaxPhases) {
+            m_phases[m_count++] = {phase, now};
+        }
+    }
+
+    void Report() noexcept {
+        std::lock_guard lock(m_mutex);
+        std::sort(m_phases, m_phases + m_count, [](const Phase& a, const Phase& b) { return a.time < b.time; });
+        for (size_t i = 0; i < m_count; ++i) {
+            std::print(stderr, "[startup] {:>9.3f} ms  {}\n",
+                std::chrono::duration<double, std::milli>(m_phases[i].time - m_start).count(), m_phases[i].name);
+        }
+    }
+
+private:
+    struct Phase {
+        const char* name;
+        std::chrono::steady_clock::time_point time;
+    };
+    static constexpr size_t MaxPhases = 16;
+    std::mutex m_mutex;
+    std::chrono::steady_clock::time_point m_start;
+    Phase m_phases[MaxPhases] = {};
+    size_t m_count = 0;
+};
+PhaseTimer g_phases;
+
+// Connects to WMI and resolves the GameZone instance path as the first job of
+// the WMI worker while main validates arguments and does IOCTL work. The first
+// real WMI call queues behind it and waits only for whatever is left of the
+// connect. Waited for on destruction so the job never outlives the transport.
+class WmiWarmup {
+public:
+    WmiWarmup() = default;
+    WmiWarmup(const WmiWarmup&) = delete;
+    WmiWarmup& operator=(const WmiWarmup&) = delete;
+    ~WmiWarmup() {
+        if (m_done.valid()) {
+            m_done.wait();
+        }
+    }
+
+    void Start(LLTCCommonUtils::WmiPathType pathType) {
+        g_phases.Mark("wmi warm-up started");
+        m_done = LLTCCommonUtils::WmiWorker::Instance().Submit([pathType] {
+            HRESULT hr = LLTCCommonUtils::GetDeviceTransport().ConnectWmi(pathType);
+            g_phases.Mark(SUCCEEDED(hr) ? "wmi warm-up connected" : "wmi warm-up failed");
+        });
+    }
+
+private:
+    std::future<void> m_done;
+};
 
 int main(int argc, char* argv[]) {
+    g_phases.Mark("entry");
+    const bool startupTiming = std::getenv("LLTC_STARTUP_TIMING") != nullptr;
+    // Reports after the warm-up thread below has been joined.
+    struct StartupReport {
+        bool enabled;
+        ~StartupReport() {
+            if (enabled) {
+                g_phases.Report();
+            }
+        }
+    } startupReport{startupTiming};
+
+    // --format may appear anywhere; strip it before dispatching the command.
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        std::string_view value;
+        if (arg == "--format" && i + 1 < argc) {
+            value = argv[++i];
+        } else if (arg.starts_with("--format=")) {
+            value = arg.substr(9);
+        } else {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        auto format = stringToOutputFormat(toLower(value));
+        if (!format) {
+            std::print(stderr, "Error: invalid output format '{}'. Use text, json, ndjson or csv.\n", value);
+            return 1;
+        }
+        LLTCOutput::Output().SetFormat(*format);
+    }
+    argc = kept;
+
+    LLTCSimulatedTransport::InstallFromEnvironment();
+    WmiWarmup warmup;
+    const char* warmupSetting = std::getenv("LLTC_WMI_WARMUP");
+    if (!(warmupSetting && std::string_view(warmupSetting) == "0")) {
+        // A running server answers with its own warm session.
+        if (auto pathType = WmiPathForCommand(argc, argv); pathType && !(IsServedCommand(argc, argv) && ServerConnection())) {
+            warmup.Start(*pathType);
+        }
+    }
+    struct CommandTiming {
+        CommandTiming() { g_phases.Mark("command started"); }
+        ~CommandTiming() { g_phases.Mark("command finished"); }
+    } commandTiming;
+
+#ifdef _WIN32
+    SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+#else
+    struct sigaction stopAction = {};
+    stopAction.sa_handler = StopSignalHandler;
+    sigaction(SIGINT, &stopAction, nullptr);
+    sigaction(SIGTERM, &stopAction, nullptr);
+#endif
+    if (std::getenv("LLTC_IOCTL_TIMING")) {
+        LLTCCommonUtils::SetIoctlObserver(PrintIoctlTiming);
+    }
     if (argc < 2) {
         std::print("Usage:\n"
+                   "  lltc [--format text|json|ndjson|csv] <command>\n"
                    "  lltc monitoroff | mo\n"
                    "  lltc get batterymode | bm\n"
                    "  lltc get overdrive | od\n"
                    "  lltc get keyboardbacklight | kb\n"
                    "  lltc get batteryinformation | bi\n"
-                   "  lltc get batteryinformation -dmon\n"
+                   "  lltc get batteryinformation -dmon [seconds|<n>ms] [--log <file.lltl|file.lltz>]\n"
+                   "      [--out <file> | --rotate <file> [--max-mb <n>] [--keep <n>]]... [--no-stdout]\n"
+                   "      [--batch <rows>] [--batch-ms <ms>] [--fsync never|batch|<ms>]   (apply to the preceding sink)\n"
+                   "      [--overflow drop|block] [--energy]\n"
                    "  lltc get powermode | pm\n"
                    "  lltc get gpumode | gm\n"
                    "  lltc get alwaysonusb | ao\n"
+                   "  lltc watch powermode | pm\n"
+                   "  lltc watch batteryinformation | bi [heartbeat seconds]\n"
                    "  lltc set batterymode <Conservation|Normal|RapidCharge|1|2|3>\n"
                    "  lltc set overdrive <on|off|1|0>\n"
                    "  lltc set keyboardbacklight <off|low|high|0|1|2>\n"
                    "  lltc set powermode <Quiet|Balance|Performance|GodMode|1|2|3|254>\n"
                    "  lltc set gpumode <Hybrid|HybridIGPU|HybridAuto|dGPU|1|2|3|4>\n"
-                   "  lltc set alwaysonusb <Off|OnWhenSleeping|OnAlways|0|1|2>\n");
+                   "  lltc set alwaysonusb <Off|OnWhenSleeping|OnAlways|0|1|2>\n"
+                   "  lltc dump <file.lltl|file.lltz>\n"
+                   "  lltc pack <in.lltl> <out.lltz>\n"
+                   "  lltc energy <file.lltl|file.lltz>\n"
+                   "  lltc serve [--max-age <ms>] [--instances <n>] [--metrics [address:]port]\n"
+                   "  lltc loadgen [--requests <n>] [--clients <n>] [--property <bm|od|kb|pm|gm|ao|bi> | --metrics [address:]port] [--reconnect]\n"
+                   "  lltc status [--stress <seconds> [--readers <n>]]\n"
+                   "  lltc batch [file|-] [--stop-on-error]   (get/set/monitoroff lines, one process)\n");
         return 1;
     }
+    return RunCommand(argc, argv);
+}
+
+// Runs one command line: argv[1] is the command. Also runs each line of a batch.
+// With checkOnly, get, set and monitoroff parse their arguments and report any
+// error, then return without touching the device.
+int RunCommand(int argc, char* argv[], bool checkOnly) {
     std::string cmd1 = toLower(argv[1]);
     // === lltc monitoroff / mo ===
     if (cmd1 == "monitoroff" || cmd1 == "mo") {
-        TurnOffMonitor();
+        if (checkOnly) {
+            return 0;
+        }
+        if (!TurnOffMonitor()) {
+            if (!LLTCOutput::Output().IsText()) {
+                ReportFailure("monitor", to_string(ResultState::NotSupported));
+            } else {
+                std::print(stderr, "Failed to turn off the monitor: {}\n", to_string(ResultState::NotSupported));
+            }
+            return 1;
+        }
+        if (!LLTCOutput::Output().IsText()) {
+            ReportValue("monitor", "off");
+        }
         return 0;
     }
     // === lltc get ... ===
@@ -64,41 +288,307 @@ int main(int argc, char* argv[]) {
         
         if (prop == "batteryinformation" || prop == "bi") {
             if (argc >= 4 && toLower(argv[3]) == "-dmon") {
-                int refreshS = 0;
-                if (argc >= 5) {
-                    try {
-                        refreshS = std::stoi(argv[4]);
-                        if (refreshS < 1) {
-                            std::print(stderr, "Error: refresh interval must be at least 1s.\n");
+                int refreshMs = 0;
+                std::wstring logPath;
+                std::vector<SinkSpec> sinks = {{SinkSpec::Kind::Stdout}};
+                bool keepStdout = true;
+                OverflowPolicy overflow = OverflowPolicy::Drop;
+                bool energyReport = false;
+                for (int i = 4; i < argc; ++i) {
+                    std::string option = toLower(argv[i]);
+                    bool takesValue = option == "--log" || option == "--out" || option == "--rotate" ||
+                                      option == "--max-mb" || option == "--keep" || option == "--batch" ||
+                                      option == "--batch-ms" || option == "--fsync" || option == "--overflow";
+                    if (takesValue && i + 1 >= argc) {
+                        std::print(stderr, "Error: '{}' requires a value.\n", argv[i]);
+                        return 1;
+                    }
+                    auto number = [&](int minimum) -> std::optional<int> {
+                        int value = 0;
+                        std::string_view text = argv[i];
+                        auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+                        if (ec != std::errc() || ptr != text.data() + text.size() || value < minimum) {
+                            std::print(stderr, "Error: invalid value '{}' for '{}'.\n", argv[i], argv[i - 1]);
+                            return std::nullopt;
+                        }
+                        return value;
+                    };
+                    if (option == "--log") {
+                        logPath = std::filesystem::path(argv[++i]).wstring();
+                    } else if (option == "--out" || option == "--rotate") {
+                        sinks.push_back({option == "--out" ? SinkSpec::Kind::File : SinkSpec::Kind::RotatingFile,
+                                         std::filesystem::path(argv[++i]).wstring()});
+                        if (option == "--rotate") {
+                            sinks.back().maxBytes = 64ULL << 20;
+                        }
+                    } else if (option == "--overflow") {
+                        std::string policy = toLower(argv[++i]);
+                        if (policy != "drop" && policy != "block") {
+                            std::print(stderr, "Error: invalid overflow policy '{}'. Use drop or block.\n", argv[i]);
+                            return 1;
+                        }
+                        overflow = (policy == "block") ? OverflowPolicy::Block : OverflowPolicy::Drop;
+                    } else if (option == "--energy") {
+                        energyReport = true;
+                    } else if (option == "--no-stdout") {
+                        keepStdout = false;
+                    } else if (option == "--max-mb" || option == "--keep") {
+                        ++i;
+                        auto value = number(option == "--keep" ? 0 : 1);
+                        if (!value) {
+                            return 1;
+                        }
+                        if (sinks.back().kind != SinkSpec::Kind::RotatingFile) {
+                            std::print(stderr, "Error: '{}' applies to a preceding --rotate sink.\n", argv[i - 1]);
                             return 1;
                         }
-                    } catch (...) {
-                        std::print(stderr, "Error: invalid refresh interval '{}'. Must be a number >= 1.\n", argv[4]);
+                        if (option == "--max-mb") {
+                            sinks.back().maxBytes = static_cast<uint64_t>(*value) << 20;
+                        } else {
+                            sinks.back().keep = static_cast<uint32_t>(*value);
+                        }
+                    } else if (option == "--batch" || option == "--batch-ms") {
+                        ++i;
+                        auto value = number(option == "--batch" ? 1 : 0);
+                        if (!value) {
+                            return 1;
+                        }
+                        if (option == "--batch") {
+                            sinks.back().options.batchRows = static_cast<uint32_t>(*value);
+                        } else {
+                            sinks.back().options.batchInterval = std::chrono::milliseconds(*value);
+                        }
+                    } else if (option == "--fsync") {
+                        std::string policy = toLower(argv[++i]);
+                        if (policy == "never") {
+                            sinks.back().options.fsync = FsyncPolicy::Never;
+                        } else if (policy == "batch") {
+                            sinks.back().options.fsync = FsyncPolicy::EveryBatch;
+                        } else {
+                            auto value = number(1);
+                            if (!value) {
+                                return 1;
+                            }
+                            sinks.back().options.fsync = FsyncPolicy::Interval;
+                            sinks.back().options.fsyncInterval = std::chrono::milliseconds(*value);
+                        }
+                    } else if (i == 4) {
+                        auto interval = ParseIntervalMs(argv[i]);
+                        if (!interval) {
+                            std::print(stderr, "Error: invalid refresh interval '{}'. Use seconds (3, 3s) or milliseconds (250ms), at least 10ms.\n", argv[i]);
+                            return 1;
+                        }
+                        refreshMs = *interval;
+                    } else {
+                        std::print(stderr, "Error: unexpected argument '{}'.\n", argv[i]);
                         return 1;
                     }
                 }
-                GetFullBatteryInfoDmon(refreshS);
+                if (!keepStdout) {
+                    sinks.erase(sinks.begin());
+                }
+                if (sinks.empty()) {
+                    std::print(stderr, "Error: '--no-stdout' needs at least one --out or --rotate sink.\n");
+                    return 1;
+                }
+                if (!checkOnly) {
+                    GetFullBatteryInfoDmon(refreshMs, logPath, sinks, overflow, energyReport);
+                }
                 return 0;
             } else {
-                return GetFullBatteryInfo() ? 0 : 1;
+                return (checkOnly || GetFullBatteryInfo()) ? 0 : 1;
             }
         } else if (prop == "batterymode" || prop == "bm") {
-            return GetBatteryMode() ? 0 : 1;
+            return (checkOnly || GetBatteryMode()) ? 0 : 1;
         } else if (prop == "overdrive" || prop == "od") {
-            return GetOverdrive() ? 0 : 1;
+            return (checkOnly || GetOverdrive()) ? 0 : 1;
         } else if (prop == "keyboardbacklight" || prop == "kb") {
-            return GetWhiteKeyboardBacklight() ? 0 : 1;
+            return (checkOnly || GetWhiteKeyboardBacklight()) ? 0 : 1;
         } else if (prop == "powermode" || prop == "pm") {
-            return GetPowerMode() ? 0 : 1;
+            return (checkOnly || GetPowerMode()) ? 0 : 1;
         } else if (prop == "gpumode" || prop == "gm") {
-            return GetGPUMode() ? 0 : 1;
+            return (checkOnly || GetGPUMode()) ? 0 : 1;
         } else if (prop == "alwaysonusb" || prop == "ao") {
-            return GetAlwaysOnUSB() ? 0 : 1;
+            return (checkOnly || GetAlwaysOnUSB()) ? 0 : 1;
         } else {
             std::print(stderr, "Error: unknown property '{}'.\n", argv[2]);
             return 1;
         }
     }
+    // === lltc dump <file> ===
+    if (cmd1 == "dump") {
+        if (argc < 3) {
+            std::print(stderr, "Error: 'dump' requires a telemetry log file (written by -dmon --log).\n");
+            return 1;
+        }
+        return DumpTelemetryLog(std::filesystem::path(argv[2]).wstring()) ? 0 : 1;
+    }
+    // === lltc pack <ring> <packed> ===
+    if (cmd1 == "pack") {
+        if (argc < 4) {
+            std::print(stderr, "Error: 'pack' requires a ring log (.lltl) and an output file (.lltz).\n");
+            return 1;
+        }
+        return PackTelemetryLog(std::filesystem::path(argv[2]).wstring(), std::filesystem::path(argv[3]).wstring()) ? 0 : 1;
+    }
+    // === lltc energy <file> ===
+    if (cmd1 == "energy") {
+        if (argc < 3) {
+            std::print(stderr, "Error: 'energy' requires a telemetry log file (written by -dmon --log).\n");
+            return 1;
+        }
+        return ReportLogEnergy(std::filesystem::path(argv[2]).wstring()) ? 0 : 1;
+    }
+    // === lltc batch [file|-] ===
+    if (cmd1 == "batch") {
+        std::wstring source = L"-";
+        bool stopOnError = false;
+        bool sourceGiven = false;
+        for (int i = 2; i < argc; ++i) {
+            std::string option = toLower(argv[i]);
+            if (option == "--stop-on-error") {
+                stopOnError = true;
+            } else if (!sourceGiven) {
+                source = std::filesystem::path(argv[i]).wstring();
+                sourceGiven = true;
+            } else {
+                std::print(stderr, "Error: unexpected argument '{}'.\n", argv[i]);
+                return 1;
+            }
+        }
+        return RunBatch(source, stopOnError) ? 0 : 1;
+    }
+    // === lltc status ===
+    if (cmd1 == "status") {
+        if (argc == 2) {
+            return ShowStatus() ? 0 : 1;
+        }
+        int seconds = 0;
+        int readers = 4;
+        for (int i = 2; i < argc; ++i) {
+            std::string option = toLower(argv[i]);
+            if ((option != "--stress" && option != "--readers") || i + 1 >= argc) {
+                std::print(stderr, "Error: unexpected argument '{}'.\n", argv[i]);
+                return 1;
+            }
+            std::string_view text = argv[++i];
+            int value = 0;
+            auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (ec != std::errc() || ptr != text.data() + text.size() || value < 1 || value > 3600) {
+                std::print(stderr, "Error: invalid value '{}' for '{}'.\n", text, argv[i - 1]);
+                return 1;
+            }
+            (option == "--stress" ? seconds : readers) = value;
+        }
+        if (seconds == 0) {
+            std::print(stderr, "Error: '--readers' applies to '--stress'.\n");
+            return 1;
+        }
+        return RunStatusStress(seconds, static_cast<uint32_t>(readers)) ? 0 : 1;
+    }
+    // === lltc serve / lltc loadgen ===
+    if (cmd1 == "serve" || cmd1 == "loadgen") {
+        std::chrono::milliseconds maxAge = LLTCService::DefaultMaxAge;
+        uint32_t instances = LLTCService::DefaultInstances;
+        uint32_t requests = 10000;
+        uint32_t clients = 1;
+        ServiceProperty property = ServiceProperty::PowerMode;
+        bool reconnect = false;
+        std::optional<sockaddr_in> metrics;
+        for (int i = 2; i < argc; ++i) {
+            std::string option = toLower(argv[i]);
+            bool takesValue = option == "--metrics" ||
+                              ((cmd1 == "serve") ? (option == "--max-age" || option == "--instances")
+                                                 : (option == "--requests" || option == "--clients" || option == "--property"));
+            if (cmd1 == "loadgen" && option == "--reconnect") {
+                reconnect = true;
+                continue;
+            }
+            if (!takesValue) {
+                std::print(stderr, "Error: unexpected argument '{}'.\n", argv[i]);
+                return 1;
+            }
+            if (i + 1 >= argc) {
+                std::print(stderr, "Error: '{}' requires a value.\n", argv[i]);
+                return 1;
+            }
+            std::string_view text = argv[++i];
+            if (option == "--property") {
+                auto parsed = ServicePropertyFromName(toLower(text));
+                if (!parsed) {
+                    std::print(stderr, "Error: unknown property '{}'.\n", text);
+                    return 1;
+                }
+                property = *parsed;
+                continue;
+            }
+            if (option == "--metrics") {
+                auto endpoint = LLTCMetrics::ParseEndpoint(text);
+                if (!endpoint) {
+                    std::print(stderr, "Error: invalid endpoint '{}' for '--metrics' (expected [address:]port).\n", text);
+                    return 1;
+                }
+                metrics = *endpoint;
+                continue;
+            }
+            int value = 0;
+            auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            int minimum = (option == "--max-age") ? 0 : 1;
+            if (ec != std::errc() || ptr != text.data() + text.size() || value < minimum ||
+                (option == "--instances" && value > 64)) {
+                std::print(stderr, "Error: invalid value '{}' for '{}'.\n", text, argv[i - 1]);
+                return 1;
+            }
+            if (option == "--max-age") {
+                maxAge = std::chrono::milliseconds(value);
+            } else if (option == "--instances") {
+                instances = static_cast<uint32_t>(value);
+            } else if (option == "--requests") {
+                requests = static_cast<uint32_t>(value);
+            } else {
+                clients = static_cast<uint32_t>(value);
+            }
+        }
+        if (cmd1 == "serve") {
+            return RunServer(maxAge, instances, metrics) ? 0 : 1;
+        }
+        if (metrics) {
+            return RunScrapeLoad(*metrics, requests, clients, reconnect) ? 0 : 1;
+        }
+        return RunLoadGenerator(property, requests, clients, reconnect) ? 0 : 1;
+    }
+    // === lltc watch ... ===
+    if (cmd1 == "watch") {
+        if (argc < 3) {
+            std::print(stderr, "Error: 'watch' requires a property (powermode/pm, batteryinformation/bi).\n");
+            return 1;
+        }
+        std::string prop = toLower(argv[2]);
+        
+        if (prop == "powermode" || prop == "pm") {
+            WatchPowerMode();
+            return 0;
+        } else if (prop == "batteryinformation" || prop == "bi") {
+            int heartbeatS = 60;
+            if (argc >= 4) {
+                try {
+                    heartbeatS = std::stoi(argv[3]);
+                    if (heartbeatS < 1) {
+                        std::print(stderr, "Error: heartbeat interval must be at least 1s.\n");
+                        return 1;
+                    }
+                } catch (...) {
+                    std::print(stderr, "Error: invalid heartbeat interval '{}'. Must be a number >= 1.\n", argv[3]);
+                    return 1;
+                }
+            }
+            WatchBatteryInformation(heartbeatS);
+            return 0;
+        } else {
+            std::print(stderr, "Error: unknown property '{}'. Only 'powermode' (pm) and 'batteryinformation' (bi) can be watched.\n", argv[2]);
+            return 1;
+        }
+    }
     // === lltc set ... ===
     if (cmd1 == "set") {
         if (argc < 3) {
@@ -140,7 +630,7 @@ int main(int argc, char* argv[]) {
                 std::print(stderr, "Error: invalid AlwaysOnUSB mode '{}'. Use Off/OnWhenSleeping/OnAlways or 0/1/2.\n", argv[3]);
                 return 1;
             }
-            return SetAlwaysOnUSB(modeInt) ? 0 : 1;
+            return (checkOnly || SetAlwaysOnUSB(modeInt)) ? 0 : 1;
         }
         
         // --- GPU Mode ---
@@ -178,7 +668,7 @@ int main(int argc, char* argv[]) {
                 std::print(stderr, "Error: invalid GPU mode '{}'. Use Hybrid/HybridIGPU/HybridAuto/dGPU or 1/2/3/4.\n", argv[3]);
                 return 1;
             }
-            return SetGPUMode(modeInt) ? 0 : 1;
+            return (checkOnly || SetGPUMode(modeInt)) ? 0 : 1;
         }
         
         // --- Power Mode ---
@@ -218,7 +708,7 @@ int main(int argc, char* argv[]) {
                 std::print(stderr, "Error: invalid power mode '{}'. Use Quiet/Balance/Performance/GodMode or 1/2/3/254.\n", argv[3]);
                 return 1;
             }
-            return SetPowerMode(modeInt) ? 0 : 1;
+            return (checkOnly || SetPowerMode(modeInt)) ? 0 : 1;
         }
         
         // --- Battery Mode ---
@@ -250,7 +740,7 @@ int main(int argc, char* argv[]) {
                     return 1;
                 }
             }
-            return SetBatteryMode(modeInt) ? 0 : 1;
+            return (checkOnly || SetBatteryMode(modeInt)) ? 0 : 1;
         }
         // --- Keyboard Backlight ---
         if (prop == "keyboardbacklight" || prop == "kb") {
@@ -281,7 +771,7 @@ int main(int argc, char* argv[]) {
                     return 1;
                 }
             }
-            return SetWhiteKeyboardBacklight(levelInt) ? 0 : 1;
+            return (checkOnly || SetWhiteKeyboardBacklight(levelInt)) ? 0 : 1;
         }
         // --- Overdrive (od / overdrive) ---
         if (prop == "overdrive" || prop == "od") {
@@ -299,7 +789,7 @@ int main(int argc, char* argv[]) {
                 std::print(stderr, "Error: invalid overdrive value '{}'. Use on/off or 1/0.\n", argv[3]);
                 return 1;
             }
-            return SetOverdrive(enable) ? 0 : 1;
+            return (checkOnly || SetOverdrive(enable)) ? 0 : 1;
         }
         // --- Unknown property ---
         std::print(stderr, "Error: only 'powermode' (pm), 'batterymode' (bm), 'keyboardbacklight' (kb), "
@@ -317,13 +807,121 @@ inline std::string toLower(std::string_view sv) {
     return r;
 }
 
+// Which GameZone instance path the command's first WMI call resolves, or
+// nullopt for commands that only use IOCTLs (or nothing) and need no warm-up.
+std::optional<LLTCCommonUtils::WmiPathType> WmiPathForCommand(int argc, char* argv[]) {
+    using LLTCCommonUtils::WmiPathType;
+    if (argc < 3) {
+        return std::nullopt;
+    }
+    std::string command = toLower(argv[1]);
+    std::string prop = toLower(argv[2]);
+    if (command != "get" && command != "set" && command != "watch") {
+        return std::nullopt;
+    }
+    if (prop == "powermode" || prop == "pm") {
+        return WmiPathType::Relative;
+    }
+    if (command != "watch" && (prop == "gpumode" || prop == "gm" || prop == "overdrive" || prop == "od")) {
+        return WmiPathType::Full;
+    }
+    // -dmon tags samples with the power mode and GPU mode.
+    if (command == "get" && (prop == "batteryinformation" || prop == "bi") && argc >= 4 && toLower(argv[3]) == "-dmon") {
+        return WmiPathType::Full;
+    }
+    return std::nullopt;
+}
+
+// get and set commands that a running `lltc serve` answers. Monitoring modes
+// and GPU switching (which may prompt for a restart) always run locally.
+bool IsServedCommand(int argc, char* argv[]) {
+    if (argc < 3) {
+        return false;
+    }
+    std::string command = toLower(argv[1]);
+    auto property = ServicePropertyFromName(toLower(argv[2]));
+    if (!property) {
+        return false;
+    }
+    if (command == "get") {
+        return !(*property == ServiceProperty::BatteryInformation && argc >= 4);
+    }
+    return command == "set" && *property != ServiceProperty::GpuMode && *property != ServiceProperty::BatteryInformation;
+}
+
+std::optional<ServiceProperty> ServicePropertyFromName(std::string_view name) {
+    if (name == "batterymode" || name == "bm") return ServiceProperty::BatteryMode;
+    if (name == "overdrive" || name == "od") return ServiceProperty::OverDrive;
+    if (name == "keyboardbacklight" || name == "kb") return ServiceProperty::KeyboardBacklight;
+    if (name == "powermode" || name == "pm") return ServiceProperty::PowerMode;
+    if (name == "gpumode" || name == "gm") return ServiceProperty::GpuMode;
+    if (name == "alwaysonusb" || name == "ao") return ServiceProperty::AlwaysOnUSB;
+    if (name == "batteryinformation" || name == "bi") return ServiceProperty::BatteryInformation;
+    return std::nullopt;
+}
+
+// The running `lltc serve`, connected on first use; nullptr when none is
+// listening or LLTC_SERVER=off.
+LLTCService::ServiceClient* ServerConnection() {
+    static LLTCService::ServiceClient client;
+    static bool attempted = false;
+    if (!attempted) {
+        attempted = true;
+        const char* setting = std::getenv("LLTC_SERVER");
+        if (!(setting && std::string_view(setting) == "off") && client.Connect(LLTCService::PipeName())) {
+            g_phases.Mark("server connected");
+        }
+    }
+    return client.IsConnected() ? &client : nullptr;
+}
+
+// Reads a property through the server when one is running, otherwise (or if
+// the server went away) through the local control.
+template<typename T, typename Local>
+std::expected<T, ResultState> ServedGet(ServiceProperty property, Local&& local) {
+    if (auto* server = ServerConnection()) {
+        if (auto response = server->Call(ServiceOp::Get, property)) {
+            if (response->status != static_cast<uint8_t>(ResultState::Success)) {
+                return std::unexpected(static_cast<ResultState>(response->status));
+            }
+            if constexpr (std::is_same_v<T, BatteryInfoResult>) {
+                return response->battery;
+            } else {
+                return static_cast<T>(response->value);
+            }
+        }
+    }
+    return local();
+}
+
+template<typename Local>
+std::expected<void, ResultState> ServedSet(ServiceProperty property, int32_t value, Local&& local) {
+    if (auto* server = ServerConnection()) {
+        if (auto response = server->Call(ServiceOp::Set, property, value)) {
+            if (response->status != static_cast<uint8_t>(ResultState::Success)) {
+                return std::unexpected(static_cast<ResultState>(response->status));
+            }
+            return {};
+        }
+    }
+    return local();
+}
+
+// Windows only: there is no desktop-independent way to blank the display elsewhere.
 bool TurnOffMonitor(){
+#ifdef _WIN32
     SendMessage(HWND_BROADCAST, WM_SYSCOMMAND, SC_MONITORPOWER, (LPARAM)2);
     return true;
+#else
+    return false;
+#endif
 }
 
 bool GetBatteryMode(){
-    auto result = LLTCBatteryControl::GetBatteryMode();
+    auto result = ServedGet<BatteryMode>(ServiceProperty::BatteryMode, LLTCBatteryControl::GetBatteryMode);
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("batterymode", to_string(*result)) : ReportFailure("batterymode", to_string(result.error()));
+    }
     if (result) {
         std::print("Battery charging mode: {}\n", to_string(result.value()));
     } else {
@@ -337,7 +935,10 @@ bool SetBatteryMode(int tar){
     auto state = intToBatteryMode(tar);
     if(!state)
         return false;
-    auto result = LLTCBatteryControl::SetBatteryMode(state.value());
+    auto result = ServedSet(ServiceProperty::BatteryMode, tar, [&] { return LLTCBatteryControl::SetBatteryMode(state.value()); });
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("batterymode", to_string(*state)) : ReportFailure("batterymode", to_string(result.error()));
+    }
     if(result){
         std::print("Successfully set battery charging mode to: {}\n", to_string(state.value()));
     } else {
@@ -348,7 +949,10 @@ bool SetBatteryMode(int tar){
 }
 
 bool GetOverdrive() {
-    auto result = LLTCOverDrive::GetState();
+    auto result = ServedGet<OverDriveState>(ServiceProperty::OverDrive, LLTCOverDrive::GetState);
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("overdrive", to_string(*result)) : ReportFailure("overdrive", to_string(result.error()));
+    }
     if (result) {
         std::print("OverDrive state: {}\n", to_string(result.value()));
     } else {
@@ -358,7 +962,10 @@ bool GetOverdrive() {
     return true;
 }
 bool SetOverdrive(int enable) {
-    auto result = LLTCOverDrive::SetState(enable);
+    auto result = ServedSet(ServiceProperty::OverDrive, enable, [enable] { return LLTCOverDrive::SetState(enable); });
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("overdrive", to_string(intToOverDriveState(enable).value())) : ReportFailure("overdrive", to_string(result.error()));
+    }
     if(result){
         std::print("Successfully set OverDrive state to: {}\n", to_string(intToOverDriveState(enable).value()));
     } else {
@@ -369,11 +976,15 @@ bool SetOverdrive(int enable) {
 }
 
 bool GetWhiteKeyboardBacklight() {
-    auto result = LLTCWhiteKeyboardBacklight::GetState();
+    auto result = ServedGet<WhiteKeyboardBacklightState>(ServiceProperty::KeyboardBacklight, LLTCWhiteKeyboardBacklight::GetState);
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("keyboardbacklight", to_string(*result)) : ReportFailure("keyboardbacklight", to_string(result.error()));
+    }
     if(result){
         std::print("Keyboard backlight state: {}\n", to_string(result.value()));
     } else {
         std::print(stderr, "Failed to get keyboard backlight state: {}\n", to_string(result.error()));
+        return false;
     }
     return true;
 }
@@ -382,7 +993,10 @@ bool SetWhiteKeyboardBacklight(int tar) {
     auto state = intToWhiteKeyboardBacklightState(tar);
     if(!state)
         return false;
-    auto result = LLTCWhiteKeyboardBacklight::SetState(state.value());
+    auto result = ServedSet(ServiceProperty::KeyboardBacklight, tar, [&] { return LLTCWhiteKeyboardBacklight::SetState(state.value()); });
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("keyboardbacklight", to_string(*state)) : ReportFailure("keyboardbacklight", to_string(result.error()));
+    }
     if(result){
         std::print("Successfully set keyboard backlight state to: {}\n", to_string(state.value()));
     } else {
@@ -393,13 +1007,48 @@ bool SetWhiteKeyboardBacklight(int tar) {
 }
 
 bool GetFullBatteryInfo() {
-    auto res = LLTCBatteryControl::GetBatteryInformation();
+    auto res = ServedGet<BatteryInfoResult>(ServiceProperty::BatteryInformation, LLTCBatteryControl::GetBatteryInformation);
+    if (!res.has_value() && !LLTCOutput::Output().IsText()) {
+        return ReportFailure("batteryinformation", to_string(res.error()));
+    }
     if(!res.has_value()){
         std::print(stderr, "Failed to get battery information: {}\n", to_string(res.error()));
         return false;
     }
     const auto& result = res.value();
 
+    if (!LLTCOutput::Output().IsText()) {
+        auto& out = LLTCOutput::Output().Begin();
+        out.Field("acConnected", result.isAcConnected)
+           .Field("percent", result.batteryLifePercent);
+        if (result.batteryLifeTime != 0xFFFFFFFF) {
+            out.Field("remainingSeconds", result.batteryLifeTime);
+        } else {
+            out.Null("remainingSeconds");
+        }
+        out.Field("rateMw", result.dischargeRate)
+           .Field("capacityMwh", result.currentCapacity)
+           .Field("designCapacityMwh", result.designedCapacity)
+           .Field("fullChargeCapacityMwh", result.fullChargedCapacity)
+           .Field("cycleCount", result.cycleCount)
+           .Field("lowBattery", result.isLowBattery);
+        if (result.temperatureC >= 0) {
+            out.Field("temperatureC", result.temperatureC, 1);
+        } else {
+            out.Null("temperatureC");
+        }
+        for (auto [key, date] : {std::pair{"manufactureDate", &result.manufactureDate}, std::pair{"firstUseDate", &result.firstUseDate}}) {
+            if (date->wYear != 0) {
+                char text[16];
+                auto formatted = std::format_to_n(text, sizeof(text), "{:04d}-{:02d}-{:02d}", date->wYear, date->wMonth, date->wDay);
+                out.Field(key, std::string_view(text, formatted.out));
+            } else {
+                out.Null(key);
+            }
+        }
+        return out.End();
+    }
+
     std::print("AC Connected: {}\n", result.isAcConnected ? "Yes" : "No");
     std::print("Battery Life: {}%\n", static_cast<int>(result.batteryLifePercent));
     
@@ -444,18 +1093,51 @@ bool GetFullBatteryInfo() {
     return true;
 }
 
-void GetFullBatteryInfoDmon(int seconds) {
-    GetFullBatteryInfo();
-    std::print("======\n");
-    
-    constexpr int TIME_COL = 20;
-    constexpr int DATA_COL = 8;
+void GetFullBatteryInfoDmon(int ms, const std::wstring& logPath, const std::vector<SinkSpec>& sinkSpecs, OverflowPolicy overflow, bool energyReport) {
+    LLTCOutput::SinkPipeline sinks;
+    if (!BuildSinks(sinkSpecs, sinks)) {
+        return;
+    }
+
+    // .lltz logs are block-compressed; anything else is a fixed-size ring.
+    LLTCTelemetry::TelemetryLogWriter log;
+    LLTCTelemetry::TelemetryBlockFileWriter packedLog;
+    if (!logPath.empty()) {
+        bool opened = IsPackedLogPath(logPath) ? packedLog.Open(logPath).has_value() : log.Open(logPath).has_value();
+        if (!opened) {
+            std::print(stderr, "Error: cannot open telemetry log (not a telemetry log or not writable).\n");
+            return;
+        }
+    }
+
+    // Machine formats emit only the per-tick records, one shape per stream.
+    auto& out = LLTCOutput::Output();
+    const bool text = out.IsText();
+    if (text) {
+        GetFullBatteryInfo();
+        std::print("======\n");
+    }
+    std::fflush(stdout);
+    out.SetPipeline(&sinks);
     
+    // Whole seconds keep the historical layout: one sample per second, one row per
+    // `ms` with averages. Other intervals sample and print once per interval.
     bool dft = false;
-    if (seconds == 0) {
-        seconds = 1;
+    if (ms == 0) {
+        ms = 1000;
         dft = true;
-        std::print("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
+    }
+    int periodMs = (ms % 1000 == 0) ? 1000 : ms;
+    int samplesPerRow = ms / periodMs;
+    bool subSecond = periodMs % 1000 != 0;
+
+    const int TIME_COL = subSecond ? 24 : 20;
+    constexpr int DATA_COL = 8;
+    
+    if (!text) {
+        out.BeginStream();
+    } else if (dft) {
+        out.Emit(std::format("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
             " ", TIME_COL,
             "AC", DATA_COL,
             "temp", DATA_COL,
@@ -464,8 +1146,8 @@ void GetFullBatteryInfoDmon(int seconds) {
             "cap", DATA_COL,
             "cycle", DATA_COL,
             "low", DATA_COL
-        );
-        std::print("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
+        ), false);
+        out.Emit(std::format("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
             " ", TIME_COL,
             "", DATA_COL,
             "(C)", DATA_COL,
@@ -474,9 +1156,9 @@ void GetFullBatteryInfoDmon(int seconds) {
             "(Wh)", DATA_COL,
             "(s)", DATA_COL,
             "(Y/N)", DATA_COL
-        );
+        ), false);
     } else {
-        std::print("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
+        out.Emit(std::format("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
             " ", TIME_COL,
             "AC", DATA_COL,
             "temp", DATA_COL,
@@ -484,11 +1166,14 @@ void GetFullBatteryInfoDmon(int seconds) {
             "percent", DATA_COL,
             "power", DATA_COL,
             "pwrAvg", DATA_COL,
+            "pwrMin", DATA_COL,
+            "pwrMax", DATA_COL,
+            "pwrSd", DATA_COL,
             "cap", DATA_COL,
             "cycle", DATA_COL,
             "lowCap", DATA_COL
-        );
-        std::print("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
+        ), false);
+        out.Emit(std::format("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
             " ", TIME_COL,
             "", DATA_COL,
             "(C)", DATA_COL,
@@ -496,110 +1181,508 @@ void GetFullBatteryInfoDmon(int seconds) {
             "(%)", DATA_COL,
             "(W)", DATA_COL,
             "(W)", DATA_COL,
+            "(W)", DATA_COL,
+            "(W)", DATA_COL,
+            "(W)", DATA_COL,
             "(Wh)", DATA_COL,
             "(s)", DATA_COL,
             "(Y/N)", DATA_COL
-        );
+        ), false);
     }
 
+    const bool traceIoctls = std::getenv("LLTC_IOCTL_TIMING") != nullptr;
     int count = 0;
-    std::vector<double> tempSamples;
-    std::vector<double> powerSamples;
+    LLTCCommonUtils::StreamingStats tempStats;
+    LLTCCommonUtils::StreamingStats powerStats;
 
-    while (true) {
-        SYSTEMTIME st;
-        GetLocalTime(&st);
-        std::string timeStr = std::format(
-            "{:04d}-{:02d}-{:02d} {:02d}:{:02d}:{:02d}",
-            static_cast<int>(st.wYear),
-            static_cast<int>(st.wMonth),
-            static_cast<int>(st.wDay),
-            static_cast<int>(st.wHour),
-            static_cast<int>(st.wMinute),
-            static_cast<int>(st.wSecond)
-        );
+    // The sampler thread only queries and enqueues, so a slow console, pipe or
+    // disk on the writer side never moves its deadlines. With the drop policy
+    // a full ring loses the newest sample and counts it; with block the sampler
+    // waits, which shows up as missed deadlines instead.
+    LLTCCommonUtils::SpscRing<DmonSample, 1024> ring;
+    std::atomic<uint64_t> droppedSamples = 0;
+    std::atomic<uint64_t> missedDeadlines = 0;
+    std::atomic<size_t> maxQueued = 0;
+    LLTCCommonUtils::SchedulerStats schedStats = {};
+    g_gracefulStop = true;
+
+    // Every sample is tagged with the active power mode (followed through a
+    // subscription) and GPU mode, so logs can be accounted per mode later. The
+    // GPU mode is read once: switching it takes effect only after a restart.
+    // The same values go to the shared status page for other readers.
+    LLTCStatus::StatusPage statusPage;
+    if (auto page = LLTCStatus::StatusPage::Create()) {
+        statusPage = std::move(*page);
+    }
+    std::atomic<uint8_t> powerModeCode = 0;
+    uint8_t gpuModeCode = 0;
+    auto powerModeSubscription = LLTCPowerMode::Subscribe([&powerModeCode, &statusPage](PowerMode mode) {
+        powerModeCode.store(LLTCTelemetry::TelemetryModeCode(mode), std::memory_order_relaxed);
+        if (statusPage.IsOpen()) {
+            statusPage.Publish(StatusField::PowerMode, static_cast<int32_t>(mode));
+        }
+    });
+    {
+        HybridModeController controller;
+        auto [result, mode] = controller.GetHybridModeAsync().get();
+        if (result == OperationResult::Success) {
+            gpuModeCode = LLTCTelemetry::TelemetryModeCode(mode);
+            if (statusPage.IsOpen()) {
+                statusPage.Publish(StatusField::GpuMode, static_cast<int32_t>(mode));
+            }
+        }
+    }
+    LLTCTelemetry::EnergyAccountant energy;
 
-        auto res = LLTCBatteryControl::GetBatteryInformation();
-        if(!res.has_value()){
-            Sleep(1000);
+    std::thread sampler([&] {
+        LLTCCommonUtils::PeriodicScheduler scheduler{std::chrono::milliseconds(periodMs)};
+        do {
+            missedDeadlines.store(scheduler.GetStats().missed, std::memory_order_relaxed);
+
+            DmonSample item = {};
+            item.localTime = LLTCPlatform::LocalTime();
+            auto ioctlsBefore = LLTCCommonUtils::GetIoctlCounters();
+            auto res = LLTCBatteryControl::GetBatteryInformation();
+            auto ioctlsAfter = LLTCCommonUtils::GetIoctlCounters();
+            item.batteryIoctls = static_cast<uint32_t>(ioctlsAfter.battery - ioctlsBefore.battery);
+            item.energyIoctls = static_cast<uint32_t>(ioctlsAfter.energyDriver - ioctlsBefore.energyDriver);
+            if (!res.has_value()) {
+                continue;
+            }
+            if (statusPage.IsOpen()) {
+                statusPage.PublishBattery(*res);
+            }
+            item.sample = LLTCTelemetry::MakeSample(*res, LLTCTelemetry::CurrentTimestampUs());
+            LLTCTelemetry::TagSample(item.sample, powerModeCode.load(std::memory_order_relaxed), gpuModeCode);
+            item.temperatureC = res->temperatureC;
+            item.lowBattery = res->isLowBattery;
+
+            if (!ring.TryPush(item)) {
+                if (overflow == OverflowPolicy::Block) {
+                    do {
+                        ring.WaitForSpace();
+                    } while (!ring.TryPush(item));
+                } else {
+                    droppedSamples.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            maxQueued.store(std::max(maxQueued.load(std::memory_order_relaxed), ring.Size()), std::memory_order_relaxed);
+        } while (scheduler.WaitNext(&g_stopEvent));
+        schedStats = scheduler.GetStats();
+        ring.Close();
+    });
+
+    uint64_t reportedMissed = 0;
+    uint64_t reportedDropped = 0;
+    DmonSample item;
+    while (true) {
+        // Sleeps no later than the next batch or fsync deadline, so buffered rows
+        // reach their sinks on time even when samples are sparse or stall.
+        auto popped = ring.PopUntil(item, sinks.NextDeadline());
+        if (popped == LLTCCommonUtils::PopResult::Closed) {
+            break;
+        }
+        if (popped == LLTCCommonUtils::PopResult::Timeout) {
+            sinks.FlushDue();
             continue;
         }
-        const auto& result = res.value();
+        uint64_t missed = missedDeadlines.load(std::memory_order_relaxed);
+        if (missed != reportedMissed) {
+            std::print(stderr, "[dmon] missed {} deadline(s)\n", missed - reportedMissed);
+            reportedMissed = missed;
+        }
+        uint64_t dropped = droppedSamples.load(std::memory_order_relaxed);
+        if (dropped != reportedDropped) {
+            std::print(stderr, "[dmon] dropped {} sample(s): output is slower than sampling\n", dropped - reportedDropped);
+            reportedDropped = dropped;
+        }
+        if (traceIoctls) {
+            std::print(stderr, "[ioctl] tick: {} battery, {} energy\n", item.batteryIoctls, item.energyIoctls);
+        }
+
+        const SYSTEMTIME& st = item.localTime;
+        const TelemetrySample& sample = item.sample;
+        log.Append(sample);
+        packedLog.Append(sample);
+        energy.Add(sample);
 
-        double currentTemp = result.temperatureC;
-        double currentPower = result.dischargeRate / 1000.0;
-        double capWh = result.currentCapacity / 1000.0;
+        const bool acConnected = (sample.flags & TelemetryFlagAc) != 0;
+        double currentTemp = item.temperatureC;
+        double currentPower = sample.rateMw / 1000.0;
+        double capWh = sample.capacityMwh / 1000.0;
 
         if (!dft) {
-            if (currentTemp >= 0) tempSamples.push_back(currentTemp);
-            powerSamples.push_back(currentPower);
+            if (currentTemp >= 0) tempStats.Add(currentTemp);
+            powerStats.Add(currentPower);
         }
 
-        if (seconds == 1 || count == seconds - 1) {
-            double avgTemp = -1.0;
-            double avgPower = 0.0;
-            
-            if (!dft && !tempSamples.empty()) {
-                avgTemp = std::accumulate(tempSamples.begin(), tempSamples.end(), 0.0) / tempSamples.size();
-            }
-            if (!dft && !powerSamples.empty()) {
-                avgPower = std::accumulate(powerSamples.begin(), powerSamples.end(), 0.0) / powerSamples.size();
-            }
-
-            std::string acStr = result.isAcConnected ? "Y" : "N";
-            std::string tempStr = (currentTemp >= 0) 
-                ? std::format("{:.1f}", currentTemp) 
-                : "N/A";
-            std::string pctStr = std::to_string(static_cast<int>(result.batteryLifePercent));
-            std::string pwrStr = std::format("{:+.2f}", currentPower);
-            std::string capStr = std::format("{:.2f}", capWh);
-            std::string cycleStr = std::to_string(result.cycleCount);
-            std::string lowStr = result.isLowBattery ? "Y" : "N";
-
-            if (dft) {
-                std::print("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
-                    timeStr, TIME_COL,
-                    acStr, DATA_COL,
-                    tempStr, DATA_COL,
-                    pctStr, DATA_COL,
-                    pwrStr, DATA_COL,
-                    capStr, DATA_COL,
-                    cycleStr, DATA_COL,
-                    lowStr, DATA_COL
-                );
+        if ((samplesPerRow == 1 || count == samplesPerRow - 1) && !text) {
+            out.Begin()
+               .Field("time", st, subSecond)
+               .Field("acConnected", acConnected);
+            if (currentTemp >= 0) {
+                out.Field("temperatureC", currentTemp, 1);
             } else {
-                std::string avgTempStr = (avgTemp >= 0)
-                    ? std::format("{:.3f}", avgTemp)
-                    : "N/A";
-                std::string avgPwrStr = std::format("{:+.3f}", avgPower);
-
-                std::print("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
-                    timeStr, TIME_COL,
-                    acStr, DATA_COL,
-                    tempStr, DATA_COL,
-                    avgTempStr, DATA_COL,
-                    pctStr, DATA_COL,
-                    pwrStr, DATA_COL,
-                    avgPwrStr, DATA_COL,
-                    capStr, DATA_COL,
-                    cycleStr, DATA_COL,
-                    lowStr, DATA_COL
-                );
-                
-                tempSamples.clear();
-                powerSamples.clear();
+                out.Null("temperatureC");
             }
+            if (!dft) {
+                if (tempStats.Count() > 0) {
+                    out.Field("temperatureAvgC", tempStats.Mean(), 3);
+                } else {
+                    out.Null("temperatureAvgC");
+                }
+            }
+            out.Field("percent", sample.percent)
+               .Field("rateMw", sample.rateMw);
+            if (!dft) {
+                out.Field("powerAvgW", powerStats.Mean(), 3)
+                   .Field("powerMinW", powerStats.Min(), 3)
+                   .Field("powerMaxW", powerStats.Max(), 3)
+                   .Field("powerSdW", powerStats.StdDev(), 3);
+                tempStats.Reset();
+                powerStats.Reset();
+            }
+            out.Field("capacityMwh", sample.capacityMwh)
+               .Field("cycleCount", sample.cycleCount)
+               .Field("lowBattery", item.lowBattery)
+               .Field("droppedSamples", dropped)
+               .End();
+            count = 0;
+        } else if (samplesPerRow == 1 || count == samplesPerRow - 1) {
+            // Rendered into a stack buffer: no temporaries per row.
+            char row[512];
+            char* at = row;
+            auto cell = [&](std::string_view text, int width) {
+                at = std::format_to_n(at, row + sizeof(row) - at, "{:>{}s}", text, width).out;
+            };
+            auto number = [](char (&buffer)[24], double value, int precision, bool sign) {
+                char* p = buffer;
+                if (sign && !std::signbit(value)) {
+                    *p++ = '+';
+                }
+                p = std::to_chars(p, buffer + sizeof(buffer), value, std::chars_format::fixed, precision).ptr;
+                return std::string_view(buffer, p);
+            };
+            char timeBuffer[24], tempBuffer[24], pctBuffer[24], pwrBuffer[24], capBuffer[24], cycleBuffer[24];
+            auto timeEnd = std::format_to_n(timeBuffer, sizeof(timeBuffer), "{:04d}-{:02d}-{:02d} {:02d}:{:02d}:{:02d}",
+                st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond).out;
+            if (subSecond) {
+                timeEnd = std::format_to_n(timeEnd, timeBuffer + sizeof(timeBuffer) - timeEnd, ".{:03d}", st.wMilliseconds).out;
+            }
+            std::string_view tempStr = (currentTemp >= 0) ? number(tempBuffer, currentTemp, 1, false) : "N/A";
+            std::string_view pctStr(pctBuffer, std::to_chars(pctBuffer, pctBuffer + sizeof(pctBuffer), sample.percent).ptr);
+            std::string_view cycleStr(cycleBuffer, std::to_chars(cycleBuffer, cycleBuffer + sizeof(cycleBuffer), sample.cycleCount).ptr);
+
+            cell({timeBuffer, timeEnd}, TIME_COL);
+            cell(acConnected ? "Y" : "N", DATA_COL);
+            cell(tempStr, DATA_COL);
+            if (!dft) {
+                char avgBuffer[24];
+                cell((tempStats.Count() > 0) ? number(avgBuffer, tempStats.Mean(), 3, false) : "N/A", DATA_COL);
+            }
+            cell(pctStr, DATA_COL);
+            cell(number(pwrBuffer, currentPower, 2, true), DATA_COL);
+            if (!dft) {
+                char avgBuffer[24], minBuffer[24], maxBuffer[24], sdBuffer[24];
+                cell(number(avgBuffer, powerStats.Mean(), 3, true), DATA_COL);
+                cell(number(minBuffer, powerStats.Min(), 2, true), DATA_COL);
+                cell(number(maxBuffer, powerStats.Max(), 2, true), DATA_COL);
+                cell(number(sdBuffer, powerStats.StdDev(), 3, false), DATA_COL);
+                tempStats.Reset();
+                powerStats.Reset();
+            }
+            cell(number(capBuffer, capWh, 2, false), DATA_COL);
+            cell(cycleStr, DATA_COL);
+            cell(item.lowBattery ? "Y" : "N", DATA_COL);
+            if (at < row + sizeof(row)) {
+                *at++ = '\n';
+            }
+            out.Emit({row, static_cast<size_t>(at - row)}, true);
             count = 0;
         } else {
             count++;
         }
+    }
+    sampler.join();
+    if (powerModeSubscription) {
+        powerModeSubscription->Stop();
+    }
+    out.EndStream();
+    sinks.Flush(true);
+    out.SetPipeline(nullptr);
+    sinks.ForEachSink([](const LLTCOutput::RecordSink& sink) {
+        const auto& stats = sink.GetStats();
+        std::print(stderr, "[sink] {}: {} row(s), {} write(s), {} sync(s), {} rotation(s), {} failed write(s)\n",
+            sink.Name(), stats.rows, stats.writes, stats.syncs, stats.rotations, stats.failedWrites);
+    });
+
+    std::print(stderr, "[dmon] {} ticks, {} missed deadline(s), {} dropped sample(s), queue high-water {}/{}, jitter min/avg/max {}/{}/{} us\n",
+        schedStats.ticks,
+        schedStats.missed,
+        droppedSamples.load(),
+        maxQueued.load(),
+        ring.GetCapacity(),
+        schedStats.minJitter.count(),
+        schedStats.ticks ? schedStats.totalJitter.count() / static_cast<long long>(schedStats.ticks) : 0,
+        schedStats.maxJitter.count());
+    if (energyReport) {
+        PrintEnergyReport(energy, stderr);
+    }
+}
+
+bool BuildSinks(const std::vector<SinkSpec>& specs, LLTCOutput::SinkPipeline& pipeline) {
+    for (const auto& spec : specs) {
+        if (spec.kind == SinkSpec::Kind::Stdout) {
+            pipeline.Add(std::make_unique<LLTCOutput::StdoutSink>(spec.options));
+            continue;
+        }
+        auto sink = std::make_unique<LLTCOutput::FileSink>(spec.path, spec.options,
+            spec.kind == SinkSpec::Kind::RotatingFile ? spec.maxBytes : 0, spec.keep);
+        if (!sink->IsOpen()) {
+            std::print(stderr, "Error: cannot open output file '{}'.\n", std::filesystem::path(spec.path).string());
+            return false;
+        }
+        pipeline.Add(std::move(sink));
+    }
+    return true;
+}
+
+bool IsPackedLogPath(const std::wstring& path) {
+    return toLower(std::filesystem::path(path).extension().string()) == ".lltz";
+}
+
+bool DumpTelemetryLog(const std::wstring& logPath) {
+    if (LLTCOutput::Output().IsText()) {
+        std::print("{:>24s}{:>8s}{:>8s}{:>8s}{:>8s}{:>8s}{:>8s}{:>8s}\n",
+            "time (UTC)", "AC", "temp", "pct", "pwr", "cap", "cycle", "low");
+    }
+    uint64_t shown = 0;
+    auto& out = LLTCOutput::Output();
+    auto printSample = [&](const TelemetrySample& sample) {
+        auto time = std::chrono::sys_time<std::chrono::microseconds>(std::chrono::microseconds(sample.timestampUs));
+        if (!out.IsText()) {
+            char timeText[32];
+            auto formatted = std::format_to_n(timeText, sizeof(timeText), "{:%FT%T}Z", std::chrono::floor<std::chrono::milliseconds>(time));
+            out.Begin()
+               .Field("time", std::string_view(timeText, formatted.out))
+               .Field("acConnected", (sample.flags & TelemetryFlagAc) != 0);
+            if (sample.temperatureDeciC != TelemetryNoTemperature) {
+                out.Field("temperatureC", sample.temperatureDeciC / 10.0, 1);
+            } else {
+                out.Null("temperatureC");
+            }
+            out.Field("percent", sample.percent)
+               .Field("rateMw", sample.rateMw)
+               .Field("capacityMwh", sample.capacityMwh)
+               .Field("cycleCount", sample.cycleCount)
+               .Field("lowBattery", (sample.flags & TelemetryFlagLowBattery) != 0)
+               .End();
+            ++shown;
+            return;
+        }
+        std::string tempStr = (sample.temperatureDeciC != TelemetryNoTemperature)
+            ? std::format("{:.1f}", sample.temperatureDeciC / 10.0)
+            : "N/A";
+        std::print("{:>24s}{:>8s}{:>8s}{:>8d}{:>+8.2f}{:>8.2f}{:>8d}{:>8s}\n",
+            std::format("{:%F %T}", std::chrono::floor<std::chrono::milliseconds>(time)),
+            (sample.flags & TelemetryFlagAc) ? "Y" : "N",
+            tempStr,
+            static_cast<int>(sample.percent),
+            sample.rateMw / 1000.0,
+            sample.capacityMwh / 1000.0,
+            sample.cycleCount,
+            (sample.flags & TelemetryFlagLowBattery) ? "Y" : "N");
+        ++shown;
+    };
+
+    LLTCTelemetry::TelemetryBlockFileReader packed;
+    if (packed.Open(logPath)) {
+        out.BeginStream();
+        packed.Reader().ForEach(printSample);
+        out.EndStream();
+        std::print(stderr, "[dump] {} sample(s) shown\n", shown);
+        return true;
+    }
+
+    LLTCTelemetry::TelemetryLogReader reader;
+    if (auto opened = reader.Open(logPath); !opened) {
+        std::print(stderr, "Error: {}.\n", opened.error() == ResultState::InvalidParameter
+            ? "not a telemetry log file" : "cannot open telemetry log");
+        return false;
+    }
+    out.BeginStream();
+    reader.ForEach(printSample);
+    out.EndStream();
+    std::print(stderr, "[dump] {} sample(s) shown, {} written in total, ring capacity {}\n",
+        shown, reader.TotalWritten(), reader.Capacity());
+    return true;
+}
+
+// Converts a ring log to the compressed block format, then decodes the result
+// and compares it with the source before reporting size and throughput.
+bool PackTelemetryLog(const std::wstring& ringPath, const std::wstring& packedPath) {
+    LLTCTelemetry::TelemetryLogReader reader;
+    if (auto opened = reader.Open(ringPath); !opened) {
+        std::print(stderr, "Error: {}.\n", opened.error() == ResultState::InvalidParameter
+            ? "not a telemetry ring log" : "cannot open telemetry log");
+        return false;
+    }
+    std::vector<TelemetrySample> source;
+    reader.ForEach([&](const TelemetrySample& sample) { source.push_back(sample); });
+
+    using Clock = std::chrono::steady_clock;
+    auto encodeStart = Clock::now();
+    std::vector<uint8_t> image;
+    LLTCTelemetry::TelemetryBlockEncoder encoder;
+    for (const auto& sample : source) {
+        encoder.Add(sample);
+        if (encoder.Count() == LLTCTelemetry::DefaultBlockSamples) {
+            encoder.Finish(image);
+        }
+    }
+    encoder.Finish(image);
+    auto encodeTime = Clock::now() - encodeStart;
+
+    // The file writer produces the same blocks; write through it so the file is
+    // exactly what -dmon --log would have produced.
+    std::error_code removeError;
+    std::filesystem::remove(packedPath, removeError);
+    {
+        LLTCTelemetry::TelemetryBlockFileWriter writer;
+        if (!writer.Open(packedPath)) {
+            std::print(stderr, "Error: cannot create '{}'.\n", std::filesystem::path(packedPath).string());
+            return false;
+        }
+        for (const auto& sample : source) {
+            if (!writer.Append(sample)) {
+                std::print(stderr, "Error: write failed.\n");
+                return false;
+            }
+        }
+    }
+
+    LLTCTelemetry::TelemetryBlockFileReader packed;
+    if (!packed.Open(packedPath)) {
+        std::print(stderr, "Error: cannot reopen '{}'.\n", std::filesystem::path(packedPath).string());
+        return false;
+    }
+    size_t index = 0;
+    size_t mismatches = 0;
+    auto decodeStart = Clock::now();
+    packed.Reader().ForEach([&](const TelemetrySample& sample) {
+        if (index < source.size()) {
+            const auto& expected = source[index];
+            if (sample.timestampUs / 1000 != expected.timestampUs / 1000 || sample.rateMw != expected.rateMw ||
+                sample.capacityMwh != expected.capacityMwh || sample.cycleCount != expected.cycleCount ||
+                sample.temperatureDeciC != expected.temperatureDeciC || sample.percent != expected.percent ||
+                sample.flags != expected.flags) {
+                ++mismatches;
+            }
+        }
+        ++index;
+    });
+    auto decodeTime = Clock::now() - decodeStart;
+
+    double rawBytes = static_cast<double>(source.size() * sizeof(TelemetrySample));
+    auto mbPerSecond = [&](Clock::duration elapsed) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        return (seconds > 0) ? rawBytes / seconds / 1e6 : 0.0;
+    };
+    bool roundTripOk = (index == source.size() && mismatches == 0);
+    size_t packedBytes = image.size() + sizeof(LLTCTelemetry::BlockFileHeader);
+    if (!LLTCOutput::Output().IsText()) {
+        LLTCOutput::Output().Begin()
+            .Field("samples", source.size())
+            .Field("rawBytes", static_cast<uint64_t>(rawBytes))
+            .Field("packedBytes", packedBytes)
+            .Field("ratio", rawBytes / packedBytes, 2)
+            .Field("encodeMBps", mbPerSecond(encodeTime), 1)
+            .Field("decodeMBps", mbPerSecond(decodeTime), 1)
+            .Field("roundTripOk", roundTripOk)
+            .End();
+        return roundTripOk;
+    }
+    std::print("{} sample(s): {} -> {} bytes ({:.1f}x, {:.2f} bits/sample)\n",
+        source.size(), static_cast<uint64_t>(rawBytes), image.size() + sizeof(LLTCTelemetry::BlockFileHeader),
+        image.empty() ? 0.0 : rawBytes / (image.size() + sizeof(LLTCTelemetry::BlockFileHeader)),
+        source.empty() ? 0.0 : image.size() * 8.0 / source.size());
+    std::print("encode {:.0f} MB/s, decode {:.0f} MB/s\n", mbPerSecond(encodeTime), mbPerSecond(decodeTime));
+    if (index != source.size() || mismatches != 0) {
+        std::print(stderr, "Error: round trip failed ({} of {} sample(s) decoded, {} mismatch(es)).\n",
+            index, source.size(), mismatches);
+        return false;
+    }
+    std::print("round trip OK\n");
+    return true;
+}
+
+// Replays a stored log (either format) through the energy accountant.
+bool ReportLogEnergy(const std::wstring& logPath) {
+    LLTCTelemetry::EnergyAccountant accountant;
+    auto add = [&](const TelemetrySample& sample) { accountant.Add(sample); };
+    LLTCTelemetry::TelemetryBlockFileReader packed;
+    LLTCTelemetry::TelemetryLogReader reader;
+    if (packed.Open(logPath)) {
+        packed.Reader().ForEach(add);
+    } else if (auto opened = reader.Open(logPath); opened) {
+        reader.ForEach(add);
+    } else {
+        std::print(stderr, "Error: {}.\n", opened.error() == ResultState::InvalidParameter
+            ? "not a telemetry log file" : "cannot open telemetry log");
+        return false;
+    }
 
-        Sleep(1000);
+    auto& out = LLTCOutput::Output();
+    if (out.IsText()) {
+        PrintEnergyReport(accountant, stdout);
+        return true;
     }
+    double batterySeconds = accountant.BatterySeconds();
+    out.BeginStream();
+    accountant.ForEachBucket([&](uint8_t powerMode, uint8_t gpuMode, const EnergyBucket& bucket) {
+        out.Begin()
+           .Field("powerMode", LLTCTelemetry::PowerModeCodeName(powerMode))
+           .Field("gpuMode", LLTCTelemetry::GpuModeCodeName(gpuMode))
+           .Field("energyWh", bucket.wattHours, 3)
+           .Field("averageW", bucket.wattHours * 3600.0 / bucket.seconds, 3)
+           .Field("seconds", bucket.seconds, 1)
+           .Field("sharePercent", batterySeconds > 0 ? bucket.seconds * 100.0 / batterySeconds : 0.0, 1)
+           .End();
+    });
+    out.EndStream();
+    return true;
+}
+
+// Per-mode table: energy, average draw and share of the time on battery.
+void PrintEnergyReport(const LLTCTelemetry::EnergyAccountant& accountant, std::FILE* stream) {
+    auto duration = [](double seconds) {
+        auto total = static_cast<long long>(seconds + 0.5);
+        return std::format("{}:{:02d}:{:02d}", total / 3600, total / 60 % 60, total % 60);
+    };
+    double batterySeconds = accountant.BatterySeconds();
+    std::print(stream, "{:<14s}{:<14s}{:>10s}{:>10s}{:>12s}{:>8s}\n", "power mode", "GPU mode", "energy", "avg", "time", "share");
+    std::print(stream, "{:<14s}{:<14s}{:>10s}{:>10s}{:>12s}{:>8s}\n", "", "", "(Wh)", "(W)", "(h:m:s)", "(%)");
+    accountant.ForEachBucket([&](uint8_t powerMode, uint8_t gpuMode, const EnergyBucket& bucket) {
+        std::print(stream, "{:<14s}{:<14s}{:>10.3f}{:>10.2f}{:>12s}{:>8.1f}\n",
+            LLTCTelemetry::PowerModeCodeName(powerMode),
+            LLTCTelemetry::GpuModeCodeName(gpuMode),
+            bucket.wattHours,
+            bucket.wattHours * 3600.0 / bucket.seconds,
+            duration(bucket.seconds),
+            batterySeconds > 0 ? bucket.seconds * 100.0 / batterySeconds : 0.0);
+    });
+    double totalWh = accountant.TotalWattHours();
+    std::print(stream, "{:<28s}{:>10.3f}{:>10.2f}{:>12s}{:>8.1f}\n", "total on battery",
+        totalWh, batterySeconds > 0 ? totalWh * 3600.0 / batterySeconds : 0.0, duration(batterySeconds), batterySeconds > 0 ? 100.0 : 0.0);
+    std::print(stream, "[energy] {} sample(s), {} on AC, {} gap(s) over {}s skipped\n",
+        accountant.Samples(), duration(accountant.AcSeconds()), accountant.SkippedGaps(), LLTCTelemetry::DefaultMaxSampleGap.count());
 }
 
 bool GetPowerMode() {
-    auto result = LLTCPowerMode::GetState();
+    auto result = ServedGet<PowerMode>(ServiceProperty::PowerMode, LLTCPowerMode::GetState);
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("powermode", to_string(*result)) : ReportFailure("powermode", to_string(result.error()));
+    }
     if (result) {
         std::print("Power mode: {}\n", to_string(result.value()));
     } else {
@@ -613,7 +1696,10 @@ bool SetPowerMode(int tar) {
     auto state = intToPowerMode(tar);
     if(!state)
         return false;
-    auto result = LLTCPowerMode::SetState(state.value());
+    auto result = ServedSet(ServiceProperty::PowerMode, tar, [&] { return LLTCPowerMode::SetState(state.value()); });
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("powermode", to_string(*state)) : ReportFailure("powermode", to_string(result.error()));
+    }
     if(result){
         std::print("Successfully set power mode to: {}\n", to_string(state.value()));
     } else {
@@ -623,12 +1709,157 @@ bool SetPowerMode(int tar) {
     return true;
 }
 
+void WatchPowerMode() {
+    auto& out = LLTCOutput::Output();
+    auto subscription = LLTCPowerMode::Subscribe([&out](PowerMode mode) {
+        SYSTEMTIME st = LLTCPlatform::LocalTime();
+        if (!out.IsText()) {
+            out.Begin().Field("time", st, true).Field("powermode", to_string(mode)).End();
+            std::fflush(stdout);
+            return;
+        }
+        std::print("{:04d}-{:02d}-{:02d} {:02d}:{:02d}:{:02d}.{:03d}  Power mode: {}\n",
+            static_cast<int>(st.wYear),
+            static_cast<int>(st.wMonth),
+            static_cast<int>(st.wDay),
+            static_cast<int>(st.wHour),
+            static_cast<int>(st.wMinute),
+            static_cast<int>(st.wSecond),
+            static_cast<int>(st.wMilliseconds),
+            to_string(mode));
+        std::fflush(stdout);
+    });
+    if (!subscription) {
+        std::print(stderr, "Failed to watch power mode: {}\n", to_string(subscription.error()));
+        return;
+    }
+    std::print(stderr, "Watching power mode ({}), press Ctrl+C to stop.\n",
+        subscription->IsEventDriven() ? "event-driven" : "polling");
+    
+    out.BeginStream();
+    g_gracefulStop = true;
+    g_stopEvent.Wait();
+    subscription->Stop();
+    out.EndStream();
+}
+
+void WatchBatteryInformation(int heartbeatSeconds) {
+    constexpr int TIME_COL = 20;
+    constexpr int DATA_COL = 8;
+
+    auto status = LLTCBatteryControl::GetBatteryStatus();
+    auto info = LLTCBatteryControl::GetBatteryInformation();
+    if (!status || !info) {
+        std::print(stderr, "Failed to watch battery information: {}\n", to_string(status ? info.error() : status.error()));
+        return;
+    }
+    // Wake on a 1% capacity step, a power-state change or the heartbeat.
+    ULONG capacityBand = std::max<ULONG>(info->fullChargedCapacity / 100, 1);
+    std::print(stderr, "Watching battery information (heartbeat {}s), press Ctrl+C to stop.\n", heartbeatSeconds);
+    auto& out = LLTCOutput::Output();
+    if (!out.IsText()) {
+        out.BeginStream();
+    } else {
+        std::print("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
+            " ", TIME_COL,
+            "why", DATA_COL,
+            "AC", DATA_COL,
+            "temp", DATA_COL,
+            "pct", DATA_COL,
+            "pwr", DATA_COL,
+            "cap", DATA_COL
+        );
+    }
+
+    bool heartbeat = false;
+    auto nextHeartbeat = std::chrono::steady_clock::now() + std::chrono::seconds(heartbeatSeconds);
+    while (true) {
+        if (status && info && !out.IsText()) {
+            SYSTEMTIME st = LLTCPlatform::LocalTime();
+            out.Begin()
+               .Field("time", st, false)
+               .Field("reason", heartbeat ? "beat" : "change")
+               .Field("acConnected", info->isAcConnected);
+            if (info->temperatureC >= 0) {
+                out.Field("temperatureC", info->temperatureC, 1);
+            } else {
+                out.Null("temperatureC");
+            }
+            out.Field("percent", info->batteryLifePercent)
+               .Field("rateMw", info->dischargeRate)
+               .Field("capacityMwh", info->currentCapacity)
+               .End();
+            std::fflush(stdout);
+        } else if (status && info) {
+            SYSTEMTIME st = LLTCPlatform::LocalTime();
+            std::string timeStr = std::format(
+                "{:04d}-{:02d}-{:02d} {:02d}:{:02d}:{:02d}",
+                static_cast<int>(st.wYear),
+                static_cast<int>(st.wMonth),
+                static_cast<int>(st.wDay),
+                static_cast<int>(st.wHour),
+                static_cast<int>(st.wMinute),
+                static_cast<int>(st.wSecond)
+            );
+            std::print("{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}{:>{}s}\n",
+                timeStr, TIME_COL,
+                heartbeat ? "beat" : "change", DATA_COL,
+                info->isAcConnected ? "Y" : "N", DATA_COL,
+                (info->temperatureC >= 0) ? std::format("{:.1f}", info->temperatureC) : "N/A", DATA_COL,
+                std::to_string(static_cast<int>(info->batteryLifePercent)), DATA_COL,
+                std::format("{:+.2f}", info->dischargeRate / 1000.0), DATA_COL,
+                std::format("{:.2f}", info->currentCapacity / 1000.0), DATA_COL
+            );
+            std::fflush(stdout);
+        }
+
+        if (!status) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            heartbeat = false;
+            status = LLTCBatteryControl::GetBatteryStatus();
+            info = LLTCBatteryControl::GetBatteryInformation();
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(nextHeartbeat - now).count();
+        auto wait = LLTCBatteryControl::WaitForBatteryChange(*status, capacityBand, static_cast<DWORD>(std::max<long long>(remaining, 0)));
+        if (!wait) {
+            status = std::unexpected(wait.error());
+            continue;
+        }
+
+        heartbeat = wait->timedOut;
+        now = std::chrono::steady_clock::now();
+        if (heartbeat) {
+            nextHeartbeat += std::chrono::seconds(heartbeatSeconds);
+            if (nextHeartbeat <= now) {
+                nextHeartbeat = now + std::chrono::seconds(heartbeatSeconds);
+            }
+            status = LLTCBatteryControl::GetBatteryStatus();
+        } else {
+            nextHeartbeat = now + std::chrono::seconds(heartbeatSeconds);
+            status = wait->status;
+        }
+        info = LLTCBatteryControl::GetBatteryInformation();
+    }
+}
+
 bool GetGPUMode() {
     HybridModeState currentState;
-    HybridModeController controller;
-    
-    auto future = controller.GetHybridModeAsync();
-    auto [result, mode] = future.get();
+    auto served = ServedGet<HybridModeState>(ServiceProperty::GpuMode, []() -> std::expected<HybridModeState, ResultState> {
+        HybridModeController controller;
+        auto [result, mode] = controller.GetHybridModeAsync().get();
+        if (result != OperationResult::Success) {
+            return std::unexpected(ResultState::Failed);
+        }
+        return mode;
+    });
+    OperationResult result = served ? OperationResult::Success : OperationResult::MethodCallFailed;
+    HybridModeState mode = served.value_or(HybridModeState::On);
+    if (!LLTCOutput::Output().IsText()) {
+        return (result == OperationResult::Success) ? ReportValue("gpumode", to_string(mode)) : ReportFailure("gpumode", "Failed");
+    }
     
     if (result == OperationResult::Success) {
         currentState = mode;
@@ -668,13 +1899,20 @@ bool SetGPUMode(int tar) {
             return false;
     }
     
+    const bool text = LLTCOutput::Output().IsText();
     auto future_get = controller.GetHybridModeAsync();
     auto [result_get, currentState] = future_get.get();
+    if (!text && result_get != OperationResult::Success) {
+        return ReportFailure("gpumode", "Failed");
+    }
     if (result_get != OperationResult::Success) {
         std::print(stderr, "Failed to get current GPU mode.\n");
         return false;
     }
 
+    if (!text && currentState == targetMode) {
+        return ReportValue("gpumode", to_string(targetMode));
+    }
     if (currentState == targetMode) {
         std::print("Already in mode: ");
         switch (targetMode) {
@@ -688,6 +1926,9 @@ bool SetGPUMode(int tar) {
 
     auto future_set = controller.SetHybridModeAsync(targetMode);
     OperationResult result_set = future_set.get();
+    if (!text && result_set != OperationResult::Success) {
+        return ReportFailure("gpumode", "Switch failed");
+    }
     if (result_set != OperationResult::Success) {
         std::print(stderr, "Switch failed.\n");
         return false;
@@ -697,6 +1938,18 @@ bool SetGPUMode(int tar) {
     const bool switchingFromDGpu = (currentState == HybridModeState::Off);
     const bool requiresReboot = switchingToDGpu || switchingFromDGpu;
 
+    // Scripts get the restart flag instead of the interactive prompt.
+    if (!text) {
+        LLTCOutput::Output().Begin()
+            .Field("property", "gpumode")
+            .Field("ok", true)
+            .Field("value", to_string(targetMode))
+            .Null("error")
+            .Field("restartRequired", requiresReboot)
+            .End();
+        return true;
+    }
+
     switch (targetMode) {
         case HybridModeState::On: std::print("Hybrid\n"); break;
         case HybridModeState::OnIGPUOnly: std::print("Hybrid-iGPU\n"); break;
@@ -706,17 +1959,24 @@ bool SetGPUMode(int tar) {
 
     if (requiresReboot) {
         std::print("\n*** SYSTEM RESTART REQUIRED ***\n");
+#ifdef _WIN32
         std::print("Press ANY KEY to restart immediately...\n");
         _getch();
         
         std::system("shutdown /r /t 0");
+#else
+        std::print("Restart to apply the change.\n");
+#endif
         return true;
     }
     return true;
 }
 
 bool GetAlwaysOnUSB() {
-    auto result = LLTCAlwaysOnUSB::GetState();
+    auto result = ServedGet<AlwaysOnUSBState>(ServiceProperty::AlwaysOnUSB, LLTCAlwaysOnUSB::GetState);
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("alwaysonusb", to_string(*result)) : ReportFailure("alwaysonusb", to_string(result.error()));
+    }
     if (result) {
         std::print("AlwaysOnUSB state: {}\n", to_string(result.value()));
     } else {
@@ -729,7 +1989,10 @@ bool SetAlwaysOnUSB(int tar) {
     auto state = intToAlwaysOnUSBState(tar);
     if(!state)
         return false;
-    auto result = LLTCAlwaysOnUSB::SetState(state.value());
+    auto result = ServedSet(ServiceProperty::AlwaysOnUSB, tar, [&] { return LLTCAlwaysOnUSB::SetState(state.value()); });
+    if (!LLTCOutput::Output().IsText()) {
+        return result ? ReportValue("alwaysonusb", to_string(*state)) : ReportFailure("alwaysonusb", to_string(result.error()));
+    }
     if(result){
         std::print("Successfully set AlwaysOnUSB state to: {}\n", to_string(state.value()));
     } else {
@@ -737,4 +2000,665 @@ bool SetAlwaysOnUSB(int tar) {
         return false;
     }
     return true;
-}
\ No newline at end of file
+}
+
+bool RunServer(std::chrono::milliseconds maxAge, uint32_t instances, std::optional<sockaddr_in> metrics) {
+    std::wstring pipeName = LLTCService::PipeName();
+    std::string displayName = std::filesystem::path(pipeName).string();
+    LLTCService::ControlServer server({pipeName, maxAge, instances});
+    if (auto started = server.Start(); !started) {
+        if (started.error() == ERROR_ACCESS_DENIED) {
+            std::print(stderr, "Error: another lltc serve is already listening on {}.\n", displayName);
+        } else {
+            std::print(stderr, "Error: failed to create pipe {} (error {}).\n", displayName, started.error());
+        }
+        return false;
+    }
+    std::optional<LLTCMetrics::MetricsExporter> exporter;
+    if (metrics) {
+        exporter.emplace(*metrics, [&server](LLTCMetrics::MetricsWriter& out) { server.WriteMetrics(out); });
+        if (auto started = exporter->Start(g_stopEvent); !started) {
+            std::print(stderr, "Error: failed to listen on {} for metrics (Winsock error {}).\n",
+                LLTCMetrics::FormatEndpoint(*metrics), started.error());
+            return false;
+        }
+        std::print(stderr, "Metrics at http://{}/metrics, rendered every {} ms.\n",
+            LLTCMetrics::FormatEndpoint(*metrics), LLTCMetrics::DefaultSampleInterval.count());
+    }
+    g_gracefulStop = true;
+    std::print(stderr, "Serving on {} with {} instance(s); reads cached for {} ms{}. Press Ctrl+C to stop.\n",
+        displayName, instances, maxAge.count(), server.IsPowerModeEventDriven() ? ", power mode pushed by events" : "");
+    server.Serve(g_stopEvent);
+    if (exporter) {
+        std::print(stderr, "[serve] {} metrics scrape(s)\n", exporter->Scrapes());
+    }
+
+    auto stats = server.GetStatistics();
+    std::print(stderr, "[serve] {} request(s), {} cache hit(s), {} device read(s), {} write(s), {} failure(s)\n",
+        stats.requests, stats.cacheHits, stats.deviceReads, stats.deviceWrites, stats.failures);
+    return true;
+}
+
+// The p-th percentile of sorted nanosecond samples, in microseconds.
+double PercentileUs(const std::vector<int64_t>& sorted, double p) {
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * (sorted.size() - 1) + 0.5));
+    return sorted[index] / 1000.0;
+}
+
+// Sends `requests` gets for one property to a running server from `clients`
+// threads and reports the round-trip latency distribution. With reconnect each
+// request opens its own connection, like separate lltc invocations do.
+bool RunLoadGenerator(ServiceProperty property, uint32_t requests, uint32_t clients, bool reconnect) {
+    using Clock = std::chrono::steady_clock;
+    std::wstring pipeName = LLTCService::PipeName();
+    {
+        LLTCService::ServiceClient probe;
+        if (!probe.Connect(pipeName) || !probe.Call(ServiceOp::Ping, property)) {
+            std::print(stderr, "Error: no lltc serve is listening on {}.\n", std::filesystem::path(pipeName).string());
+            return false;
+        }
+    }
+
+    uint32_t perClient = std::max<uint32_t>(requests / clients, 1);
+    std::vector<std::vector<int64_t>> latencies(clients);
+    std::atomic<uint64_t> failures = 0;
+    std::atomic<uint64_t> cached = 0;
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (uint32_t c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            auto& samples = latencies[c];
+            samples.reserve(perClient);
+            LLTCService::ServiceClient client;
+            // One untimed request so the first sample does not include the cache fill.
+            if (client.Connect(pipeName)) {
+                client.Call(ServiceOp::Get, property);
+            }
+            for (uint32_t i = 0; i < perClient; ++i) {
+                auto begin = Clock::now();
+                if (reconnect || !client.IsConnected()) {
+                    client.Connect(pipeName, 1000);
+                }
+                auto response = client.Call(ServiceOp::Get, property);
+                if (reconnect) {
+                    client.Close();
+                }
+                auto end = Clock::now();
+                if (!response || response->status != static_cast<uint8_t>(ResultState::Success)) {
+                    failures.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (response->flags & ServiceFlagCached) {
+                    cached.fetch_add(1, std::memory_order_relaxed);
+                }
+                samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<int64_t> all;
+    for (auto& samples : latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    if (all.empty()) {
+        std::print(stderr, "Error: every request failed.\n");
+        return false;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentileUs = [&](double p) { return PercentileUs(all, p); };
+    double rate = seconds > 0 ? all.size() / seconds : 0.0;
+
+    if (!LLTCOutput::Output().IsText()) {
+        return LLTCOutput::Output().Begin()
+            .Field("requests", static_cast<uint64_t>(all.size()))
+            .Field("failures", failures.load())
+            .Field("cached", cached.load())
+            .Field("clients", clients)
+            .Field("reconnect", reconnect)
+            .Field("requestsPerSecond", rate, 0)
+            .Field("p50Us", percentileUs(0.50), 1)
+            .Field("p90Us", percentileUs(0.90), 1)
+            .Field("p99Us", percentileUs(0.99), 1)
+            .Field("p999Us", percentileUs(0.999), 1)
+            .Field("maxUs", all.back() / 1000.0, 1)
+            .End();
+    }
+    std::print("{} request(s) from {} client(s){}: {:.0f} req/s, {} failure(s), {} served from cache\n",
+        all.size(), clients, reconnect ? ", new connection each" : "", rate, failures.load(), cached.load());
+    std::print("latency us: p50 {:.1f}  p90 {:.1f}  p99 {:.1f}  p99.9 {:.1f}  max {:.1f}\n",
+        percentileUs(0.50), percentileUs(0.90), percentileUs(0.99), percentileUs(0.999), all.back() / 1000.0);
+    return failures.load() == 0;
+}
+
+// Scrapes a running `lltc serve --metrics` from `clients` threads and reports the
+// scrape rate and latency distribution, and the server's CPU use meanwhile from
+// its own process_cpu_seconds_total.
+bool RunScrapeLoad(const sockaddr_in& endpoint, uint32_t requests, uint32_t clients, bool reconnect) {
+    using Clock = std::chrono::steady_clock;
+    WSADATA data;
+    if (int error = WSAStartup(MAKEWORD(2, 2), &data); error != 0) {
+        std::print(stderr, "Error: failed to initialize Winsock (error {}).\n", error);
+        return false;
+    }
+    struct WinsockScope {
+        ~WinsockScope() { WSACleanup(); }
+    } winsock;
+    std::string address = LLTCMetrics::FormatEndpoint(endpoint);
+
+    // (render time, CPU seconds) from the first response rendered after `after`
+    // (Unix seconds), so that the two readings bracket the load.
+    auto serverCpu = [&](double after) -> std::optional<std::pair<double, double>> {
+        LLTCMetrics::ScrapeClient client;
+        auto deadline = Clock::now() + 3 * LLTCMetrics::DefaultSampleInterval;
+        do {
+            if (client.IsConnected() || client.Connect(endpoint)) {
+                if (auto body = client.Scrape()) {
+                    auto rendered = LLTCMetrics::FindSample(*body, "lltc_exporter_render_timestamp_seconds");
+                    auto cpu = LLTCMetrics::FindSample(*body, "process_cpu_seconds_total");
+                    if (rendered && cpu && *rendered > after) {
+                        return std::pair{*rendered, *cpu};
+                    }
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        } while (Clock::now() < deadline);
+        return std::nullopt;
+    };
+    auto before = serverCpu(0);
+    if (!before) {
+        std::print(stderr, "Error: no lltc serve --metrics is answering on {}.\n", address);
+        return false;
+    }
+
+    uint32_t perClient = std::max<uint32_t>(requests / clients, 1);
+    std::vector<std::vector<int64_t>> latencies(clients);
+    std::atomic<uint64_t> failures = 0;
+    std::atomic<uint64_t> bodyBytes = 0;
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (uint32_t c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            auto& samples = latencies[c];
+            samples.reserve(perClient);
+            LLTCMetrics::ScrapeClient client;
+            for (uint32_t i = 0; i < perClient; ++i) {
+                auto begin = Clock::now();
+                if (reconnect || !client.IsConnected()) {
+                    client.Connect(endpoint);
+                }
+                auto body = client.Scrape();
+                size_t size = body ? body->size() : 0;
+                if (reconnect) {
+                    client.Close();
+                }
+                auto end = Clock::now();
+                if (size == 0) {
+                    failures.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                bodyBytes.store(size, std::memory_order_relaxed);
+                samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    auto after = serverCpu(LLTCTelemetry::CurrentTimestampUs() / 1e6);
+
+    std::vector<int64_t> all;
+    for (auto& samples : latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    if (all.empty()) {
+        std::print(stderr, "Error: every scrape failed.\n");
+        return false;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentileUs = [&](double p) { return PercentileUs(all, p); };
+    double rate = seconds > 0 ? all.size() / seconds : 0.0;
+    // Includes the renders in the window, about one per DefaultSampleInterval.
+    double cpuSeconds = after ? after->second - before->second : 0.0;
+    double window = after ? after->first - before->first : 0.0;
+    double cpuPercent = window > 0 ? 100.0 * cpuSeconds / window : 0.0;
+    double cpuUsPerScrape = 1e6 * cpuSeconds / all.size();
+
+    if (!LLTCOutput::Output().IsText()) {
+        auto& record = LLTCOutput::Output().Begin()
+            .Field("scrapes", static_cast<uint64_t>(all.size()))
+            .Field("failures", failures.load())
+            .Field("clients", clients)
+            .Field("reconnect", reconnect)
+            .Field("bodyBytes", bodyBytes.load())
+            .Field("scrapesPerSecond", rate, 0)
+            .Field("p50Us", percentileUs(0.50), 1)
+            .Field("p90Us", percentileUs(0.90), 1)
+            .Field("p99Us", percentileUs(0.99), 1)
+            .Field("p999Us", percentileUs(0.999), 1)
+            .Field("maxUs", all.back() / 1000.0, 1);
+        if (after) {
+            record.Field("serverCpuPercent", cpuPercent, 2).Field("serverCpuUsPerScrape", cpuUsPerScrape, 2);
+        }
+        return record.End();
+    }
+    std::print("{} scrape(s) of {} bytes from {} client(s){}: {:.0f} scrapes/s, {} failure(s)\n", all.size(),
+        bodyBytes.load(), clients, reconnect ? ", new connection each" : "", rate, failures.load());
+    std::print("latency us: p50 {:.1f}  p90 {:.1f}  p99 {:.1f}  p99.9 {:.1f}  max {:.1f}\n",
+        percentileUs(0.50), percentileUs(0.90), percentileUs(0.99), percentileUs(0.999), all.back() / 1000.0);
+    if (after) {
+        std::print("server CPU: {:.3f} s over {:.1f} s ({:.2f}% of one core, {:.2f} us per scrape, renders included)\n",
+            cpuSeconds, window, cpuPercent, cpuUsPerScrape);
+    } else {
+        std::print("server CPU: no fresh render to compare against\n");
+    }
+    return failures.load() == 0;
+}
+
+// Runs newline-separated commands from a file, or stdin for "-", in this one
+// process: COM, the WMI session, the device handles and the capability answers
+// are set up once and shared by every line, and a running server is asked over
+// one connection. Lines use the command-line syntax, with an optional leading
+// "lltc"; blank lines and lines starting with '#' are skipped. Only get, set and
+// monitoroff are allowed, except -dmon and set gpumode (which may restart the
+// system). Every line is parsed, arguments included, before the first one runs.
+//
+// Each command prints what it prints on its own (a JSON array of all records
+// with --format json); its status and time go to stderr.
+bool RunBatch(const std::wstring& source, bool stopOnError) {
+    using Clock = std::chrono::steady_clock;
+    auto batchStart = Clock::now();
+#ifdef _WIN32
+    std::FILE* input = (source == L"-") ? stdin : _wfopen(source.c_str(), L"rb");
+#else
+    std::FILE* input = (source == L"-") ? stdin : std::fopen(std::filesystem::path(source).c_str(), "rb");
+#endif
+    if (!input) {
+        std::print(stderr, "Error: cannot open '{}'.\n", std::filesystem::path(source).string());
+        return false;
+    }
+    std::string text;
+    char buffer[4096];
+    while (size_t read = std::fread(buffer, 1, sizeof(buffer), input)) {
+        text.append(buffer, read);
+    }
+    if (input != stdin) {
+        std::fclose(input);
+    }
+
+    struct BatchCommand {
+        int line;
+        std::string text;
+        std::vector<std::string> words;
+    };
+    std::vector<BatchCommand> commands;
+    bool valid = true;
+    int lineNumber = 0;
+    for (size_t at = 0; at <= text.size();) {
+        size_t end = std::min(text.find('\n', at), text.size());
+        std::string_view line(text.data() + at, end - at);
+        at = end + 1;
+        ++lineNumber;
+        while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back()))) {
+            line.remove_suffix(1);
+        }
+        while (!line.empty() && std::isspace(static_cast<unsigned char>(line.front()))) {
+            line.remove_prefix(1);
+        }
+        if (line.empty() || line.front() == '#') {
+            continue;
+        }
+        BatchCommand command{lineNumber, std::string(line), {}};
+        for (size_t i = 0; i < line.size();) {
+            size_t next = i;
+            while (next < line.size() && !std::isspace(static_cast<unsigned char>(line[next]))) {
+                ++next;
+            }
+            if (next > i) {
+                command.words.emplace_back(line.substr(i, next - i));
+            }
+            i = next + 1;
+        }
+        if (toLower(command.words.front()) == "lltc" || toLower(command.words.front()) == "lltc.exe") {
+            command.words.erase(command.words.begin());
+        }
+        std::string verb = command.words.empty() ? std::string() : toLower(command.words.front());
+        std::string property = command.words.size() > 1 ? toLower(command.words[1]) : std::string();
+        const char* problem = nullptr;
+        if (verb != "get" && verb != "set" && verb != "monitoroff" && verb != "mo") {
+            problem = "only get, set and monitoroff can run in a batch";
+        } else if (verb == "get" && command.words.size() > 2 && toLower(command.words[2]) == "-dmon") {
+            problem = "-dmon runs until Ctrl+C and cannot run in a batch";
+        } else if (verb == "set" && (property == "gpumode" || property == "gm")) {
+            problem = "set gpumode may restart the system; run it on its own";
+        }
+        if (problem) {
+            std::print(stderr, "Error: line {}: '{}': {}.\n", lineNumber, command.text, problem);
+            valid = false;
+            continue;
+        }
+        commands.push_back(std::move(command));
+    }
+
+    // Command lines as argv arrays; argv[0] stands in for the program name.
+    std::vector<std::vector<char*>> arguments;
+    arguments.reserve(commands.size());
+    std::string program = "lltc";
+    for (auto& command : commands) {
+        auto& argv = arguments.emplace_back();
+        argv.push_back(program.data());
+        for (auto& word : command.words) {
+            argv.push_back(word.data());
+        }
+        argv.push_back(nullptr);
+        if (RunCommand(static_cast<int>(argv.size()) - 1, argv.data(), true) != 0) {
+            std::print(stderr, "Error: line {}: '{}' is not a valid command.\n", command.line, command.text);
+            valid = false;
+        }
+    }
+    if (!valid) {
+        return false;
+    }
+
+    // One warm-up for the whole batch, covering the widest path any command needs.
+    WmiWarmup warmup;
+    const char* warmupSetting = std::getenv("LLTC_WMI_WARMUP");
+    if (!(warmupSetting && std::string_view(warmupSetting) == "0")) {
+        std::optional<LLTCCommonUtils::WmiPathType> pathType;
+        for (auto& argv : arguments) {
+            int argc = static_cast<int>(argv.size()) - 1;
+            auto needed = WmiPathForCommand(argc, argv.data());
+            if (needed && !(IsServedCommand(argc, argv.data()) && ServerConnection()) &&
+                (!pathType || *needed == LLTCCommonUtils::WmiPathType::Full)) {
+                pathType = needed;
+            }
+        }
+        if (pathType) {
+            warmup.Start(*pathType);
+        }
+    }
+
+    auto& out = LLTCOutput::Output();
+    if (out.Format() == OutputFormat::Json) {
+        out.BeginStream();
+    }
+    size_t failed = 0;
+    size_t ran = 0;
+    double commandMs = 0;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        auto start = Clock::now();
+        int status = RunCommand(static_cast<int>(arguments[i].size()) - 1, arguments[i].data());
+        std::fflush(stdout);
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        commandMs += ms;
+        ++ran;
+        std::print(stderr, "[batch] line {}: {} -> {} ({:.2f} ms)\n", commands[i].line, commands[i].text,
+            status == 0 ? "ok" : "failed", ms);
+        if (status != 0) {
+            ++failed;
+            if (stopOnError) {
+                break;
+            }
+        }
+    }
+    if (out.Format() == OutputFormat::Json) {
+        out.EndStream();
+    }
+    double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - batchStart).count();
+    std::print(stderr, "[batch] {} of {} command(s) run, {} failed; {:.2f} ms in commands, {:.2f} ms total\n",
+        ran, commands.size(), failed, commandMs, totalMs);
+    return failed == 0;
+}
+
+// Prints the shared status page published by `lltc serve` or -dmon.
+bool ShowStatus() {
+    auto& out = LLTCOutput::Output();
+    auto page = LLTCStatus::StatusPage::Open();
+    StatusSnapshot snapshot;
+    if (!page || !page->Read(snapshot)) {
+        if (!out.IsText()) {
+            return ReportFailure("status", "Not published");
+        }
+        std::print(stderr, "No status page: start 'lltc serve' or 'lltc get bi -dmon'.\n");
+        return false;
+    }
+
+    int64_t now = LLTCTelemetry::CurrentTimestampUs();
+    auto ageMs = [&](StatusField field) {
+        return std::max<int64_t>(now - snapshot.updatedUs[static_cast<size_t>(field)], 0) / 1000;
+    };
+    struct ModeField {
+        StatusField field;
+        std::string_view key;
+        std::string_view label;
+        std::string_view value;
+    };
+    const ModeField modes[] = {
+        {StatusField::PowerMode, "powermode", "Power mode", to_string(static_cast<PowerMode>(snapshot.powerMode))},
+        {StatusField::GpuMode, "gpumode", "GPU mode", to_string(static_cast<HybridModeState>(snapshot.gpuMode))},
+        {StatusField::BatteryMode, "batterymode", "Battery mode", to_string(static_cast<BatteryMode>(snapshot.batteryMode))},
+        {StatusField::OverDrive, "overdrive", "OverDrive", to_string(static_cast<OverDriveState>(snapshot.overDrive))},
+        {StatusField::AlwaysOnUSB, "alwaysonusb", "AlwaysOnUSB", to_string(static_cast<AlwaysOnUSBState>(snapshot.alwaysOnUsb))},
+        {StatusField::KeyboardBacklight, "keyboardbacklight", "Keyboard backlight",
+            to_string(static_cast<WhiteKeyboardBacklightState>(snapshot.keyboardBacklight))},
+    };
+
+    if (!out.IsText()) {
+        out.Begin().Field("generation", snapshot.generation);
+        if (snapshot.Has(StatusField::Battery)) {
+            out.Field("acConnected", snapshot.battery.isAcConnected)
+               .Field("percent", snapshot.battery.batteryLifePercent)
+               .Field("rateMw", snapshot.battery.dischargeRate)
+               .Field("capacityMwh", snapshot.battery.currentCapacity)
+               .Field("batteryAgeMs", ageMs(StatusField::Battery));
+        } else {
+            out.Null("acConnected").Null("percent").Null("rateMw").Null("capacityMwh").Null("batteryAgeMs");
+        }
+        for (const auto& mode : modes) {
+            char ageKey[32];
+            auto formatted = std::format_to_n(ageKey, sizeof(ageKey), "{}AgeMs", mode.key);
+            std::string_view ageName(ageKey, formatted.out);
+            if (snapshot.Has(mode.field)) {
+                out.Field(mode.key, mode.value).Field(ageName, ageMs(mode.field));
+            } else {
+                out.Null(mode.key).Null(ageName);
+            }
+        }
+        return out.End();
+    }
+
+    std::print("Generation: {}\n", snapshot.generation);
+    if (snapshot.Has(StatusField::Battery)) {
+        std::print("Battery: {}%, {}, {} mW, {} mWh  ({} ms ago)\n", static_cast<int>(snapshot.battery.batteryLifePercent),
+            snapshot.battery.isAcConnected ? "AC" : "on battery", snapshot.battery.dischargeRate,
+            snapshot.battery.currentCapacity, ageMs(StatusField::Battery));
+    } else {
+        std::print("Battery: not published\n");
+    }
+    for (const auto& mode : modes) {
+        if (snapshot.Has(mode.field)) {
+            std::print("{}: {}  ({} ms ago)\n", mode.label, mode.value, ageMs(mode.field));
+        } else {
+            std::print("{}: not published\n", mode.label);
+        }
+    }
+    return true;
+}
+
+// One writer publishes as fast as it can into a private status page while
+// `readers` threads read it; every field of a snapshot is derived from its
+// generation, so a torn read shows up as a mismatch.
+bool RunStatusStress(int seconds, uint32_t readers) {
+    auto page = LLTCStatus::StatusPage::Create(L"");
+    if (!page) {
+        std::print(stderr, "Error: cannot create a status page (error {}).\n", page.error());
+        return false;
+    }
+    auto fill = [](StatusSnapshot& snapshot, uint64_t generation) {
+        uint32_t g = static_cast<uint32_t>(generation);
+        snapshot.battery.isAcConnected = g & 1;
+        snapshot.battery.batteryLifePercent = static_cast<BYTE>(g % 101);
+        snapshot.battery.batteryLifeTime = g;
+        snapshot.battery.batteryFullLifeTime = ~g;
+        snapshot.battery.dischargeRate = -static_cast<LONG>(g & 0x7FFFFFFF);
+        snapshot.battery.currentCapacity = g * 3;
+        snapshot.battery.designedCapacity = g ^ 0x5A5A5A5A;
+        snapshot.battery.fullChargedCapacity = g + 7;
+        snapshot.battery.cycleCount = g >> 3;
+        snapshot.battery.isLowBattery = (g & 2) != 0;
+        snapshot.battery.temperatureC = static_cast<double>(g);
+        snapshot.battery.manufactureDate.wYear = static_cast<WORD>(g);
+        snapshot.battery.firstUseDate.wYear = static_cast<WORD>(g >> 16);
+        snapshot.powerMode = static_cast<int32_t>(g);
+        snapshot.gpuMode = static_cast<int32_t>(g + 1);
+        snapshot.batteryMode = static_cast<int32_t>(g + 2);
+        snapshot.overDrive = static_cast<int32_t>(g + 3);
+        snapshot.alwaysOnUsb = static_cast<int32_t>(g + 4);
+        snapshot.keyboardBacklight = static_cast<int32_t>(g + 5);
+        for (size_t i = 0; i < std::size(snapshot.updatedUs); ++i) {
+            snapshot.updatedUs[i] = static_cast<int64_t>(generation * 8 + i);
+        }
+    };
+    // Field by field: padding bytes are not part of the contract.
+    auto fields = [](const StatusSnapshot& snapshot) {
+        const auto& b = snapshot.battery;
+        return std::tuple(b.isAcConnected, b.batteryLifePercent, b.batteryLifeTime, b.batteryFullLifeTime, b.dischargeRate,
+                          b.currentCapacity, b.designedCapacity, b.fullChargedCapacity, b.cycleCount, b.isLowBattery,
+                          b.temperatureC, b.manufactureDate.wYear, b.firstUseDate.wYear, snapshot.powerMode, snapshot.gpuMode,
+                          snapshot.batteryMode, snapshot.overDrive, snapshot.alwaysOnUsb, snapshot.keyboardBacklight);
+    };
+
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> writes = 0;
+    std::atomic<uint64_t> reads = 0;
+    std::atomic<uint64_t> torn = 0;
+    std::atomic<uint64_t> busy = 0;
+    std::thread writer([&] {
+        while (!stop.load(std::memory_order_relaxed)) {
+            // Update advances the generation after fn returns.
+            page->Update([&](StatusSnapshot& snapshot) { fill(snapshot, snapshot.generation + 1); });
+            writes.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    std::vector<std::thread> readerThreads;
+    for (uint32_t r = 0; r < readers; ++r) {
+        readerThreads.emplace_back([&] {
+            uint64_t count = 0;
+            uint64_t lastGeneration = 0;
+            StatusSnapshot snapshot;
+            StatusSnapshot expected = {};
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (!page->Read(snapshot, 1024)) {
+                    busy.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                ++count;
+                if (snapshot.generation != 0) {
+                    fill(expected, snapshot.generation);
+                    if (fields(snapshot) != fields(expected) ||
+                        !std::equal(std::begin(snapshot.updatedUs), std::end(snapshot.updatedUs), std::begin(expected.updatedUs)) ||
+                        snapshot.generation < lastGeneration) {
+                        torn.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                lastGeneration = snapshot.generation;
+            }
+            reads.fetch_add(count, std::memory_order_relaxed);
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    writer.join();
+    for (auto& thread : readerThreads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!LLTCOutput::Output().IsText()) {
+        return LLTCOutput::Output().Begin()
+            .Field("seconds", elapsed, 3)
+            .Field("readers", readers)
+            .Field("writes", writes.load())
+            .Field("reads", reads.load())
+            .Field("busyRetries", busy.load())
+            .Field("torn", torn.load())
+            .End() && torn == 0 && reads > 0;
+    }
+    std::print("{:.1f} s, {} reader(s): {} write(s), {} read(s) ({:.0f}/s), {} read(s) gave up while busy, {} torn\n",
+        elapsed, readers, writes.load(), reads.load(), reads.load() / elapsed, busy.load(), torn.load());
+    return torn == 0 && reads > 0;
+}
+
+void PrintIoctlTiming(LLTCCommonUtils::DeviceKind device, const LLTCCommonUtils::IoctlRequest& request) {
+    uint32_t command = 0;
+    if (request.input && request.inputSize >= sizeof(command)) {
+        std::memcpy(&command, request.input, sizeof(command));
+    }
+    std::print(stderr, "[ioctl] {} 0x{:08X} in=0x{:X} {} us{}\n",
+               device == LLTCCommonUtils::DeviceKind::Battery ? "battery" : "energy",
+               request.ioctlCode, command, request.latency.count(),
+               request.error == ERROR_SUCCESS ? "" : std::format(" (error {})", request.error));
+}
+
+std::optional<int> ParseIntervalMs(std::string_view text) {
+    int scale = 1000;
+    if (text.ends_with("ms")) {
+        text.remove_suffix(2);
+        scale = 1;
+    } else if (text.ends_with("s")) {
+        text.remove_suffix(1);
+    }
+    int value = 0;
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || ptr != text.data() + text.size() || value < 1 ||
+        value > std::numeric_limits<int>::max() / scale || value * scale < 10) {
+        return std::nullopt;
+    }
+    return value * scale;
+}
+
+bool ReportValue(std::string_view property, std::string_view value) {
+    LLTCOutput::Output().Begin()
+        .Field("property", property)
+        .Field("ok", true)
+        .Field("value", value)
+        .Null("error")
+        .End();
+    return true;
+}
+
+bool ReportFailure(std::string_view property, std::string_view error) {
+    LLTCOutput::Output().Begin()
+        .Field("property", property)
+        .Field("ok", false)
+        .Null("value")
+        .Field("error", error)
+        .End();
+    return false;
+}
+
+#ifdef _WIN32
+BOOL WINAPI ConsoleCtrlHandler(DWORD ctrlType) {
+    if ((ctrlType == CTRL_C_EVENT || ctrlType == CTRL_BREAK_EVENT) && g_gracefulStop) {
+        g_stopEvent.Set();
+        return TRUE;
+    }
+    return FALSE;
+}
+#else
+// SIGINT/SIGTERM: the ConsoleCtrlHandler counterpart. Only async-signal-safe calls.
+void StopSignalHandler(int signal) {
+    if (g_gracefulStop) {
+        g_stopEvent.Set();
+        return;
+    }
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+#endif
\ No newline at end of file
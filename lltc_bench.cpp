@@ -0,0 +1,226 @@
+// Reproducible benchmarks for the per-sample and per-row hot paths of -dmon.
+// Inputs come from a fixed seed, so every run sees the same data and prints
+// the same statistics; only the timings differ between machines.
+//
+//   lltc_bench [name filter]
+//
+// Timings are reported, not checked. The exit code is 1 if a result is wrong.
+#include "RecordWriter.hpp"
+#include "TelemetryLog.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <print>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace {
+    // Every C++ heap allocation in the process, counted by the replacement
+    // operator new below. stdio's own buffer is malloc'ed on a stream's first
+    // write, which the benchmarks do before they start counting.
+    std::atomic<uint64_t> g_allocations = 0;
+}
+
+void* operator new(std::size_t size) {
+    ++g_allocations;
+    if (void* block = std::malloc(size ? size : 1)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC flags free() here once these are inlined into callers of the replaced
+// operator new, as if that were still the library's.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* block) noexcept { std::free(block); }
+void operator delete(void* block, std::size_t) noexcept { std::free(block); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double NsPer(Clock::duration elapsed, uint64_t count) {
+        return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(count);
+    }
+
+    bool Expect(bool ok, std::string_view what) {
+        if (!ok) {
+            std::print(stderr, "    unexpected result: {}\n", what);
+        }
+        return ok;
+    }
+
+    // Uniform on [0, width) from the top 53 bits of mt19937_64, which is fully
+    // specified by the standard (std::uniform_real_distribution is not).
+    std::vector<double> UniformSamples(size_t count, double width, uint64_t seed) {
+        std::mt19937_64 generator{seed};
+        std::vector<double> samples(count);
+        for (auto& sample : samples) {
+            sample = static_cast<double>(generator() >> 11) * 0x1.0p-53 * width;
+        }
+        return samples;
+    }
+
+    // StreamingStats over 10^7 uniform samples: ns per sample for growing
+    // prefixes (flat if the cost is O(1)), the accumulator's fixed size, and the
+    // results against the analytic mean and standard deviation. The vector and
+    // std::accumulate baseline is what -dmon averaging did before.
+    bool BenchStreamingStats() {
+        constexpr size_t SampleCount = 10000000;
+        constexpr double Width = 100.0;
+        auto samples = UniformSamples(SampleCount, Width, 0x4c4c5443);
+
+        std::print("  sizeof(StreamingStats) = {} bytes for any sample count\n", sizeof(LLTCCommonUtils::StreamingStats));
+        LLTCCommonUtils::StreamingStats stats;
+        for (size_t prefix : {size_t{100000}, size_t{1000000}, SampleCount}) {
+            stats = LLTCCommonUtils::StreamingStats{};
+            auto start = Clock::now();
+            for (size_t i = 0; i < prefix; ++i) {
+                stats.Add(samples[i]);
+            }
+            std::print("  {:>9} samples: {:6.2f} ns/sample\n", prefix, NsPer(Clock::now() - start, prefix));
+        }
+
+        auto start = Clock::now();
+        std::vector<double> kept;
+        for (double sample : samples) {
+            kept.push_back(sample);
+        }
+        double vectorMean = std::accumulate(kept.begin(), kept.end(), 0.0) / static_cast<double>(kept.size());
+        std::print("  vector baseline: {:6.2f} ns/sample, {} MiB held\n", NsPer(Clock::now() - start, SampleCount), kept.capacity() * sizeof(double) >> 20);
+
+        double expectedSd = Width / std::sqrt(12.0);
+        std::print("  mean {:.6f} (exact 50), stddev {:.6f} (exact {:.6f}), min {:.6f}, max {:.6f}, ewma {:.6f}\n",
+                   stats.Mean(), stats.StdDev(), expectedSd, stats.Min(), stats.Max(), stats.Ewma());
+
+        bool ok = Expect(stats.Count() == SampleCount, "sample count");
+        ok &= Expect(std::abs(stats.Mean() - Width / 2) < 0.05, "mean");
+        ok &= Expect(std::abs(stats.StdDev() - expectedSd) < 0.05, "stddev");
+        ok &= Expect(std::abs(stats.Mean() - vectorMean) < 1e-9, "mean differs from the vector baseline");
+        ok &= Expect(stats.Min() >= 0.0 && stats.Min() < 0.001 && stats.Max() < Width && stats.Max() > Width - 0.001, "min/max");
+        return ok;
+    }
+
+    // One averaged -dmon row, with the same fields in the same order as lltc.cpp
+    // writes them.
+    struct DmonRow {
+        TelemetrySample sample;
+        double temperatureC;
+        double temperatureAvgC;
+        double powerAvgW;
+        double powerMinW;
+        double powerMaxW;
+        double powerSdW;
+        uint64_t dropped;
+    };
+
+    bool WriteDmonRow(LLTCOutput::RecordWriter& out, const SYSTEMTIME& time, const DmonRow& row) {
+        return out.Begin()
+            .Field("time", time, true)
+            .Field("acConnected", (row.sample.flags & TelemetryFlagAc) != 0)
+            .Field("temperatureC", row.temperatureC, 1)
+            .Field("temperatureAvgC", row.temperatureAvgC, 3)
+            .Field("percent", row.sample.percent)
+            .Field("rateMw", row.sample.rateMw)
+            .Field("powerAvgW", row.powerAvgW, 3)
+            .Field("powerMinW", row.powerMinW, 3)
+            .Field("powerMaxW", row.powerMaxW, 3)
+            .Field("powerSdW", row.powerSdW, 3)
+            .Field("capacityMwh", row.sample.capacityMwh)
+            .Field("cycleCount", row.sample.cycleCount)
+            .Field("lowBattery", (row.sample.flags & TelemetryFlagLowBattery) != 0)
+            .Field("droppedSamples", row.dropped)
+            .End();
+    }
+
+    // RecordWriter formatting 2*10^6 averaged -dmon rows per format into the
+    // null device: ns per row against the 1 us budget, and the heap allocations
+    // made after a warm-up row, which must be zero. Rows are built up front from
+    // a fixed seed so only formatting and the fwrite are timed.
+    bool BenchRecordWriter() {
+        constexpr uint64_t RowCount = 2000000;
+        constexpr double BudgetNs = 1000.0;
+        std::vector<DmonRow> rows(4096);
+        auto values = UniformSamples(rows.size() * 4, 1.0, 0x524f5753);
+        for (size_t i = 0; i < rows.size(); ++i) {
+            const double* v = &values[i * 4];
+            double power = -60.0 + 120.0 * v[0];
+            rows[i].sample = {i, 0, static_cast<int32_t>(power * 1000), 20000 + static_cast<uint32_t>(60000 * v[1]),
+                              static_cast<uint32_t>(i % 1000), 0, static_cast<uint8_t>(100 * v[1]),
+                              static_cast<uint8_t>((i % 3 == 0 ? TelemetryFlagAc : 0) | (v[1] < 0.1 ? TelemetryFlagLowBattery : 0))};
+            rows[i].temperatureC = 25.0 + 30.0 * v[2];
+            rows[i].temperatureAvgC = rows[i].temperatureC - 0.5 + v[3];
+            rows[i].powerAvgW = power;
+            rows[i].powerMinW = power - 5.0 * v[3];
+            rows[i].powerMaxW = power + 5.0 * v[2];
+            rows[i].powerSdW = 2.0 * v[3];
+            rows[i].dropped = i % 7 == 0 ? i : 0;
+        }
+
+#ifdef _WIN32
+        std::FILE* null = std::fopen("NUL", "wb");
+#else
+        std::FILE* null = std::fopen("/dev/null", "wb");
+#endif
+        if (!null) {
+            return Expect(false, "could not open the null device");
+        }
+        bool ok = true;
+        for (OutputFormat format : {OutputFormat::Json, OutputFormat::Ndjson, OutputFormat::Csv}) {
+            LLTCOutput::RecordWriter out(null);
+            out.SetFormat(format);
+            SYSTEMTIME time = LLTCPlatform::LocalTime();
+            bool written = WriteDmonRow(out, time, rows[0]);
+
+            uint64_t allocationsBefore = g_allocations;
+            auto start = Clock::now();
+            for (uint64_t i = 0; i < RowCount; ++i) {
+                time.wMilliseconds = static_cast<WORD>(i % 1000);
+                written &= WriteDmonRow(out, time, rows[i % rows.size()]);
+            }
+            auto elapsed = Clock::now() - start;
+            uint64_t allocations = g_allocations - allocationsBefore;
+            double perRow = NsPer(elapsed, RowCount);
+            std::print("  {:<6} {:7.1f} ns/row ({} the {:.0f} ns budget), {} heap allocation(s)\n",
+                       to_string(format), perRow, perRow < BudgetNs ? "within" : "over", BudgetNs, allocations);
+            ok &= Expect(written, "a row did not fit the record buffer or failed to write");
+            ok &= Expect(allocations == 0, "formatting a row allocated");
+        }
+        std::fclose(null);
+        return ok;
+    }
+
+    struct BenchCase {
+        std::string_view name;
+        bool (*run)();
+    };
+
+    constexpr BenchCase Benchmarks[] = {
+        {"streaming stats", BenchStreamingStats},
+        {"record writer", BenchRecordWriter},
+    };
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view filter = argc > 1 ? argv[1] : "";
+    int failed = 0;
+    int run = 0;
+    for (const auto& bench : Benchmarks) {
+        if (bench.name.find(filter) == std::string_view::npos) {
+            continue;
+        }
+        std::print("{}\n", bench.name);
+        failed += bench.run() ? 0 : 1;
+        ++run;
+    }
+    std::print("{} benchmark(s), {} with unexpected results\n", run, failed);
+    return failed == 0 && run > 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,417 @@
+// Checks of the controls and the server against the simulated transport, so
+// they run without Legion hardware and on any system the CLI builds on.
+//
+//   lltc_tests [name filter]
+//
+// Every test installs a fresh simulator. The exit code is 0 if every check passed.
+#include "ControlService.hpp"
+#include "RecordWriter.hpp"
+#include "SimulatedDeviceTransport.hpp"
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <print>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+    using Simulator = LLTCSimulatedTransport::SimulatedDeviceTransport;
+
+    int g_checks = 0;
+    int g_failures = 0;
+
+    void Check(bool ok, std::string_view expression, int line) {
+        ++g_checks;
+        if (!ok) {
+            ++g_failures;
+            std::print(stderr, "    line {}: CHECK({}) failed\n", line, expression);
+        }
+    }
+
+#define CHECK(...) Check(static_cast<bool>(__VA_ARGS__), #__VA_ARGS__, __LINE__)
+
+    // Replaces the transport with a new simulator; the reference stays valid
+    // until the next call.
+    Simulator& FreshSimulator(std::chrono::microseconds ioctlLatency = {}, std::chrono::microseconds wmiLatency = {}) {
+        auto simulator = std::make_unique<Simulator>(ioctlLatency, wmiLatency);
+        auto& installed = *simulator;
+        LLTCCommonUtils::SetDeviceTransport(std::move(simulator));
+        return installed;
+    }
+
+    ServiceRequest GetRequest(ServiceProperty property) {
+        return {ServiceMagic, ServiceProtocolVersion, static_cast<uint8_t>(ServiceOp::Get), static_cast<uint8_t>(property), 0, 0, 0};
+    }
+
+    // After the first read (which also fetches what is cached, like the battery
+    // tag), every read costs the same calls: IOCTLs for the battery, WMI for the
+    // power mode, and nothing crosses over.
+    void TestSimulatorCallCounts() {
+        auto& sim = FreshSimulator();
+        auto costOf = [&](auto&& read) {
+            size_t ioctls = sim.GetIoControlCount();
+            size_t wmiCalls = sim.GetWmiCallCount();
+            CHECK(read());
+            return std::pair(sim.GetIoControlCount() - ioctls, sim.GetWmiCallCount() - wmiCalls);
+        };
+        auto battery = [] { return LLTCBatteryControl::GetBatteryInformation().has_value(); };
+        auto powerMode = [] { return LLTCPowerMode::GetState().has_value(); };
+
+        auto firstBattery = costOf(battery);
+        auto batteryCost = costOf(battery);
+        CHECK(batteryCost.first > 0 && batteryCost.first <= firstBattery.first);
+        CHECK(batteryCost.second == 0);
+        CHECK(costOf(battery) == batteryCost);
+
+        costOf(powerMode);
+        auto powerModeCost = costOf(powerMode);
+        CHECK(powerModeCost == std::pair<size_t, size_t>(0, 1));
+        CHECK(costOf(powerMode) == powerModeCost);
+    }
+
+    // A read younger than maxAge is answered by the server without touching the device.
+    void TestServerCacheSkipsDevice() {
+        auto& sim = FreshSimulator();
+        LLTCService::ControlServer server({L"", std::chrono::minutes(1), 1});
+        for (auto property : {ServiceProperty::BatteryInformation, ServiceProperty::PowerMode, ServiceProperty::BatteryMode}) {
+            auto first = server.Handle(GetRequest(property));
+            CHECK(first.status == static_cast<uint8_t>(ResultState::Success));
+            CHECK(!(first.flags & ServiceFlagCached));
+            size_t ioctls = sim.GetIoControlCount();
+            size_t wmiCalls = sim.GetWmiCallCount();
+            auto second = server.Handle(GetRequest(property));
+            CHECK(second.status == static_cast<uint8_t>(ResultState::Success));
+            CHECK(second.flags & ServiceFlagCached);
+            CHECK(second.value == first.value);
+            CHECK(sim.GetIoControlCount() == ioctls);
+            CHECK(sim.GetWmiCallCount() == wmiCalls);
+        }
+        auto stats = server.GetStatistics();
+        CHECK(stats.deviceReads == 3);
+        CHECK(stats.cacheHits == 3);
+    }
+
+    // The GPU mode needs two independent WMI reads. They go out as one async
+    // batch, so the read costs about one call's latency where two sequential
+    // calls cost two.
+    void TestHybridModeReadsOverlap() {
+        constexpr auto Latency = std::chrono::milliseconds(50);
+        auto& sim = FreshSimulator({}, Latency);
+        HybridModeController controller;
+        HybridModeState mode;
+        CHECK(controller.GetHybridModeSync(mode) == OperationResult::Success);
+
+        auto timed = [](auto&& fn) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            return std::chrono::steady_clock::now() - start;
+        };
+        size_t wmiCalls = sim.GetWmiCallCount();
+        auto batched = timed([&] { CHECK(controller.GetHybridModeSync(mode) == OperationResult::Success); });
+        CHECK(sim.GetWmiCallCount() == wmiCalls + 2);
+        CHECK(mode == HybridModeState::On);
+        auto sequential = timed([&] {
+            for (const wchar_t* method : {L"GetGSyncStatus", L"GetIGPUModeStatus"}) {
+                int value = -1;
+                CHECK(SUCCEEDED(sim.CallWmiMethod({.methodName = method}, &value)));
+            }
+        });
+        CHECK(batched >= Latency);
+        CHECK(batched < Latency * 3 / 2);
+        CHECK(sequential >= 2 * Latency);
+    }
+
+    // Delivered power modes, in order.
+    struct ModeLog {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<PowerMode> modes;
+
+        void Add(PowerMode mode) {
+            {
+                std::lock_guard lock(mutex);
+                modes.push_back(mode);
+            }
+            changed.notify_all();
+        }
+
+        std::vector<PowerMode> Snapshot() {
+            std::lock_guard lock(mutex);
+            return modes;
+        }
+
+        bool WaitForLast(PowerMode mode, std::chrono::milliseconds timeout) {
+            std::unique_lock lock(mutex);
+            return changed.wait_for(lock, timeout, [&] { return !modes.empty() && modes.back() == mode; });
+        }
+    };
+
+    bool HasRepeats(const std::vector<PowerMode>& modes) {
+        return std::adjacent_find(modes.begin(), modes.end()) != modes.end();
+    }
+
+    // Threads flood the subscription with events, half of them repeats. The
+    // subscriber sees every change once and in order, and never the same mode
+    // twice in a row. Failing the event subscription mid-flood switches it to
+    // polling, which still finds the final mode; after Stop nothing arrives.
+    void TestPowerModeEventStress() {
+        auto& sim = FreshSimulator();
+        ModeLog log;
+        auto subscription = LLTCPowerMode::Subscribe([&](PowerMode mode) { log.Add(mode); });
+        CHECK(subscription && subscription->IsEventDriven());
+        CHECK(sim.GetEventSubscriptionCount() == 1);
+        CHECK(log.Snapshot() == std::vector{PowerMode::Balance});
+
+        // Repeats of the current mode are dropped.
+        for (int i = 0; i < 1000; ++i) {
+            sim.RaiseSmartFanModeEvent(static_cast<int>(PowerMode::Balance));
+        }
+        CHECK(log.Snapshot().size() == 1);
+
+        constexpr int Threads = 4;
+        constexpr int EventsPerThread = 20000;
+        constexpr int Modes[] = {1, 1, 2, 2, 3, 3};
+        auto flood = [&](int seed) {
+            for (int i = 0; i < EventsPerThread; ++i) {
+                sim.RaiseSmartFanModeEvent(Modes[(i + seed) % std::size(Modes)]);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 0; t < Threads; ++t) {
+            threads.emplace_back(flood, t);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        auto delivered = log.Snapshot();
+        CHECK(!HasRepeats(delivered));
+        CHECK(delivered.size() > 2 && delivered.size() <= 1 + Threads * EventsPerThread);
+        CHECK(delivered.back() == LLTCPowerMode::GetState());
+
+        // The event source fails while events are still coming in.
+        threads.clear();
+        for (int t = 0; t < Threads; ++t) {
+            threads.emplace_back(flood, t);
+        }
+        sim.FailEventSubscriptions(E_FAIL);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(!subscription->IsEventDriven());
+        CHECK(sim.GetEventSubscriptionCount() == 0);
+        auto current = LLTCPowerMode::GetState();
+        auto next = current == PowerMode::Performance ? PowerMode::Quiet : PowerMode::Performance;
+        sim.RaiseSmartFanModeEvent(static_cast<int>(next));
+        CHECK(log.WaitForLast(next, std::chrono::seconds(10)));
+        CHECK(!HasRepeats(log.Snapshot()));
+
+        subscription->Stop();
+        size_t count = log.Snapshot().size();
+        sim.RaiseSmartFanModeEvent(static_cast<int>(current == PowerMode::Performance ? PowerMode::Balance : PowerMode::Quiet));
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        CHECK(log.Snapshot().size() == count);
+    }
+
+    // `watch bi` sleeps in WaitForBatteryChange. With nothing changing the wait
+    // ends at its timeout, not at the IOCTL deadline after it. It wakes when the
+    // capacity leaves the band, and with the AC adapter toggled every second
+    // (what LLTC_SIM_AC_TOGGLE_S=1 does) each wait ends at the flip.
+    void TestBatteryWaitWakesOnChange() {
+        using namespace std::chrono_literals;
+        auto& sim = FreshSimulator();
+        auto status = LLTCBatteryControl::GetBatteryStatus();
+        CHECK(status && (status->PowerState & BATTERY_POWER_ON_LINE));
+        if (!status) {
+            return;
+        }
+        constexpr ULONG WideBand = 1000000;
+        auto since = [](std::chrono::steady_clock::time_point start) { return std::chrono::steady_clock::now() - start; };
+
+        auto start = std::chrono::steady_clock::now();
+        auto idle = LLTCBatteryControl::WaitForBatteryChange(*status, WideBand, 300);
+        CHECK(idle && idle->timedOut);
+        CHECK(since(start) >= 300ms && since(start) < 1s);
+
+        // Charging at 20 W moves the capacity by 2 mWh in about 0.4 s.
+        auto charging = LLTCBatteryControl::WaitForBatteryChange(*status, 2, 5000);
+        CHECK(charging && !charging->timedOut);
+        if (charging) {
+            CHECK(charging->status.Capacity > status->Capacity + 2);
+            status = charging->status;
+        }
+
+        start = std::chrono::steady_clock::now();
+        sim.SetAcToggleInterval(std::chrono::seconds(1));
+        BATTERY_STATUS last = *status;
+        for (int flip = 1; flip <= 3; ++flip) {
+            auto wait = LLTCBatteryControl::WaitForBatteryChange(last, WideBand, 5000);
+            CHECK(wait && !wait->timedOut);
+            if (!wait) {
+                return;
+            }
+            auto at = since(start);
+            CHECK((wait->status.PowerState ^ last.PowerState) & BATTERY_POWER_ON_LINE);
+            CHECK(at >= flip * 1s - 50ms && at < flip * 1s + 200ms);
+            last = wait->status;
+        }
+        sim.SetAcToggleInterval(std::chrono::seconds(0));
+    }
+
+    // Ticks never wake before their deadline and stay on the start + k * period
+    // grid, with and without a stop event; a set stop event ends a long wait at
+    // once. Single wake-ups on a loaded machine can be late, so only the mean
+    // lateness is bounded.
+    void TestSchedulerTicksOnDeadline() {
+        using namespace std::chrono_literals;
+        LLTCPlatform::Event stop;
+        for (const LLTCPlatform::Event* stopEvent : {static_cast<const LLTCPlatform::Event*>(nullptr), static_cast<const LLTCPlatform::Event*>(&stop)}) {
+            LLTCCommonUtils::PeriodicScheduler scheduler{5ms};
+            auto first = scheduler.GetDeadline();
+            for (int tick = 1; tick <= 100; ++tick) {
+                if (!scheduler.WaitNext(stopEvent)) {
+                    break;
+                }
+                CHECK(std::chrono::steady_clock::now() >= scheduler.GetDeadline());
+            }
+            const auto& stats = scheduler.GetStats();
+            CHECK(stats.ticks == 100);
+            CHECK(scheduler.GetDeadline() == first + static_cast<int64_t>(stats.ticks + stats.missed) * scheduler.GetPeriod());
+            CHECK(stats.minJitter >= 0us);
+#ifndef _WIN32
+            CHECK(stats.totalJitter / 100 < 2ms);
+#endif
+        }
+
+        LLTCCommonUtils::PeriodicScheduler slow{10s};
+        auto start = std::chrono::steady_clock::now();
+        std::thread setter([&] {
+            std::this_thread::sleep_for(50ms);
+            stop.Set();
+        });
+        CHECK(!slow.WaitNext(&stop));
+        setter.join();
+        auto waited = std::chrono::steady_clock::now() - start;
+        CHECK(waited >= 50ms && waited < 500ms);
+    }
+
+    // Fixed-point fields are mostly written from a scaled integer; the text must
+    // match std::to_chars exactly, including rounding ties, negative zero and
+    // values too large for the integer path.
+    void TestRecordWriterDoublesMatchToChars() {
+        std::FILE* file = std::tmpfile();
+        CHECK(file != nullptr);
+        if (!file) {
+            return;
+        }
+        std::vector<std::pair<double, int>> cases;
+        std::mt19937_64 generator{20261017};
+        for (int i = 0; i < 200000; ++i) {
+            double unit = static_cast<double>(generator() >> 11) * 0x1.0p-53;
+            double magnitude = std::pow(10.0, static_cast<int>(generator() % 18) - 5);
+            cases.emplace_back((generator() & 1 ? -unit : unit) * magnitude, static_cast<int>(generator() % 7));
+        }
+        for (int n = -5000; n <= 5000; ++n) {
+            cases.emplace_back(n / 2000.0, 3);      // x.xxx5 ties at precision 3
+            cases.emplace_back(n / 20.0, 1);
+            cases.emplace_back(n * 0.5, 0);
+        }
+        for (double edge : {0.0, -0.0, -0.0001, 0x1p40 / 1000, 0x1p40 / 1000 - 0.0005, 1e300, -1e-300}) {
+            cases.emplace_back(edge, 3);
+        }
+
+        LLTCOutput::RecordWriter out(file);
+        out.SetFormat(OutputFormat::Ndjson);
+        for (auto [value, precision] : cases) {
+            out.Begin().Field("v", value, precision).End();
+        }
+        std::rewind(file);
+        int mismatches = 0;
+        char line[400];
+        for (auto [value, precision] : cases) {
+            char expected[400];
+            auto end = std::to_chars(expected, expected + sizeof(expected), value, std::chars_format::fixed, precision).ptr;
+            std::string_view written = std::fgets(line, sizeof(line), file) ? std::string_view(line) : std::string_view();
+            auto want = std::format("{{\"v\":{}}}\n", std::string_view(expected, end));
+            if (written != want && ++mismatches <= 5) {
+                std::print(stderr, "    expected {} at precision {}, wrote {}\n", std::string_view(expected, end), precision,
+                           written.substr(0, written.find('\n')));
+            }
+        }
+        CHECK(mismatches == 0);
+        std::fclose(file);
+    }
+
+#ifdef _WIN32
+    // One ConnectServer serves every caller until the session is released.
+    // root\WMI exists on every Windows machine, so this needs no Legion hardware.
+    void TestWmiSessionConnectsOnce() {
+        auto& session = LLTCCommonUtils::WmiSession::Instance();
+        session.Release();
+        uint32_t before = session.GetConnectCount();
+        std::atomic<int> failures = 0;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 25; ++i) {
+                    if (FAILED(session.Connect())) {
+                        ++failures;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(failures == 0);
+        CHECK(session.GetConnectCount() == before + 1);
+
+        session.Release();
+        CHECK(SUCCEEDED(session.Connect()));
+        CHECK(session.GetConnectCount() == before + 2);
+        session.Release();
+    }
+#endif
+
+    struct TestCase {
+        std::string_view name;
+        void (*run)();
+    };
+
+    constexpr TestCase Tests[] = {
+        {"simulator call counts", TestSimulatorCallCounts},
+        {"server cache skips device", TestServerCacheSkipsDevice},
+        {"hybrid mode reads overlap", TestHybridModeReadsOverlap},
+        {"power mode event stress", TestPowerModeEventStress},
+        {"battery wait wakes on change", TestBatteryWaitWakesOnChange},
+        {"scheduler ticks on deadline", TestSchedulerTicksOnDeadline},
+        {"record writer doubles match to_chars", TestRecordWriterDoublesMatchToChars},
+#ifdef _WIN32
+        {"wmi session connects once", TestWmiSessionConnectsOnce},
+#endif
+    };
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view filter = argc > 1 ? argv[1] : "";
+    int failedTests = 0;
+    int run = 0;
+    for (const auto& test : Tests) {
+        if (test.name.find(filter) == std::string_view::npos) {
+            continue;
+        }
+        int failuresBefore = g_failures;
+        auto start = std::chrono::steady_clock::now();
+        test.run();
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        bool passed = g_failures == failuresBefore;
+        failedTests += passed ? 0 : 1;
+        ++run;
+        std::print("{} {} ({:.1f} ms)\n", passed ? "[ ok ]" : "[FAIL]", test.name, elapsed);
+    }
+    std::print("{} test(s), {} check(s), {} failed test(s)\n", run, g_checks, failedTests);
+    return failedTests == 0 && run > 0 ? 0 : 1;
+}
\ No newline at end of file